@@ -0,0 +1,757 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include "../include/fatimg.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <direct.h>
+#else
+#include <unistd.h>
+#endif
+
+/**
+ * fatimg 基准测试
+ *
+ * 覆盖 FAT12/FAT32 镜像创建、单个大文件导入、大量小文件导入、空闲簇统计及目录查找，
+ * 每个用例重复若干次取耗时最短的一次，结果以 JSON 输出(每个用例一行)：
+ *   wallMs          - 耗时(毫秒)
+ *   mbPerSec        - 吞吐量(MB/s)，创建镜像按实际写入(占用)的字节数计算，无法统计或不适用时为 null
+ *   opsPerSec       - 每秒操作数(创建的镜像数、导入的文件数、统计次数或查找次数)
+ *   writeSyscalls   - 镜像写入器发生的写入类系统调用次数(与机器无关，可精确比较)
+ *   osReadSyscalls / osWriteSyscalls - 进程实际的读写系统调用次数(/proc/self/io，不可用时为 -1)
+ * 指定基准文件时逐个用例比较：opsPerSec 低于基准超过容差或 writeSyscalls 多于基准即视为性能退化
+ */
+
+/** 每个用例默认重复次数 */
+#define BENCH_REPEATS 5
+/** 默认性能退化容差(%) */
+#define BENCH_TOLERANCE 30
+/** 默认大文件大小(MB) */
+#define BENCH_LARGE_MB 256
+/** 默认小文件个数 */
+#define BENCH_SMALL_NUM 2000
+/** FAT12 镜像中导入的小文件个数(1.44M 软盘放得下) */
+#define BENCH_FAT12_SMALL_NUM 200
+/** 最多的用例数 */
+#define BENCH_MAX_CASES 16
+
+/** 测试配置 */
+typedef struct {
+    // 工作目录，存放生成的本地文件及镜像
+    char *workDir;
+    // 每个用例重复次数
+    int repeats;
+    // 大文件大小(MB)
+    int largeMB;
+    // 小文件个数
+    int smallNum;
+    // 读取 /proc/self/io 本身产生的读系统调用次数
+    long long probeReads;
+} BenchConfig;
+
+/** 一次测量的起点 */
+typedef struct {
+    struct timeval start;
+    unsigned long long writeSyscalls;
+    long long osReads;
+    long long osWrites;
+} BenchSample;
+
+/** 一个用例的结果 */
+typedef struct {
+    // 用例名
+    char name[32];
+    // 最短一次的耗时(毫秒)
+    double wallMs;
+    // 每次测量处理的字节数及操作数
+    double bytes;
+    double ops;
+    // 最短一次测量中的系统调用次数
+    unsigned long long writeSyscalls;
+    long long osReadSyscalls;
+    long long osWriteSyscalls;
+    // 是否已有测量
+    int measured;
+} BenchResult;
+
+
+/**
+ * 读取进程实际发生的读写系统调用次数
+ * @param reads - 返回读系统调用次数，不可用时为 -1
+ * @param writes - 返回写系统调用次数，不可用时为 -1
+ */
+static void readOsSyscalls(long long *reads, long long *writes) {
+    char line[128];
+    FILE *fp = fopen("/proc/self/io", "r");
+
+    *reads = *writes = -1;
+    if (fp == NULL) return;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (!strncmp(line, "syscr:", 6)) *reads = atoll(line + 6);
+        else if (!strncmp(line, "syscw:", 6)) *writes = atoll(line + 6);
+    }
+    fclose(fp);
+}
+
+
+/**
+ * 开始一次测量
+ * 先写回此前用例(及上一次运行)留下的脏页，避免后台写回影响本次耗时
+ * @param s - 测量起点
+ */
+static void sampleBegin(BenchSample *s) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    sync();
+#endif
+    readOsSyscalls(&s->osReads, &s->osWrites);
+    s->writeSyscalls = getImgWriterSyscalls();
+    gettimeofday(&s->start, NULL);
+}
+
+
+/**
+ * 结束一次测量，耗时比已有结果短时替换结果
+ * @param cfg - 测试配置
+ * @param s - 测量起点
+ * @param r - 用例结果
+ * @param bytes - 本次处理的字节数，无法统计时为 -1
+ * @param ops - 本次操作数
+ */
+static void sampleEnd(BenchConfig *cfg, BenchSample *s, BenchResult *r, double bytes, double ops) {
+    struct timeval end;
+    double ms;
+    unsigned long long writeSyscalls;
+    long long reads, writes;
+
+    gettimeofday(&end, NULL);
+    writeSyscalls = getImgWriterSyscalls() - s->writeSyscalls;
+    readOsSyscalls(&reads, &writes);
+
+    ms = (double) (end.tv_sec - s->start.tv_sec) * 1000.0 + (double) (end.tv_usec - s->start.tv_usec) / 1000.0;
+    if (ms <= 0) ms = 0.001;
+    if (r->measured && ms >= r->wallMs) return;
+
+    r->measured = 1;
+    r->wallMs = ms;
+    r->bytes = bytes;
+    r->ops = ops;
+    r->writeSyscalls = writeSyscalls;
+    r->osReadSyscalls = reads < 0 || s->osReads < 0 ? -1 : reads - s->osReads - cfg->probeReads;
+    r->osWriteSyscalls = writes < 0 || s->osWrites < 0 ? -1 : writes - s->osWrites;
+    if (r->osReadSyscalls < -1) r->osReadSyscalls = 0;
+}
+
+
+/**
+ * 拼接工作目录中的路径
+ * @param cfg - 测试配置
+ * @param name - 相对工作目录的路径
+ * @param path - 返回完整路径
+ * @param size - path 容量
+ */
+static void workPath(BenchConfig *cfg, const char *name, char *path, size_t size) {
+    snprintf(path, size, "%s/%s", cfg->workDir, name);
+}
+
+
+/**
+ * 创建目录(已存在时忽略)
+ * @param path - 目录路径
+ */
+static void makeDir(const char *path) {
+#if defined(_WIN32) || defined(_WIN64)
+    _mkdir(path);
+#else
+    mkdir(path, 0755);
+#endif
+}
+
+
+/**
+ * 删除空目录
+ * @param path - 目录路径
+ */
+static void removeDir(const char *path) {
+#if defined(_WIN32) || defined(_WIN64)
+    _rmdir(path);
+#else
+    rmdir(path);
+#endif
+}
+
+
+/**
+ * 生成内容可重现的伪随机数据文件
+ * @param path - 文件路径
+ * @param size - 文件大小(字节)
+ * @param seed - 随机种子
+ * @return
+ */
+static int writeDataFile(const char *path, long long size, unsigned int seed) {
+    static unsigned int block[16384];
+    long long left = size;
+    size_t n, i;
+    FILE *fp = fopen(path, "wb");
+
+    if (fp == NULL) return ERROR;
+    while (left > 0) {
+        n = left < (long long) sizeof(block) ? (size_t) left : sizeof(block);
+        for (i = 0; i < sizeof(block) / sizeof(block[0]); i ++) {
+            // xorshift32
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            block[i] = seed;
+        }
+        if (fwrite(block, 1, n, fp) != n) {
+            fclose(fp);
+            return ERROR;
+        }
+        left -= (long long) n;
+    }
+    return fclose(fp) == 0 ? OK : ERROR;
+}
+
+
+/**
+ * 小文件的文件名及大小
+ * @param index - 文件序号
+ * @param name - 返回文件名(8.3 格式)
+ * @return 文件大小(1 ~ 4096 字节)
+ */
+static long long smallFileName(unsigned int index, char *name) {
+    sprintf(name, "f%05u.bin", index);
+    return (long long) ((index * 2654435761u) % 4096u) + 1;
+}
+
+
+/**
+ * 在工作目录中生成小文件目录
+ * @param cfg - 测试配置
+ * @param dirName - 目录名
+ * @param num - 文件个数
+ * @param totalSize - 返回文件总大小(字节)
+ * @return
+ */
+static int writeSmallFiles(BenchConfig *cfg, const char *dirName, unsigned int num, double *totalSize) {
+    char dir[1024], path[1100], name[16];
+    unsigned int i;
+    long long size;
+
+    workPath(cfg, dirName, dir, sizeof(dir));
+    makeDir(dir);
+    *totalSize = 0;
+    for (i = 0; i < num; i ++) {
+        size = smallFileName(i, name);
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        if (writeDataFile(path, size, i + 1) != OK) return ERROR;
+        *totalSize += (double) size;
+    }
+    return OK;
+}
+
+
+/**
+ * 删除工作目录中的小文件目录
+ * @param cfg - 测试配置
+ * @param dirName - 目录名
+ * @param num - 文件个数
+ */
+static void removeSmallFiles(BenchConfig *cfg, const char *dirName, unsigned int num) {
+    char dir[1024], path[1100], name[16];
+    unsigned int i;
+
+    workPath(cfg, dirName, dir, sizeof(dir));
+    for (i = 0; i < num; i ++) {
+        smallFileName(i, name);
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        remove(path);
+    }
+    removeDir(dir);
+}
+
+
+/**
+ * 取得下一个用例结果
+ * @param results - 结果数组
+ * @param count - 已有结果数
+ * @param name - 用例名
+ * @return
+ */
+static BenchResult* newResult(BenchResult *results, int *count, const char *name) {
+    BenchResult *r = &results[(*count) ++];
+
+    memset(r, 0, sizeof(BenchResult));
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    return r;
+}
+
+
+/**
+ * 取得镜像实际占用的字节数(稀疏镜像中未写入的部分不占用空间)
+ * @param path - 镜像路径
+ * @return 无法统计时返回 -1
+ */
+static double writtenBytes(const char *path) {
+#if defined(_WIN32) || defined(_WIN64)
+    return -1;
+#else
+    struct stat st;
+
+    if (stat(path, &st) != 0) return -1;
+    return (double) st.st_blocks * 512;
+#endif
+}
+
+
+/**
+ * 镜像创建用例：FAT12 软盘镜像及不同大小的FAT32镜像(包括超过4G的镜像)
+ * @param cfg - 测试配置
+ * @param results - 结果数组
+ * @param count - 已有结果数
+ * @return
+ */
+static int benchCreate(BenchConfig *cfg, BenchResult *results, int *count) {
+    static const struct {
+        const char *name;
+        float sizeMB;
+        int iterations;
+    } fat32Cases[] = {
+        {"fat32_create_260mb", 260, 100},
+        {"fat32_create_1gb", 1024, 100},
+        {"fat32_create_4000mb", 4000, 100},
+        {"fat32_create_8gb", 8192, 100},
+        {"fat32_create_32gb", 32768, 100},
+    };
+    char img[1024];
+    BenchSample s;
+    BenchResult *r;
+    double bytes;
+    int i, j, k;
+
+    workPath(cfg, "create.img", img, sizeof(img));
+
+    r = newResult(results, count, "fat12_create");
+    for (i = 0; i < cfg->repeats; i ++) {
+        sampleBegin(&s);
+        for (j = 0; j < 500; j ++) {
+            if (createEmptyFat12img(img, "BENCH") != OK) return ERROR;
+        }
+        bytes = writtenBytes(img);
+        sampleEnd(cfg, &s, r, bytes < 0 ? -1 : bytes * 500, 500);
+    }
+
+    for (k = 0; k < (int) (sizeof(fat32Cases) / sizeof(fat32Cases[0])); k ++) {
+        r = newResult(results, count, fat32Cases[k].name);
+        for (i = 0; i < cfg->repeats; i ++) {
+            sampleBegin(&s);
+            for (j = 0; j < fat32Cases[k].iterations; j ++) {
+                if (createEmptyFat32img(img, fat32Cases[k].sizeMB, 8) != OK) return ERROR;
+            }
+            bytes = writtenBytes(img);
+            sampleEnd(cfg, &s, r, bytes < 0 ? -1 : bytes * fat32Cases[k].iterations, fat32Cases[k].iterations);
+        }
+    }
+
+    remove(img);
+    return OK;
+}
+
+
+/**
+ * 单个大文件导入FAT32镜像
+ * @param cfg - 测试配置
+ * @param results - 结果数组
+ * @param count - 已有结果数
+ * @return
+ */
+static int benchLargeFile(BenchConfig *cfg, BenchResult *results, int *count) {
+    char img[1024], file[1024];
+    char *files[1];
+    BenchSample s;
+    BenchResult *r;
+    long long size = (long long) cfg->largeMB * 1024 * 1024;
+    int i, status = OK;
+    float imgMB = (float) cfg->largeMB * 1.25f + 64;
+
+    if (imgMB < 260) imgMB = 260;
+    workPath(cfg, "large.img", img, sizeof(img));
+    workPath(cfg, "large.bin", file, sizeof(file));
+    if (writeDataFile(file, size, 0x12345678) != OK) return ERROR;
+    files[0] = file;
+
+    r = newResult(results, count, "fat32_import_large");
+    for (i = 0; i < cfg->repeats && status == OK; i ++) {
+        status = createEmptyFat32img(img, imgMB, 8);
+        if (status != OK) break;
+        sampleBegin(&s);
+        status = copyFilesToFat32img(img, files, 1, 0, ALLOC_FIRST_FIT, 0);
+        sampleEnd(cfg, &s, r, (double) size, 1);
+    }
+
+    remove(file);
+    remove(img);
+    return status;
+}
+
+
+/**
+ * 大量小文件导入FAT12/FAT32镜像；FAT32镜像保留给空闲簇统计及目录查找用例
+ * @param cfg - 测试配置
+ * @param results - 结果数组
+ * @param count - 已有结果数
+ * @return
+ */
+static int benchSmallFiles(BenchConfig *cfg, BenchResult *results, int *count) {
+    char img[1024], dir[1024];
+    char *files[1];
+    BenchSample s;
+    BenchResult *r;
+    double totalSize;
+    int i, status;
+
+    // FAT12
+    workPath(cfg, "small12.img", img, sizeof(img));
+    workPath(cfg, "small12", dir, sizeof(dir));
+    files[0] = dir;
+    status = writeSmallFiles(cfg, "small12", BENCH_FAT12_SMALL_NUM, &totalSize);
+    r = newResult(results, count, "fat12_import_small");
+    for (i = 0; i < cfg->repeats && status == OK; i ++) {
+        status = createEmptyFat12img(img, "BENCH");
+        if (status != OK) break;
+        sampleBegin(&s);
+        status = copyFilesToFat12img(img, files, 1, 0, ALLOC_FIRST_FIT, 0);
+        sampleEnd(cfg, &s, r, totalSize, BENCH_FAT12_SMALL_NUM);
+    }
+    removeSmallFiles(cfg, "small12", BENCH_FAT12_SMALL_NUM);
+    if (status != OK) return status;
+
+    // FAT32
+    workPath(cfg, "small32.img", img, sizeof(img));
+    workPath(cfg, "small", dir, sizeof(dir));
+    status = writeSmallFiles(cfg, "small", (unsigned int) cfg->smallNum, &totalSize);
+    r = newResult(results, count, "fat32_import_small");
+    for (i = 0; i < cfg->repeats && status == OK; i ++) {
+        status = createEmptyFat32img(img, 260, 8);
+        if (status != OK) break;
+        sampleBegin(&s);
+        status = copyFilesToFat32img(img, files, 1, 0, ALLOC_FIRST_FIT, 0);
+        sampleEnd(cfg, &s, r, totalSize, cfg->smallNum);
+    }
+    removeSmallFiles(cfg, "small", (unsigned int) cfg->smallNum);
+    return status;
+}
+
+
+/**
+ * 空闲簇统计：在内存中的FAT表上重复建立空闲簇位图(FAT12 含解包)
+ * @param cfg - 测试配置
+ * @param results - 结果数组
+ * @param count - 已有结果数
+ * @param imgName - 工作目录中的镜像名
+ * @param caseName - 用例名
+ * @param iterations - 每次测量的统计次数
+ * @return
+ */
+static int benchFreeCount(BenchConfig *cfg, BenchResult *results, int *count,
+                          const char *imgName, const char *caseName, int iterations) {
+    char img[1024];
+    FatImg fatImg;
+    BenchSample s;
+    BenchResult *r;
+    const FatCodec *codec;
+    unsigned char *table;
+    unsigned short *entries = NULL;
+    unsigned long long *freeMap;
+    unsigned int freeNum = 0, entryNum;
+    int i, j, status;
+
+    workPath(cfg, imgName, img, sizeof(img));
+    status = openFatImg(&fatImg, img, IMG_OPEN_RDONLY);
+    if (status != OK) return status;
+
+    codec = getFatCodec(fatImg.type);
+    table = (unsigned char*) malloc(fatImg.fat.size);
+    freeMap = (unsigned long long*) calloc((fatImg.fat.clusterCount + 63) / 64 + 1, sizeof(unsigned long long));
+    if (fatImg.type == FAT12) entries = (unsigned short*) calloc(FAT12_MAX_ENTRIES, sizeof(unsigned short));
+    if (table == NULL || freeMap == NULL || (fatImg.type == FAT12 && entries == NULL)
+        || imgWriterRead(&fatImg.io, fatImg.fat.pos, table, fatImg.fat.size) != OK) {
+        status = ERROR;
+    }
+
+    // FAT12表中容纳的完整表项数，与载入镜像时相同
+    entryNum = fatImg.fat.size / 3 * 2 + (fatImg.fat.size % 3 == 2);
+    if (entryNum > FAT12_MAX_ENTRIES) entryNum = FAT12_MAX_ENTRIES;
+
+    r = newResult(results, count, caseName);
+    for (i = 0; i < cfg->repeats && status == OK; i ++) {
+        sampleBegin(&s);
+        for (j = 0; j < iterations; j ++) {
+            if (fatImg.type == FAT12) {
+                unpackFat12(table, entries, entryNum);
+                freeNum = codec->mapFree(entries, fatImg.fat.clusterCount, freeMap);
+            } else {
+                freeNum = codec->mapFree(table, fatImg.fat.clusterCount, freeMap);
+            }
+        }
+        sampleEnd(cfg, &s, r, (double) fatImg.fat.size * iterations, iterations);
+    }
+    // 统计结果应与打开镜像时的空闲簇数一致
+    if (status == OK && freeNum != fatImg.fat.freeCount) status = ERROR;
+
+    free(entries);
+    free(freeMap);
+    free(table);
+    closeFatImg(&fatImg);
+    return status;
+}
+
+
+/**
+ * 目录查找：在含大量小文件的目录中按伪随机顺序查找文件
+ * @param cfg - 测试配置
+ * @param results - 结果数组
+ * @param count - 已有结果数
+ * @return
+ */
+static int benchLookup(BenchConfig *cfg, BenchResult *results, int *count) {
+    char img[1024], path[64], name[16];
+    FatImg fatImg;
+    ImgItemInfo info;
+    BenchSample s;
+    BenchResult *r;
+    unsigned int seed, j, lookups = 5000;
+    int i, status;
+
+    workPath(cfg, "small32.img", img, sizeof(img));
+    status = openFatImg(&fatImg, img, IMG_OPEN_RDONLY);
+    if (status != OK) return status;
+
+    r = newResult(results, count, "fat32_dir_lookup");
+    for (i = 0; i < cfg->repeats && status == OK; i ++) {
+        seed = 1;
+        sampleBegin(&s);
+        for (j = 0; j < lookups && status == OK; j ++) {
+            seed = seed * 1103515245u + 12345u;
+            smallFileName((seed >> 8) % (unsigned int) cfg->smallNum, name);
+            sprintf(path, "/small/%s", name);
+            status = lookupImgPath(&fatImg, path, &info);
+        }
+        sampleEnd(cfg, &s, r, -1, lookups);
+    }
+
+    closeFatImg(&fatImg);
+    return status;
+}
+
+
+/**
+ * 以 JSON 输出测试结果，每个用例一行
+ * @param fp - 输出文件
+ * @param cfg - 测试配置
+ * @param results - 结果数组
+ * @param count - 结果数
+ */
+static void writeJson(FILE *fp, BenchConfig *cfg, BenchResult *results, int count) {
+    BenchResult *r;
+    char mbPerSec[32];
+    int i;
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"config\": {\"repeats\": %d, \"largeFileMB\": %d, \"smallFiles\": %d},\n",
+            cfg->repeats, cfg->largeMB, cfg->smallNum);
+    fprintf(fp, "  \"results\": [\n");
+    for (i = 0; i < count; i ++) {
+        r = &results[i];
+        if (r->bytes < 0) snprintf(mbPerSec, sizeof(mbPerSec), "null");
+        else snprintf(mbPerSec, sizeof(mbPerSec), "%.2f", r->bytes / 1048576.0 / (r->wallMs / 1000.0));
+        fprintf(fp, "    {\"name\": \"%s\", \"wallMs\": %.3f, \"mbPerSec\": %s, \"opsPerSec\": %.2f, "
+                    "\"writeSyscalls\": %llu, \"osReadSyscalls\": %lld, \"osWriteSyscalls\": %lld}%s\n",
+                r->name, r->wallMs, mbPerSec, r->ops / (r->wallMs / 1000.0),
+                r->writeSyscalls, r->osReadSyscalls, r->osWriteSyscalls, i + 1 < count ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+
+/**
+ * 从基准文件内容中读取用例的一个数值
+ * @param text - 基准文件内容
+ * @param name - 用例名
+ * @param key - 字段名
+ * @param value - 返回数值
+ * @return 用例或字段不存在返回 NO_FIND
+ */
+static int findBaselineValue(const char *text, const char *name, const char *key, double *value) {
+    char pattern[64];
+    const char *line, *end, *field;
+
+    snprintf(pattern, sizeof(pattern), "\"name\": \"%s\"", name);
+    line = strstr(text, pattern);
+    if (line == NULL) return NO_FIND;
+    end = strchr(line, '}');
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    field = strstr(line, pattern);
+    if (field == NULL || (end != NULL && field > end)) return NO_FIND;
+    *value = strtod(field + strlen(pattern), NULL);
+    return OK;
+}
+
+
+/**
+ * 与基准结果比较
+ * @param baselinePath - 基准文件路径
+ * @param cfg - 测试配置
+ * @param results - 结果数组
+ * @param count - 结果数
+ * @param tolerance - opsPerSec 允许下降的比例(%)
+ * @return 性能退化的用例数，基准文件不存在返回 NO_FIND
+ */
+static int compareBaseline(const char *baselinePath, BenchConfig *cfg, BenchResult *results, int count, int tolerance) {
+    char *text, config[128];
+    FILE *fp;
+    long size;
+    double baseOps, baseSyscalls, ops;
+    int i, sameConfig, regressions = 0;
+
+    fp = fopen(baselinePath, "rb");
+    if (fp == NULL) return NO_FIND;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    text = (char*) malloc((size_t) size + 1);
+    if (text == NULL || size < 0 || fread(text, 1, (size_t) size, fp) != (size_t) size) {
+        free(text);
+        fclose(fp);
+        return ERROR;
+    }
+    text[size] = '\0';
+    fclose(fp);
+
+    // 文件大小或个数不同时系统调用次数不可比
+    snprintf(config, sizeof(config), "\"largeFileMB\": %d, \"smallFiles\": %d", cfg->largeMB, cfg->smallNum);
+    sameConfig = strstr(text, config) != NULL;
+    if (!sameConfig) fprintf(stderr, "Baseline config differs, syscall counts are not compared.\n");
+
+    fprintf(stderr, "%-20s %14s %14s %8s %10s %10s\n", "case", "ops/s", "baseline", "change", "syscalls", "baseline");
+    for (i = 0; i < count; i ++) {
+        const char *verdict = "";
+
+        ops = results[i].ops / (results[i].wallMs / 1000.0);
+        if (findBaselineValue(text, results[i].name, "opsPerSec", &baseOps) != OK
+            || findBaselineValue(text, results[i].name, "writeSyscalls", &baseSyscalls) != OK) {
+            fprintf(stderr, "%-20s %14.2f %14s\n", results[i].name, ops, "-");
+            continue;
+        }
+        if (baseOps > 0 && ops < baseOps * (100 - tolerance) / 100) verdict = "  SLOWER";
+        if (sameConfig && (double) results[i].writeSyscalls > baseSyscalls) verdict = "  MORE SYSCALLS";
+        if (verdict[0] != '\0') regressions ++;
+        fprintf(stderr, "%-20s %14.2f %14.2f %+7.1f%% %10llu %10.0f%s\n", results[i].name, ops, baseOps,
+                baseOps > 0 ? (ops - baseOps) * 100 / baseOps : 0.0, results[i].writeSyscalls, baseSyscalls, verdict);
+    }
+
+    free(text);
+    return regressions;
+}
+
+
+/**
+ * 显示用法
+ * @param programName - 程序名
+ * @return
+ */
+static int usage(const char *programName) {
+    printf("Usage: %s [options]\n", programName);
+    printf("Options: \n");
+    printf("  %-15s\t%s\n", "-o <file>", "Write JSON results to file (default standard output).");
+    printf("  %-15s\t%s\n", "-b <baseline>", "Compare with a baseline JSON file, return non-zero on regression.");
+    printf("  %-15s\t%s\n", "-t <percent>", "Allowed ops/s drop against the baseline (default 30).");
+    printf("  %-15s\t%s\n", "-r <repeats>", "Runs per case, the fastest one is kept (default 5).");
+    printf("  %-15s\t%s\n", "-d <dir>", "Work directory for generated files and images (default outputs/bench).");
+    printf("  %-15s\t%s\n", "-s <MB>", "Size of the large file, at most 3000 (default 256).");
+    printf("  %-15s\t%s\n", "-n <files>", "Number of small files (default 2000).");
+    return ERROR;
+}
+
+
+int main(int argc, char *argv[]) {
+    BenchConfig cfg;
+    BenchResult results[BENCH_MAX_CASES];
+    char *outPath = NULL, *baselinePath = NULL;
+    char path[1024];
+    int i, count = 0, tolerance = BENCH_TOLERANCE, status = OK;
+    long long reads, writes, reads2;
+    FILE *out;
+
+    cfg.workDir = "outputs/bench";
+    cfg.repeats = BENCH_REPEATS;
+    cfg.largeMB = BENCH_LARGE_MB;
+    cfg.smallNum = BENCH_SMALL_NUM;
+
+    for (i = 1; i < argc; i ++) {
+        if (i + 1 >= argc) return usage(argv[0]);
+        if (!strcmp(argv[i], "-o")) outPath = argv[++ i];
+        else if (!strcmp(argv[i], "-b")) baselinePath = argv[++ i];
+        else if (!strcmp(argv[i], "-t")) tolerance = atoi(argv[++ i]);
+        else if (!strcmp(argv[i], "-r")) cfg.repeats = atoi(argv[++ i]);
+        else if (!strcmp(argv[i], "-d")) cfg.workDir = argv[++ i];
+        else if (!strcmp(argv[i], "-s")) cfg.largeMB = atoi(argv[++ i]);
+        else if (!strcmp(argv[i], "-n")) cfg.smallNum = atoi(argv[++ i]);
+        else return usage(argv[0]);
+    }
+    if (cfg.repeats <= 0 || cfg.largeMB <= 0 || cfg.largeMB > 3000 || cfg.smallNum <= 0
+        || cfg.smallNum > 60000 || tolerance < 0 || tolerance >= 100) {
+        return usage(argv[0]);
+    }
+    makeDir(cfg.workDir);
+    if (getFileType(cfg.workDir) != TYPE_DIRECTORY) {
+        fprintf(stderr, "Cannot create work directory %s\n", cfg.workDir);
+        return ERROR;
+    }
+
+    // 两次相邻读取 /proc/self/io 之间的差值即读取本身的开销
+    readOsSyscalls(&reads, &writes);
+    readOsSyscalls(&reads2, &writes);
+    cfg.probeReads = reads < 0 ? 0 : reads2 - reads;
+
+    if (status == OK) status = benchCreate(&cfg, results, &count);
+    if (status == OK) status = benchLargeFile(&cfg, results, &count);
+    if (status == OK) status = benchSmallFiles(&cfg, results, &count);
+    if (status == OK) status = benchFreeCount(&cfg, results, &count, "small32.img", "fat32_free_count", 200);
+    if (status == OK) status = benchFreeCount(&cfg, results, &count, "small12.img", "fat12_free_count", 20000);
+    if (status == OK) status = benchLookup(&cfg, results, &count);
+    workPath(&cfg, "small32.img", path, sizeof(path));
+    remove(path);
+    workPath(&cfg, "small12.img", path, sizeof(path));
+    remove(path);
+    removeDir(cfg.workDir);
+
+    if (status != OK) {
+        fprintf(stderr, "Benchmark fail.\n");
+        return status;
+    }
+
+    out = outPath != NULL ? fopen(outPath, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "Cannot write %s\n", outPath);
+        return ERROR;
+    }
+    writeJson(out, &cfg, results, count);
+    if (out != stdout) fclose(out);
+
+    if (baselinePath != NULL) {
+        status = compareBaseline(baselinePath, &cfg, results, count, tolerance);
+        if (status == NO_FIND) {
+            fprintf(stderr, "not find baseline file.\n");
+            return NO_FIND;
+        }
+        if (status > 0) {
+            fprintf(stderr, "%d benchmark case(s) regressed.\n", status);
+            return BAD_FORMAT;
+        }
+        if (status != OK) return status;
+    }
+    return OK;
+}
@@ -0,0 +1,1076 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/fatimg.h"
+
+
+/** 扇区大小(字节) */
+#define EXFAT_SECTOR_SIZE 512
+/** 引导区扇区数(主引导区及备份引导区各 12 个扇区) */
+#define EXFAT_BOOT_SECTORS 12
+/** FAT表起始扇区(紧随备份引导区) */
+#define EXFAT_FAT_OFFSET 24
+/** 目录表项大小(字节) */
+#define EXFAT_ITEM_SIZE 32
+/** 文件名最大长度(UTF-16 字符数) */
+#define EXFAT_NAME_MAX 255
+/** 每个文件名表项容纳的 UTF-16 字符数 */
+#define EXFAT_NAME_CHARS 15
+/** 一个文件目录项集最多占用的表项数(文件、流扩展及 17 个文件名表项) */
+#define EXFAT_SET_MAX (2 + (EXFAT_NAME_MAX + EXFAT_NAME_CHARS - 1) / EXFAT_NAME_CHARS)
+/** 簇链结束标记 */
+#define EXFAT_END_CLUSTER 0xFFFFFFFF
+/** 最大目录深度 */
+#define EXFAT_MAX_DEPTH 128
+
+/** 目录表项类型 */
+#define EXFAT_ITEM_BITMAP 0x81
+#define EXFAT_ITEM_UPCASE 0x82
+#define EXFAT_ITEM_LABEL 0x83
+#define EXFAT_ITEM_FILE 0x85
+#define EXFAT_ITEM_STREAM 0xC0
+#define EXFAT_ITEM_NAME 0xC1
+
+/** 流扩展表项标志：已分配簇 */
+#define EXFAT_ALLOC_POSSIBLE 0x01
+/** 流扩展表项标志：簇连续存放，不使用FAT簇链 */
+#define EXFAT_NO_FAT_CHAIN 0x02
+
+
+/** 已打开的exFAT镜像 */
+typedef struct {
+    // 镜像读写器
+    ImgWriter io;
+    // 每簇字节数
+    unsigned int bytesPerCluster;
+    // FAT表起始位置(字节)
+    long long fatPos;
+    // 簇堆(数据区)起始位置(字节)
+    long long heapPos;
+    // 簇数
+    unsigned int clusterCount;
+    // 空闲簇数
+    unsigned int freeCount;
+    // 下一次分配的起始簇号
+    unsigned int nextFree;
+    // 分配位图，第 2 簇对应第 0 位
+    unsigned char *bitmap;
+    // 分配位图起始簇号
+    unsigned int bitmapCluster;
+    // 分配位图中被修改的字节范围
+    unsigned int bitmapDirtyStart;
+    unsigned int bitmapDirtyEnd;
+    // 大写转换表(65536 项)
+    unsigned short *upcase;
+    // 根目录起始簇号
+    unsigned int rootCluster;
+} ExfatImg;
+
+/** 内存中的目录数据 */
+typedef struct {
+    // 目录数据
+    unsigned char *data;
+    // 目录结束标记之前的表项数
+    unsigned int itemNum;
+    // 目录数据容量(表项数)
+    unsigned int capacity;
+    // 已占用的簇(已有目录)
+    unsigned int *clusters;
+    // 已占用的簇数
+    unsigned int clusterNum;
+} ExfatDir;
+
+
+/** 按镜像大小选择每簇扇区数 */
+static unsigned int getExfatSectorsPerCluster(unsigned long long totalSectors);
+/** 生成压缩的大写转换表 */
+static unsigned int buildUpcaseTable(unsigned short *table);
+/** 计算大写转换表校验值 */
+static unsigned int getTableChecksum(const unsigned char *data, unsigned long long len);
+/** 计算引导区校验值 */
+static unsigned int getBootChecksum(const unsigned char *sectors, unsigned int bytesPerSector);
+/** 计算目录项集校验值 */
+static unsigned short getSetChecksum(const unsigned char *items, unsigned int itemNum);
+/** 计算文件名哈希 */
+static unsigned short getNameHash(ExfatImg *img, const unsigned short *name, int len);
+/** 打开exFAT镜像 */
+static int openExfatImg(ExfatImg *img, const char *path);
+/** 写回分配位图、根目录并关闭镜像 */
+static int closeExfatImg(ExfatImg *img, ExfatDir *root);
+/** 读取FAT表项 */
+static unsigned int getExfatFatEntry(ExfatImg *img, unsigned int clusterNum);
+/** 沿簇链读入整个目录 */
+static int loadExfatDir(ExfatImg *img, unsigned int firstCluster, unsigned long long size, char noFatChain, ExfatDir *dir);
+/** 分配簇并在位图中标记 */
+static int allocExfatClusters(ExfatImg *img, unsigned int needClusters, ClusterExtent **extents, unsigned int *extentNum);
+/** 统计或释放簇 */
+static unsigned int walkExfatClusters(ExfatImg *img, unsigned int firstCluster, unsigned long long size, char noFatChain, char release);
+/** 为不连续的区段写入FAT簇链 */
+static int writeExfatChain(ExfatImg *img, ClusterExtent *extents, unsigned int extentNum);
+/** 统计文件或目录(递归)导入后占用的簇数 */
+static unsigned long long countExfatNodeClusters(ExfatImg *img, FileNode *node, unsigned int depth);
+/** 将文件或目录(递归)导入镜像目录 */
+static int importExfatNode(ExfatImg *img, ExfatDir *dir, FileNode *node, unsigned int depth);
+/** 在目录中追加文件目录项集 */
+static int appendExfatItemSet(ExfatImg *img, ExfatDir *dir, FileNode *node, unsigned int firstCluster,
+                              unsigned long long size, unsigned char flags);
+/** 按文件名查找目录项集 */
+static int findExfatItem(ExfatImg *img, ExfatDir *dir, const unsigned short *name, int len);
+/** 查找连续的未使用表项 */
+static unsigned int findExfatFreeItems(ExfatDir *dir, unsigned int count);
+/** 统计或删除目录项集及其占用的簇 */
+static unsigned int walkExfatItem(ExfatImg *img, ExfatDir *dir, unsigned int index, unsigned int depth, char release);
+/** 读写小端整数 */
+static void putLE16(unsigned char *p, unsigned int v);
+static void putLE32(unsigned char *p, unsigned int v);
+static void putLE64(unsigned char *p, unsigned long long v);
+static unsigned int getLE16(const unsigned char *p);
+static unsigned int getLE32(const unsigned char *p);
+static unsigned long long getLE64(const unsigned char *p);
+
+
+/**
+ * 创建空的exFAT镜像
+ * 引导区(主/备份)各 12 扇区，含校验扇区；FAT表紧随其后，簇堆按簇大小对齐。
+ * 簇堆依次存放分配位图、大写转换表及根目录(各自的FAT簇链连续)，其余数据区以文件空洞形式存在
+ * @param imgPath - 镜像文件路径
+ * @param size - 镜像大小(MB)
+ * @param cluster - 用户指定簇大小(每簇扇区数)，0 按镜像大小选择
+ * @param volumeLabel - 卷标，最多 11 个字符
+ * @return 镜像大小或簇大小无效返回 BAD_FORMAT
+ */
+int createEmptyExfatImg(char *imgPath, float size, int cluster, char *volumeLabel) {
+    ImgWriter writer;
+    unsigned long long totalSectors = (unsigned long long) (size * 1024 * 1024) / EXFAT_SECTOR_SIZE;
+    unsigned int sectorsPerCluster, shift, fatLength, heapOffset, clusterCount, bytesPerCluster;
+    unsigned int bitmapClusters, upcaseClusters, usedClusters, i, checksum, labelLen;
+    unsigned long long bitmapSize;
+    unsigned short *upcase, label[11];
+    unsigned int upcaseLen;
+    unsigned char *boot, *bitmap, *root, *fat;
+    int status;
+
+    // exFAT 最小 1MB，簇数不超过 2^32 - 11
+    if (totalSectors < 2048) return BAD_FORMAT;
+    sectorsPerCluster = cluster > 0 ? (unsigned int) cluster : getExfatSectorsPerCluster(totalSectors);
+    for (shift = 0; (1u << shift) < sectorsPerCluster; shift ++);
+    if ((1u << shift) != sectorsPerCluster || shift > 16) return BAD_FORMAT;
+    bytesPerCluster = sectorsPerCluster * EXFAT_SECTOR_SIZE;
+
+    // 先按最大簇数估算FAT表大小，簇堆起始按簇对齐后再计算实际簇数
+    if ((totalSectors - EXFAT_FAT_OFFSET) / sectorsPerCluster > 0xFFFFFFF5ULL) return BAD_FORMAT;
+    clusterCount = (unsigned int) ((totalSectors - EXFAT_FAT_OFFSET) / sectorsPerCluster);
+    fatLength = (unsigned int) (((unsigned long long) clusterCount + 2) * 4 + EXFAT_SECTOR_SIZE - 1) / EXFAT_SECTOR_SIZE;
+    heapOffset = (EXFAT_FAT_OFFSET + fatLength + sectorsPerCluster - 1) / sectorsPerCluster * sectorsPerCluster;
+    if (totalSectors <= heapOffset) return BAD_FORMAT;
+    clusterCount = (unsigned int) ((totalSectors - heapOffset) / sectorsPerCluster);
+
+    // 分配位图、大写转换表及根目录各自占用的簇
+    upcase = (unsigned short*) malloc(0x10000 * 2 * sizeof(unsigned short));
+    if (upcase == NULL) return ERROR;
+    upcaseLen = buildUpcaseTable(upcase) * 2;
+    bitmapSize = ((unsigned long long) clusterCount + 7) / 8;
+    bitmapClusters = (unsigned int) ((bitmapSize + bytesPerCluster - 1) / bytesPerCluster);
+    upcaseClusters = (upcaseLen + bytesPerCluster - 1) / bytesPerCluster;
+    usedClusters = bitmapClusters + upcaseClusters + 1;
+    if (usedClusters >= clusterCount) {
+        free(upcase);
+        return BAD_FORMAT;
+    }
+
+    boot = (unsigned char*) calloc(EXFAT_BOOT_SECTORS, EXFAT_SECTOR_SIZE);
+    bitmap = (unsigned char*) calloc((size_t) bitmapClusters, bytesPerCluster);
+    root = (unsigned char*) calloc(1, bytesPerCluster);
+    fat = (unsigned char*) malloc(((size_t) usedClusters + 2) * 4);
+    if (boot == NULL || bitmap == NULL || root == NULL || fat == NULL) {
+        free(upcase);
+        free(boot);
+        free(bitmap);
+        free(root);
+        free(fat);
+        return ERROR;
+    }
+
+    // 引导扇区
+    boot[0] = 0xEB;
+    boot[1] = 0x76;
+    boot[2] = 0x90;
+    memcpy(boot + 3, "EXFAT   ", 8);
+    putLE64(boot + 72, totalSectors);
+    putLE32(boot + 80, EXFAT_FAT_OFFSET);
+    putLE32(boot + 84, fatLength);
+    putLE32(boot + 88, heapOffset);
+    putLE32(boot + 92, clusterCount);
+    putLE32(boot + 96, 2 + bitmapClusters + upcaseClusters);
+    putLE32(boot + 100, getVolumeID());
+    // 文件系统版本 1.00
+    putLE16(boot + 104, 0x0100);
+    // 每扇区字节数 2^9，每簇扇区数 2^shift，FAT表个数，驱动器号
+    boot[108] = 9;
+    boot[109] = (unsigned char) shift;
+    boot[110] = 1;
+    boot[111] = 0x80;
+    boot[112] = (unsigned char) ((unsigned long long) usedClusters * 100 / clusterCount);
+    boot[510] = 0x55;
+    boot[511] = 0xAA;
+    // 扩展引导扇区结束标记
+    for (i = 1; i <= 8; i ++) {
+        boot[i * EXFAT_SECTOR_SIZE + 510] = 0x55;
+        boot[i * EXFAT_SECTOR_SIZE + 511] = 0xAA;
+    }
+    // 校验扇区重复填充前 11 个扇区的校验值
+    checksum = getBootChecksum(boot, EXFAT_SECTOR_SIZE);
+    for (i = 0; i < EXFAT_SECTOR_SIZE / 4; i ++) putLE32(boot + 11 * EXFAT_SECTOR_SIZE + i * 4, checksum);
+
+    // FAT表：保留项及分配位图、大写转换表、根目录的连续簇链
+    putLE32(fat, 0xFFFFFFF8);
+    putLE32(fat + 4, EXFAT_END_CLUSTER);
+    for (i = 0; i < usedClusters; i ++) {
+        putLE32(fat + (i + 2) * 4, i + 1 == bitmapClusters || i + 1 == bitmapClusters + upcaseClusters
+                                   || i + 1 == usedClusters ? EXFAT_END_CLUSTER : i + 3);
+    }
+
+    // 分配位图中标记已占用的簇
+    for (i = 0; i < usedClusters; i ++) bitmap[i / 8] |= (unsigned char) (1 << (i % 8));
+
+    // 根目录：卷标、分配位图、大写转换表
+    for (labelLen = 0; volumeLabel != NULL && labelLen < 11 && volumeLabel[labelLen] != '\0'; labelLen ++) {
+        label[labelLen] = (unsigned char) volumeLabel[labelLen];
+    }
+    while (labelLen > 0 && label[labelLen - 1] == ' ') labelLen --;
+    root[0] = labelLen > 0 ? EXFAT_ITEM_LABEL : EXFAT_ITEM_LABEL & 0x7F;
+    root[1] = (unsigned char) labelLen;
+    for (i = 0; i < labelLen; i ++) putLE16(root + 2 + i * 2, label[i]);
+    root[32] = EXFAT_ITEM_BITMAP;
+    putLE32(root + 32 + 20, 2);
+    putLE64(root + 32 + 24, bitmapSize);
+    root[64] = EXFAT_ITEM_UPCASE;
+    putLE32(root + 64 + 4, getTableChecksum((unsigned char*) upcase, upcaseLen));
+    putLE32(root + 64 + 20, 2 + bitmapClusters);
+    putLE64(root + 64 + 24, upcaseLen);
+
+    status = imgWriterOpen(&writer, imgPath, IMG_OPEN_CREATE);
+    if (status == OK) {
+        // 主引导区及备份引导区
+        status = imgWriterWrite(&writer, 0, boot, EXFAT_BOOT_SECTORS * EXFAT_SECTOR_SIZE);
+        if (status == OK) status = imgWriterWrite(&writer, EXFAT_BOOT_SECTORS * EXFAT_SECTOR_SIZE, boot, EXFAT_BOOT_SECTORS * EXFAT_SECTOR_SIZE);
+        if (status == OK) status = imgWriterWrite(&writer, (long long) EXFAT_FAT_OFFSET * EXFAT_SECTOR_SIZE, fat, ((size_t) usedClusters + 2) * 4);
+        // 分配位图、大写转换表、根目录依次连续存放，位图的空白部分不写入
+        if (status == OK) status = imgWriterWrite(&writer, (long long) heapOffset * EXFAT_SECTOR_SIZE, bitmap, (usedClusters + 7) / 8);
+        if (status == OK) status = imgWriterWrite(&writer, (long long) heapOffset * EXFAT_SECTOR_SIZE
+                                                  + (long long) bitmapClusters * bytesPerCluster, upcase, upcaseLen);
+        if (status == OK) status = imgWriterWrite(&writer, (long long) heapOffset * EXFAT_SECTOR_SIZE
+                                                  + (long long) (bitmapClusters + upcaseClusters) * bytesPerCluster, root, bytesPerCluster);
+        if (status == OK) status = imgWriterSetSize(&writer, (long long) totalSectors * EXFAT_SECTOR_SIZE);
+        if (imgWriterClose(&writer) != OK) status = ERROR;
+    }
+
+    free(upcase);
+    free(boot);
+    free(bitmap);
+    free(root);
+    free(fat);
+    return status;
+}
+
+
+/**
+ * 拷贝多个文件或目录(递归)到exFAT镜像根目录
+ * 簇按分配位图分配，连续存放的文件及目录标记为 NoFatChain，不写FAT表项；
+ * 只有空间不足而分段存放时才写入FAT簇链。同名的已有文件或目录被替换
+ * @param imgPath - 镜像文件
+ * @param filePaths - 要拷贝的文件或目录列表
+ * @param fileNum - 文件数
+ * @return
+ */
+int copyFilesToExfatImg(char *imgPath, char **filePaths, unsigned int fileNum) {
+    ExfatImg img;
+    ExfatDir root;
+    FileNode node;
+    unsigned int i;
+    int status;
+
+    status = openExfatImg(&img, imgPath);
+    if (status != OK) return status;
+    memset(&root, 0, sizeof(ExfatDir));
+    status = loadExfatDir(&img, img.rootCluster, 0, 0, &root);
+    if (status != OK) {
+        // 根目录读取失败时不写回
+        free(root.data);
+        free(root.clusters);
+        memset(&root, 0, sizeof(ExfatDir));
+    }
+
+    for (i = 0; i < fileNum && status == OK; i ++) {
+        memset(&node, 0, sizeof(FileNode));
+        status = scanFileTree(filePaths[i], &node);
+        if (status == OK) status = importExfatNode(&img, &root, &node, 0);
+        freeFileTree(&node);
+        if (status != OK) printf("Copy %s fail.\n", filePaths[i]);
+    }
+
+    if (closeExfatImg(&img, &root) != OK && status == OK) status = ERROR;
+    return status;
+}
+
+
+/**
+ * 按镜像大小选择每簇扇区数
+ * 256MB 以下 4KB，32GB 以下 32KB，更大的镜像 128KB
+ * @param totalSectors - 镜像总扇区数
+ * @return 每簇扇区数
+ */
+static unsigned int getExfatSectorsPerCluster(unsigned long long totalSectors) {
+    if (totalSectors < 256ULL * 2048) return 8;
+    if (totalSectors < 32768ULL * 2048) return 64;
+    return 256;
+}
+
+
+/**
+ * 生成压缩的大写转换表
+ * 覆盖 ASCII、Latin-1、Latin Extended-A、希腊字母、西里尔字母及全角拉丁字母，
+ * 连续的不变字符按 "0xFFFF, 个数" 压缩存放
+ * @param table - 压缩表缓冲区，至少 0x20000 项
+ * @return 压缩表项数
+ */
+static unsigned int buildUpcaseTable(unsigned short *table) {
+    unsigned int c, up, run, len = 0;
+    unsigned short *map = table + 0x10000;
+
+    for (c = 0; c < 0x10000; c ++) {
+        up = c;
+        if ((c >= 'a' && c <= 'z') || (c >= 0xE0 && c <= 0xFE && c != 0xF7)) up = c - 0x20;
+        else if (c == 0xFF) up = 0x178;
+        else if (((c >= 0x100 && c <= 0x137) || (c >= 0x14A && c <= 0x177)) && (c & 1)) up = c - 1;
+        else if (((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E)) && !(c & 1)) up = c - 1;
+        else if ((c >= 0x3B1 && c <= 0x3C1) || (c >= 0x3C3 && c <= 0x3CB)) up = c - 0x20;
+        else if (c == 0x3C2) up = 0x3A3;
+        else if (c >= 0x430 && c <= 0x44F) up = c - 0x20;
+        else if (c >= 0x450 && c <= 0x45F) up = c - 0x50;
+        else if (c >= 0xFF41 && c <= 0xFF5A) up = c - 0x20;
+        map[c] = (unsigned short) up;
+    }
+
+    // 压缩表写在映射表之前，写入位置总不超过读取位置
+    for (c = 0; c < 0x10000; c += run) {
+        for (run = 0; c + run < 0x10000 && map[c + run] == c + run; run ++);
+        if (run >= 2 || (run == 1 && c == 0xFFFF)) {
+            table[len ++] = 0xFFFF;
+            table[len ++] = (unsigned short) run;
+        } else {
+            table[len ++] = map[c];
+            run = 1;
+        }
+    }
+    return len;
+}
+
+
+/**
+ * 计算大写转换表校验值
+ * @param data - 表数据
+ * @param len - 字节数
+ * @return 校验值
+ */
+static unsigned int getTableChecksum(const unsigned char *data, unsigned long long len) {
+    unsigned int checksum = 0;
+    unsigned long long i;
+
+    for (i = 0; i < len; i ++) checksum = ((checksum & 1) ? 0x80000000u : 0) + (checksum >> 1) + data[i];
+    return checksum;
+}
+
+
+/**
+ * 计算引导区校验值
+ * 覆盖前 11 个扇区，跳过引导扇区中的卷标志(106、107)及使用百分比(112)
+ * @param sectors - 引导区数据
+ * @param bytesPerSector - 扇区大小
+ * @return 校验值
+ */
+static unsigned int getBootChecksum(const unsigned char *sectors, unsigned int bytesPerSector) {
+    unsigned int checksum = 0, i;
+
+    for (i = 0; i < bytesPerSector * 11; i ++) {
+        if (i == 106 || i == 107 || i == 112) continue;
+        checksum = ((checksum & 1) ? 0x80000000u : 0) + (checksum >> 1) + sectors[i];
+    }
+    return checksum;
+}
+
+
+/**
+ * 计算目录项集校验值
+ * 覆盖整个目录项集，跳过文件表项中的校验值字段(2、3)
+ * @param items - 目录项集
+ * @param itemNum - 表项数
+ * @return 校验值
+ */
+static unsigned short getSetChecksum(const unsigned char *items, unsigned int itemNum) {
+    unsigned short checksum = 0;
+    unsigned int i;
+
+    for (i = 0; i < itemNum * EXFAT_ITEM_SIZE; i ++) {
+        if (i == 2 || i == 3) continue;
+        checksum = (unsigned short) (((checksum & 1) ? 0x8000 : 0) + (checksum >> 1) + items[i]);
+    }
+    return checksum;
+}
+
+
+/**
+ * 计算文件名哈希
+ * 按大写转换表转换后的 UTF-16 字符逐字节(低字节在前)计算
+ * @param img - 镜像
+ * @param name - UTF-16 文件名
+ * @param len - 字符数
+ * @return 哈希值
+ */
+static unsigned short getNameHash(ExfatImg *img, const unsigned short *name, int len) {
+    unsigned short hash = 0, c;
+    int i;
+
+    for (i = 0; i < len; i ++) {
+        c = img->upcase[name[i]];
+        hash = (unsigned short) (((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c & 0xFF));
+        hash = (unsigned short) (((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c >> 8));
+    }
+    return hash;
+}
+
+
+/**
+ * 打开exFAT镜像
+ * 读取引导扇区，载入分配位图及大写转换表
+ * @param img - 镜像
+ * @param path - 镜像文件路径
+ * @return 不是exFAT镜像返回 BAD_FORMAT
+ */
+static int openExfatImg(ExfatImg *img, const char *path) {
+    unsigned char boot[EXFAT_SECTOR_SIZE], *upcaseData = NULL, *item;
+    unsigned int i, j, c, bitmapSize = 0, upcaseCluster = 0, upcaseLen = 0;
+    ExfatDir root;
+    int status;
+
+    memset(img, 0, sizeof(ExfatImg));
+    if (imgWriterOpen(&img->io, path, IMG_OPEN_EXISTING) != OK) return NO_FIND;
+    if (imgWriterRead(&img->io, 0, boot, sizeof(boot)) != OK || memcmp(boot + 3, "EXFAT   ", 8) != 0
+        || boot[108] != 9 || boot[109] > 16) {
+        imgWriterClose(&img->io);
+        return BAD_FORMAT;
+    }
+    img->bytesPerCluster = EXFAT_SECTOR_SIZE << boot[109];
+    img->fatPos = (long long) getLE32(boot + 80) * EXFAT_SECTOR_SIZE;
+    img->heapPos = (long long) getLE32(boot + 88) * EXFAT_SECTOR_SIZE;
+    img->clusterCount = getLE32(boot + 92);
+    img->rootCluster = getLE32(boot + 96);
+    img->nextFree = 2;
+    img->bitmapDirtyStart = 0xFFFFFFFF;
+
+    // 在根目录中查找分配位图及大写转换表
+    memset(&root, 0, sizeof(ExfatDir));
+    status = loadExfatDir(img, img->rootCluster, 0, 0, &root);
+    for (i = 0; i < root.itemNum && status == OK; i ++) {
+        item = root.data + (size_t) i * EXFAT_ITEM_SIZE;
+        if (item[0] == EXFAT_ITEM_BITMAP && img->bitmapCluster == 0) {
+            img->bitmapCluster = getLE32(item + 20);
+            bitmapSize = (unsigned int) getLE64(item + 24);
+        } else if (item[0] == EXFAT_ITEM_UPCASE) {
+            upcaseCluster = getLE32(item + 20);
+            upcaseLen = (unsigned int) getLE64(item + 24);
+        }
+    }
+    free(root.data);
+    free(root.clusters);
+    if (status == OK && (img->bitmapCluster == 0 || bitmapSize < (img->clusterCount + 7) / 8 || upcaseLen > 0x20000)) status = BAD_FORMAT;
+
+    // 分配位图及大写转换表连续存放，各自一次读入
+    if (status == OK) {
+        img->bitmap = (unsigned char*) malloc(bitmapSize);
+        img->upcase = (unsigned short*) malloc(0x10000 * sizeof(unsigned short));
+        upcaseData = (unsigned char*) malloc(upcaseLen + 2);
+        if (img->bitmap == NULL || img->upcase == NULL || upcaseData == NULL) status = ERROR;
+    }
+    if (status == OK) status = imgWriterRead(&img->io, img->heapPos + (long long) (img->bitmapCluster - 2) * img->bytesPerCluster, img->bitmap, bitmapSize);
+    if (status == OK && upcaseLen > 0) status = imgWriterRead(&img->io, img->heapPos + (long long) (upcaseCluster - 2) * img->bytesPerCluster, upcaseData, upcaseLen);
+
+    if (status == OK) {
+        // 展开压缩的大写转换表，表中未覆盖的字符保持不变
+        for (c = 0; c < 0x10000; c ++) img->upcase[c] = (unsigned short) c;
+        for (i = 0, c = 0; i + 1 < upcaseLen && c < 0x10000; i += 2) {
+            j = getLE16(upcaseData + i);
+            if (j == 0xFFFF && i + 3 < upcaseLen) {
+                i += 2;
+                c += getLE16(upcaseData + i);
+            } else img->upcase[c ++] = (unsigned short) j;
+        }
+        for (i = 0; i < img->clusterCount; i ++) {
+            if (!(img->bitmap[i / 8] & (1 << (i % 8)))) img->freeCount ++;
+        }
+    }
+    free(upcaseData);
+
+    if (status != OK) {
+        free(img->bitmap);
+        free(img->upcase);
+        imgWriterClose(&img->io);
+    }
+    return status;
+}
+
+
+/**
+ * 写回分配位图、根目录并关闭镜像
+ * 分配位图只写入被修改的字节范围，引导扇区的使用百分比不参与校验，直接更新
+ * @param img - 镜像
+ * @param root - 根目录
+ * @return
+ */
+static int closeExfatImg(ExfatImg *img, ExfatDir *root) {
+    ClusterExtent *extents = NULL;
+    unsigned int needClusters, extentNum = 0, i, j, last, *temp;
+    unsigned char percent, entry[4];
+    int status = OK;
+
+    // 根目录按FAT簇链存放，空间不足时追加簇并接到簇链末尾
+    if (root->data != NULL) {
+        needClusters = (unsigned int) (((unsigned long long) root->itemNum * EXFAT_ITEM_SIZE + img->bytesPerCluster - 1) / img->bytesPerCluster);
+        if (needClusters > root->clusterNum) {
+            temp = (unsigned int*) realloc(root->clusters, needClusters * sizeof(unsigned int));
+            if (temp == NULL) status = ERROR;
+            else root->clusters = temp;
+            if (status == OK) status = allocExfatClusters(img, needClusters - root->clusterNum, &extents, &extentNum);
+            for (i = 0; i < extentNum && status == OK; i ++) {
+                for (j = 0; j < extents[i].count; j ++) {
+                    last = root->clusters[root->clusterNum - 1];
+                    putLE32(entry, extents[i].start + j);
+                    status = imgWriterWrite(&img->io, img->fatPos + (long long) last * 4, entry, 4);
+                    root->clusters[root->clusterNum ++] = extents[i].start + j;
+                }
+            }
+            putLE32(entry, EXFAT_END_CLUSTER);
+            if (status == OK) status = imgWriterWrite(&img->io, img->fatPos + (long long) root->clusters[root->clusterNum - 1] * 4, entry, 4);
+            free(extents);
+        }
+        for (i = 0; i < root->clusterNum && status == OK; i ++) {
+            status = imgWriterWrite(&img->io, img->heapPos + (long long) (root->clusters[i] - 2) * img->bytesPerCluster,
+                                    root->data + (size_t) i * img->bytesPerCluster, img->bytesPerCluster);
+        }
+    }
+
+    if (status == OK && img->bitmapDirtyStart < img->bitmapDirtyEnd) {
+        status = imgWriterWrite(&img->io, img->heapPos + (long long) (img->bitmapCluster - 2) * img->bytesPerCluster + img->bitmapDirtyStart,
+                                img->bitmap + img->bitmapDirtyStart, img->bitmapDirtyEnd - img->bitmapDirtyStart);
+    }
+    if (status == OK && img->clusterCount > 0) {
+        percent = (unsigned char) ((unsigned long long) (img->clusterCount - img->freeCount) * 100 / img->clusterCount);
+        status = imgWriterWrite(&img->io, 112, &percent, 1);
+    }
+
+    free(root->data);
+    free(root->clusters);
+    free(img->bitmap);
+    free(img->upcase);
+    if (imgWriterClose(&img->io) != OK) status = ERROR;
+    return status;
+}
+
+
+/**
+ * 读取FAT表项
+ * @param img - 镜像
+ * @param clusterNum - 簇号
+ * @return 表项值，读取失败返回结束标记
+ */
+static unsigned int getExfatFatEntry(ExfatImg *img, unsigned int clusterNum) {
+    unsigned char entry[4];
+    if (imgWriterRead(&img->io, img->fatPos + (long long) clusterNum * 4, entry, 4) != OK) return EXFAT_END_CLUSTER;
+    return getLE32(entry);
+}
+
+
+/**
+ * 沿簇链读入整个目录
+ * @param img - 镜像
+ * @param firstCluster - 起始簇号
+ * @param size - 目录大小(字节)，NoFatChain 目录按此计算簇数；按FAT簇链读取时为 0
+ * @param noFatChain - 是否为连续存放的目录
+ * @param dir - 目录数据
+ * @return 簇链越界返回 BAD_FORMAT
+ */
+static int loadExfatDir(ExfatImg *img, unsigned int firstCluster, unsigned long long size, char noFatChain, ExfatDir *dir) {
+    unsigned int cluster = firstCluster, capacity = 0, *temp, i, total;
+    unsigned char *data;
+
+    memset(dir, 0, sizeof(ExfatDir));
+    total = noFatChain ? (unsigned int) ((size + img->bytesPerCluster - 1) / img->bytesPerCluster) : img->clusterCount;
+    while (cluster >= 2 && cluster < img->clusterCount + 2 && dir->clusterNum < total) {
+        if (dir->clusterNum == capacity) {
+            capacity = capacity == 0 ? 4 : capacity * 2;
+            temp = (unsigned int*) realloc(dir->clusters, capacity * sizeof(unsigned int));
+            if (temp == NULL) return ERROR;
+            dir->clusters = temp;
+        }
+        dir->clusters[dir->clusterNum ++] = cluster;
+        cluster = noFatChain ? cluster + 1 : getExfatFatEntry(img, cluster);
+    }
+    if (dir->clusterNum == 0) return BAD_FORMAT;
+
+    dir->capacity = dir->clusterNum * (img->bytesPerCluster / EXFAT_ITEM_SIZE);
+    dir->data = (unsigned char*) calloc(dir->capacity, EXFAT_ITEM_SIZE);
+    if (dir->data == NULL) return ERROR;
+    for (i = 0; i < dir->clusterNum; i ++) {
+        data = dir->data + (size_t) i * img->bytesPerCluster;
+        if (imgWriterRead(&img->io, img->heapPos + (long long) (dir->clusters[i] - 2) * img->bytesPerCluster, data, img->bytesPerCluster) != OK) return ERROR;
+    }
+    for (dir->itemNum = 0; dir->itemNum < dir->capacity && dir->data[(size_t) dir->itemNum * EXFAT_ITEM_SIZE] != 0; dir->itemNum ++);
+    return OK;
+}
+
+
+/**
+ * 分配簇并在位图中标记
+ * 优先从上次分配结束的位置起寻找一整段连续空闲簇，找不到时从头按位图顺序取若干段
+ * @param img - 镜像
+ * @param needClusters - 所需簇数
+ * @param extents - 返回分配的区段数组，由调用者释放
+ * @param extentNum - 返回区段数
+ * @return 空间不足返回 INSUFFICIENT_SPACE
+ */
+static int allocExfatClusters(ExfatImg *img, unsigned int needClusters, ClusterExtent **extents, unsigned int *extentNum) {
+    ClusterExtent *list = NULL, *temp;
+    unsigned int count = 0, capacity = 0, remaining = needClusters, i, start, end, pass, from, k;
+
+    *extents = NULL;
+    *extentNum = 0;
+    if (needClusters == 0) return OK;
+    if (needClusters > img->freeCount) return INSUFFICIENT_SPACE;
+
+    // 位图第 i 位对应第 i + 2 簇；整字节已满时跳过
+    for (pass = 0; pass < 3 && remaining > 0; pass ++) {
+        from = pass == 0 ? img->nextFree - 2 : 0;
+        for (i = from; i < img->clusterCount && remaining > 0; i = end) {
+            if (img->bitmap[i / 8] == 0xFF && i % 8 == 0) {
+                end = i + 8;
+                continue;
+            }
+            if (img->bitmap[i / 8] & (1 << (i % 8))) {
+                end = i + 1;
+                continue;
+            }
+            for (start = i, end = i; end < img->clusterCount && end - start < remaining && !(img->bitmap[end / 8] & (1 << (end % 8))); end ++);
+            // 前两遍只接受一整段
+            if (pass < 2 && end - start < remaining) continue;
+
+            if (count == capacity) {
+                capacity = capacity == 0 ? 4 : capacity * 2;
+                temp = (ClusterExtent*) realloc(list, capacity * sizeof(ClusterExtent));
+                if (temp == NULL) {
+                    free(list);
+                    return ERROR;
+                }
+                list = temp;
+            }
+            list[count].start = start + 2;
+            list[count ++].count = end - start;
+            remaining -= end - start;
+            for (k = start; k < end; k ++) img->bitmap[k / 8] |= (unsigned char) (1 << (k % 8));
+            if (start / 8 < img->bitmapDirtyStart) img->bitmapDirtyStart = start / 8;
+            if ((end + 7) / 8 > img->bitmapDirtyEnd) img->bitmapDirtyEnd = (end + 7) / 8;
+        }
+    }
+
+    if (remaining > 0) {
+        // 位图与空闲簇数不一致
+        free(list);
+        return INSUFFICIENT_SPACE;
+    }
+    img->freeCount -= needClusters;
+    img->nextFree = list[count - 1].start + list[count - 1].count;
+    if (img->nextFree >= img->clusterCount + 2) img->nextFree = 2;
+    *extents = list;
+    *extentNum = count;
+    return OK;
+}
+
+
+/**
+ * 统计或释放簇
+ * @param img - 镜像
+ * @param firstCluster - 起始簇号
+ * @param size - 占用的字节数
+ * @param noFatChain - 是否连续存放
+ * @param release - 是否在位图中释放
+ * @return 在位图中已标记的簇数
+ */
+static unsigned int walkExfatClusters(ExfatImg *img, unsigned int firstCluster, unsigned long long size, char noFatChain, char release) {
+    unsigned long long num = (size + img->bytesPerCluster - 1) / img->bytesPerCluster, i;
+    unsigned int cluster = firstCluster, bit, count = 0;
+
+    for (i = 0; i < num && cluster >= 2 && cluster < img->clusterCount + 2; i ++) {
+        bit = cluster - 2;
+        if (img->bitmap[bit / 8] & (1 << (bit % 8))) {
+            count ++;
+            if (release) {
+                img->bitmap[bit / 8] &= (unsigned char) ~(1 << (bit % 8));
+                img->freeCount ++;
+                if (bit / 8 < img->bitmapDirtyStart) img->bitmapDirtyStart = bit / 8;
+                if (bit / 8 + 1 > img->bitmapDirtyEnd) img->bitmapDirtyEnd = bit / 8 + 1;
+            }
+        }
+        cluster = noFatChain ? cluster + 1 : getExfatFatEntry(img, cluster);
+    }
+    return count;
+}
+
+
+/**
+ * 为不连续的区段写入FAT簇链
+ * 每段的表项在内存中拼好后一次写出
+ * @param img - 镜像
+ * @param extents - 区段数组
+ * @param extentNum - 区段数
+ * @return
+ */
+static int writeExfatChain(ExfatImg *img, ClusterExtent *extents, unsigned int extentNum) {
+    unsigned char *entries;
+    unsigned int i, j, maxCount = 0;
+    int status = OK;
+
+    for (i = 0; i < extentNum; i ++) if (extents[i].count > maxCount) maxCount = extents[i].count;
+    entries = (unsigned char*) malloc((size_t) maxCount * 4);
+    if (entries == NULL) return ERROR;
+
+    for (i = 0; i < extentNum && status == OK; i ++) {
+        for (j = 0; j + 1 < extents[i].count; j ++) putLE32(entries + j * 4, extents[i].start + j + 1);
+        putLE32(entries + j * 4, i + 1 < extentNum ? extents[i + 1].start : EXFAT_END_CLUSTER);
+        status = imgWriterWrite(&img->io, img->fatPos + (long long) extents[i].start * 4, entries, (size_t) extents[i].count * 4);
+    }
+    free(entries);
+    return status;
+}
+
+
+/**
+ * 统计文件或目录(递归)导入后占用的簇数
+ * 目录按子项目录项集的表项数计算大小，至少占一簇
+ * @param img - 镜像
+ * @param node - 本地文件或目录
+ * @param depth - 目录深度
+ * @return
+ */
+static unsigned long long countExfatNodeClusters(ExfatImg *img, FileNode *node, unsigned int depth) {
+    unsigned short name[EXFAT_NAME_MAX];
+    unsigned long long clusters = 0, items = 0;
+    unsigned int i;
+    int len;
+
+    if (node->type != TYPE_DIRECTORY) return (node->size + img->bytesPerCluster - 1) / img->bytesPerCluster;
+    for (i = 0; i < node->childNum && depth < EXFAT_MAX_DEPTH; i ++) {
+        len = utf8ToUtf16(node->children[i].name, name, EXFAT_NAME_MAX);
+        items += 2 + (unsigned int) (len > 0 ? len + EXFAT_NAME_CHARS - 1 : 0) / EXFAT_NAME_CHARS;
+        clusters += countExfatNodeClusters(img, &node->children[i], depth + 1);
+    }
+    items = (items * EXFAT_ITEM_SIZE + img->bytesPerCluster - 1) / img->bytesPerCluster;
+    return clusters + (items == 0 ? 1 : items);
+}
+
+
+/**
+ * 将文件或目录(递归)导入镜像目录
+ * 文件数据按区段直接拷贝；目录先在内存中建立全部子项，再按最终大小一次分配并写出。
+ * 导入前先按整棵文件树(及根目录的增长)检查空间；同名(不区分大小写)的已有项先删除，其占用的簇计入可用空间，
+ * 空间不足时保留已有项。导入失败时释放本次已分配的簇，不在位图中留下无主的簇
+ * @param img - 镜像
+ * @param dir - 目标目录
+ * @param node - 本地文件或目录
+ * @param depth - 目录深度
+ * @return 空间不足返回 INSUFFICIENT_SPACE
+ */
+static int importExfatNode(ExfatImg *img, ExfatDir *dir, FileNode *node, unsigned int depth) {
+    ClusterExtent *extents = NULL;
+    unsigned short name[EXFAT_NAME_MAX];
+    unsigned int extentNum = 0, i;
+    unsigned long long size, done = 0, len, needClusters, freeClusters;
+    unsigned char flags = 0;
+    ExfatDir sub;
+    FILE *fp;
+    long long pos;
+    int status = OK, found, nameLen;
+
+    if (depth > EXFAT_MAX_DEPTH) return BAD_FORMAT;
+
+    // 先检查空间再删除同名项，避免替换失败时丢失已有项；子项已包含在上层的检查中
+    nameLen = utf8ToUtf16(node->name, name, EXFAT_NAME_MAX);
+    if (nameLen <= 0) return BAD_FORMAT;
+    found = findExfatItem(img, dir, name, nameLen);
+    if (depth == 0 || found >= 0) {
+        needClusters = countExfatNodeClusters(img, node, depth);
+        freeClusters = img->freeCount;
+        if (found >= 0) freeClusters += walkExfatItem(img, dir, (unsigned int) found, depth, 0);
+        // 已有目录(根目录)放不下新的目录项集时关闭镜像前追加簇
+        if (dir->clusterNum > 0) {
+            i = findExfatFreeItems(dir, 2 + (unsigned int) (nameLen + EXFAT_NAME_CHARS - 1) / EXFAT_NAME_CHARS)
+                + 2 + (unsigned int) (nameLen + EXFAT_NAME_CHARS - 1) / EXFAT_NAME_CHARS;
+            if (i < dir->itemNum) i = dir->itemNum;
+            len = ((unsigned long long) i * EXFAT_ITEM_SIZE + img->bytesPerCluster - 1) / img->bytesPerCluster;
+            if (len > dir->clusterNum) needClusters += len - dir->clusterNum;
+        }
+        if (needClusters > freeClusters) return INSUFFICIENT_SPACE;
+        if (found >= 0) walkExfatItem(img, dir, (unsigned int) found, depth, 1);
+    }
+
+    if (node->type == TYPE_DIRECTORY) {
+        // 子项全部写入后再确定目录大小，目录至少占一簇
+        memset(&sub, 0, sizeof(ExfatDir));
+        for (i = 0; i < node->childNum && status == OK; i ++) status = importExfatNode(img, &sub, &node->children[i], depth + 1);
+        size = ((unsigned long long) sub.itemNum * EXFAT_ITEM_SIZE + img->bytesPerCluster - 1) / img->bytesPerCluster * img->bytesPerCluster;
+        if (size == 0) size = img->bytesPerCluster;
+        if (status == OK) status = allocExfatClusters(img, (unsigned int) (size / img->bytesPerCluster), &extents, &extentNum);
+        for (i = 0; i < extentNum && status == OK; i ++) {
+            len = (unsigned long long) extents[i].count * img->bytesPerCluster;
+            if (done + len > (unsigned long long) sub.itemNum * EXFAT_ITEM_SIZE) {
+                // 目录数据之后的部分填充 0
+                if (done < (unsigned long long) sub.itemNum * EXFAT_ITEM_SIZE) {
+                    status = imgWriterWrite(&img->io, img->heapPos + (long long) (extents[i].start - 2) * img->bytesPerCluster,
+                                            sub.data + done, (size_t) (sub.itemNum * EXFAT_ITEM_SIZE - done));
+                }
+                pos = (long long) (done > (unsigned long long) sub.itemNum * EXFAT_ITEM_SIZE ? 0 : sub.itemNum * EXFAT_ITEM_SIZE - done);
+                if (status == OK) status = imgWriterZero(&img->io, img->heapPos + (long long) (extents[i].start - 2) * img->bytesPerCluster + pos, (long long) len - pos);
+            } else {
+                status = imgWriterWrite(&img->io, img->heapPos + (long long) (extents[i].start - 2) * img->bytesPerCluster, sub.data + done, (size_t) len);
+            }
+            done += len;
+        }
+        // 失败时释放已导入子项占用的簇
+        for (i = 0; i < sub.itemNum && status != OK; i ++) {
+            if (sub.data[(size_t) i * EXFAT_ITEM_SIZE] == EXFAT_ITEM_FILE) walkExfatItem(img, &sub, i, depth + 1, 1);
+        }
+        free(sub.data);
+        free(sub.clusters);
+    } else {
+        // 命令行直接指定的文件没有扫描大小，以打开后的文件大小为准
+        fp = fopen(node->path, "rb");
+        if (fp == NULL) return NO_FIND;
+        pos = getFileSize(fp);
+        if (pos < 0) status = ERROR;
+        size = pos > 0 ? (unsigned long long) pos : 0;
+        if (size > 0 && status == OK) {
+            status = allocExfatClusters(img, (unsigned int) ((size + img->bytesPerCluster - 1) / img->bytesPerCluster), &extents, &extentNum);
+            for (i = 0; i < extentNum && status == OK; i ++) {
+                pos = img->heapPos + (long long) (extents[i].start - 2) * img->bytesPerCluster;
+                len = (unsigned long long) extents[i].count * img->bytesPerCluster;
+                if (len > size - done) len = size - done;
+                status = imgWriterCopyFrom(&img->io, pos, fileno(fp), (long long) done, (long long) len);
+                done += len;
+                // 最后一簇未满，剩余部分填充 0
+                if (status == OK && done == size && len % img->bytesPerCluster != 0) {
+                    status = imgWriterZero(&img->io, pos + (long long) len, img->bytesPerCluster - len % img->bytesPerCluster);
+                }
+            }
+        }
+        fclose(fp);
+    }
+
+    // 一整段连续簇不写FAT簇链
+    if (status == OK && extentNum > 0) {
+        flags = EXFAT_ALLOC_POSSIBLE;
+        if (extentNum == 1) flags |= EXFAT_NO_FAT_CHAIN;
+        else status = writeExfatChain(img, extents, extentNum);
+    }
+    if (status == OK) status = appendExfatItemSet(img, dir, node, extentNum > 0 ? extents[0].start : 0, size, flags);
+    // 失败时释放本项已分配的簇
+    for (i = 0; i < extentNum && status != OK; i ++) {
+        walkExfatClusters(img, extents[i].start, (unsigned long long) extents[i].count * img->bytesPerCluster, 1, 1);
+    }
+    free(extents);
+    return status;
+}
+
+
+/**
+ * 在目录中追加文件目录项集
+ * 目录项集由文件表项、流扩展表项及若干文件名表项组成；优先放入已删除的连续表项，没有时追加到目录末尾
+ * @param img - 镜像
+ * @param dir - 目标目录
+ * @param node - 本地文件或目录
+ * @param firstCluster - 起始簇号，空文件为 0
+ * @param size - 数据大小(字节)
+ * @param flags - 流扩展表项标志
+ * @return 文件名过长返回 BAD_FORMAT
+ */
+static int appendExfatItemSet(ExfatImg *img, ExfatDir *dir, FileNode *node, unsigned int firstCluster,
+                              unsigned long long size, unsigned char flags) {
+    unsigned short name[EXFAT_NAME_MAX];
+    unsigned char *items, *temp;
+    unsigned int itemNum, stamp, i, capacity, index;
+    int len;
+
+    len = utf8ToUtf16(node->name, name, EXFAT_NAME_MAX);
+    if (len <= 0) return BAD_FORMAT;
+
+    // 目录末尾留出结束标记
+    itemNum = 2 + (unsigned int) (len + EXFAT_NAME_CHARS - 1) / EXFAT_NAME_CHARS;
+    index = findExfatFreeItems(dir, itemNum);
+    if (index + itemNum + 1 > dir->capacity) {
+        capacity = dir->capacity == 0 ? 64 : dir->capacity;
+        while (index + itemNum + 1 > capacity) capacity *= 2;
+        temp = (unsigned char*) realloc(dir->data, (size_t) capacity * EXFAT_ITEM_SIZE);
+        if (temp == NULL) return ERROR;
+        memset(temp + (size_t) dir->capacity * EXFAT_ITEM_SIZE, 0, (size_t) (capacity - dir->capacity) * EXFAT_ITEM_SIZE);
+        dir->data = temp;
+        dir->capacity = capacity;
+    }
+    items = dir->data + (size_t) index * EXFAT_ITEM_SIZE;
+    memset(items, 0, (size_t) itemNum * EXFAT_ITEM_SIZE);
+
+    // 文件表项：属性及创建/修改/访问时间(与 FAT 日期时间格式相同)
+    stamp = ((unsigned int) formatCreateDateArray(node->createTimes) << 16) | formatCreateTimeArray(node->createTimes);
+    items[0] = EXFAT_ITEM_FILE;
+    items[1] = (unsigned char) (itemNum - 1);
+    putLE16(items + 4, node->type == TYPE_DIRECTORY ? 0x10 : 0x20);
+    putLE32(items + 8, stamp);
+    putLE32(items + 12, stamp);
+    putLE32(items + 16, stamp);
+
+    // 流扩展表项
+    items[32] = EXFAT_ITEM_STREAM;
+    items[32 + 1] = flags;
+    items[32 + 3] = (unsigned char) len;
+    putLE16(items + 32 + 4, getNameHash(img, name, len));
+    putLE64(items + 32 + 8, size);
+    putLE32(items + 32 + 20, firstCluster);
+    putLE64(items + 32 + 24, size);
+
+    // 文件名表项，每项 15 个字符
+    for (i = 0; i < (unsigned int) len; i ++) {
+        if (i % EXFAT_NAME_CHARS == 0) items[(2 + i / EXFAT_NAME_CHARS) * EXFAT_ITEM_SIZE] = EXFAT_ITEM_NAME;
+        putLE16(items + (2 + i / EXFAT_NAME_CHARS) * EXFAT_ITEM_SIZE + 2 + (i % EXFAT_NAME_CHARS) * 2, name[i]);
+    }
+    putLE16(items + 2, getSetChecksum(items, itemNum));
+    if (index + itemNum > dir->itemNum) dir->itemNum = index + itemNum;
+    return OK;
+}
+
+
+/**
+ * 按文件名查找目录项集(不区分大小写)
+ * 先比较流扩展表项中的文件名长度及哈希，再逐字符比较
+ * @param img - 镜像
+ * @param dir - 目录
+ * @param name - UTF-16 文件名
+ * @param len - 字符数
+ * @return 文件表项序号，没有返回 NO_FIND
+ */
+static int findExfatItem(ExfatImg *img, ExfatDir *dir, const unsigned short *name, int len) {
+    unsigned short hash = getNameHash(img, name, len);
+    const unsigned char *item;
+    unsigned int i, secondary;
+    int j;
+
+    for (i = 0; i < dir->itemNum; i += 1 + secondary) {
+        item = dir->data + (size_t) i * EXFAT_ITEM_SIZE;
+        secondary = item[0] == EXFAT_ITEM_FILE ? item[1] : 0;
+        if (secondary < 2 || i + 1 + secondary > dir->itemNum) {
+            secondary = 0;
+            continue;
+        }
+        if (item[32] != EXFAT_ITEM_STREAM || item[32 + 3] != len || getLE16(item + 32 + 4) != hash) continue;
+        for (j = 0; j < len; j ++) {
+            if (img->upcase[getLE16(item + (2 + j / EXFAT_NAME_CHARS) * EXFAT_ITEM_SIZE + 2 + (j % EXFAT_NAME_CHARS) * 2)]
+                != img->upcase[name[j]]) break;
+        }
+        if (j == len) return (int) i;
+    }
+    return NO_FIND;
+}
+
+
+/**
+ * 查找连续的未使用表项(使用标记已清除的表项)
+ * 目录末尾的未使用表项可与追加的表项连成一段
+ * @param dir - 目录
+ * @param count - 所需表项数
+ * @return 起始表项序号，没有时返回目录末尾的序号
+ */
+static unsigned int findExfatFreeItems(ExfatDir *dir, unsigned int count) {
+    unsigned int i, start = 0;
+
+    for (i = 0; i < dir->itemNum; i ++) {
+        if (dir->data[(size_t) i * EXFAT_ITEM_SIZE] & 0x80) start = i + 1;
+        else if (i + 1 - start == count) return start;
+    }
+    return start;
+}
+
+
+/**
+ * 统计或删除目录项集及其占用的簇
+ * 删除时目录项集各表项清除使用标记；子目录递归处理其中全部子项
+ * @param img - 镜像
+ * @param dir - 目录
+ * @param index - 文件表项序号
+ * @param depth - 目录深度
+ * @param release - 是否删除
+ * @return 占用的簇数
+ */
+static unsigned int walkExfatItem(ExfatImg *img, ExfatDir *dir, unsigned int index, unsigned int depth, char release) {
+    unsigned char *item = dir->data + (size_t) index * EXFAT_ITEM_SIZE;
+    unsigned int i, secondary = item[1], first = getLE32(item + 32 + 20), count = 0;
+    unsigned long long size = getLE64(item + 32 + 24);
+    char noFatChain = (item[32 + 1] & EXFAT_NO_FAT_CHAIN) != 0;
+    ExfatDir sub;
+
+    if ((getLE16(item + 4) & 0x10) && first != 0 && depth < EXFAT_MAX_DEPTH) {
+        if (loadExfatDir(img, first, size, noFatChain, &sub) == OK) {
+            for (i = 0; i < sub.itemNum; i ++) {
+                if (sub.data[(size_t) i * EXFAT_ITEM_SIZE] == EXFAT_ITEM_FILE) count += walkExfatItem(img, &sub, i, depth + 1, release);
+            }
+        }
+        free(sub.data);
+        free(sub.clusters);
+    }
+    if (first != 0) count += walkExfatClusters(img, first, size, noFatChain, release);
+    for (i = 0; i <= secondary && index + i < dir->itemNum && release; i ++) item[i * EXFAT_ITEM_SIZE] &= 0x7F;
+    return count;
+}
+
+
+/** 写入 16 位小端整数 */
+static void putLE16(unsigned char *p, unsigned int v) {
+    p[0] = (unsigned char) v;
+    p[1] = (unsigned char) (v >> 8);
+}
+
+
+/** 写入 32 位小端整数 */
+static void putLE32(unsigned char *p, unsigned int v) {
+    putLE16(p, v);
+    putLE16(p + 2, v >> 16);
+}
+
+
+/** 写入 64 位小端整数 */
+static void putLE64(unsigned char *p, unsigned long long v) {
+    putLE32(p, (unsigned int) v);
+    putLE32(p + 4, (unsigned int) (v >> 32));
+}
+
+
+/** 读取 16 位小端整数 */
+static unsigned int getLE16(const unsigned char *p) {
+    return p[0] | (p[1] << 8);
+}
+
+
+/** 读取 32 位小端整数 */
+static unsigned int getLE32(const unsigned char *p) {
+    return getLE16(p) | (getLE16(p + 2) << 16);
+}
+
+
+/** 读取 64 位小端整数 */
+static unsigned long long getLE64(const unsigned char *p) {
+    return getLE32(p) | ((unsigned long long) getLE32(p + 4) << 32);
+}
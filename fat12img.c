@@ -1,7 +1,15 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include "include/fatimg.h"
 
+#if defined(_WIN32) || defined(_WIN64)
+#include <direct.h>
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 
 /** FAT12软盘总扇区数 */
 #define TOTAL_SECTORS 2880
@@ -99,14 +107,99 @@ typedef struct {
     unsigned int size;
 } __attribute__((packed)) DirItem;
 
+/** 提取或遍历目录时的最大目录深度，避免损坏的目录簇链形成死循环 */
+#define EXTRACT_MAX_DEPTH 128
+/** 同步时比较文件内容的单次读取字节数 */
+#define SYNC_COMPARE_SIZE (1024 * 1024)
+
+/** 已载入内存的镜像目录 */
+typedef struct {
+    // 目录索引(根目录指向镜像的根目录索引，子目录指向缓存的子目录索引)
+    DirIndex *index;
+    // 镜像子目录缓存中的子目录，根目录为 NULL
+    SubDir *sub;
+} ImgDir;
+
+/** 同步统计 */
+typedef struct {
+    // 新增的文件及目录数
+    unsigned int added;
+    // 重写数据的文件数
+    unsigned int updated;
+    // 删除的文件及目录数
+    unsigned int removed;
+    // 内容未变化的文件数
+    unsigned int unchanged;
+} SyncStats;
+
 
 
 /** 查找根目录区中的空值表项 */
-int findEmptyRootDirItem(FILE*);
+int findEmptyRootDirItem(FatImg*);
 /** 在软盘镜像文件中寻找是否存在文件 */
-int findFileInRootDir(FILE*, char*);
+int findFileInRootDir(FatImg*, char*);
 /** 从软盘镜像中删除文件 */
-int deleteFileFromImg(FILE*, unsigned short);
+int deleteFileFromImg(FatImg*, unsigned int);
+/** 写入标准FAT12软盘镜像引导扇区之后的FAT表、根目录区及数据区 */
+static int writeFat12Layout(ImgWriter *writer, const char *volumeLabel);
+/** 获取根目录表项 */
+static DirItem* getRootDirItem(FatImg *img, unsigned int index);
+/** 按区段将文件数据写入镜像 */
+static int writeFileExtents(FatImg *img, FILE *fp, ClusterExtent *extents, unsigned int extentNum, unsigned long long fileSize);
+/** 获取目录表项的起始簇号 */
+static unsigned int getItemCluster(FatImg *img, DirItem *item);
+/** 填充目录表项 */
+static void fillDirItem(DirItem *item, const char *shortName, char attr, int *createTimes, unsigned int firstCluster, unsigned int size);
+/** 确保根目录区有足够的连续空闲表项 */
+static int reserveRootDirItems(FatImg *img, unsigned int count, int oldIndex);
+/** 为目录下的各子项生成短文件名及目录数据 */
+static int buildDirItems(FileNode *dir);
+/** 目录数据所需簇数 */
+static unsigned int getDirClusters(FatImg *img, unsigned int itemNum);
+/** 文件树所需簇数 */
+static unsigned long long countTreeClusters(FatImg *img, FileNode *node);
+/** 为文件树分配簇 */
+static int planTree(FatImg *img, FileNode *node);
+/** 将文件树写入镜像 */
+static int writeTree(FatImg *img, FileNode *node, unsigned int parentCluster);
+/** 统计或释放簇链 */
+static unsigned int walkClusterChain(FatImg *img, unsigned int firstCluster, char release);
+/** 统计或释放目录及其全部子项占用的簇 */
+static unsigned int walkDirTree(FatImg *img, unsigned int firstCluster, unsigned int depth, char release);
+/** 统计或释放一段目录表项中各子项占用的簇 */
+static unsigned int walkDirItems(FatImg *img, DirItem *items, unsigned int itemNum, unsigned int depth, char release, int *ended);
+/** 将本地目录树同步到镜像目录 */
+static int syncDirNode(FatImg *img, ImgDir *dir, FileNode *node, SyncStats *stats);
+/** 同步一个本地文件到镜像目录中的已有文件 */
+static int syncFileItem(FatImg *img, ImgDir *dir, unsigned int slot, FileNode *node, SyncStats *stats);
+/** 将本地文件或目录新增到镜像目录 */
+static int syncNewItem(FatImg *img, ImgDir *dir, FileNode *node, SyncStats *stats);
+/** 删除镜像目录中的表项及其占用的簇 */
+static void syncRemoveItem(FatImg *img, ImgDir *dir, unsigned int slot, SyncStats *stats);
+/** 检查未匹配的镜像表项在本地是否确实已不存在 */
+static int isHostItemMissing(FileNode *node, ImgDir *dir, unsigned int slot);
+/** 比较镜像中的文件数据与本地文件是否相同 */
+static int compareFileExtents(FatImg *img, FILE *fp, ClusterExtent *extents, unsigned int extentNum, unsigned long long fileSize);
+/** 获取簇链的连续簇区段 */
+static int getChainExtents(FatImg *img, unsigned int firstCluster, ClusterExtent **extents, unsigned int *extentNum);
+/** 载入子目录簇链并建立索引(已载入时直接使用) */
+static int loadSubDir(FatImg *img, unsigned int firstCluster, ImgDir *dir);
+/** 结束对镜像目录的使用 */
+static int closeSubDir(FatImg *img, ImgDir *dir);
+/** 确保镜像目录有足够的连续空闲表项 */
+static int reserveImgDirItems(FatImg *img, ImgDir *dir, unsigned int count);
+/** 按镜像内路径查找文件或目录 */
+static int resolveImgPath(FatImg *img, const char *path, ImgDir *dir, int *slot);
+/** 将镜像中的文件数据按连续簇区段写出到目标文件 */
+static int extractFileItem(FatImg *img, DirItem *item, int destFd);
+/** 将镜像目录(递归)提取到本地目录 */
+static int extractDirItems(FatImg *img, ImgDir *dir, const char *destPath, unsigned int depth);
+/** 将镜像中的文件提取为本地文件 */
+static int extractFileTo(FatImg *img, DirItem *item, const char *destPath);
+/** 载入镜像内路径对应的目录 */
+static int openImgDir(FatImg *img, const char *path, ImgDir *dir);
+/** 写入引导扇区(FAT32 同时写入备份引导扇区) */
+static int writeImgBootSector(FatImg *img, const unsigned char *sector);
 
 
 /**
@@ -118,7 +211,9 @@ int deleteFileFromImg(FILE*, unsigned short);
  */
 int createCustomBootFat12img(char *imgPath, char *bootPath, char isInit) {
 
-    FILE *bf, *fp;
+    FILE *bf;
+    ImgWriter writer;
+    int status;
     unsigned char bootSector[BYTES_SECTOR] = {0};
 
     // 打开引导扇区文件并将引导扇区信息读入数组
@@ -132,74 +227,30 @@ int createCustomBootFat12img(char *imgPath, char *bootPath, char isInit) {
         return BAD_FORMAT;
     }
 
-    // 尝试以 "rb+" 模式打开镜像（读写模式，不抹除内容）
-    fp = fopen(imgPath, "rb+");
-    if (fp == NULL) {
-        // 文件不存在，使用 "wb" 创建新文件
-        fp = fopen(imgPath, "wb");
-        if (fp == NULL) return ERROR;
-        // 文件不存在必须格式化镜像文件
-        isInit = 1;
-    }
+    // 打开镜像（读写模式，不抹除内容），文件不存在时新建
+    if (imgWriterOpen(&writer, imgPath, IMG_OPEN_KEEP) != OK) return ERROR;
+    // 文件不存在(新建的空文件)必须格式化镜像文件
+    if (writer.fileSize == 0) isInit = 1;
 
-    fseek(fp, 0, SEEK_SET); // 确保指针在文件开头
     // 将引导扇区信息写入软盘镜像
-    fwrite(bootSector, BYTES_SECTOR, 1, fp);
-
-    if (isInit) {
-        // 引导扇区后是两个 FAT 表（默认各占 9 扇区）
-        // FAT表的第 0 项和第 1 项为保留项，一个FAT表项 12 bit，两项共 24 bit，即 3 字节
-        // 其中第 0 字节（首字节）表示磁盘类型，其值与BPB中介质描述符（BPB_Media）对应的磁盘类型相同(0xf0-软盘，0xf8-硬盘)
-        // 第 2，3 字节代表 FAT 文件分配表标识符, 使用 0xff（文件结束符） 填充，避免被错误使用
-        // 从第四个字节开始与用户数据区所有的簇一一对应
-        unsigned char fatTable[9 * 512] = {0};
-        fatTable[0] = 0xF0; // 介质描述符
-        fatTable[1] = 0xFF; // 文件结束标记
-        fatTable[2] = 0xFF;
-        // 写 FAT1 表信息
-        fwrite(fatTable, sizeof(fatTable), 1, fp);
-        // 写入 FAT2 (与 FAT1 完全相同)
-        fwrite(fatTable, sizeof(fatTable), 1, fp);
-
-        // 写目录区
-        unsigned char rootDir[14 * 512] = {0};
-        // 设置根目录项卷标条目 (根目录第 0 个条目)
-        // 目录项名位置放卷标名
+    status = imgWriterWrite(&writer, 0, bootSector, BYTES_SECTOR);
+
+    if (isInit && status == OK) {
+        // 设置根目录项卷标条目
         // 检查 bootSector[43] 开始的 11 字节
         if (bootSector[43] == 0 || bootSector[43] == ' ') {
             // 默认卷标
-            memcpy(&rootDir[0], "FATIMG     ", 11);
+            status = writeFat12Layout(&writer, "FATIMG     ");
         } else {
             // 如果引导扇区里已经定义了卷标，则直接引用
-            memcpy(&rootDir[0], &bootSector[43], 11);
-        }
-        // 目录项属性：0x08 - 卷标
-        rootDir[11] = 0x08;
-        unsigned short timeVal = formatTime();
-        unsigned short dateVal = formatDate();
-        // 强制转换或手动拆分写入，以保证跨平台安全
-        // 最后修改时间
-        rootDir[22] = (unsigned char)(timeVal & 0xFF);
-        rootDir[23] = (unsigned char)((timeVal >> 8) & 0xFF);
-        // 最后修改日期
-        rootDir[24] = (unsigned char)(dateVal & 0xFF);
-        rootDir[25] = (unsigned char)((dateVal >> 8) & 0xFF);
-        // 写入 14 个扇区的根目录区
-        fwrite(rootDir, sizeof(rootDir), 1, fp);
-
-        // 用 0 填充 FAT12 用户数据区
-        // 用户区数据区扇区数 = 总扇区数 - 引导扇区数 - FAT表扇区数 * 2 - 根目录扇区数 = 总扇区数 - 数据区起始扇区号
-        unsigned char emptySector[512] = {0};
-        int dataSectorsCount = TOTAL_SECTORS - DATA_FIRST_SECTOR;
-        for (int i = 0; i < dataSectorsCount; i++) {
-            fwrite(emptySector, 512, 1, fp);
+            status = writeFat12Layout(&writer, (char*) &bootSector[43]);
         }
     }
 
-    // 关闭文件
-    fclose(fp);
+    // 写出数据并关闭文件
+    if (imgWriterClose(&writer) != OK) status = ERROR;
 
-    return OK;
+    return status;
 }
 
 
@@ -210,6 +261,8 @@ int createCustomBootFat12img(char *imgPath, char *bootPath, char isInit) {
  * @return
  */
 int createEmptyFat12img(char *imgPath, char *volumeLabel) {
+    ImgWriter writer;
+    int status;
     // 格式化卷标, 多一位用于设置字符串结束符 '\0'
     char formattedLabel[12];
     formatFat12VolumeLabel(formattedLabel, volumeLabel);
@@ -221,11 +274,6 @@ int createEmptyFat12img(char *imgPath, char *volumeLabel) {
         }
     }
 
-    // 新建镜像文件
-    // wb, 文件存在会覆盖数据
-    FILE *fp = fopen(imgPath, "wb");
-    if(fp == NULL) return ERROR;
-
     // 写入引导扇区信息 (512 字节)
     BootSector bootSector = {
             {0xeb, 0x3B, 0x90}, // 0x2D = 59 字节，跳过 3 + 59 = 62 字节
@@ -253,32 +301,51 @@ int createEmptyFat12img(char *imgPath, char *volumeLabel) {
     };
     // 手动复制卷标到结构体
     strncpy((char*) bootSector.volumeLabel, formattedLabel, 11);
+
+    // 新建镜像文件
+    // 文件存在会覆盖数据
+    if (imgWriterOpen(&writer, imgPath, IMG_OPEN_CREATE) != OK) return ERROR;
+
     // 将引导扇区信息写入软盘镜像
-    fwrite(&bootSector, BYTES_SECTOR, 1, fp);
+    status = imgWriterWrite(&writer, 0, &bootSector, BYTES_SECTOR);
+    // 写入FAT表、根目录区及数据区
+    if (status == OK) status = writeFat12Layout(&writer, formattedLabel);
 
+    // 写出数据并关闭文件
+    if (imgWriterClose(&writer) != OK) status = ERROR;
+
+    return status;
+}
+
+
+/**
+ * 写入标准FAT12软盘镜像引导扇区之后的FAT表、根目录区及数据区
+ * 引导扇区、FAT表与根目录区首尾相接，由写入器合并为一次写出
+ * @param writer - 镜像写入器
+ * @param volumeLabel - 已格式化的 11 字节卷标
+ * @return
+ */
+static int writeFat12Layout(ImgWriter *writer, const char *volumeLabel) {
     // 引导扇区后是两个 FAT 表（默认各占 9 扇区）
     // FAT表的第 0 项和第 1 项为保留项，一个FAT表项 12 bit，两项共 24 bit，即 3 字节
     // 其中第 0 字节（首字节）表示磁盘类型，其值与BPB中介质描述符（BPB_Media）对应的磁盘类型相同(0xf0-软盘，0xf8-硬盘)
     // 第 2，3 字节代表 FAT 文件分配表标识符, 使用 0xff（文件结束符） 填充，避免被错误使用
     // 从第四个字节开始与用户数据区所有的簇一一对应
-    unsigned char fatTable[9 * 512] = {0};
+    unsigned char fatTable[FAT_SECTOR_NUM * BYTES_SECTOR] = {0};
+    // 根目录区
+    unsigned char rootDir[(DATA_FIRST_SECTOR - ROOT_FIRST_SECTOR) * BYTES_SECTOR] = {0};
+    unsigned short timeVal = formatTime();
+    unsigned short dateVal = formatDate();
+
     fatTable[0] = 0xF0; // 介质描述符
     fatTable[1] = 0xFF; // 文件结束标记
     fatTable[2] = 0xFF;
-    // 写 FAT1 表信息
-    fwrite(fatTable, sizeof(fatTable), 1, fp);
-    // 写入 FAT2 (与 FAT1 完全相同)
-    fwrite(fatTable, sizeof(fatTable), 1, fp);
 
-    // 写目录区
-    unsigned char rootDir[14 * 512] = {0};
     // 设置根目录项卷标条目 (根目录第 0 个条目)
     // 目录项名位置放卷标名
-    memcpy(&rootDir[0], formattedLabel, 11);
+    memcpy(&rootDir[0], volumeLabel, 11);
     // 目录项属性：0x08 - 卷标
     rootDir[11] = 0x08;
-    unsigned short timeVal = formatTime();
-    unsigned short dateVal = formatDate();
     // 强制转换或手动拆分写入，以保证跨平台安全
     // 最后修改时间
     rootDir[22] = (unsigned char)(timeVal & 0xFF);
@@ -286,58 +353,459 @@ int createEmptyFat12img(char *imgPath, char *volumeLabel) {
     // 最后修改日期
     rootDir[24] = (unsigned char)(dateVal & 0xFF);
     rootDir[25] = (unsigned char)((dateVal >> 8) & 0xFF);
+
+    // 写 FAT1 表信息
+    if (imgWriterWrite(writer, FAT_FIRST_SECTOR * BYTES_SECTOR, fatTable, sizeof(fatTable)) != OK) return ERROR;
+    // 写入 FAT2 (与 FAT1 完全相同)
+    if (imgWriterWrite(writer, (FAT_FIRST_SECTOR + FAT_SECTOR_NUM) * BYTES_SECTOR, fatTable, sizeof(fatTable)) != OK) return ERROR;
     // 写入 14 个扇区的根目录区
-    fwrite(rootDir, sizeof(rootDir), 1, fp);
+    if (imgWriterWrite(writer, ROOT_FIRST_SECTOR * BYTES_SECTOR, rootDir, sizeof(rootDir)) != OK) return ERROR;
 
     // 用 0 填充 FAT12 用户数据区
     // 用户区数据区扇区数 = 总扇区数 - 引导扇区数 - FAT表扇区数 * 2 - 根目录扇区数 = 总扇区数 - 数据区起始扇区号
-    unsigned char emptySector[512] = {0};
-    int dataSectorsCount = TOTAL_SECTORS - DATA_FIRST_SECTOR;
-    for (int i = 0; i < dataSectorsCount; i++) {
-        fwrite(emptySector, 512, 1, fp);
+    return imgWriterZero(writer, (long long)DATA_FIRST_SECTOR * BYTES_SECTOR,
+                         (long long)(TOTAL_SECTORS - DATA_FIRST_SECTOR) * BYTES_SECTOR);
+}
+
+
+/**
+ * 拷贝多个文件到FAT12软盘镜像
+ * 镜像只打开一次，全部文件拷贝完成后统一写回FAT表及根目录区
+ * @param imgPath - 镜像文件
+ * @param filePaths - 要拷贝的文件或目录列表，目录连同其全部子项一起拷贝
+ * @param fileNum - 文件数
+ * @param fileAttr - 要拷贝的文件属性 0x00 - 普通文件，0x01 - 只读，0x02 - 隐藏，0x04 - 系统文件，0x10 - 目录
+ * @param allocPolicy - 簇分配策略 ALLOC_FIRST_FIT / ALLOC_NEXT_FIT / ALLOC_BEST_FIT
+ * @param openMode - 镜像打开方式，IMG_OPEN_MMAP 以内存映射方式修改镜像
+ * @return
+ */
+int copyFilesToFat12img(char *imgPath, char **filePaths, unsigned int fileNum, char fileAttr, int allocPolicy, int openMode) {
+    FatImg img;
+    unsigned int i;
+    int status;
+
+    // 打开镜像文件并载入FAT表
+    status = openFatImg(&img, imgPath, openMode);
+    if (status != OK) return status;
+    img.allocPolicy = allocPolicy;
+
+    for (i = 0; i < fileNum && status == OK; i ++) {
+        if (getFileType(filePaths[i]) == TYPE_DIRECTORY) status = addDirToImg(&img, filePaths[i]);
+        else status = addFileToImg(&img, filePaths[i], fileAttr);
+        if (status != OK) printf("Copy %s fail.\n", filePaths[i]);
     }
 
-    // 关闭文件
-    fclose(fp);
+    // 写回FAT表、根目录区并关闭镜像
+    if (closeFatImg(&img) != OK && status == OK) status = ERROR;
+    return status;
+}
 
-    return OK;
+
+/**
+ * 将本地目录同步到FAT12/FAT32镜像的根目录
+ * 本地目录下的各子项与镜像中的表项按文件名(不区分大小写)对应：
+ * 大小及修改时间均相同的文件不做任何修改，只有修改时间不同的文件先比较内容，内容相同时只更新时间；
+ * 内容变化的文件簇数不变时在原簇链中重写，否则重新分配簇；本地不存在的文件及目录从镜像中删除。
+ * 修改量只与变化的文件有关，与镜像大小无关
+ * @param imgPath - 镜像文件
+ * @param dirPath - 要同步的本地目录
+ * @param allocPolicy - 簇分配策略 ALLOC_FIRST_FIT / ALLOC_NEXT_FIT / ALLOC_BEST_FIT
+ * @param openMode - 镜像打开方式，IMG_OPEN_MMAP 以内存映射方式修改镜像
+ * @return
+ */
+int syncDirToFatImg(char *imgPath, char *dirPath, int allocPolicy, int openMode) {
+    FatImg img;
+    FileNode tree;
+    ImgDir root;
+    SyncStats stats = {0};
+    int status;
+
+    // 扫描本地目录树
+    status = scanFileTree(dirPath, &tree);
+    if (status != OK) return status;
+    if (tree.type != TYPE_DIRECTORY) {
+        freeFileTree(&tree);
+        return BAD_FORMAT;
+    }
+
+    // 打开镜像文件并载入FAT表及根目录
+    status = openFatImg(&img, imgPath, openMode);
+    if (status != OK) {
+        freeFileTree(&tree);
+        return status;
+    }
+    img.allocPolicy = allocPolicy;
+
+    memset(&root, 0, sizeof(ImgDir));
+    root.index = &img.rootIndex;
+    status = syncDirNode(&img, &root, &tree, &stats);
+
+    // 写回FAT表、根目录区并关闭镜像
+    if (closeFatImg(&img) != OK && status == OK) status = ERROR;
+    freeFileTree(&tree);
+
+    if (status == OK) {
+        printf("Sync: %u added, %u updated, %u removed, %u unchanged.\n",
+               stats.added, stats.updated, stats.removed, stats.unchanged);
+    }
+    return status;
 }
 
 
 /**
- * 拷贝文件到FAT12软盘镜像
+ * 从FAT12/FAT32镜像中提取文件或目录，或将文件内容输出到标准输出
+ * 镜像以只读方式打开，文件簇链先合并为连续簇区段，每个区段一次拷贝：
+ * 写入普通文件时由 copy_file_range 在内核中完成，输出到管道时使用 sendfile
  * @param imgPath - 镜像文件
+ * @param srcPath - 镜像内路径(以 '/' 分隔，不区分大小写)，"/" 表示根目录
+ * @param destPath - 本地目标路径，为 NULL 时将文件内容输出到标准输出；
+ *                   目标为已存在的目录且提取的是文件时，提取到该目录下的同名文件
+ * @return 镜像内路径不存在返回 NO_FIND，输出目录到标准输出返回 BAD_FORMAT
+ */
+int extractFromFatImg(char *imgPath, char *srcPath, char *destPath) {
+    FatImg img;
+    ImgDir dir, subDir;
+    DirItem *item = NULL;
+    char name[DIR_NAME_SIZE], *filePath;
+    int slot, status;
+
+    status = openFatImg(&img, imgPath, IMG_OPEN_RDONLY);
+    if (status != OK) return status;
+
+    status = resolveImgPath(&img, srcPath, &dir, &slot);
+    if (status == OK && slot >= 0) item = (DirItem*) (dir.index->data + (size_t) slot * sizeof(DirItem));
+
+    if (status != OK) {
+        // 路径不存在
+    } else if (destPath == NULL) {
+        // 输出文件内容到标准输出
+        if (item == NULL || (item->attr & 0x10)) status = BAD_FORMAT;
+        else {
+            fflush(stdout);
+#if defined(_WIN32) || defined(_WIN64)
+            _setmode(_fileno(stdout), _O_BINARY);
+#endif
+            status = extractFileItem(&img, item, fileno(stdout));
+        }
+    } else if (item == NULL) {
+        // 提取根目录
+        status = extractDirItems(&img, &dir, destPath, 0);
+    } else if (item->attr & 0x10) {
+        status = loadSubDir(&img, getItemCluster(&img, item), &subDir);
+        if (status == OK) {
+            status = extractDirItems(&img, &subDir, destPath, 0);
+            closeSubDir(&img, &subDir);
+        }
+    } else if (getFileType(destPath) == TYPE_DIRECTORY) {
+        getDirItemName(dir.index, (unsigned int) slot, name);
+        filePath = (char*) malloc(strlen(destPath) + strlen(name) + 2);
+        if (filePath == NULL) status = ERROR;
+        else {
+            sprintf(filePath, "%s%c%s", destPath, SEPARATOR, name);
+            status = extractFileTo(&img, item, filePath);
+            free(filePath);
+        }
+    } else {
+        status = extractFileTo(&img, item, destPath);
+    }
+
+    closeSubDir(&img, &dir);
+    if (closeFatImg(&img) != OK && status == OK) status = ERROR;
+    return status;
+}
+
+
+/**
+ * 将本地文件或目录(递归)拷贝到已打开镜像中的目录
+ * 目录中存在同名(不区分大小写)的文件或目录时先删除旧的再拷贝，修改的目录扇区在关闭镜像时写回。
+ * 剩余空间(包括同名文件/目录部分)不足时不删除旧的
+ * @param img - 已打开的镜像
+ * @param hostPath - 本地文件或目录
+ * @param imgDirPath - 镜像内目标目录路径，NULL 或 "/" 表示根目录
+ * @return 目标目录不存在返回 NO_FIND，目标不是目录或文件名不合法返回 BAD_FORMAT，空间不足返回 INSUFFICIENT_SPACE
+ */
+int addPathToImgDir(FatImg *img, const char *hostPath, const char *imgDirPath) {
+    FileNode node;
+    ImgDir dir;
+    SyncStats stats = {0};
+    DirItem *item;
+    char oldName[DIR_NAME_SIZE];
+    unsigned long long needClusters, freeClusters;
+    int slot, status, lfnNum;
+
+    status = scanFileTree(hostPath, &node);
+    if (status != OK) return status;
+    if (getLongNameItemNum(node.name) < 0) {
+        freeFileTree(&node);
+        return BAD_FORMAT;
+    }
+
+    status = openImgDir(img, imgDirPath, &dir);
+    if (status != OK) {
+        freeFileTree(&node);
+        return status;
+    }
+
+    slot = findDirItemByName(dir.index, node.name);
+    if (slot >= 0) {
+        // 旧表项删除后腾出的表项放不下新文件名时，先扩展目录
+        lfnNum = getLongNameItemNum(node.name);
+        getDirItemName(dir.index, (unsigned int) slot, oldName);
+        if (getLongNameItemNum(oldName) < lfnNum && findFreeDirRun(dir.index, (unsigned int) lfnNum + 1) == NO_FIND) {
+            status = reserveImgDirItems(img, &dir, (unsigned int) lfnNum + 1);
+            if (status != OK) status = INSUFFICIENT_SPACE;
+        }
+
+        // 剩余空间不足（包括同名文件/目录部分）时保留旧的文件/目录
+        if (status == OK && node.type == TYPE_DIRECTORY) status = buildDirItems(&node);
+        if (status == OK) {
+            item = (DirItem*) (dir.index->data + (size_t) slot * sizeof(DirItem));
+            needClusters = countTreeClusters(img, &node);
+            freeClusters = getFreeClusterNum(&img->fat);
+            freeClusters += (item->attr & 0x10) ? walkDirTree(img, getItemCluster(img, item), 0, 0)
+                                                : walkClusterChain(img, getItemCluster(img, item), 0);
+            if (needClusters > freeClusters) status = INSUFFICIENT_SPACE;
+        }
+        if (status == OK) syncRemoveItem(img, &dir, (unsigned int) slot, &stats);
+    }
+    if (status == OK) status = syncNewItem(img, &dir, &node, &stats);
+    if (closeSubDir(img, &dir) != OK && status == OK) status = ERROR;
+
+    freeFileTree(&node);
+    return status;
+}
+
+
+/**
+ * 在已打开的镜像中创建目录
+ * 路径中不存在的各级目录依次创建，已存在的目录直接进入
+ * @param img - 已打开的镜像
+ * @param imgPath - 镜像内目录路径
+ * @return 路径中某一级是文件或名称不合法返回 BAD_FORMAT
+ */
+int makeImgDir(FatImg *img, const char *imgPath) {
+    ImgDir dir, subDir;
+    FileNode node;
+    SyncStats stats = {0};
+    DirItem *item;
+    struct tm tmBuf;
+    char *buf, *name, *end;
+    int slot, status = OK;
+
+    buf = (char*) malloc(strlen(imgPath) + 1);
+    if (buf == NULL) return ERROR;
+    strcpy(buf, imgPath);
+
+    // 新目录使用当前时间(可重现构建时不晚于固定时间)
+    memset(&node, 0, sizeof(FileNode));
+    node.type = TYPE_DIRECTORY;
+    if (getLocalTime(getBuildTime(time(NULL)), &tmBuf) != NULL) {
+        node.createTimes[0] = tmBuf.tm_year + 1900;
+        node.createTimes[1] = tmBuf.tm_mon + 1;
+        node.createTimes[2] = tmBuf.tm_mday;
+        node.createTimes[3] = tmBuf.tm_hour;
+        node.createTimes[4] = tmBuf.tm_min;
+        node.createTimes[5] = tmBuf.tm_sec;
+    }
+
+    memset(&dir, 0, sizeof(ImgDir));
+    dir.index = &img->rootIndex;
+    for (name = buf; *name && status == OK; name = end) {
+        for (end = name; *end && *end != '/' && *end != '\\'; end ++);
+        if (*end) *end ++ = '\0';
+        if (*name == '\0') continue;
+
+        slot = findDirItemByName(dir.index, name);
+        if (slot < 0) {
+            if (getLongNameItemNum(name) < 0) {
+                status = BAD_FORMAT;
+                break;
+            }
+            node.path = name;
+            node.name = name;
+            status = syncNewItem(img, &dir, &node, &stats);
+            free(node.dirData);
+            free(node.extents);
+            node.dirData = NULL;
+            node.extents = NULL;
+            node.extentNum = 0;
+            if (status != OK) break;
+            slot = findDirItemByName(dir.index, name);
+        }
+
+        item = (DirItem*) (dir.index->data + (size_t) slot * sizeof(DirItem));
+        if (!(item->attr & 0x10)) {
+            status = BAD_FORMAT;
+            break;
+        }
+        status = loadSubDir(img, getItemCluster(img, item), &subDir);
+        if (status != OK) break;
+        if (closeSubDir(img, &dir) != OK) status = ERROR;
+        dir = subDir;
+    }
+
+    if (closeSubDir(img, &dir) != OK && status == OK) status = ERROR;
+    free(buf);
+    return status;
+}
+
+
+/**
+ * 从已打开的镜像中删除文件或目录
+ * 删除目录时其全部子项占用的簇一并释放
+ * @param img - 已打开的镜像
+ * @param imgPath - 镜像内路径
+ * @return 路径不存在返回 NO_FIND，路径为根目录返回 BAD_FORMAT
+ */
+int removeImgPath(FatImg *img, const char *imgPath) {
+    ImgDir dir;
+    SyncStats stats = {0};
+    int slot, status;
+
+    status = resolveImgPath(img, imgPath, &dir, &slot);
+    if (status == OK && slot < 0) status = BAD_FORMAT;
+    if (status == OK) syncRemoveItem(img, &dir, (unsigned int) slot, &stats);
+
+    if (closeSubDir(img, &dir) != OK && status == OK) status = ERROR;
+    return status;
+}
+
+
+/**
+ * 查找已打开镜像中的文件或目录
+ * @param img - 已打开的镜像
+ * @param imgPath - 镜像内路径，"/" 表示根目录
+ * @param info - 返回文件或目录信息
+ * @return 路径不存在返回 NO_FIND
+ */
+int lookupImgPath(FatImg *img, const char *imgPath, ImgItemInfo *info) {
+    ImgDir dir;
+    DirItem *item;
+    int slot, status;
+
+    memset(info, 0, sizeof(ImgItemInfo));
+    status = resolveImgPath(img, imgPath, &dir, &slot);
+    if (status == OK && slot < 0) {
+        // 根目录
+        info->type = TYPE_DIRECTORY;
+        info->attr = 0x10;
+        info->firstCluster = img->rootCluster;
+        info->clusterNum = img->type == FAT32 ? walkClusterChain(img, img->rootCluster, 0) : 0;
+    } else if (status == OK) {
+        item = (DirItem*) (dir.index->data + (size_t) slot * sizeof(DirItem));
+        info->type = (item->attr & 0x10) ? TYPE_DIRECTORY : TYPE_FILE;
+        info->attr = item->attr;
+        info->size = item->size;
+        info->firstCluster = getItemCluster(img, item);
+        info->clusterNum = walkClusterChain(img, info->firstCluster, 0);
+    }
+
+    closeSubDir(img, &dir);
+    return status;
+}
+
+
+/**
+ * 设置已打开镜像的卷标
+ * 同时修改引导扇区(FAT32 含备份引导扇区)中的卷标及根目录中的卷标表项，根目录没有卷标表项时新增一项
+ * @param img - 已打开的镜像
+ * @param volumeLabel - 卷标，最多 11 个字符，为空使用默认卷标
+ * @return 卷标含非法字符返回 BAD_FORMAT，根目录已满返回 INSUFFICIENT_SPACE
+ */
+int setImgVolumeLabel(FatImg *img, const char *volumeLabel) {
+    unsigned char sector[BYTES_SECTOR];
+    char label[12];
+    DirItem item, *items = (DirItem*) img->rootIndex.data;
+    unsigned int i;
+    int slot = NO_FIND;
+
+    if (volumeLabel[0] != '\0' && !isValidFat12VolumeLabel(volumeLabel)) return BAD_FORMAT;
+    formatFat12VolumeLabel(label, volumeLabel);
+
+    // 引导扇区中的卷标(FAT12/FAT16 位于 43 字节，FAT32 位于 71 字节)
+    if (imgWriterRead(&img->io, 0, sector, BYTES_SECTOR) != OK) return ERROR;
+    memcpy(sector + (img->type == FAT32 ? 71 : 43), label, 11);
+    if (writeImgBootSector(img, sector) != OK) return ERROR;
+
+    // 查找根目录中的卷标表项(跳过已删除项及长文件名项)
+    for (i = 0; i < img->rootIndex.itemNum && items[i].name[0] != 0x00; i ++) {
+        if (items[i].name[0] != 0xe5 && (items[i].attr & 0x0F) != 0x0F && (items[i].attr & 0x08)) {
+            slot = (int) i;
+            break;
+        }
+    }
+    while (slot == NO_FIND && (slot = findFreeDirItem(&img->rootIndex)) == NO_FIND) {
+        if (img->type != FAT32 || growRootDir(img) != OK) return INSUFFICIENT_SPACE;
+        items = (DirItem*) img->rootIndex.data;
+    }
+
+    memset(&item, 0, sizeof(DirItem));
+    memcpy(item.name, label, 11);
+    item.attr = 0x08;
+    item.writeTime = formatTime();
+    item.writeDate = formatDate();
+    setDirItem(&img->rootIndex, (unsigned int) slot, &item);
+    return OK;
+}
+
+
+/**
+ * 将引导文件中的引导代码写入已打开的镜像
+ * 只替换跳转指令及BPB之后的引导代码，镜像的BPB保持不变
+ * @param img - 已打开的镜像
+ * @param bootPath - 引导扇区二进制文件路径(512 字节，以 0x55 0xAA 结尾)
+ * @return 引导文件不存在返回 NO_FIND，引导扇区无效返回 BAD_FORMAT
+ */
+int setImgBootCode(FatImg *img, const char *bootPath) {
+    unsigned char boot[BYTES_SECTOR], sector[BYTES_SECTOR];
+    // 引导代码起始位置(FAT12/FAT16 为 62 字节，FAT32 为 90 字节)
+    size_t codePos = img->type == FAT32 ? 90 : 62;
+    size_t n;
+    FILE *bf;
+
+    bf = fopen(bootPath, "rb");
+    if (bf == NULL) return NO_FIND;
+    n = fread(boot, 1, BYTES_SECTOR, bf);
+    fclose(bf);
+    if (n != BYTES_SECTOR || boot[BYTES_SECTOR - 2] != 0x55 || boot[BYTES_SECTOR - 1] != 0xaa) return BAD_FORMAT;
+
+    if (imgWriterRead(&img->io, 0, sector, BYTES_SECTOR) != OK) return ERROR;
+    memcpy(sector, boot, 3);
+    memcpy(sector + codePos, boot + codePos, BYTES_SECTOR - codePos);
+    return writeImgBootSector(img, sector);
+}
+
+
+/**
+ * 拷贝文件到已打开的镜像根目录中
+ * 镜像中存在同名文件时先删除旧文件再创建新文件
+ * @param img - 已打开的镜像
  * @param filePath - 要拷贝的文件
- * @param fileAttr - 要拷贝的文件属性 0x00 - 普通文件，0x01 - 只读，0x02 - 隐藏，0x04 - 系统文件，0x10 - 目录
+ * @param fileAttr - 要拷贝的文件属性
  * @return
  */
-int copyFileToFat12img(char *imgPath, char *filePath, char fileAttr) {
-    FILE *ifp, *fp;
-    DirItem dirItem;
-    unsigned short i;
+int addFileToImg(FatImg *img, char *filePath, char fileAttr) {
+    FILE *fp;
+    int status;
+    DirItem dirItem, *item;
     // 根目录表项序号
     int rootDirItemIndex;
-    // 目录表项大小
-    unsigned short dirItemSize = sizeof(DirItem);
+    // 长文件名表项数
+    int lfnNum;
     // 要拷贝的文件大小
-    unsigned long fileSize = 0;
+    long long fileSize = 0;
     // 要拷贝的文件的创建时间
     int fileCreateTimes[6] = {0};
     char newFileName[12], *fileName;
-    /** 拷贝数据临时中转数组 */
-    unsigned char tempData[BYTES_SECTOR] = {0};
-    unsigned short needSectors, remainingBytes;
-    /** FAT文件簇链 */
-    unsigned short fileSectorList[TOTAL_SECTORS] = {0};
-
-    // 打开镜像文件
-    // rb+ 以读写方式打开已存在的文件，若文件不存在，则打开失败
-    ifp = fopen(imgPath, "rb+");
-    if(ifp == NULL) return NO_FIND;
+    unsigned char caseFlags;
+    unsigned int needClusters, freeClusters;
+    /** 文件占用的连续簇区段 */
+    ClusterExtent *extents;
+    unsigned int extentNum;
+
     // 打开要拷贝的文件
     fp = fopen(filePath, "rb");
     if(fp == NULL) return NO_FIND;
-
     // 获取文件创建时间
     getFileCreateTimeArray(filePath, fileCreateTimes);
 
@@ -355,226 +823,1232 @@ int copyFileToFat12img(char *imgPath, char *filePath, char fileAttr) {
         fileName = fileName + 1;
     }
 
-    // 若软盘镜像里存在同名文件，将此文件信息读出(获取文件大小)
-    rootDirItemIndex = findFileInRootDir(ifp, fileName);
-    if(rootDirItemIndex != NO_FIND) {
-        fseek(ifp, ROOT_FIRST_SECTOR * BYTES_SECTOR + rootDirItemIndex * dirItemSize, SEEK_SET);
-        fread(&dirItem, dirItemSize, 1, ifp);
-    } else {
-        dirItem.size = 0;
+    // 获取要拷贝的文件大小(字节)，FAT文件大小最大为 4G - 1
+    fileSize = getFileSize(fp);
+    lfnNum = getLongNameItemNum(fileName);
+    if (fileSize < 0 || fileSize > 0xFFFFFFFFLL || lfnNum < 0) {
+        fclose(fp);
+        return BAD_FORMAT;
     }
 
-    // ftell() 用于得到当前文件位置指针相对于文件首的偏移字节数
-    // 获取要拷贝的文件大小(字节)
-    fileSize = (fseek(fp, 0, SEEK_END), ftell(fp));
-    // 剩余空间不足（包括同名文件部分）
-    if((dirItem.size + getFreeClusterNum(ifp, FAT_FIRST_SECTOR * BYTES_SECTOR,
-            FAT_SECTOR_NUM * BYTES_SECTOR, FAT12) * BYTES_SECTOR) < fileSize) {
+    // 根目录区无足够的连续空表项存放长文件名及短文件名表项(FAT32根目录可追加簇)
+    rootDirItemIndex = findFileInRootDir(img, fileName);
+    if (reserveRootDirItems(img, lfnNum + 1, rootDirItemIndex) != OK) {
         fclose(fp);
-        fclose(ifp);
         return INSUFFICIENT_SPACE;
     }
-    // 根目录区无空表项
-    if(findEmptyRootDirItem(ifp) == NO_FIND) {
+
+    // 若软盘镜像里存在同名文件，统计其占用的簇数
+    freeClusters = getFreeClusterNum(&img->fat);
+    if(rootDirItemIndex != NO_FIND) {
+        item = getRootDirItem(img, rootDirItemIndex);
+        freeClusters += (item->attr & 0x10) ? walkDirTree(img, getItemCluster(img, item), 0, 0)
+                                            : walkClusterChain(img, getItemCluster(img, item), 0);
+    }
+
+    // 剩余空间不足（包括同名文件部分）
+    needClusters = (fileSize + img->bytesPerCluster - 1) / img->bytesPerCluster;
+    if(freeClusters < needClusters) {
         fclose(fp);
-        fclose(ifp);
         return INSUFFICIENT_SPACE;
     }
 
     // 删除同名文件
-    if(rootDirItemIndex != NO_FIND) deleteFileFromImg(ifp, rootDirItemIndex);
+    if(rootDirItemIndex != NO_FIND) deleteFileFromImg(img, rootDirItemIndex);
+
+    // 生成根目录中唯一的短文件名(不符合 8.3 格式的文件名使用 ~N 别名)
+    lfnNum = makeShortName(&img->rootIndex, fileName, newFileName, &caseFlags);
+    if (lfnNum < 0) {
+        fclose(fp);
+        return lfnNum;
+    }
 
     /**************** 向镜像中增加文件 ****************/
-    // 除去所需的完整扇区后文件剩余的字节数
-    remainingBytes = fileSize % BYTES_SECTOR;
-    // 计算源文件所需扇区数
-    needSectors = fileSize / BYTES_SECTOR + (remainingBytes > 0 ? 1 : 0);
-
-    fileSectorList[0] = findEmptyCluster(ifp, FAT_FIRST_SECTOR * BYTES_SECTOR,
-            FAT_SECTOR_NUM * BYTES_SECTOR, 2, FAT12);
-    for(i = 1; i < needSectors; i++) {
-        fileSectorList[i] = findEmptyCluster(ifp, FAT_FIRST_SECTOR * BYTES_SECTOR,
-                FAT_SECTOR_NUM * BYTES_SECTOR, fileSectorList[i - 1] + 1, FAT12);
-        setNextClusterLinkNum(ifp, FAT_FIRST_SECTOR * BYTES_SECTOR,
-                (FAT_FIRST_SECTOR + FAT_SECTOR_NUM) * BYTES_SECTOR,fileSectorList[i - 1], fileSectorList[i], FAT12);
-    }
-    // 最后一个文件簇写入文件结束符EOF(0xff8 ~ 0xfff)
-    setNextClusterLinkNum(ifp, FAT_FIRST_SECTOR * BYTES_SECTOR,
-            (FAT_FIRST_SECTOR + FAT_SECTOR_NUM) * BYTES_SECTOR,fileSectorList[i - 1], 0xfff, FAT12);
+    // 按分配策略为源文件分配尽量连续的簇
+    if (allocClusterExtents(&img->fat, needClusters, img->allocPolicy, &extents, &extentNum) != OK) {
+        fclose(fp);
+        return INSUFFICIENT_SPACE;
+    }
 
     // 设置文件相关信息
-    strncpy((char*)dirItem.name, (formatFileName(fileName, newFileName), newFileName), 11);
-    dirItem.attr = fileAttr;
-    dirItem.winNTRes = 0;
-    dirItem.createTimeMs = 0;
-    dirItem.createTime = formatCreateTimeArray(fileCreateTimes);
-    dirItem.createDate = formatCreateDateArray(fileCreateTimes);
-    dirItem.lastAccessDate = 0;
-    dirItem.firstClusterHi = 0;
-    dirItem.writeTime = formatTime();
-    dirItem.writeDate = formatDate();
-    dirItem.firstCluster = fileSectorList[0];
-    dirItem.size = fileSize;
-
-    // 将带有文件信息的根目录表项写入根目录区
-    rootDirItemIndex = findEmptyRootDirItem(ifp);
-    fseek(ifp, ROOT_FIRST_SECTOR * BYTES_SECTOR + rootDirItemIndex * dirItemSize, SEEK_SET);
-    fwrite(&dirItem, dirItemSize, 1, ifp);
-
-    // 拷贝文件到相应扇区
-    fseek(fp, 0, SEEK_SET);
-    for(i = 0; i < needSectors - 1; i++) {
-        // 从要拷贝的文件中读一扇区的数据到临时中转数组
-        fread(tempData, BYTES_SECTOR, 1, fp);
-        // FAT表项中的第0簇项和第0簇项为保留簇项，用做起始标记，
-        // 但是数据区并不会浪费2个簇的空间，所以FAT表项的第2簇项对应数据区的0簇，第3簇项对应数据区的1簇..,以此类推
-        // fileSectorList[i] - 2 表示FAT表项簇序号对应的数据区簇序号
-        fseek(ifp, (fileSectorList[i] - 2 + DATA_FIRST_SECTOR) * BYTES_SECTOR, SEEK_SET);
-        fwrite(tempData, BYTES_SECTOR, 1, ifp);
-    }
-    // 最后一个扇区单独处理
-    // 最后一个扇区未满 512 字节，剩余部分填充0
-    if(remainingBytes > 0) {
-        fread(tempData, remainingBytes, 1, fp);
-        for(i = remainingBytes; i < BYTES_SECTOR; i ++) {
-            tempData[i] = 0;
+    fillDirItem(&dirItem, newFileName, fileAttr, fileCreateTimes, extentNum > 0 ? extents[0].start : 0, (unsigned int) fileSize);
+    dirItem.winNTRes = caseFlags;
+
+    // 将长文件名表项及带有文件信息的根目录表项写入根目录区缓存
+    insertDirItem(&img->rootIndex, fileName, (unsigned int) lfnNum, &dirItem);
+
+    // 按区段拷贝文件数据
+    status = writeFileExtents(img, fp, extents, extentNum, fileSize);
+    free(extents);
+    fclose(fp);
+
+    return status;
+}
+
+
+
+/**
+ * 按区段将文件数据写入镜像
+ * 每个区段的数据由 imgWriterCopyFrom 一次拷贝(尽量由内核直接完成)，最后一簇未满部分填充 0
+ * @param img - 镜像
+ * @param fp - 源文件句柄
+ * @param extents - 文件占用的连续簇区段
+ * @param extentNum - 区段数
+ * @param fileSize - 文件大小
+ * @return
+ */
+static int writeFileExtents(FatImg *img, FILE *fp, ClusterExtent *extents, unsigned int extentNum, unsigned long long fileSize) {
+    unsigned int i;
+    unsigned long long done = 0, len;
+    long long pos;
+
+    for (i = 0; i < extentNum; i ++) {
+        pos = getClusterPos(img, extents[i].start);
+        len = (unsigned long long) extents[i].count * img->bytesPerCluster;
+        if (len > fileSize - done) len = fileSize - done;
+
+        if (imgWriterCopyFrom(&img->io, pos, fileno(fp), (long long) done, (long long) len) != OK) return ERROR;
+        done += len;
+
+        // 最后一簇未满，剩余部分填充0
+        if (done == fileSize && len % img->bytesPerCluster != 0) {
+            if (imgWriterZero(&img->io, pos + len, img->bytesPerCluster - len % img->bytesPerCluster) != OK) return ERROR;
+        }
+    }
+    return OK;
+}
+
+
+/**
+ * 拷贝目录及其全部子项到已打开的镜像根目录中
+ * 先扫描本地目录树并一次规划全部簇(目录簇之后紧跟其文件簇)，
+ * 再按规划顺序写入，每个目录的数据在内存中构造完成后只写入一次。
+ * 镜像中存在同名文件或目录时先删除旧的再创建新的
+ * @param img - 已打开的镜像
+ * @param dirPath - 要拷贝的目录
+ * @return
+ */
+int addDirToImg(FatImg *img, char *dirPath) {
+    FileNode tree;
+    DirItem dirItem, *item;
+    int rootDirItemIndex, status, lfnNum;
+    unsigned long long needClusters, freeClusters;
+
+    // 扫描本地目录树
+    status = scanFileTree(dirPath, &tree);
+    if (status != OK) return status;
+    if (tree.type != TYPE_DIRECTORY) {
+        freeFileTree(&tree);
+        return BAD_FORMAT;
+    }
+
+    lfnNum = getLongNameItemNum(tree.name);
+    status = lfnNum < 0 ? BAD_FORMAT : buildDirItems(&tree);
+    if (status != OK) {
+        freeFileTree(&tree);
+        return status;
+    }
+
+    // 根目录区无足够的连续空表项(FAT32根目录可追加簇)
+    rootDirItemIndex = findFileInRootDir(img, tree.name);
+    if (reserveRootDirItems(img, lfnNum + 1, rootDirItemIndex) != OK) {
+        freeFileTree(&tree);
+        return INSUFFICIENT_SPACE;
+    }
+
+    // 剩余空间不足（包括同名文件/目录部分）
+    freeClusters = getFreeClusterNum(&img->fat);
+    if (rootDirItemIndex != NO_FIND) {
+        item = getRootDirItem(img, rootDirItemIndex);
+        freeClusters += (item->attr & 0x10) ? walkDirTree(img, getItemCluster(img, item), 0, 0)
+                                            : walkClusterChain(img, getItemCluster(img, item), 0);
+    }
+    needClusters = countTreeClusters(img, &tree);
+    if (needClusters > freeClusters) {
+        freeFileTree(&tree);
+        return INSUFFICIENT_SPACE;
+    }
+
+    // 删除同名文件/目录
+    if (rootDirItemIndex != NO_FIND) deleteFileFromImg(img, rootDirItemIndex);
+
+    // 规划簇并写入
+    lfnNum = makeShortName(&img->rootIndex, tree.name, tree.shortName, &tree.caseFlags);
+    status = lfnNum < 0 ? lfnNum : planTree(img, &tree);
+    if (status == OK) {
+        fillDirItem(&dirItem, tree.shortName, 0x10, tree.createTimes, tree.extents[0].start, 0);
+        dirItem.winNTRes = tree.caseFlags;
+        insertDirItem(&img->rootIndex, tree.name, (unsigned int) lfnNum, &dirItem);
+        status = writeTree(img, &tree, 0);
+    }
+
+    freeFileTree(&tree);
+    return status;
+}
+
+
+/**
+ * 将本地目录树同步到镜像目录
+ * 先按文件名对应本地子项与镜像表项并删除本地已不存在的表项(释放的簇可供后续新增使用)，
+ * 再逐个同步已有的文件、递归同步已有的子目录，最后新增镜像中没有的子项
+ * @param img - 镜像
+ * @param dir - 镜像目录
+ * @param node - 本地目录节点
+ * @param stats - 同步统计
+ * @return 本地文件名不合法或重复返回 BAD_FORMAT
+ */
+static int syncDirNode(FatImg *img, ImgDir *dir, FileNode *node, SyncStats *stats) {
+    FileNode *child;
+    ImgDir subDir;
+    DirItem *item;
+    unsigned int i, itemNum = dir->index->itemNum;
+    unsigned char *matched;
+    int *slots, status = OK;
+
+    slots = (int*) malloc((node->childNum + 1) * sizeof(int));
+    matched = (unsigned char*) calloc(itemNum + 1, 1);
+    if (slots == NULL || matched == NULL) {
+        free(slots);
+        free(matched);
+        return ERROR;
+    }
+
+    // 本地子项与镜像表项一一对应
+    for (i = 0; i < node->childNum && status == OK; i ++) {
+        child = &node->children[i];
+        if (getLongNameItemNum(child->name) < 0) {
+            printf("Bad file name: %s\n", child->path);
+            status = BAD_FORMAT;
+            break;
+        }
+        slots[i] = findDirItemByName(dir->index, child->name);
+        if (slots[i] < 0) continue;
+        if (matched[slots[i]]) {
+            printf("Duplicate file name: %s\n", child->path);
+            status = BAD_FORMAT;
+            break;
+        }
+        matched[slots[i]] = 1;
+    }
+
+    // 删除本地已不存在的文件及目录(跳过已删除项、'.'、'..'、长文件名项及卷标)
+    for (i = 0; i < itemNum && status == OK; i ++) {
+        item = (DirItem*) (dir->index->data + (size_t) i * sizeof(DirItem));
+        if (item->name[0] == 0x00) break;
+        if (item->name[0] == 0xe5 || item->name[0] == '.' || (item->attr & 0x08) || matched[i]) continue;
+        status = isHostItemMissing(node, dir, i);
+        if (status == OK) syncRemoveItem(img, dir, i, stats);
+        else if (status == NO_FIND) status = OK;
+    }
+
+    // 同步已有的文件及子目录，类型不同时删除后重新新增
+    for (i = 0; i < node->childNum && status == OK; i ++) {
+        child = &node->children[i];
+        if (slots[i] < 0) continue;
+        item = (DirItem*) (dir->index->data + (size_t) slots[i] * sizeof(DirItem));
+        if ((child->type == TYPE_DIRECTORY) != ((item->attr & 0x10) != 0)) {
+            syncRemoveItem(img, dir, (unsigned int) slots[i], stats);
+            slots[i] = NO_FIND;
+        } else if (child->type == TYPE_DIRECTORY) {
+            status = loadSubDir(img, getItemCluster(img, item), &subDir);
+            if (status != OK) break;
+            status = syncDirNode(img, &subDir, child, stats);
+            if (closeSubDir(img, &subDir) != OK && status == OK) status = ERROR;
+        } else {
+            status = syncFileItem(img, dir, (unsigned int) slots[i], child, stats);
         }
-    } else {
-        fread(tempData, BYTES_SECTOR, 1, fp);
     }
-    // 将最后一扇区的数据写入软盘镜像
-    fseek(ifp, (fileSectorList[needSectors - 1] - 2 + DATA_FIRST_SECTOR) * BYTES_SECTOR, SEEK_SET);
-    fwrite(tempData, BYTES_SECTOR, 1, ifp);
 
-    // 关闭文件
+    // 新增镜像中没有的文件及目录
+    for (i = 0; i < node->childNum && status == OK; i ++) {
+        if (slots[i] < 0) status = syncNewItem(img, dir, &node->children[i], stats);
+    }
+
+    free(slots);
+    free(matched);
+    return status;
+}
+
+
+
+/**
+ * 检查未匹配的镜像表项在本地是否确实已不存在
+ * 扫描时跳过的本地项(如设备文件、命名管道)不在文件树中，同名的镜像表项不能当作已删除
+ * @param node - 本地目录节点
+ * @param dir - 镜像目录
+ * @param slot - 表项序号
+ * @return 本地已不存在返回 OK，本地仍存在(不删除)返回 NO_FIND
+ */
+static int isHostItemMissing(FileNode *node, ImgDir *dir, unsigned int slot) {
+    char name[DIR_NAME_SIZE], *path;
+    FILE_TYPE type;
+
+    getDirItemName(dir->index, slot, name);
+    if (name[0] == '\0' || strchr(name, '/') != NULL || strchr(name, '\\') != NULL) return OK;
+    path = (char*) malloc(strlen(node->path) + strlen(name) + 2);
+    if (path == NULL) return ERROR;
+    sprintf(path, "%s%c%s", node->path, SEPARATOR, name);
+    type = getFileType(path);
+    if (type != TYPE_NOT_FOUND) printf("Keep %s: not a regular file or directory on the host.\n", path);
+    free(path);
+    return type == TYPE_NOT_FOUND ? OK : NO_FIND;
+}
+/**
+ * 同步一个本地文件到镜像目录中的已有文件
+ * 大小相同时比较内容，内容相同只更新时间；FAT 时间精度为 2 秒且可能被 SOURCE_DATE_EPOCH 固定，
+ * 时间相同不能说明内容未变化
+ * @param img - 镜像
+ * @param dir - 镜像目录
+ * @param slot - 已有文件的短文件名表项序号
+ * @param node - 本地文件节点
+ * @param stats - 同步统计
+ * @return
+ */
+static int syncFileItem(FatImg *img, ImgDir *dir, unsigned int slot, FileNode *node, SyncStats *stats) {
+    DirItem item;
+    FILE *fp;
+    ClusterExtent *extents;
+    unsigned int extentNum, oldClusters = 0, needClusters, i;
+    unsigned short createDate = formatCreateDateArray(node->createTimes);
+    unsigned short createTime = formatCreateTimeArray(node->createTimes);
+    unsigned char caseFlags;
+    char shortName[12];
+    int status;
+
+    if (node->size > 0xFFFFFFFFULL) return BAD_FORMAT;
+    memcpy(&item, dir->index->data + (size_t) slot * sizeof(DirItem), sizeof(DirItem));
+    fp = fopen(node->path, "rb");
+    if (fp == NULL) return NO_FIND;
+    status = getChainExtents(img, getItemCluster(img, &item), &extents, &extentNum);
+    if (status != OK) {
+        fclose(fp);
+        return status;
+    }
+    for (i = 0; i < extentNum; i ++) oldClusters += extents[i].count;
+    needClusters = (node->size + img->bytesPerCluster - 1) / img->bytesPerCluster;
+
+    // 内容未变化时只更新时间
+    if (item.size == node->size && oldClusters == needClusters) {
+        status = compareFileExtents(img, fp, extents, extentNum, node->size);
+        if (status == 1) {
+            if (item.createDate != createDate || item.createTime != createTime) {
+                item.createDate = createDate;
+                item.createTime = createTime;
+                setDirItem(dir->index, slot, &item);
+            }
+            stats->unchanged ++;
+            free(extents);
+            fclose(fp);
+            return OK;
+        }
+    }
+
+    // 簇数变化时先确认空间足够，再释放旧簇链并重新分配
+    if (oldClusters != needClusters) {
+        free(extents);
+        if (getFreeClusterNum(&img->fat) + oldClusters < needClusters) {
+            fclose(fp);
+            return INSUFFICIENT_SPACE;
+        }
+        walkClusterChain(img, getItemCluster(img, &item), 1);
+        if (allocClusterExtents(&img->fat, needClusters, img->allocPolicy, &extents, &extentNum) != OK) {
+            fclose(fp);
+            return INSUFFICIENT_SPACE;
+        }
+    }
+
+    // 保留短文件名、属性及大小写标记
+    status = writeFileExtents(img, fp, extents, extentNum, node->size);
+    memcpy(shortName, item.name, 11);
+    caseFlags = item.winNTRes;
+    fillDirItem(&item, shortName, (char) item.attr, node->createTimes,
+                extentNum > 0 ? extents[0].start : 0, (unsigned int) node->size);
+    item.winNTRes = caseFlags;
+    setDirItem(dir->index, slot, &item);
+    stats->updated ++;
+
+    free(extents);
     fclose(fp);
-    fclose(ifp);
+    return status;
+}
 
+
+/**
+ * 将本地文件或目录新增到镜像目录
+ * @param img - 镜像
+ * @param dir - 镜像目录
+ * @param node - 本地文件或目录节点
+ * @param stats - 同步统计
+ * @return
+ */
+static int syncNewItem(FatImg *img, ImgDir *dir, FileNode *node, SyncStats *stats) {
+    DirItem dirItem;
+    FILE *fp = NULL;
+    unsigned long long needClusters;
+    int lfnNum, status;
+
+    // 本地目录中有只是大小写不同的文件名
+    if (findDirItemByName(dir->index, node->name) != NO_FIND) {
+        printf("Duplicate file name: %s\n", node->path);
+        return BAD_FORMAT;
+    }
+
+    if (node->type == TYPE_DIRECTORY) {
+        // 替换同名项时调用方已构造过目录数据
+        status = node->dirData == NULL ? buildDirItems(node) : OK;
+        if (status != OK) return status;
+        needClusters = countTreeClusters(img, node);
+    } else {
+        if (node->size > 0xFFFFFFFFULL) return BAD_FORMAT;
+        needClusters = (node->size + img->bytesPerCluster - 1) / img->bytesPerCluster;
+        fp = fopen(node->path, "rb");
+        if (fp == NULL) return NO_FIND;
+    }
+
+    // 目录表项不足时先扩展目录(可能占用一簇)，再检查剩余空间
+    lfnNum = getLongNameItemNum(node->name);
+    if (reserveImgDirItems(img, dir, (unsigned int) lfnNum + 1) != OK || needClusters > getFreeClusterNum(&img->fat)) {
+        if (fp != NULL) fclose(fp);
+        return INSUFFICIENT_SPACE;
+    }
+
+    lfnNum = makeShortName(dir->index, node->name, node->shortName, &node->caseFlags);
+    if (lfnNum < 0) status = lfnNum;
+    else if (node->type == TYPE_DIRECTORY) status = planTree(img, node);
+    else status = allocClusterExtents(&img->fat, (unsigned int) needClusters, img->allocPolicy, &node->extents, &node->extentNum);
+
+    if (status == OK) {
+        fillDirItem(&dirItem, node->shortName, node->type == TYPE_DIRECTORY ? 0x10 : 0x00, node->createTimes,
+                    node->extentNum > 0 ? node->extents[0].start : 0, node->type == TYPE_DIRECTORY ? 0 : (unsigned int) node->size);
+        dirItem.winNTRes = node->caseFlags;
+        insertDirItem(dir->index, node->name, (unsigned int) lfnNum, &dirItem);
+        if (node->type == TYPE_DIRECTORY) status = writeTree(img, node, dir->sub != NULL ? dir->sub->firstCluster : 0);
+        else status = writeFileExtents(img, fp, node->extents, node->extentNum, node->size);
+        stats->added ++;
+    }
+
+    if (fp != NULL) fclose(fp);
+    return status;
+}
+
+
+/**
+ * 删除镜像目录中的表项(连同长文件名表项)及其占用的簇
+ * @param img - 镜像
+ * @param dir - 镜像目录
+ * @param slot - 短文件名表项序号
+ * @param stats - 同步统计
+ */
+static void syncRemoveItem(FatImg *img, ImgDir *dir, unsigned int slot, SyncStats *stats) {
+    DirItem *item = (DirItem*) (dir->index->data + (size_t) slot * sizeof(DirItem));
+
+    if (item->attr & 0x10) walkDirTree(img, getItemCluster(img, item), 0, 1);
+    else walkClusterChain(img, getItemCluster(img, item), 1);
+    removeDirItem(dir->index, slot);
+    stats->removed ++;
+}
+
+
+/**
+ * 比较镜像中的文件数据与本地文件是否相同
+ * @param img - 镜像
+ * @param fp - 本地文件句柄
+ * @param extents - 文件占用的连续簇区段
+ * @param extentNum - 区段数
+ * @param fileSize - 文件大小
+ * @return 相同返回 1，不同返回 0
+ */
+static int compareFileExtents(FatImg *img, FILE *fp, ClusterExtent *extents, unsigned int extentNum, unsigned long long fileSize) {
+    unsigned char *imgBuf, *fileBuf;
+    unsigned long long done = 0, len, offset;
+    size_t n;
+    unsigned int i;
+    int same = 1;
+
+    imgBuf = (unsigned char*) malloc(SYNC_COMPARE_SIZE);
+    fileBuf = (unsigned char*) malloc(SYNC_COMPARE_SIZE);
+    if (imgBuf == NULL || fileBuf == NULL) same = 0;
+
+    fseek(fp, 0, SEEK_SET);
+    for (i = 0; i < extentNum && done < fileSize && same; i ++) {
+        len = (unsigned long long) extents[i].count * img->bytesPerCluster;
+        if (len > fileSize - done) len = fileSize - done;
+
+        for (offset = 0; offset < len && same; offset += n) {
+            n = len - offset < SYNC_COMPARE_SIZE ? (size_t) (len - offset) : SYNC_COMPARE_SIZE;
+            if (imgWriterRead(&img->io, getClusterPos(img, extents[i].start) + (long long) offset, imgBuf, n) != OK
+                || fread(fileBuf, 1, n, fp) != n || memcmp(imgBuf, fileBuf, n) != 0) same = 0;
+        }
+        done += len;
+    }
+
+    free(imgBuf);
+    free(fileBuf);
+    return same && done == fileSize;
+}
+
+
+/**
+ * 获取簇链的连续簇区段
+ * @param img - 镜像
+ * @param firstCluster - 起始簇号，为 0 表示空文件
+ * @param extents - 返回区段数组，由调用者释放
+ * @param extentNum - 返回区段数
+ * @return
+ */
+static int getChainExtents(FatImg *img, unsigned int firstCluster, ClusterExtent **extents, unsigned int *extentNum) {
+    ClusterExtent *list = NULL, *temp;
+    unsigned int clusterLinkNum = firstCluster, count = 0, capacity = 0, walked = 0;
+    unsigned int endFlag = getEndClusterFlag(img->type) & ~7u;
+
+    // 簇链长度不会超过簇总数，以免损坏的簇链形成死循环
+    while (clusterLinkNum < endFlag && clusterLinkNum >= 2 && clusterLinkNum < img->fat.clusterCount
+           && walked < img->fat.clusterCount) {
+        if (count > 0 && list[count - 1].start + list[count - 1].count == clusterLinkNum) {
+            list[count - 1].count ++;
+        } else {
+            if (count == capacity) {
+                capacity = capacity == 0 ? 4 : capacity * 2;
+                temp = (ClusterExtent*) realloc(list, capacity * sizeof(ClusterExtent));
+                if (temp == NULL) {
+                    free(list);
+                    return ERROR;
+                }
+                list = temp;
+            }
+            list[count].start = clusterLinkNum;
+            list[count].count = 1;
+            count ++;
+        }
+        clusterLinkNum = getNextClusterLinkNum(&img->fat, clusterLinkNum);
+        walked ++;
+    }
+
+    *extents = list;
+    *extentNum = count;
     return OK;
 }
 
 
+/**
+ * 载入子目录簇链并建立索引
+ * 簇链中连续的簇合并为一次读取；载入的子目录缓存在镜像中直到关闭镜像，已载入时直接使用
+ * @param img - 镜像
+ * @param firstCluster - 子目录起始簇号
+ * @param dir - 镜像目录
+ * @return 子目录簇链无效返回 BAD_FORMAT
+ */
+static int loadSubDir(FatImg *img, unsigned int firstCluster, ImgDir *dir) {
+    ClusterExtent *extents;
+    SubDir *sub;
+    unsigned int extentNum, i, j;
+    unsigned char *data;
+    size_t offset = 0;
+    int status;
+
+    memset(dir, 0, sizeof(ImgDir));
+    sub = findSubDir(img, firstCluster);
+    if (sub != NULL) {
+        dir->sub = sub;
+        dir->index = &sub->index;
+        return OK;
+    }
+
+    sub = (SubDir*) calloc(1, sizeof(SubDir));
+    if (sub == NULL) return ERROR;
+    status = getChainExtents(img, firstCluster, &extents, &extentNum);
+    if (status != OK) {
+        free(sub);
+        return status;
+    }
+    for (i = 0; i < extentNum; i ++) sub->clusterNum += extents[i].count;
+
+    data = sub->clusterNum > 0 ? (unsigned char*) malloc((size_t) sub->clusterNum * img->bytesPerCluster) : NULL;
+    sub->clusters = sub->clusterNum > 0 ? (unsigned int*) malloc(sub->clusterNum * sizeof(unsigned int)) : NULL;
+    if (data == NULL || sub->clusters == NULL) {
+        status = sub->clusterNum > 0 ? ERROR : BAD_FORMAT;
+        free(extents);
+        free(data);
+        free(sub->clusters);
+        free(sub);
+        return status;
+    }
+
+    for (i = 0, sub->clusterNum = 0; i < extentNum && status == OK; i ++) {
+        for (j = 0; j < extents[i].count; j ++) sub->clusters[sub->clusterNum ++] = extents[i].start + j;
+        status = imgWriterRead(&img->io, getClusterPos(img, extents[i].start), data + offset,
+                               (size_t) extents[i].count * img->bytesPerCluster);
+        offset += (size_t) extents[i].count * img->bytesPerCluster;
+    }
+    free(extents);
+
+    sub->firstCluster = firstCluster;
+    if (status == OK) status = buildDirIndex(&sub->index, data, sub->clusterNum * img->bytesPerCluster / sizeof(DirItem), img->bytesPerSector);
+    if (status == OK) status = addSubDir(img, sub);
+    if (status != OK) {
+        free(data);
+        freeDirIndex(&sub->index);
+        free(sub->clusters);
+        free(sub);
+        return ERROR;
+    }
+    dir->sub = sub;
+    dir->index = &sub->index;
+    return OK;
+}
+
 
 /**
- * 从软盘镜像中删除文件
- * @param ifp - 软盘镜像文件句柄
- * @param rootDirItemIndex - 根目录表项序号
+ * 结束对镜像目录的使用
+ * 子目录保留在镜像的子目录缓存中，被修改的扇区在关闭镜像时写回
+ * @param img - 镜像
+ * @param dir - 镜像目录
  * @return
  */
-int deleteFileFromImg(FILE *ifp, unsigned short rootDirItemIndex) {
-    // 文件簇链本簇号/下一个FAT文件簇链号
-    unsigned short clusterLinkNum, nextCluster;
-    // 目录表项大小
-    unsigned short dirItemSize = sizeof(DirItem);
-    DirItem tDirItem;
+static int closeSubDir(FatImg *img, ImgDir *dir) {
+    memset(dir, 0, sizeof(ImgDir));
+    return OK;
+}
 
-    // 读出指定的根目录表项
-    fseek(ifp, ROOT_FIRST_SECTOR * BYTES_SECTOR + rootDirItemIndex * dirItemSize, SEEK_SET);
-    fread(&tDirItem, dirItemSize, 1, ifp);
 
-    // 循环清空FAT文件簇链直到文件末尾
-    clusterLinkNum = tDirItem.firstCluster;
-    if (clusterLinkNum != 0) {
-        // 如果文件不是空的（起始簇号不为0）
-        while (clusterLinkNum < 0xff8 && clusterLinkNum >= 2) {
-            // 先获取下一个簇的索引（在清空当前簇之前）
-            nextCluster = getNextClusterLinkNum(ifp, FAT_FIRST_SECTOR * BYTES_SECTOR, clusterLinkNum, FAT12);
-            // 清空当前簇（设置为 0 表示空闲）
-            setNextClusterLinkNum(ifp, FAT_FIRST_SECTOR * BYTES_SECTOR,
-                                  (FAT_FIRST_SECTOR + FAT_SECTOR_NUM) * BYTES_SECTOR,clusterLinkNum, 0, FAT12);
-            // 移动到下一个簇
-            clusterLinkNum = nextCluster;
+/**
+ * 确保镜像目录有足够的连续空闲表项
+ * 根目录通过 growRootDir 扩展(只有FAT32可以扩展)，子目录在簇链末尾追加一簇
+ * @param img - 镜像
+ * @param dir - 镜像目录
+ * @param count - 所需表项数(长文件名表项数 + 1)
+ * @return
+ */
+static int reserveImgDirItems(FatImg *img, ImgDir *dir, unsigned int count) {
+    ClusterExtent *extents;
+    SubDir *sub = dir->sub;
+    unsigned int extentNum, *clusters;
+    unsigned char *data;
+
+    while (findFreeDirRun(dir->index, count) == NO_FIND) {
+        if (sub == NULL) {
+            if (growRootDir(img) != OK) return INSUFFICIENT_SPACE;
+            continue;
         }
+
+        data = (unsigned char*) realloc(sub->index.data, (size_t) (sub->clusterNum + 1) * img->bytesPerCluster);
+        if (data == NULL) return ERROR;
+        sub->index.data = data;
+        clusters = (unsigned int*) realloc(sub->clusters, (sub->clusterNum + 1) * sizeof(unsigned int));
+        if (clusters == NULL) return ERROR;
+        sub->clusters = clusters;
+
+        if (allocClusterExtents(&img->fat, 1, img->allocPolicy, &extents, &extentNum) != OK) return INSUFFICIENT_SPACE;
+        setNextClusterLinkNum(&img->fat, sub->clusters[sub->clusterNum - 1], extents[0].start);
+        sub->clusters[sub->clusterNum ++] = extents[0].start;
+        free(extents);
+
+        // 新簇的目录项全部置 0，关闭镜像时随脏扇区一起写回
+        memset(data + (size_t) (sub->clusterNum - 1) * img->bytesPerCluster, 0, img->bytesPerCluster);
+        if (growDirIndex(&sub->index, data, sub->clusterNum * img->bytesPerCluster / sizeof(DirItem)) != OK) return ERROR;
     }
+    return OK;
+}
 
-    // 设置根目录区表项标记为已删除
-    fseek(ifp, ROOT_FIRST_SECTOR * BYTES_SECTOR + rootDirItemIndex * dirItemSize, SEEK_SET);
-    fputc(0xe5, ifp);
 
+/**
+ * 按镜像内路径查找文件或目录
+ * 路径各级以 '/' 或 '\\' 分隔，逐级通过目录索引按文件名(不区分大小写)查找，中间各级目录按需载入
+ * @param img - 镜像
+ * @param path - 镜像内路径
+ * @param dir - 返回最后一级文件或目录所在的目录，由调用者通过 closeSubDir 释放
+ * @param slot - 返回短文件名表项序号，路径为根目录时返回 -1
+ * @return 路径不存在返回 NO_FIND
+ */
+static int resolveImgPath(FatImg *img, const char *path, ImgDir *dir, int *slot) {
+    ImgDir subDir;
+    DirItem *item;
+    char *buf, *name, *end;
+    int status = OK;
+
+    memset(dir, 0, sizeof(ImgDir));
+    dir->index = &img->rootIndex;
+    *slot = -1;
+
+    buf = (char*) malloc(strlen(path) + 1);
+    if (buf == NULL) return ERROR;
+    strcpy(buf, path);
+
+    for (name = buf; *name && status == OK; name = end) {
+        for (end = name; *end && *end != '/' && *end != '\\'; end ++);
+        if (*end) *end ++ = '\0';
+        if (*name == '\0') continue;
+
+        // 上一级必须是目录
+        if (*slot >= 0) {
+            item = (DirItem*) (dir->index->data + (size_t) *slot * sizeof(DirItem));
+            if (!(item->attr & 0x10)) {
+                status = NO_FIND;
+                break;
+            }
+            status = loadSubDir(img, getItemCluster(img, item), &subDir);
+            if (status != OK) break;
+            closeSubDir(img, dir);
+            *dir = subDir;
+        }
+
+        *slot = findDirItemByName(dir->index, name);
+        if (*slot < 0) status = NO_FIND;
+    }
+
+    free(buf);
+    return status;
+}
+
+
+/**
+ * 载入镜像内路径对应的目录
+ * @param img - 镜像
+ * @param path - 镜像内目录路径，NULL 或 "/" 表示根目录
+ * @param dir - 返回镜像目录，由调用者通过 closeSubDir 释放
+ * @return 路径不存在返回 NO_FIND，路径不是目录返回 BAD_FORMAT
+ */
+static int openImgDir(FatImg *img, const char *path, ImgDir *dir) {
+    ImgDir subDir;
+    DirItem *item;
+    int slot, status;
+
+    status = resolveImgPath(img, path != NULL ? path : "", dir, &slot);
+    if (status == OK && slot >= 0) {
+        item = (DirItem*) (dir->index->data + (size_t) slot * sizeof(DirItem));
+        status = (item->attr & 0x10) ? loadSubDir(img, getItemCluster(img, item), &subDir) : BAD_FORMAT;
+        if (status == OK) {
+            if (closeSubDir(img, dir) != OK) status = ERROR;
+            *dir = subDir;
+        }
+    }
+    if (status != OK) closeSubDir(img, dir);
+    return status;
+}
+
+
+/**
+ * 写入引导扇区
+ * FAT32 的备份引导扇区(BPB 50 字节记录的扇区号)同时写入
+ * @param img - 镜像
+ * @param sector - 引导扇区内容
+ * @return
+ */
+static int writeImgBootSector(FatImg *img, const unsigned char *sector) {
+    unsigned int backup = img->type == FAT32 ? (unsigned int) (sector[50] | (sector[51] << 8)) : 0;
+
+    if (imgWriterWrite(&img->io, 0, sector, BYTES_SECTOR) != OK) return ERROR;
+    if (backup > 0 && backup != 0xFFFF
+        && imgWriterWrite(&img->io, (long long) backup * img->bytesPerSector, sector, BYTES_SECTOR) != OK) return ERROR;
     return OK;
 }
 
 
 /**
- * 在软盘镜像文件中寻找是否存在文件
- * @param imgPath - 软盘镜像
- * @param fileName - 要查找的文件名
- * @return 文件的FAT表项序号
+ * 将镜像中的文件数据按连续簇区段写出到目标文件
+ * 簇链先合并为连续簇区段，每个区段由 imgWriterCopyTo 一次拷贝，不逐簇读取
+ * @param img - 镜像
+ * @param item - 文件目录表项
+ * @param destFd - 目标文件描述符，从其当前位置写入
+ * @return 簇链长度与文件大小不符返回 BAD_FORMAT
+ */
+static int extractFileItem(FatImg *img, DirItem *item, int destFd) {
+    ClusterExtent *extents;
+    unsigned int extentNum, i;
+    unsigned long long done = 0, len, total = 0;
+    int status;
+
+    status = getChainExtents(img, getItemCluster(img, item), &extents, &extentNum);
+    if (status != OK) return status;
+    for (i = 0; i < extentNum; i ++) total += (unsigned long long) extents[i].count * img->bytesPerCluster;
+    if (total < item->size) {
+        free(extents);
+        return BAD_FORMAT;
+    }
+
+    for (i = 0; i < extentNum && done < item->size && status == OK; i ++) {
+        len = (unsigned long long) extents[i].count * img->bytesPerCluster;
+        if (len > item->size - done) len = item->size - done;
+        status = imgWriterCopyTo(&img->io, getClusterPos(img, extents[i].start), destFd, (long long) len);
+        done += len;
+    }
+    free(extents);
+    return status;
+}
+
+
+/**
+ * 将镜像中的文件提取为本地文件
+ * @param img - 镜像
+ * @param item - 文件目录表项
+ * @param destPath - 本地文件路径，已存在时覆盖
+ * @return
  */
-int findFileInRootDir(FILE *ifp, char *fileName) {
-
-    // 目录表项
-    DirItem tDirItem;
-    // 格式化后的文件名
-    char newFileName[12];
-    // 从根目录区查询出的文件名
-    char desItemName[12] = {0};
-    // 根目录区大小
-    unsigned short rootDirSize;
-    // 目录表项大小
-    unsigned short dirItemSize = sizeof(DirItem);
-    unsigned short i;
-
-    // 格式化文件名为 8 + 3 + 0 格式
-    formatFileName(fileName, newFileName);
-    newFileName[11] = '\0';
-
-    // 计算根目录区的大小
-    rootDirSize = (DATA_FIRST_SECTOR - ROOT_FIRST_SECTOR) * BYTES_SECTOR;
-    for(i = 0; i < rootDirSize / dirItemSize; i ++) {
-        // 读取一个根目录表项
-        fseek(ifp, ROOT_FIRST_SECTOR * BYTES_SECTOR + dirItemSize * i, SEEK_SET);
-        fread(&tDirItem, dirItemSize, 1, ifp);
-
-        // 如果首字节为 0, 说明从此往后全是空的，直接结束搜索
-        if (tDirItem.name[0] == 0x00) {
+static int extractFileTo(FatImg *img, DirItem *item, const char *destPath) {
+    FILE *fp = fopen(destPath, "wb");
+    int status;
+
+    if (fp == NULL) {
+        printf("Create %s fail.\n", destPath);
+        return ERROR;
+    }
+    status = extractFileItem(img, item, fileno(fp));
+    if (fclose(fp) != 0 && status == OK) status = ERROR;
+    return status;
+}
+
+
+/**
+ * 将镜像目录(递归)提取到本地目录
+ * 文件名使用长文件名，没有长文件名时按大小写标记还原短文件名
+ * @param img - 镜像
+ * @param dir - 镜像目录
+ * @param destPath - 本地目录路径，不存在时创建
+ * @param depth - 当前目录深度
+ * @return
+ */
+static int extractDirItems(FatImg *img, ImgDir *dir, const char *destPath, unsigned int depth) {
+    ImgDir subDir;
+    DirItem *item;
+    char name[DIR_NAME_SIZE], *childPath;
+    unsigned int i;
+    int status = OK;
+
+    if (depth > EXTRACT_MAX_DEPTH) return BAD_FORMAT;
+#if defined(_WIN32) || defined(_WIN64)
+    _mkdir(destPath);
+#else
+    mkdir(destPath, 0755);
+#endif
+    if (getFileType(destPath) != TYPE_DIRECTORY) {
+        printf("Create %s fail.\n", destPath);
+        return ERROR;
+    }
+
+    for (i = 0; i < dir->index->itemNum && status == OK; i ++) {
+        item = (DirItem*) (dir->index->data + (size_t) i * sizeof(DirItem));
+        if (item->name[0] == 0x00) break;
+        // 跳过已删除项、'.'、'..'、长文件名项及卷标
+        if (item->name[0] == 0xe5 || item->name[0] == '.' || (item->attr & 0x08)) continue;
+
+        // 文件名不能含路径分隔符，避免写到目标目录之外
+        getDirItemName(dir->index, i, name);
+        if (name[0] == '\0' || strchr(name, '/') != NULL || strchr(name, '\\') != NULL
+            || !strcmp(name, ".") || !strcmp(name, "..")) {
+            printf("Bad file name: %s\n", name);
+            continue;
+        }
+        childPath = (char*) malloc(strlen(destPath) + strlen(name) + 2);
+        if (childPath == NULL) return ERROR;
+        sprintf(childPath, "%s%c%s", destPath, SEPARATOR, name);
+
+        if (item->attr & 0x10) {
+            status = loadSubDir(img, getItemCluster(img, item), &subDir);
+            if (status == OK) {
+                status = extractDirItems(img, &subDir, childPath, depth + 1);
+                closeSubDir(img, &subDir);
+            }
+        } else {
+            status = extractFileTo(img, item, childPath);
+        }
+        if (status != OK) printf("Extract %s fail.\n", childPath);
+        free(childPath);
+    }
+    return status;
+}
+
+
+/**
+ * 获取目录表项的起始簇号
+ * FAT32 起始簇号由高 16 位与低 16 位组成，FAT12/FAT16 只使用低 16 位
+ * @param img - 镜像
+ * @param item - 目录表项
+ * @return
+ */
+static unsigned int getItemCluster(FatImg *img, DirItem *item) {
+    if (img->type == FAT32) return ((unsigned int) item->firstClusterHi << 16) | item->firstCluster;
+    return item->firstCluster;
+}
+
+
+/**
+ * 填充目录表项
+ * @param item - 目录表项
+ * @param shortName - 8 + 3 格式的短文件名
+ * @param attr - 文件属性
+ * @param createTimes - 文件创建时间
+ * @param firstCluster - 起始簇号
+ * @param size - 文件大小，目录为 0
+ */
+static void fillDirItem(DirItem *item, const char *shortName, char attr, int *createTimes, unsigned int firstCluster, unsigned int size) {
+    memcpy(item->name, shortName, 11);
+    item->attr = attr;
+    item->winNTRes = 0;
+    item->createTimeMs = 0;
+    item->createTime = formatCreateTimeArray(createTimes);
+    item->createDate = formatCreateDateArray(createTimes);
+    item->lastAccessDate = 0;
+    // FAT12/FAT16 的簇号不超过 16 位，高 16 位始终为 0
+    item->firstClusterHi = (unsigned short) (firstCluster >> 16);
+    item->writeTime = formatTime();
+    item->writeDate = formatDate();
+    item->firstCluster = (unsigned short) firstCluster;
+    item->size = size;
+}
+
+
+/**
+ * 确保根目录区有足够的连续空闲表项
+ * 同名的旧表项所占表项足够时删除后直接复用，FAT32根目录不足时追加簇
+ * @param img - 镜像
+ * @param count - 所需表项数(长文件名表项数 + 1)
+ * @param oldIndex - 同名旧表项序号，没有为 NO_FIND
+ * @return
+ */
+static int reserveRootDirItems(FatImg *img, unsigned int count, int oldIndex) {
+    while (findFreeDirRun(&img->rootIndex, count) == NO_FIND) {
+        if (oldIndex != NO_FIND && getDirItemSpan(&img->rootIndex, (unsigned int) oldIndex) >= count) return OK;
+        if (growRootDir(img) != OK) return INSUFFICIENT_SPACE;
+    }
+    return OK;
+}
+
+
+/**
+ * 为目录下的各子项(递归)生成短文件名，并在内存中构造目录数据
+ * 目录数据依次为 '.'、'..' 及各子项的长文件名表项和短文件名表项，
+ * 短文件名表项只写入文件名，其余字段在写入镜像时填充。
+ * 同一目录下的文件名(不区分大小写)及 ~N 别名均通过目录索引查重，不逐项比较
+ * @param dir - 目录节点
+ * @return 同一目录下存在相同文件名或文件名不合法返回 BAD_FORMAT
+ */
+static int buildDirItems(FileNode *dir) {
+    DirIndex index;
+    DirItem item;
+    FileNode *child;
+    unsigned int i, itemNum = 2;
+    int status = OK, lfnNum;
+
+    for (i = 0; i < dir->childNum; i ++) {
+        lfnNum = getLongNameItemNum(dir->children[i].name);
+        if (lfnNum < 0) {
+            printf("Bad file name: %s\n", dir->children[i].path);
+            return BAD_FORMAT;
+        }
+        itemNum += lfnNum + 1;
+    }
+
+    dir->dirData = (unsigned char*) calloc(itemNum, sizeof(DirItem));
+    if (dir->dirData == NULL) return ERROR;
+    dir->dirItemNum = itemNum;
+    if (buildDirIndex(&index, dir->dirData, itemNum, BYTES_SECTOR) != OK) return ERROR;
+
+    memset(&item, 0, sizeof(DirItem));
+    item.attr = 0x10;
+    memcpy(item.name, ".          ", 11);
+    setDirItem(&index, 0, &item);
+    memcpy(item.name, "..         ", 11);
+    setDirItem(&index, 1, &item);
+
+    for (i = 0; i < dir->childNum && status == OK; i ++) {
+        child = &dir->children[i];
+        if (findDirItemByName(&index, child->name) != NO_FIND) {
+            printf("Duplicate file name: %s\n", child->path);
+            status = BAD_FORMAT;
             break;
         }
-        // 如果首字节为 0xE5, 说明该文件被删除了，跳过比对，看下一个
-        if ((unsigned char)tDirItem.name[0] == 0xE5) {
-            continue;
+        lfnNum = makeShortName(&index, child->name, child->shortName, &child->caseFlags);
+        if (lfnNum < 0) {
+            status = lfnNum;
+            break;
         }
-        // 检查是否是“卷标”，如果是找文件，通常也需要跳过
-        if (tDirItem.attr == 0x08) {
-            continue;
+        memcpy(item.name, child->shortName, 11);
+        item.attr = child->type == TYPE_DIRECTORY ? 0x10 : 0x00;
+        child->dirSlot = (unsigned int) insertDirItem(&index, child->name, (unsigned int) lfnNum, &item);
+
+        if (child->type == TYPE_DIRECTORY) status = buildDirItems(child);
+    }
+
+    freeDirIndex(&index);
+    return status;
+}
+
+
+/**
+ * 目录数据所需簇数
+ * 目录数据包含 '.'、'..' 两个表项及各子项的长文件名表项和短文件名表项，至少占用一簇
+ * @param img - 镜像
+ * @param itemNum - 目录表项数
+ * @return
+ */
+static unsigned int getDirClusters(FatImg *img, unsigned int itemNum) {
+    return (itemNum * sizeof(DirItem) + img->bytesPerCluster - 1) / img->bytesPerCluster;
+}
+
+
+/**
+ * 文件树所需簇数
+ * @param img - 镜像
+ * @param node - 文件树节点
+ * @return
+ */
+static unsigned long long countTreeClusters(FatImg *img, FileNode *node) {
+    unsigned long long clusters;
+    unsigned int i;
+
+    if (node->type != TYPE_DIRECTORY) return (node->size + img->bytesPerCluster - 1) / img->bytesPerCluster;
+
+    clusters = getDirClusters(img, node->dirItemNum);
+    for (i = 0; i < node->childNum; i ++) {
+        clusters += countTreeClusters(img, &node->children[i]);
+    }
+    return clusters;
+}
+
+
+/**
+ * 为文件树分配簇
+ * 先分配目录自身的簇，再依次分配目录下各文件的簇，最后递归分配各子目录，
+ * 使目录数据与其文件数据在镜像中尽量相邻
+ * @param img - 镜像
+ * @param node - 目录节点
+ * @return
+ */
+static int planTree(FatImg *img, FileNode *node) {
+    FileNode *child;
+    unsigned int i;
+    int status;
+
+    status = allocClusterExtents(&img->fat, getDirClusters(img, node->dirItemNum), img->allocPolicy,
+                                 &node->extents, &node->extentNum);
+    if (status != OK) return status;
+
+    for (i = 0; i < node->childNum; i ++) {
+        child = &node->children[i];
+        if (child->type == TYPE_DIRECTORY) continue;
+        if (child->size > 0xFFFFFFFFULL) return BAD_FORMAT;
+        status = allocClusterExtents(&img->fat, (child->size + img->bytesPerCluster - 1) / img->bytesPerCluster,
+                                     img->allocPolicy, &child->extents, &child->extentNum);
+        if (status != OK) return status;
+    }
+
+    for (i = 0; i < node->childNum; i ++) {
+        if (node->children[i].type != TYPE_DIRECTORY) continue;
+        status = planTree(img, &node->children[i]);
+        if (status != OK) return status;
+    }
+    return OK;
+}
+
+
+/**
+ * 按规划顺序将文件树写入镜像
+ * @param img - 镜像
+ * @param node - 目录节点
+ * @param parentCluster - 上级目录起始簇号，根目录为 0
+ * @return
+ */
+static int writeTree(FatImg *img, FileNode *node, unsigned int parentCluster) {
+    FileNode *child;
+    DirItem *items;
+    FILE *fp;
+    unsigned char *data;
+    unsigned int i, offset = 0;
+    int status = OK;
+
+    // 在预先构造的目录数据(含长文件名表项)中填充各短文件名表项
+    data = (unsigned char*) calloc(getDirClusters(img, node->dirItemNum), img->bytesPerCluster);
+    if (data == NULL) return ERROR;
+    memcpy(data, node->dirData, (size_t) node->dirItemNum * sizeof(DirItem));
+    items = (DirItem*) data;
+    fillDirItem(&items[0], ".          ", 0x10, node->createTimes, node->extents[0].start, 0);
+    fillDirItem(&items[1], "..         ", 0x10, node->createTimes, parentCluster, 0);
+    for (i = 0; i < node->childNum; i ++) {
+        child = &node->children[i];
+        fillDirItem(&items[child->dirSlot], child->shortName, child->type == TYPE_DIRECTORY ? 0x10 : 0x00, child->createTimes,
+                    child->extentNum > 0 ? child->extents[0].start : 0, child->type == TYPE_DIRECTORY ? 0 : child->size);
+        items[child->dirSlot].winNTRes = child->caseFlags;
+    }
+
+    // 目录数据按区段写入
+    for (i = 0; i < node->extentNum && status == OK; i ++) {
+        status = imgWriterWrite(&img->io, getClusterPos(img, node->extents[i].start), data + offset,
+                                (size_t) node->extents[i].count * img->bytesPerCluster);
+        offset += node->extents[i].count * img->bytesPerCluster;
+    }
+    free(data);
+
+    // 写入目录下的文件
+    for (i = 0; i < node->childNum && status == OK; i ++) {
+        child = &node->children[i];
+        if (child->type == TYPE_DIRECTORY) continue;
+        fp = fopen(child->path, "rb");
+        if (fp == NULL) {
+            printf("Copy %s fail.\n", child->path);
+            return NO_FIND;
         }
+        status = writeFileExtents(img, fp, child->extents, child->extentNum, child->size);
+        fclose(fp);
+    }
 
-        // 获取根目录表项文件名(FAT根目录表项文件名没有'\0'结束符)
-        strncpy(desItemName, (char*)tDirItem.name, 11);
-        desItemName[11] = '\0';
+    // 写入子目录
+    for (i = 0; i < node->childNum && status == OK; i ++) {
+        if (node->children[i].type == TYPE_DIRECTORY) status = writeTree(img, &node->children[i], node->extents[0].start);
+    }
+    return status;
+}
+
+
+/**
+ * 从软盘镜像中删除文件或目录
+ * 删除目录时其全部子项占用的簇一并释放
+ * @param img - 软盘镜像
+ * @param rootDirItemIndex - 根目录表项序号
+ * @return
+ */
+int deleteFileFromImg(FatImg *img, unsigned int rootDirItemIndex) {
+    // 指定的根目录表项
+    DirItem *item = getRootDirItem(img, rootDirItemIndex);
 
-        // 判断要查找的文件是否存在
-        if(!strcmp(desItemName, newFileName)) return i;
+    // 循环清空FAT文件簇链直到文件末尾
+    if (item->attr & 0x10) walkDirTree(img, getItemCluster(img, item), 0, 1);
+    else walkClusterChain(img, getItemCluster(img, item), 1);
+
+    // 设置根目录区表项标记为已删除
+    removeDirItem(&img->rootIndex, rootDirItemIndex);
+
+    return OK;
+}
+
+
+/**
+ * 统计或释放簇链
+ * @param img - 软盘镜像
+ * @param firstCluster - 起始簇号，为 0 表示空文件
+ * @param release - 是否释放簇链
+ * @return 簇链长度
+ */
+static unsigned int walkClusterChain(FatImg *img, unsigned int firstCluster, char release) {
+    // 文件簇链本簇号/下一个FAT文件簇链号
+    unsigned int clusterLinkNum = firstCluster, nextCluster, count = 0;
+    unsigned int endFlag = getEndClusterFlag(img->type) & ~7u;
+
+    // 簇链长度不会超过簇总数，以免损坏的簇链形成死循环
+    while (clusterLinkNum < endFlag && clusterLinkNum >= 2 && clusterLinkNum < img->fat.clusterCount
+           && count < img->fat.clusterCount) {
+        // 先获取下一个簇的索引（在清空当前簇之前）
+        nextCluster = getNextClusterLinkNum(&img->fat, clusterLinkNum);
+        // 清空当前簇（设置为 0 表示空闲）
+        if (release) setNextClusterLinkNum(&img->fat, clusterLinkNum, 0);
+        // 移动到下一个簇
+        clusterLinkNum = nextCluster;
+        count ++;
     }
+    return count;
+}
+
 
-    return NO_FIND;
+/**
+ * 统计或释放目录及其全部子项占用的簇
+ * 超过最大深度(损坏的镜像中目录形成环)的子目录不再处理
+ * @param img - 软盘镜像
+ * @param firstCluster - 目录起始簇号
+ * @param depth - 目录深度
+ * @param release - 是否释放
+ * @return 目录及其全部子项占用的簇数
+ */
+static unsigned int walkDirTree(FatImg *img, unsigned int firstCluster, unsigned int depth, char release) {
+    unsigned int clusterLinkNum = firstCluster, count = 0, walked = 0, itemNum = img->bytesPerCluster / sizeof(DirItem);
+    unsigned int endFlag = getEndClusterFlag(img->type) & ~7u;
+    DirItem *items;
+    SubDir *sub;
+    int ended = 0;
+
+    if (depth > EXTRACT_MAX_DEPTH) return 0;
+
+    // 已载入的子目录可能含有尚未写回的修改，按缓存中的目录数据处理；释放后不再写回
+    sub = findSubDir(img, firstCluster);
+    if (sub != NULL) {
+        if (release) dropSubDir(img, firstCluster);
+        count = walkDirItems(img, (DirItem*) sub->index.data, sub->index.itemNum, depth, release, &ended);
+        return count + walkClusterChain(img, firstCluster, release);
+    }
+
+    // 无法读取子项时仍处理目录自身的簇链
+    items = (DirItem*) malloc(img->bytesPerCluster);
+    if (items == NULL) return walkClusterChain(img, firstCluster, release);
+
+    // 逐簇读取目录数据，先处理子项再处理目录自身的簇链
+    while (clusterLinkNum < endFlag && clusterLinkNum >= 2 && clusterLinkNum < img->fat.clusterCount
+           && walked < img->fat.clusterCount && !ended) {
+        if (imgWriterRead(&img->io, getClusterPos(img, clusterLinkNum), items, img->bytesPerCluster) != OK) break;
+        count += walkDirItems(img, items, itemNum, depth, release, &ended);
+        clusterLinkNum = getNextClusterLinkNum(&img->fat, clusterLinkNum);
+        walked ++;
+    }
+    free(items);
+
+    return count + walkClusterChain(img, firstCluster, release);
+}
+
+
+/**
+ * 统计或释放一段目录表项中各子项占用的簇
+ * @param img - 软盘镜像
+ * @param items - 目录表项
+ * @param itemNum - 表项数
+ * @param depth - 目录深度
+ * @param release - 是否释放
+ * @param ended - 遇到目录结束标记时置 1
+ * @return 各子项占用的簇数
+ */
+static unsigned int walkDirItems(FatImg *img, DirItem *items, unsigned int itemNum, unsigned int depth, char release, int *ended) {
+    unsigned int i, count = 0;
+
+    for (i = 0; i < itemNum; i ++) {
+        if (items[i].name[0] == 0x00) {
+            *ended = 1;
+            break;
+        }
+        // 跳过已删除项、'.'、'..'、长文件名项及卷标
+        if (items[i].name[0] == 0xe5 || items[i].name[0] == '.' || (items[i].attr & 0x08)) continue;
+        if (items[i].attr & 0x10) count += walkDirTree(img, getItemCluster(img, &items[i]), depth + 1, release);
+        else count += walkClusterChain(img, getItemCluster(img, &items[i]), release);
+    }
+    return count;
+}
+
+
+/**
+ * 在软盘镜像文件中寻找是否存在文件
+ * 通过根目录索引按长文件名(不区分大小写)或短文件名查找
+ * @param img - 软盘镜像
+ * @param fileName - 要查找的文件名
+ * @return 文件的FAT表项序号
+ */
+int findFileInRootDir(FatImg *img, char *fileName) {
+    return findDirItemByName(&img->rootIndex, fileName);
 }
 
 
 /**
  * 查找根目录区中的空值表项
- * @param ifp - 软盘镜像文件句柄
+ * 文件名的第 1 字节是0xe5表示此文件已被删除，如果文件名第 1 字节是0表示此目录项可用
+ * @param img - 软盘镜像
  * @return 第一个空值表项序号
  */
-int findEmptyRootDirItem(FILE *ifp) {
-    DirItem dirItem;
-    unsigned short i;
-    unsigned char temp;
-    // 根目录表项数量
-    unsigned short rootDirSize;
-    // 根目录表项大小
-    unsigned short dirItemSize = sizeof(DirItem);
+int findEmptyRootDirItem(FatImg *img) {
+    return findFreeDirItem(&img->rootIndex);
+}
 
-    rootDirSize = (DATA_FIRST_SECTOR - ROOT_FIRST_SECTOR) * BYTES_SECTOR / dirItemSize;
-    for(i = 0; i < rootDirSize; i++) {
-        // 读取第 i + 1 个表项
-        fseek(ifp, ROOT_FIRST_SECTOR * BYTES_SECTOR + dirItemSize * i, SEEK_SET);
-        fread(&dirItem, dirItemSize, 1, ifp);
 
-        // 文件名的第 1 字节是0xe5表示此文件已被删除，如果文件名第 1 字节是0表示此目录项可用
-        temp = dirItem.name[0];
-        if((temp == 0) || (temp == 0xe5)) return i;
-    }
-
-    return NO_FIND;
+/**
+ * 获取根目录表项
+ * 根目录区在打开镜像时已整体载入内存(映射模式下直接位于映射内存中)
+ * @param img - 软盘镜像
+ * @param index - 根目录表项序号
+ * @return 表项指针
+ */
+static DirItem* getRootDirItem(FatImg *img, unsigned int index) {
+    return (DirItem*) (img->rootDir + (size_t)index * sizeof(DirItem));
 }
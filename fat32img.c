@@ -1,7 +1,14 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "include/fatimg.h"
 
+/** FAT32 最多的数据簇数(簇号 2 ~ 0x0FFFFFF6) */
+#define FAT32_MAX_CLUSTERS 0x0FFFFFF5
+/** BPB中 32 位总扇区数的上限 */
+#define FAT32_MAX_SECTORS 0xFFFFFFFFULL
+
 
 /** FAT32 引导扇区结构 */
 typedef struct {
@@ -72,7 +79,7 @@ typedef struct {
 typedef struct {
 
     // 文件名
-    unsigned char name[11];
+    unsigned char name[8];
     //  扩展名
     unsigned char extName[3];
     // 文件属性
@@ -100,29 +107,6 @@ typedef struct {
 
 } __attribute__((packed)) ShortDirItem;
 
-
-/** 长文件名目录项结构 */
-typedef struct {
-
-    // 文件属性
-    unsigned char attr;
-    // 长文件名1
-    unsigned char name1[10];
-    // 长文件名目录项标志
-    unsigned char longNameDirItemFlag;
-    // 保留项
-    unsigned char reserved;
-    // 校验值
-    unsigned char checksum;
-    // 长文件名2
-    unsigned char name2[12];
-    // 文件起始簇号 (目前长置0)
-    unsigned short firstCluster;
-    // 长文件名3
-    unsigned char name3[4];
-
-} __attribute__((packed)) LongDirItem;
-
 /**
  * 此结构体用于返回 镜像BPM信息计算结果
  */
@@ -143,6 +127,46 @@ typedef struct {
 
 /** 根据镜像大小计算最佳的每簇扇区数和FAT所占扇区数 */
 CalResult getFAT32SectorsPerCluster(float size, int cluster);
+/** 以稀疏方式写出FAT32镜像 */
+static int writeSparseFat32img(char *imgPath, BootSector *bootSector);
+
+
+/**
+ * 拷贝多个文件到FAT32镜像
+ * 根目录为从 rootFirstClusterNum 开始的簇链，目录项空间不足时自动追加一簇；
+ * 目录项起始簇号分别写入 clusterNumH16 / clusterNumL16
+ * @param imgPath - 镜像文件
+ * @param filePaths - 要拷贝的文件或目录列表，目录连同其全部子项一起拷贝
+ * @param fileNum - 文件数
+ * @param fileAttr - 要拷贝的文件属性
+ * @param allocPolicy - 簇分配策略 ALLOC_FIRST_FIT / ALLOC_NEXT_FIT / ALLOC_BEST_FIT
+ * @param openMode - 镜像打开方式，IMG_OPEN_MMAP 以内存映射方式修改镜像
+ * @return
+ */
+int copyFilesToFat32img(char *imgPath, char **filePaths, unsigned int fileNum, char fileAttr, int allocPolicy, int openMode) {
+    FatImg img;
+    unsigned int i;
+    int status;
+
+    // 打开镜像文件并载入FAT表及根目录簇链
+    status = openFatImg(&img, imgPath, openMode);
+    if (status != OK) return status;
+    if (img.type != FAT32) {
+        closeFatImg(&img);
+        return BAD_FORMAT;
+    }
+    img.allocPolicy = allocPolicy;
+
+    for (i = 0; i < fileNum && status == OK; i ++) {
+        if (getFileType(filePaths[i]) == TYPE_DIRECTORY) status = addDirToImg(&img, filePaths[i]);
+        else status = addFileToImg(&img, filePaths[i], fileAttr);
+        if (status != OK) printf("Copy %s fail.\n", filePaths[i]);
+    }
+
+    // 写回FAT表、根目录簇链并关闭镜像
+    if (closeFatImg(&img) != OK && status == OK) status = ERROR;
+    return status;
+}
 
 
 /**
@@ -154,18 +178,9 @@ CalResult getFAT32SectorsPerCluster(float size, int cluster);
  */
 int createCustomBootFat32img(char *imgPath, char *bootPath, float size, int cluster) {
 
-    FILE *fp, *bf;
-    unsigned long int i;
-    // FSINFO 扩展引导标志
-    unsigned int extBootFlag = 0x41615252;
-    // FSINFO 签名
-    unsigned int FSINFOFlag = 0x61417272;
-    // FSINFO 下一可用簇号
-    unsigned int nextEmptyClusNo = 2;
+    FILE *bf;
     // FAT32镜像BPM信息
     CalResult result;
-    // FAT表保留项及设置一簇(2号簇)的根目录
-    unsigned int fat32Flag[3] = {0x0FFFFFF0, 0x0FFFFFFF, 0x0FFFFFF8};
     // fat32软盘镜像引导扇区信息(512字节)
     BootSector bootSector;
 
@@ -183,74 +198,7 @@ int createCustomBootFat32img(char *imgPath, char *bootPath, float size, int clus
     result = getFAT32SectorsPerCluster((float)bootSector.totalSectors32 * 512 / 1024 / 1024, bootSector.sectorsPerCluster);
     if (result.status == BAD_FORMAT) return BAD_FORMAT;
 
-    // 新建镜像文件
-    // wb, 文件存在会覆盖数据
-    fp = fopen(imgPath, "wb");
-    if(fp == NULL) return ERROR;
-
-    // 将引导扇区信息写入软盘镜像
-    fwrite(&bootSector, bootSector.bytesPerSector, 1, fp);
-
-    // 写入文件系统信息扇区(FSINFO)
-    // 写入扩展引导标志
-    fwrite(&extBootFlag, 4, 1, fp);
-    // 写入保留位
-    for(i = 0; i < 480; i ++) {
-        fputc(0, fp);
-    }
-
-    // 写入FSINFO签名
-    fwrite(&FSINFOFlag, 4, 1, fp);
-    // 写入文件系统空簇数
-    fwrite(&result.dataClusters, 4, 1, fp);
-    // 写入下一可用簇号
-    fwrite(&nextEmptyClusNo, 4, 1, fp);
-    // 写入保留位
-    for(i = 0; i < 14; i ++) {
-        fputc(0, fp);
-    }
-    // 写入扇区结束标记
-    fwrite(&bootSector.bootEndFlag, 2, 1, fp);
-
-    // 用0填充n个扇区直到引导备份扇区
-    // 用0填充4扇区
-    for(i = bootSector.bytesPerSector * 2; i < bootSector.backBootSectorNum * bootSector.bytesPerSector; i ++) {
-        fputc(0, fp);
-    }
-
-    // 写入引导扇区备份
-    fwrite(&bootSector, bootSector.bytesPerSector, 1, fp);
-
-    // 用0填充n个扇区直到保留扇区结束
-    for(i = bootSector.bytesPerSector * (2 + bootSector.backBootSectorNum);
-        i < bootSector.reservedSectors * bootSector.bytesPerSector; i ++) {
-        fputc(0, fp);
-    }
-
-    // 写 FAT1 表信息
-    fwrite(fat32Flag, sizeof(fat32Flag), 1, fp);
-    for(i = sizeof(fat32Flag); i < bootSector.sectorsPerFAT32 * bootSector.bytesPerSector; i ++) {
-        fputc(0, fp);
-    }
-
-    // 写 FAT2 表信息
-    // FAT2表紧随FAT1表
-    fwrite(fat32Flag, sizeof(fat32Flag), 1, fp);
-    for(i = sizeof(fat32Flag); i < bootSector.sectorsPerFAT32 * bootSector.bytesPerSector; i ++) {
-        fputc(0, fp);
-    }
-
-    // 用0填充FAT32数据区及残留空间
-    // 数据区及残留空间扇区 = 总扇区 - FAT表扇区数 * 2 - 保留扇区数
-    for(i = 0; i < (bootSector.totalSectors32 - bootSector.sectorsPerFAT32 * 2
-                    - bootSector.reservedSectors) * bootSector.bytesPerSector; i ++) {
-        fputc(0, fp);
-    }
-
-    // 关闭文件
-    fclose(fp);
-
-    return OK;
+    return writeSparseFat32img(imgPath, &bootSector);
 }
 
 
@@ -263,16 +211,6 @@ int createCustomBootFat32img(char *imgPath, char *bootPath, float size, int clus
  */
 int createEmptyFat32img(char *imgPath, float size, int cluster) {
 
-    FILE *fp;
-    unsigned long int i;
-    // FSINFO 扩展引导标志
-    unsigned int extBootFlag = 0x41615252;
-    // FSINFO 签名
-    unsigned int FSINFOFlag = 0x61417272;
-    // FSINFO 下一可用簇号
-    unsigned int nextEmptyClusNo = 2;
-    // FAT表保留项及设置一簇(2号簇)的根目录
-    unsigned int fat32Flag[3] = {0x0FFFFFF0, 0x0FFFFFFF, 0x0FFFFFF8};
     // 计算FAT32镜像BPM信息
     CalResult result = getFAT32SectorsPerCluster(size, cluster);
     // fat32软盘镜像引导扇区信息(512字节)
@@ -311,72 +249,118 @@ int createEmptyFat32img(char *imgPath, float size, int cluster) {
     // 判断BPM信息是否计算成功
     if (result.status == BAD_FORMAT) return BAD_FORMAT;
 
-    // 新建镜像文件
-    // wb, 文件存在会覆盖数据
-    fp = fopen(imgPath, "wb");
-    if(fp == NULL) return ERROR;
+    return writeSparseFat32img(imgPath, &bootSector);
+}
 
-    // 将引导扇区信息写入软盘镜像
-    fwrite(&bootSector, bootSector.bytesPerSector, 1, fp);
 
-    // 写入文件系统信息扇区(FSINFO)
-    // 写入扩展引导标志
-    fwrite(&extBootFlag, 4, 1, fp);
-    // 写入保留位
-    for(i = 0; i < 480; i ++) {
-        fputc(0, fp);
+/**
+ * 以稀疏方式写出FAT32镜像
+ * 只写入保留区(引导扇区、FSINFO、引导扇区备份)及各FAT表的非零表头，
+ * 其余全 0 的FAT表项与数据区通过截断文件留为空洞，不产生任何实际写入
+ * @param imgPath - 镜像文件路径
+ * @param bootSector - 引导扇区
+ * @return
+ */
+static int writeSparseFat32img(char *imgPath, BootSector *bootSector) {
+
+    ImgWriter writer;
+    unsigned int i;
+    int status;
+    // 每扇区字节数
+    unsigned int bytesPerSector = bootSector->bytesPerSector;
+    // 保留区(含引导扇区、FSINFO及引导扇区备份)
+    unsigned char *reserved;
+    unsigned long reservedSize = (unsigned long)bootSector->reservedSectors * bytesPerSector;
+    // FAT表保留项及设置一簇(2号簇)的根目录
+    unsigned int fat32Flag[3] = {0x0FFFFFF0, 0x0FFFFFFF, 0x0FFFFFF8};
+    // FAT表个数，未设置时按 2 个处理
+    unsigned int fatNum = bootSector->FATNum > 0 ? bootSector->FATNum : 2;
+    // 镜像文件总字节数
+    long long imgSize = (long long)bootSector->totalSectors32 * bytesPerSector;
+    // FSINFO扇区号，引导扇区未指定时默认紧随引导扇区
+    unsigned int fsInfoSector = bootSector->FSInfoSectorNum;
+    // 数据区空闲簇数，与打开镜像时按BPB计算的簇数一致，根目录占用的 2 号簇不计入
+    unsigned int freeClusters;
+    if (fsInfoSector == 0 || fsInfoSector >= bootSector->reservedSectors) fsInfoSector = 1;
+
+    // 保留区必须能容纳引导扇区、FSINFO扇区及引导扇区备份
+    if (bytesPerSector < 512 || bootSector->reservedSectors < 2
+        || bootSector->backBootSectorNum >= bootSector->reservedSectors) {
+        return BAD_FORMAT;
     }
 
-    // 写入FSINFO签名
-    fwrite(&FSINFOFlag, 4, 1, fp);
-    // 写入文件系统空簇数
-    fwrite(&result.dataClusters, 4, 1, fp);
-    // 写入下一可用簇号
-    fwrite(&nextEmptyClusNo, 4, 1, fp);
-    // 写入保留位
-    for(i = 0; i < 14; i ++) {
-        fputc(0, fp);
+    if (bootSector->sectorsPerCluster == 0
+        || bootSector->totalSectors32 <= bootSector->reservedSectors + fatNum * bootSector->sectorsPerFAT32) {
+        return BAD_FORMAT;
+    }
+    freeClusters = (bootSector->totalSectors32 - bootSector->reservedSectors - fatNum * bootSector->sectorsPerFAT32)
+                   / bootSector->sectorsPerCluster;
+    // 数据区末尾FAT表容纳不下的簇不可用
+    if (freeClusters + 2 > (unsigned long long) bootSector->sectorsPerFAT32 * bytesPerSector / 4) {
+        freeClusters = (unsigned int) ((unsigned long long) bootSector->sectorsPerFAT32 * bytesPerSector / 4 - 2);
+    }
+    freeClusters -= 1;
+
+    reserved = (unsigned char*) calloc(reservedSize, 1);
+    if (reserved == NULL) return ERROR;
+
+    // 引导扇区
+    memcpy(reserved, bootSector, 512);
+    // 文件系统信息扇区(FSINFO)
+    buildFSInfoSector(reserved + fsInfoSector * bytesPerSector, freeClusters, 3);
+    // 引导扇区备份
+    if (bootSector->backBootSectorNum != 0) {
+        memcpy(reserved + bootSector->backBootSectorNum * bytesPerSector, bootSector, 512);
     }
-    // 写入扇区结束标记
-    fwrite(&bootSector.bootEndFlag, 2, 1, fp);
 
-    // 用0填充4扇区
-    for(i = 0; i < 4 * bootSector.bytesPerSector; i ++) {
-        fputc(0, fp);
+    // 新建镜像文件，文件存在会覆盖数据
+    if (imgWriterOpen(&writer, imgPath, IMG_OPEN_CREATE) != OK) {
+        free(reserved);
+        return ERROR;
     }
 
-    // 在6扇区写入引导扇区备份
-    fwrite(&bootSector, bootSector.bytesPerSector, 1, fp);
+    // 写入整个保留区，FAT1 表头与保留区相接，合并为一次写出
+    status = imgWriterWrite(&writer, 0, reserved, reservedSize);
+    free(reserved);
 
-    // 用0填充25扇区
-    for(i = 0; i < 25 * bootSector.bytesPerSector; i ++) {
-        fputc(0, fp);
+    // 写各FAT表的表头，FAT表其余部分均为 0
+    for (i = 0; i < fatNum && status == OK; i ++) {
+        status = imgWriterWrite(&writer, (long long)reservedSize + (long long)i * bootSector->sectorsPerFAT32 * bytesPerSector,
+                                fat32Flag, sizeof(fat32Flag));
     }
 
-    // 写 FAT1 表信息
-    fwrite(fat32Flag, sizeof(fat32Flag), 1, fp);
-    for(i = sizeof(fat32Flag); i < bootSector.sectorsPerFAT32 * bootSector.bytesPerSector; i ++) {
-        fputc(0, fp);
-    }
+    // 设置镜像文件大小，FAT表剩余部分及数据区以文件空洞形式存在
+    if (status == OK) status = imgWriterSetSize(&writer, imgSize);
+    if (imgWriterClose(&writer) != OK) status = ERROR;
 
-    // 写 FAT2 表信息
-    // FAT2表紧随FAT1表
-    fwrite(fat32Flag, sizeof(fat32Flag), 1, fp);
-    for(i = sizeof(fat32Flag); i < bootSector.sectorsPerFAT32 * bootSector.bytesPerSector; i ++) {
-        fputc(0, fp);
-    }
+    return status;
+}
 
-    // 用0填充FAT32数据区及残留空间
-    // 数据区及残留空间扇区 = 总扇区 - FAT表扇区数 * 2 - 保留扇区数
-    for(i = 0; i < (bootSector.totalSectors32 - bootSector.sectorsPerFAT32 * 2
-        - bootSector.reservedSectors) * bootSector.bytesPerSector; i ++) {
-        fputc(0, fp);
-    }
 
-    // 关闭文件
-    fclose(fp);
+/**
+ * 构造FAT32文件系统信息扇区(FSINFO)
+ * @param sector - 扇区缓冲区(至少512字节)
+ * @param freeCount - 空闲簇数
+ * @param nextFree - 下一可用簇号
+ */
+void buildFSInfoSector(unsigned char *sector, unsigned int freeCount, unsigned int nextFree) {
+    // FSINFO 扩展引导标志
+    unsigned int extBootFlag = 0x41615252;
+    // FSINFO 签名
+    unsigned int FSINFOFlag = 0x61417272;
 
-    return OK;
+    memset(sector, 0, 512);
+    // 写入扩展引导标志
+    memcpy(sector, &extBootFlag, 4);
+    // 写入FSINFO签名(保留位 480 字节之后)
+    memcpy(sector + 484, &FSINFOFlag, 4);
+    // 写入文件系统空簇数
+    memcpy(sector + 488, &freeCount, 4);
+    // 写入下一可用簇号
+    memcpy(sector + 492, &nextFree, 4);
+    // 写入扇区结束标记
+    sector[510] = 0x55;
+    sector[511] = 0xaa;
 }
 
 
@@ -390,8 +374,9 @@ CalResult getFAT32SectorsPerCluster(float size, int cluster) {
     CalResult result;
     // 每簇扇区数
     int sectorsPerCluster;
-    // 镜像总扇区数
-    unsigned int totalSectors = (unsigned int)size * 1024 * 1024 / 512;
+    // 镜像总扇区数(按整 MB 计算，以 64 位计算避免 4GB 以上溢出)
+    unsigned long long sectors64 = size > 0 ? (unsigned long long) size * 1024 * 1024 / 512 : 0;
+    unsigned int totalSectors = (unsigned int) sectors64;
     // FAT表及数据区总簇数
     unsigned int fatAndDataClusters;
     // FAT总簇数
@@ -401,6 +386,12 @@ CalResult getFAT32SectorsPerCluster(float size, int cluster) {
     // 每FAT所占扇区数
     unsigned int sectorsPerFat;
 
+    // 总扇区数须能写入BPB
+    if (sectors64 > FAT32_MAX_SECTORS) {
+        result.status = BAD_FORMAT;
+        return result;
+    }
+
     // 用户指定簇大小
     if (cluster != 0 ) {
         // FAT表及数据区总簇数 = (扇区总数 - 保留扇区数) / 每簇扇区数
@@ -416,8 +407,8 @@ CalResult getFAT32SectorsPerCluster(float size, int cluster) {
         fatClusters = ceil(((double)fatAndDataClusters * 4 + 8) / 512 / cluster * 2);
         // 数据区总簇数 = FAT表及数据区总簇数 - FAT总簇数
         dataClusters = fatAndDataClusters - fatClusters;
-        // FAT32必须至少包含65527个簇
-        if (dataClusters < 65527) {
+        // FAT32必须至少包含65527个簇，且不超过最大簇数
+        if (dataClusters < 65527 || dataClusters > FAT32_MAX_CLUSTERS) {
             result.status = BAD_FORMAT;
             return result;
         }
@@ -446,8 +437,8 @@ CalResult getFAT32SectorsPerCluster(float size, int cluster) {
         fatClusters = ceil(((double)fatAndDataClusters * 4 + 8) / 512 / sectorsPerCluster * 2);
         // 数据区总簇数 = FAT表及数据区总簇数 - FAT总簇数
         dataClusters = fatAndDataClusters - fatClusters;
-        // FAT32必须至少包含65527个簇
-        if (dataClusters < 65527) continue;
+        // FAT32必须至少包含65527个簇，且不超过最大簇数
+        if (dataClusters < 65527 || dataClusters > FAT32_MAX_CLUSTERS) continue;
 
         // 每FAT所占扇区数 = (数据区总簇数 * FAT项大小 + FAT保留项) / 扇区字节数
         // 若存在小数，使用 ceil 向上取整
@@ -2,6 +2,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include "include/fatimg.h"
+#include "include/libfatimg.h"
 
 /** 当前版本 */
 #define FATIMG_VERSION "0.1"
@@ -12,8 +13,47 @@ void help(char* programName);
 int badArg();
 /** 错误的命令 */
 int badCommand();
+/** 解析簇分配策略 */
+int getAllocPolicy(const char* name);
+/** 拷贝文件到FAT镜像 */
+int copyFilesToImg(char* imgPath, char** files, unsigned int fileNum, int allocPolicy, int openMode);
 /** 自定义FAT镜像创建 */
 int customCreateImg(char* imgPath, char* bootPath, char* volumeLabel, float size, int secPerCluster, FAT_TYPE type, char isInit);
+/** 按命令行参数创建FAT镜像 */
+int createImgByArgs(char* imgPath, int argc, char** argv);
+/** 按命令行参数拷贝文件到FAT镜像 */
+int copyFilesByArgs(char* imgPath, int argc, char** argv);
+
+int syncDirByArgs(char* imgPath, int argc, char** argv);
+/** 在一次打开的FAT镜像上批量执行命令脚本 */
+int runBatchByArgs(char* imgPath, int argc, char** argv);
+
+int extractByArgs(char* imgPath, char* srcPath, char* destPath, char isCat);
+/** 按构建说明文件并行构建多个镜像 */
+int buildImagesBySpec(char* specPath, unsigned int threadNum, char* cacheDir);
+/** 构建说明文件中的一个镜像 */
+int buildImageJob(void* specs, unsigned int index);
+/** 计算构建说明中一个镜像的全部输入的哈希键 */
+int getImageSpecKey(int argc, char** argv, char* key);
+
+
+/** 构建说明文件中的一个镜像 */
+typedef struct {
+    // 参数，第 0 个为镜像文件路径
+    char** argv;
+    // 参数个数
+    int argc;
+    // 构建缓存目录，为 NULL 表示不使用缓存
+    char* cacheDir;
+} ImageSpec;
+
+/** 批处理脚本中的一条命令 */
+typedef struct {
+    // 参数，第 0 个为命令名
+    char** argv;
+    // 参数个数
+    int argc;
+} BatchCommand;
 
 
 /**
@@ -24,18 +64,20 @@ int customCreateImg(char* imgPath, char* bootPath, char* volumeLabel, float size
  * @return
  */
 int main(int argc, char* argv[]) {
-    int i;
     char* str = NULL;
-    // 默认生成FAT12镜像
-    FAT_TYPE type = FAT12;
-    // 默认不指定镜像大小
-    float size = 0;
-    // 默认不指定每簇扇区数
-    int secPerCluster = 0;
-    // 默认卷标
-    char* volumeLabel = "FATIMG     ";
-    // 写入 boot file 时是否格式化软盘镜像
-    char isInit = 0;
+    char* seed;
+    long long epoch;
+
+    // 设置 SOURCE_DATE_EPOCH 时使用固定时间，卷序列号由 FATIMG_VOLUME_SEED(默认为该时间)生成，
+    // 相同输入得到完全相同的镜像
+    str = getenv("SOURCE_DATE_EPOCH");
+    if (str != NULL && str[0] != '\0') {
+        epoch = strtoll(str, NULL, 10);
+        if (epoch < 0) return badArg();
+        seed = getenv("FATIMG_VOLUME_SEED");
+        setReproducibleBuild(epoch, seed != NULL && seed[0] != '\0' ? (unsigned int) strtoul(seed, NULL, 0)
+                                                                    : (unsigned int) epoch);
+    }
 
     // --help
     // 显示提示信息
@@ -59,119 +101,593 @@ int main(int argc, char* argv[]) {
         printf("%s Version: %s\n", str, FATIMG_VERSION);
 
     }
-    // -cp <dest file>
-    // 拷贝目标文件到fat镜像中
-    else if(argc == 4 && !strcasecmp(argv[2], "-cp")) {
-        FILE_TYPE fileType = getFileType(argv[3]);
-        if (fileType == TYPE_NOT_FOUND) {
-            printf("The target file does not exist.\n");
-            return BAD_FORMAT;
-        } else if (fileType != TYPE_FILE) {
-            printf("Currently, only copying regular files to FAT12 images is supported.\n");
-            return BAD_FORMAT;
+    // -build <spec file> [-j <threads>] [-cache <dir>]
+    // 按构建说明文件并行构建多个镜像
+    else if(argc >= 3 && !strcasecmp(argv[1], "-build")) {
+        int threadNum = 0, i;
+        char* cacheDir = NULL;
+
+        for (i = 3; i < argc; i ++) {
+            if (i + 1 >= argc) return badArg();
+            if (!strcasecmp(argv[i], "-j")) {
+                threadNum = atoi(argv[++ i]);
+                if (threadNum <= 0) return badArg();
+            } else if (!strcasecmp(argv[i], "-cache")) {
+                cacheDir = argv[++ i];
+            } else return badCommand();
         }
-
-        type = getImageFatType(argv[1]);
-        if (type == FAT12) {
-            // 复制普通文件到 FAT12 镜像中
-            i = copyFileToFat12img(argv[1], argv[3], 0);
-        } else if (type == FAT32) {
-            // 暂不支持复制文件到FAT32软盘镜像
-            printf("Copying files to FAT32 is not supported temporarily.\n");
-            return BAD_FORMAT;
-        } else {
-            printf("Bad FAT image format.\n");
-            return BAD_FORMAT;
+        // 只有可重现构建的镜像才能由输入确定，才能使用缓存
+        if (cacheDir != NULL && !getReproducibleBuild(NULL, NULL)) {
+            printf("Build cache needs SOURCE_DATE_EPOCH, cache disabled.\n");
+            cacheDir = NULL;
         }
+        return buildImagesBySpec(argv[2], (unsigned int) threadNum, cacheDir);
+    }
+    // -cp <dest file>... [-m <manifest file>] [-al <first/next/best>] [-mmap]
+    // 拷贝目标文件到fat镜像中
+    else if(argc >= 4 && !strcasecmp(argv[2], "-cp")) {
+        return copyFilesByArgs(argv[1], argc - 3, argv + 3);
+    }
+    // -sync <dir> [-al <first/next/best>] [-mmap]
+    // 将本地目录同步到fat镜像根目录中，只修改有变化的文件
+    else if(argc >= 4 && !strcasecmp(argv[2], "-sync")) {
+        return syncDirByArgs(argv[1], argc - 3, argv + 3);
+    }
+    // --batch [script file] [-al <first/next/best>] [-mmap]
+    // 在一次打开的fat镜像上批量执行 add/mkdir/rm/label/boot 命令
+    else if(argc >= 3 && !strcasecmp(argv[2], "--batch")) {
+        return runBatchByArgs(argv[1], argc - 3, argv + 3);
+    }
+    // --check [--repair]
+    // 检查fat镜像的一致性，可选修复备份FAT表及FSINFO
+    else if((argc == 3 || (argc == 4 && !strcasecmp(argv[3], "--repair"))) && !strcasecmp(argv[2], "--check")) {
+        int result = checkFatImg(argv[1], argc == 4);
+        if (result == NO_FIND) printf("not find image file.\n");
+        else if (result == BAD_FORMAT) printf("The image has problems.\n");
+        else if (result == UNSUPPORTED) printf("exFAT check not supported.\n");
+        else if (result != OK) printf("Check image fail.\n");
+        return result;
+    }
+    // --defrag
+    // 整理fat镜像碎片，使每个文件及目录连续存放
+    else if(argc == 3 && !strcasecmp(argv[2], "--defrag")) {
+        int result = defragFatImg(argv[1]);
+        if (result == NO_FIND) printf("not find image file.\n");
+        else if (result == BAD_FORMAT) printf("The image cannot be defragmented.\n");
+        else if (result != OK) printf("Defrag image fail.\n");
+        return result;
+    }
+    // -x <image path> [dest path]
+    // 从fat镜像中提取文件或目录
+    else if((argc == 4 || argc == 5) && !strcasecmp(argv[2], "-x")) {
+        return extractByArgs(argv[1], argv[3], argc == 5 ? argv[4] : NULL, 0);
+    }
+    // -cat <image path>
+    // 将fat镜像中的文件内容输出到标准输出
+    else if(argc == 4 && !strcasecmp(argv[2], "-cat")) {
+        return extractByArgs(argv[1], argv[3], NULL, 1);
+    }
+    // 创建FAT镜像文件
+    else if (argc >= 2 && argv[1][0] != '-') {
+        return createImgByArgs(argv[1], argc - 2, argv + 2);
+    } else return badArg();
+
+    return 0;
+}
+
+
+/**
+ * 按命令行参数创建FAT镜像
+ * 不带参数时创建标准 FAT12 镜像
+ * @param imgPath - 镜像文件路径
+ * @param argc - 参数个数
+ * @param argv - 参数 [-b <boot file>] [-f <12/16/32/64>] [-s <size>] [-sc <n>] [-vl <label>] [-i]
+ * @return
+ */
+int createImgByArgs(char* imgPath, int argc, char** argv) {
+    int i;
+    char* bootPath = NULL;
+    // 默认生成FAT12镜像
+    FAT_TYPE type = FAT12;
+    // 默认不指定镜像大小
+    float size = 0;
+    // 默认不指定每簇扇区数
+    int secPerCluster = 0;
+    // 默认卷标
+    char* volumeLabel = "FATIMG     ";
+    // 写入 boot file 时是否格式化软盘镜像
+    char isInit = 0;
 
-        if (i == NO_FIND) {
-            printf("not find file.\n");
-            return NO_FIND;
-        } else if (i == INSUFFICIENT_SPACE) {
-            printf("Insufficient disk image space.\n");
-            return INSUFFICIENT_SPACE;
+    // 循环提取信息
+    for(i = 0; i < argc; i ++) {
+        // -i
+        // 写入 boot file 的同时格式化软盘镜像
+        if (!strcasecmp(argv[i], "-i")) {
+            isInit = 1;
+            continue;
         }
+        if (i + 1 >= argc) return badArg();
 
+        // -b <boot file>
+        // 使用自定义的引导扇区文件创建FAT镜像
+        if (!strcasecmp(argv[i], "-b")) {
+            bootPath = argv[++ i];
+        }
+        // -f <formatNum>
+        // 指定创建的FAT格式
+        else if (!strcasecmp(argv[i], "-f")) {
+            type = (char)atoi(argv[++ i]);
+            if (type != FAT12 && type != FAT16 && type != FAT32 && type != EXFAT) {
+                return badArg();
+            }
+        }
+        // -s <size>
+        // 指定创建的FAT镜像文件大小(对fat12无效)
+        else if (!strcasecmp(argv[i], "-s")) {
+            size = atof(argv[++ i]);
+            if (size <= 0) {
+                return badArg();
+            }
+        }
+        // -sc <4/8/16/32/64>
+        // 指定创建的FAT镜像的每簇扇区数(对fat12无效)
+        else if (!strcasecmp(argv[i], "-sc")) {
+            secPerCluster = atoi(argv[++ i]);
+            if (secPerCluster != 4 && secPerCluster != 8
+                && secPerCluster !=16 && secPerCluster != 32 && secPerCluster != 64) {
+                return badArg();
+            }
+        }
+        // -vl <volumeLabel>
+        // 指定创建的FAT镜像的卷标，最大11个字符
+        else if (!strcasecmp(argv[i], "-vl")) {
+            volumeLabel = argv[++ i];
+        }
+        else return badCommand();
     }
-    // 创建FAT镜像文件
-    else if (argc >= 2) {
 
-        // 默认创建标准 FAT12 镜像文件.
-        if(argc == 2 && argv[1][0] != '-') {
-            i = createEmptyFat12img(argv[1], volumeLabel);
-            if (i == ERROR) {
-                printf("Create image file fail.\n");
-                return ERROR;
+    // 自定义FAT镜像创建
+    return customCreateImg(imgPath, bootPath, volumeLabel, size, secPerCluster, type, isInit);
+}
+
+
+/**
+ * 按命令行参数拷贝文件到FAT镜像
+ * @param imgPath - 镜像文件路径
+ * @param argc - 参数个数
+ * @param argv - 参数 <dest file>... [-m <manifest file>] [-al <first/next/best>] [-mmap]
+ * @return
+ */
+int copyFilesByArgs(char* imgPath, int argc, char** argv) {
+    int i;
+    int allocPolicy = ALLOC_FIRST_FIT;
+    int openMode = 0;
+    unsigned int fileNum = 0;
+    char** files;
+    FileList manifest = {0};
+
+    for (i = 0; i < argc; i ++) {
+        // -al <first/next/best>
+        // 指定簇分配策略
+        if (!strcasecmp(argv[i], "-al") && i + 1 < argc) {
+            allocPolicy = getAllocPolicy(argv[++ i]);
+            if (allocPolicy == ERROR) {
+                freeFileList(&manifest);
+                return badArg();
             }
         }
-        else if(argc == 4 && !strcasecmp(argv[2], "-vl")) {
-            i = createEmptyFat12img(argv[1], argv[3]);
-            if (i == ERROR) {
-                printf("Create image file fail.\n");
-                return ERROR;
+        // -mmap
+        // 以内存映射方式修改镜像
+        else if (!strcasecmp(argv[i], "-mmap")) {
+            openMode |= IMG_OPEN_MMAP;
+        }
+        // -m <manifest file>
+        // 从清单文件读取要拷贝的文件，每行一个文件路径
+        else if (!strcasecmp(argv[i], "-m") && i + 1 < argc) {
+            if (manifest.data != NULL) {
+                freeFileList(&manifest);
+                return badCommand();
+            }
+            if (loadFileList(argv[++ i], &manifest) != OK) {
+                printf("not find manifest file.\n");
+                return NO_FIND;
             }
         }
-        else if(argc >= 4 && argc % 2 == 0) {
-            // 循环提取信息
-            for(i = 2; i < argc; i += 2) {
-                // -b <boot file>
-                // 使用自定义的引导扇区文件创建FAT镜像
-                if (!strcasecmp(argv[i], "-b")) {
-                    str = argv[i + 1];
-                    if (str == NULL) {
-                        return badArg();
-                    }
-                }
-                // -f <formatNum>
-                // 指定创建的FAT格式
-                else if (!strcasecmp(argv[i], "-f")) {
-                    type = (char)atoi(argv[i + 1]);
-                    if (type != FAT12 && type != FAT16 && type != FAT32 && type != EXFAT) {
-                        return badArg();
-                    }
-                }
-                // -s <size>
-                // 指定创建的FAT镜像文件大小(对fat12无效)
-                else if (!strcasecmp(argv[i], "-s")) {
+        else if (argv[i][0] == '-') {
+            freeFileList(&manifest);
+            return badCommand();
+        }
+    }
+
+    // 汇总命令行中的文件与清单中的文件
+    files = (char**) malloc((argc + manifest.count + 1) * sizeof(char*));
+    if (files == NULL) {
+        freeFileList(&manifest);
+        return ERROR;
+    }
+    for (i = 0; i < argc; i ++) {
+        if (!strcasecmp(argv[i], "-al") || !strcasecmp(argv[i], "-m")) i ++;
+        else if (argv[i][0] != '-') files[fileNum ++] = argv[i];
+    }
+    for (i = 0; i < (int) manifest.count; i ++) {
+        files[fileNum ++] = manifest.entries[i];
+    }
 
-                    size = atof(argv[i + 1]);
-                    if (size <= 0) {
-                        return badArg();
-                    }
+    if (fileNum == 0) i = badArg();
+    else i = copyFilesToImg(imgPath, files, fileNum, allocPolicy, openMode);
 
-                }
-                // -sc <4/8/16/32/64>
-                // 指定创建的FAT镜像的每簇扇区数(对fat12无效)
-                else if (!strcasecmp(argv[i], "-sc")) {
+    free(files);
+    freeFileList(&manifest);
+    return i;
+}
 
-                    secPerCluster = atoi(argv[i + 1]);
-                    if (secPerCluster != 4 && secPerCluster != 8
-                        && secPerCluster !=16 && secPerCluster != 32 && secPerCluster != 64) {
-                        return badArg();
-                    }
 
-                }
-                // -vl <volumeLabel>
-                // 指定创建的FAT镜像的卷标，最大11个字符
-                else if (!strcasecmp(argv[i], "-vl")) {
-                    volumeLabel = argv[i + 1];
-                }
-                // -i
-                // 写入 boot file 的同时格式化软盘镜像
-                else if (!strcasecmp(argv[i], "-i")) {
-                    isInit = 1;
-                }
-                else return badCommand();
+/**
+ * 按命令行参数将本地目录同步到FAT镜像
+ * @param imgPath - 镜像文件路径
+ * @param argc - 参数个数
+ * @param argv - 参数 <dir> [-al <first/next/best>] [-mmap]
+ * @return
+ */
+int syncDirByArgs(char* imgPath, int argc, char** argv) {
+    int i, result;
+    int allocPolicy = ALLOC_FIRST_FIT;
+    int openMode = 0;
+    FAT_TYPE type;
+
+    for (i = 1; i < argc; i ++) {
+        // -al <first/next/best>
+        // 指定簇分配策略
+        if (!strcasecmp(argv[i], "-al") && i + 1 < argc) {
+            allocPolicy = getAllocPolicy(argv[++ i]);
+            if (allocPolicy == ERROR) return badArg();
+        }
+        // -mmap
+        // 以内存映射方式修改镜像
+        else if (!strcasecmp(argv[i], "-mmap")) {
+            openMode |= IMG_OPEN_MMAP;
+        }
+        else return badCommand();
+    }
+
+    if (getFileType(argv[0]) != TYPE_DIRECTORY) {
+        printf("The target directory does not exist: %s\n", argv[0]);
+        return BAD_FORMAT;
+    }
+
+    type = getImageFatType(imgPath);
+    if (type != FAT12 && type != FAT32) {
+        printf("Bad FAT image format.\n");
+        return BAD_FORMAT;
+    }
+
+    result = syncDirToFatImg(imgPath, argv[0], allocPolicy, openMode);
+    if (result == NO_FIND) {
+        printf("not find file.\n");
+    } else if (result == INSUFFICIENT_SPACE) {
+        printf("Insufficient disk image space.\n");
+    } else if (result != OK) {
+        printf("Sync directory fail.\n");
+    }
+    return result;
+}
+
+
+/**
+ * 按命令脚本批量修改FAT镜像
+ * 脚本每行一条命令，含空白的参数用双引号括起，忽略空行及 '#' 开头的注释行：
+ *   add <本地文件或目录> [镜像内目录]、mkdir <镜像内目录>、rm <镜像内路径>、label <卷标>、boot <引导文件>
+ * 全部命令先解析检查，再在同一个打开的镜像上依次执行，子目录只在首次用到时载入一次并在后续命令中复用，
+ * FAT表、目录及FSINFO在关闭镜像时一次写回；
+ * 某条命令失败时停止执行，此前命令的修改照常写回。add 替换同名项时先检查剩余空间(包括同名项部分)，
+ * 空间不足时拒绝替换，镜像中的同名项保持不变
+ * @param imgPath - 镜像文件路径
+ * @param argc - 参数个数
+ * @param argv - 参数 [script file] [-al <first/next/best>] [-mmap]，未指定脚本文件时从标准输入读取
+ * @return
+ */
+int runBatchByArgs(char* imgPath, int argc, char** argv) {
+    FileList script;
+    BatchCommand* commands;
+    FatImgHandle* handle = NULL;
+    char* scriptPath = NULL;
+    char** args;
+    char* name;
+    int i, result = OK, cmdArgc;
+    int allocPolicy = ALLOC_FIRST_FIT;
+    int openFlags = 0;
+    unsigned int j, done = 0;
+    size_t capacity = 0, used = 0;
+    FILE* fp;
+
+    for (i = 0; i < argc; i ++) {
+        // -al <first/next/best>
+        // 指定簇分配策略
+        if (!strcasecmp(argv[i], "-al") && i + 1 < argc) {
+            allocPolicy = getAllocPolicy(argv[++ i]);
+            if (allocPolicy == ERROR) return badArg();
+        }
+        // -mmap
+        // 以内存映射方式修改镜像
+        else if (!strcasecmp(argv[i], "-mmap")) {
+            openFlags |= FATIMG_OPEN_MMAP;
+        }
+        else if (argv[i][0] != '-' && scriptPath == NULL) {
+            scriptPath = argv[i];
+        }
+        else return badCommand();
+    }
+
+    fp = scriptPath != NULL ? fopen(scriptPath, "rb") : stdin;
+    if (fp == NULL || readFileList(fp, &script) != OK) {
+        if (fp != NULL && fp != stdin) fclose(fp);
+        printf("not find batch script.\n");
+        return NO_FIND;
+    }
+    if (fp != stdin) fclose(fp);
+
+    // 每个参数至少占用 2 字节(参数及分隔符)，据此确定参数指针数组大小
+    for (j = 0; j < script.count; j ++) {
+        capacity += strlen(script.entries[j]) / 2 + 1;
+    }
+    commands = (BatchCommand*) calloc(script.count + 1, sizeof(BatchCommand));
+    args = (char**) malloc((capacity + 1) * sizeof(char*));
+    if (commands == NULL || args == NULL) result = ERROR;
+
+    // 先检查全部命令，避免执行到一半才发现脚本错误
+    for (j = 0; j < script.count && result == OK; j ++) {
+        cmdArgc = splitListEntry(script.entries[j], args + used, (int) (capacity - used));
+        name = cmdArgc > 0 ? args[used] : NULL;
+        if (cmdArgc <= 0
+            || !((!strcasecmp(name, "add") && (cmdArgc == 2 || cmdArgc == 3))
+                || (!strcasecmp(name, "mkdir") && cmdArgc == 2)
+                || (!strcasecmp(name, "rm") && cmdArgc == 2)
+                || (!strcasecmp(name, "label") && cmdArgc == 2)
+                || (!strcasecmp(name, "boot") && cmdArgc == 2))) {
+            printf("Bad batch command %u: %s\n", j + 1, script.entries[j]);
+            result = BAD_FORMAT;
+            break;
+        }
+        commands[j].argv = args + used;
+        commands[j].argc = cmdArgc;
+        used += (size_t) cmdArgc;
+    }
+
+    if (result == OK) {
+        result = fatimgOpen(imgPath, openFlags, &handle);
+        if (result == NO_FIND) printf("not find image file.\n");
+        else if (result == BAD_FORMAT) printf("Bad FAT image format.\n");
+        else if (result != OK) printf("Open image fail.\n");
+        else fatimgSetAllocPolicy(handle, allocPolicy);
+    }
+
+    for (j = 0; j < script.count && result == OK; j ++) {
+        char** cmd = commands[j].argv;
+
+        if (!strcasecmp(cmd[0], "add")) result = fatimgAdd(handle, cmd[1], commands[j].argc == 3 ? cmd[2] : NULL);
+        else if (!strcasecmp(cmd[0], "mkdir")) result = fatimgMkdir(handle, cmd[1]);
+        else if (!strcasecmp(cmd[0], "rm")) result = fatimgRemove(handle, cmd[1]);
+        else if (!strcasecmp(cmd[0], "label")) result = fatimgSetLabel(handle, cmd[1]);
+        else result = fatimgSetBoot(handle, cmd[1]);
+
+        if (result == OK) {
+            done ++;
+            continue;
+        }
+        printf("Batch command %u fail: %s %s\n", j + 1, cmd[0], cmd[1]);
+        if (result == NO_FIND) printf("not find file.\n");
+        else if (result == INSUFFICIENT_SPACE && !strcasecmp(cmd[0], "add")) {
+            printf("Insufficient disk image space, the existing entry is kept.\n");
+        }
+        else if (result == INSUFFICIENT_SPACE) printf("Insufficient disk image space.\n");
+        else if (result == BAD_FORMAT) printf("Bad path, volume label or boot file.\n");
+    }
+
+    // 无论成功与否都关闭镜像，写回已完成命令的元数据
+    if (handle != NULL && fatimgClose(handle) != OK && result == OK) {
+        printf("Write image fail.\n");
+        result = ERROR;
+    }
+    if (handle != NULL) printf("Batch: %u of %u commands done.\n", done, script.count);
+
+    free(args);
+    free(commands);
+    freeFileList(&script);
+    return result;
+}
+
+
+/**
+ * 按命令行参数从FAT镜像中提取文件或目录
+ * @param imgPath - 镜像文件路径
+ * @param srcPath - 镜像内路径
+ * @param destPath - 本地目标路径，为 NULL 时使用镜像内路径的最后一级名称(根目录为当前目录)
+ * @param isCat - 是否将文件内容输出到标准输出，此时提示信息输出到标准错误
+ * @return
+ */
+int extractByArgs(char* imgPath, char* srcPath, char* destPath, char isCat) {
+    FILE* msg = isCat ? stderr : stdout;
+    char* name = NULL;
+    char* str;
+    size_t len;
+    int result;
+
+    if (!isCat && destPath == NULL) {
+        len = strlen(srcPath);
+        name = (char*) malloc(len + 1);
+        if (name == NULL) return ERROR;
+        strcpy(name, srcPath);
+
+        // 去除末尾的分隔符后取最后一级名称
+        while (len > 0 && (name[len - 1] == '/' || name[len - 1] == '\\')) name[-- len] = '\0';
+        destPath = name;
+        for (str = name; *str; str ++) {
+            if (*str == '/' || *str == '\\') destPath = str + 1;
+        }
+        if (*destPath == '\0') destPath = ".";
+    }
+
+    result = extractFromFatImg(imgPath, srcPath, isCat ? NULL : destPath);
+    if (result == NO_FIND) {
+        fprintf(msg, "not find file in image: %s\n", srcPath);
+    } else if (result == BAD_FORMAT) {
+        fprintf(msg, isCat ? "Not a file: %s\n" : "Bad FAT image or file: %s\n", srcPath);
+    } else if (result != OK) {
+        fprintf(msg, "Extract %s fail.\n", srcPath);
+    }
+    free(name);
+    return result;
+}
+
+
+/**
+ * 按构建说明文件并行构建多个镜像
+ * 说明文件每行描述一个镜像：<image file> [创建参数...] [-cp <dest file>... [拷贝参数...]]，
+ * 参数与单独调用 fatimg 时相同，含空白的参数用双引号括起，忽略空行及 '#' 开头的注释行。
+ * 各镜像相互独立，由线程池(默认线程数为处理器核数)并行创建并拷贝文件
+ * @param specPath - 构建说明文件路径
+ * @param threadNum - 线程数，为 0 时使用处理器核数
+ * @param cacheDir - 构建缓存目录，为 NULL 表示不使用缓存
+ * @return
+ */
+int buildImagesBySpec(char* specPath, unsigned int threadNum, char* cacheDir) {
+    FileList list;
+    ImageSpec* specs;
+    char** args;
+    int* results;
+    int status = OK, argc;
+    unsigned int i, j;
+    size_t capacity = 0, used = 0;
+
+    if (loadFileList(specPath, &list) != OK) {
+        printf("not find build spec file.\n");
+        return NO_FIND;
+    }
+    if (list.count == 0) {
+        freeFileList(&list);
+        return badArg();
+    }
+
+    // 每个参数至少占用 2 字节(参数及分隔符)，据此确定参数指针数组大小
+    for (i = 0; i < list.count; i ++) {
+        capacity += strlen(list.entries[i]) / 2 + 1;
+    }
+    specs = (ImageSpec*) calloc(list.count, sizeof(ImageSpec));
+    args = (char**) malloc(capacity * sizeof(char*));
+    results = (int*) calloc(list.count, sizeof(int));
+    if (specs == NULL || args == NULL || results == NULL) status = ERROR;
+
+    for (i = 0; i < list.count && status == OK; i ++) {
+        argc = splitListEntry(list.entries[i], args + used, (int) (capacity - used));
+        if (argc <= 0 || args[used][0] == '-') {
+            printf("Bad build spec: %s\n", list.entries[i]);
+            status = BAD_FORMAT;
+            break;
+        }
+        specs[i].argv = args + used;
+        specs[i].argc = argc;
+        specs[i].cacheDir = cacheDir;
+        used += (size_t) argc;
+
+        // 同一镜像不能由两个线程同时构建
+        for (j = 0; j < i; j ++) {
+            if (!strcmp(specs[j].argv[0], specs[i].argv[0])) {
+                printf("Duplicate image in build spec: %s\n", specs[i].argv[0]);
+                status = BAD_FORMAT;
             }
+        }
+    }
+
+    if (status == OK) {
+        status = runParallelJobs(list.count, threadNum, buildImageJob, specs, results);
+        clearContentDigests();
+        for (i = 0; i < list.count; i ++) {
+            if (results[i] != OK) printf("Build %s fail.\n", specs[i].argv[0]);
+        }
+    }
 
-            // 自定义FAT镜像创建
-            return customCreateImg(argv[1], str, volumeLabel, size, secPerCluster, type, isInit);
+    free(results);
+    free(args);
+    free(specs);
+    freeFileList(&list);
+    return status;
+}
 
-        } else return badArg();
 
-    } else return badArg();
+/**
+ * 构建说明文件中的一个镜像(在线程池中执行)
+ * -cp 之前的参数用于创建镜像，之后的参数用于拷贝文件。
+ * 使用缓存时，全部输入的哈希键在缓存中已存在则直接取出镜像，否则构建后存入缓存；
+ * 只更新引导扇区(-b 不带 -i)的镜像依赖已有镜像内容，不使用缓存
+ * @param specs - 构建说明数组
+ * @param index - 镜像序号
+ * @return
+ */
+int buildImageJob(void* specs, unsigned int index) {
+    ImageSpec* spec = (ImageSpec*) specs + index;
+    char key[33];
+    int i, result, cached, hasBoot = 0, hasInit = 0;
+
+    for (i = 1; i < spec->argc && strcasecmp(spec->argv[i], "-cp"); i ++) {
+        if (!strcasecmp(spec->argv[i], "-b")) hasBoot = 1;
+        if (!strcasecmp(spec->argv[i], "-i")) hasInit = 1;
+    }
 
-    return 0;
+    cached = spec->cacheDir != NULL && (!hasBoot || hasInit)
+             && getImageSpecKey(spec->argc - 1, spec->argv + 1, key) == OK;
+    if (cached && fetchCachedImage(spec->cacheDir, key, spec->argv[0]) == OK) return OK;
+
+    result = createImgByArgs(spec->argv[0], i - 1, spec->argv + 1);
+    if (result == OK && i < spec->argc) result = copyFilesByArgs(spec->argv[0], spec->argc - i - 1, spec->argv + i + 1);
+    if (result == OK && cached && storeCachedImage(spec->cacheDir, key, spec->argv[0]) != OK) {
+        printf("Store %s to build cache fail.\n", spec->argv[0]);
+    }
+    return result;
+}
+
+
+/**
+ * 计算构建说明中一个镜像的全部输入的哈希键
+ * 输入包括版本号、固定时间及卷序列号种子、全部参数(不含镜像文件路径，内容相同的镜像共用缓存)，
+ * 以及参数所指的引导文件、要拷贝的文件及目录、清单文件中列出的文件的名称、时间和内容
+ * @param argc - 参数个数
+ * @param argv - 参数(不含镜像文件路径)
+ * @param key - 32 个十六进制字符的键
+ * @return 输入文件读取失败返回 ERROR
+ */
+int getImageSpecKey(int argc, char** argv, char* key) {
+    InputHash hash;
+    FileList manifest;
+    FILE_TYPE type;
+    long long epoch;
+    unsigned int seed, j;
+    int i, status = OK;
+
+    inputHashInit(&hash);
+    inputHashUpdate(&hash, FATIMG_VERSION, sizeof(FATIMG_VERSION));
+    getReproducibleBuild(&epoch, &seed);
+    inputHashUpdate(&hash, &epoch, sizeof(epoch));
+    inputHashUpdate(&hash, &seed, sizeof(seed));
+
+    for (i = 0; i < argc && status == OK; i ++) {
+        inputHashUpdate(&hash, argv[i], strlen(argv[i]) + 1);
+        type = getFileType(argv[i]);
+        if (type == TYPE_FILE || type == TYPE_DIRECTORY) status = inputHashPath(&hash, argv[i]);
+
+        // 清单文件中列出的文件
+        if (status == OK && i > 0 && !strcasecmp(argv[i - 1], "-m")) {
+            if (loadFileList(argv[i], &manifest) != OK) return ERROR;
+            for (j = 0; j < manifest.count && status == OK; j ++) {
+                inputHashUpdate(&hash, manifest.entries[j], strlen(manifest.entries[j]) + 1);
+                status = inputHashPath(&hash, manifest.entries[j]);
+            }
+            freeFileList(&manifest);
+        }
+    }
+    if (status != OK) return ERROR;
+
+    inputHashFinal(&hash, key);
+    return OK;
 }
 
 
@@ -235,8 +751,22 @@ int customCreateImg(
                 return BAD_FORMAT;
             }
         }
-        case FAT16:
-        case EXFAT: break;
+        case FAT16: break;
+        case EXFAT: {
+            // exFAT镜像不支持自定义引导扇区，大小不受 32GB 限制
+            if (bootPath != NULL) {
+                printf("Custom boot file is not supported for exfat image.\n");
+                return BAD_FORMAT;
+            }
+            result = size > 0 ? createEmptyExfatImg(imgPath, size, secPerCluster, volumeLabel) : BAD_FORMAT;
+            if (result == ERROR) {
+                printf("Create image file fail.\n");
+                return ERROR;
+            } else if (result == BAD_FORMAT) {
+                printf("Bad exfat image size or sectors per cluster !\n");
+                return BAD_FORMAT;
+            }
+        } break;
         default: {
             return badArg();
         }
@@ -246,6 +776,76 @@ int customCreateImg(
 }
 
 
+/**
+ * 拷贝文件到FAT镜像
+ * 全部文件在一次打开的镜像中完成拷贝
+ * @param imgPath - 镜像文件路径
+ * @param files - 要拷贝的文件列表
+ * @param fileNum - 文件数
+ * @param allocPolicy - 簇分配策略
+ * @param openMode - 镜像打开方式
+ * @return
+ */
+int copyFilesToImg(char* imgPath, char** files, unsigned int fileNum, int allocPolicy, int openMode) {
+    FILE_TYPE fileType;
+    FAT_TYPE type;
+    unsigned int i;
+    int result;
+
+    // 先检查全部文件，避免拷贝到一半才发现错误
+    for (i = 0; i < fileNum; i ++) {
+        fileType = getFileType(files[i]);
+        if (fileType == TYPE_NOT_FOUND) {
+            printf("The target file does not exist: %s\n", files[i]);
+            return BAD_FORMAT;
+        } else if (fileType != TYPE_FILE && fileType != TYPE_DIRECTORY) {
+            printf("Currently, only copying regular files and directories to FAT images is supported: %s\n", files[i]);
+            return BAD_FORMAT;
+        }
+    }
+
+    type = getImageFatType(imgPath);
+    if (type == FAT12) {
+        // 复制普通文件到 FAT12 镜像中
+        result = copyFilesToFat12img(imgPath, files, fileNum, 0, allocPolicy, openMode);
+    } else if (type == FAT32) {
+        // 复制普通文件到 FAT32 镜像中
+        result = copyFilesToFat32img(imgPath, files, fileNum, 0, allocPolicy, openMode);
+    } else if (type == EXFAT) {
+        // 复制普通文件及目录到 exFAT 镜像中
+        result = copyFilesToExfatImg(imgPath, files, fileNum);
+    } else {
+        printf("Bad FAT image format.\n");
+        return BAD_FORMAT;
+    }
+
+    if (result == NO_FIND) {
+        printf("not find file.\n");
+        return NO_FIND;
+    } else if (result == INSUFFICIENT_SPACE) {
+        printf("Insufficient disk image space.\n");
+        return INSUFFICIENT_SPACE;
+    } else if (result != OK) {
+        printf("Copy files fail.\n");
+        return result;
+    }
+    return OK;
+}
+
+
+/**
+ * 解析簇分配策略
+ * @param name - 策略名 first/next/best
+ * @return 分配策略，无效的策略名返回 ERROR
+ */
+int getAllocPolicy(const char* name) {
+    if (!strcasecmp(name, "first")) return ALLOC_FIRST_FIT;
+    if (!strcasecmp(name, "next")) return ALLOC_NEXT_FIT;
+    if (!strcasecmp(name, "best")) return ALLOC_BEST_FIT;
+    return ERROR;
+}
+
+
 /**
  * 错误的参数
  * @return
@@ -276,7 +876,19 @@ void help(char* programName) {
     printf("Options: \n");
     printf("  %-15s\t%s\n", "--help", "Display this information.");
     printf("  %-15s\t%s\n", "--version", "Display this version information.");
-    printf("  %-15s\t%s\n", "-cp <dest file>", "Copy dest file to FAT12 image. \n\t\t\tThis command can only be used alone.\n");
+    printf("  %-15s\t%s\n", "-cp <dest file>...", "Copy dest files or directories (recursively) to FAT12/FAT32/EXFAT image. \n\t\t\tThis command can only be used alone.");
+    printf("  %-15s\t%s\n", "-sync <dir>", "Make the image root match dir, rewriting only changed files and removing missing ones.");
+    printf("  %-15s\t%s\n", "-x <path> [dest]", "Extract a file or directory (recursively) from the image to dest.");
+    printf("  %-15s\t%s\n", "-cat <path>", "Write a file in the image to standard output.");
+    printf("  %-15s\t%s\n", "--batch [script]", "Run add/mkdir/rm/label/boot commands, one per line, from script (default stdin) \n\t\t\ton one open FAT12/FAT32 image, writing metadata once at the end.");
+    printf("  %-15s\t%s\n", "--check [--repair]", "Check FAT mirrors, cluster chains, lost clusters and FSINFO; \n\t\t\t--repair rewrites FAT mirrors and FSINFO.");
+    printf("  %-15s\t%s\n", "--defrag", "Move every file and directory into one contiguous run and pack directories.");
+    printf("  %-15s\t%s\n", "-m  <manifest>", "Also copy the files listed in manifest, one path per line (used by -cp).");
+    printf("  %-15s\t%s\n", "-al <first/next/best>", "Cluster allocation policy used by -cp/-sync/--batch (default first).");
+    printf("  %-15s\t%s\n", "-mmap", "Modify the image through a memory mapping (used by -cp/-sync/--batch).");
+    printf("  %-15s\t%s\n", "-build <spec file>", "Build every image listed in spec file in parallel, one image per line: \n\t\t\t<image file> [options]... [-cp <dest file>...]. Use as: fatimg -build <spec file>.");
+    printf("  %-15s\t%s\n", "-j  <threads>", "Number of images built at the same time (used by -build, default CPU cores).");
+    printf("  %-15s\t%s\n", "-cache <dir>", "Reuse images with identical inputs from dir (used by -build, needs SOURCE_DATE_EPOCH).\n");
     printf("  %-15s\t%s\n", "-b  <boot file>", "Create a standard FAT12 image and init the image with boot file.");
     printf("  %-15s\t%s\n", "-f  <12/16/32/64>", "Create a FAT12/FAT16/FAT32/EXFAT image.");
     printf("  %-15s\t%s\n", "-s  <img size(MB)>", "Create a standard FAT12 image.");
@@ -4,12 +4,16 @@
 #ifndef FATIMG_FATIMG_H
 #define FATIMG_FATIMG_H
 
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
 
 #define OK 0
 #define ERROR -1
 #define NO_FIND -2
 #define BAD_FORMAT -3
 #define INSUFFICIENT_SPACE -4
+#define UNSUPPORTED -5
 
 
 /** 定义文件分割符 */
@@ -37,15 +41,377 @@ typedef char FILE_TYPE;
 #define TYPE_NOT_FOUND 3
 
 
+/****************************************************************
+ * 镜像写入层
+ ****************************************************************/
+/** 写入缓冲区大小 */
+#define IMG_IO_BUFFER_SIZE (4 * 1024 * 1024)
+/** 写入缓冲区对齐字节数 */
+#define IMG_IO_ALIGN 4096
+/** 拷贝文件时单次读写的最大字节数 */
+#define IMG_COPY_CHUNK_SIZE (16 * 1024 * 1024)
+
+/** 镜像打开方式 */
+#define IMG_OPEN_EXISTING 0
+#define IMG_OPEN_CREATE 1
+#define IMG_OPEN_KEEP 2
+#define IMG_OPEN_READ 3
+/** 以内存映射方式访问已存在的镜像(openFatImg) */
+#define IMG_OPEN_MMAP 0x10
+/** 以只读方式打开已存在的镜像(openFatImg)，关闭时不写回任何数据 */
+#define IMG_OPEN_RDONLY 0x20
+
+/** 镜像写入器 */
+typedef struct {
+    // 镜像文件描述符
+    int fd;
+    // 是否由写入器负责关闭文件描述符
+    int ownFd;
+    // 写入缓冲区
+    unsigned char *buf;
+    // 缓冲区容量
+    size_t cap;
+    // 缓冲区数据对应的镜像位置
+    long long bufPos;
+    // 缓冲区数据长度
+    size_t bufLen;
+    // 镜像文件当前实际大小
+    long long fileSize;
+    // 关闭时镜像文件应有的大小
+    long long size;
+    // 已发生的写入类系统调用次数
+    unsigned long syscalls;
+    // 镜像文件映射内存(未映射时为 NULL)
+    unsigned char *map;
+    // 映射长度
+    long long mapSize;
+    // 映射内存是否被修改
+    int mapDirty;
+    // 是否以只读方式打开
+    int readOnly;
+} ImgWriter;
+
+/** 打开镜像文件并创建写入器 */
+int imgWriterOpen(ImgWriter *w, const char *path, int mode);
+/** 将已打开的文件描述符关联到写入器 */
+int imgWriterAttach(ImgWriter *w, int fd);
+/** 向镜像指定位置写入数据 */
+int imgWriterWrite(ImgWriter *w, long long pos, const void *data, size_t len);
+/** 将镜像指定区域置 0 */
+int imgWriterZero(ImgWriter *w, long long pos, long long len);
+/** 设置镜像文件大小 */
+int imgWriterSetSize(ImgWriter *w, long long size);
+/** 从镜像指定位置读取数据 */
+int imgWriterRead(ImgWriter *w, long long pos, void *data, size_t len);
+/** 写出缓冲区中的数据 */
+int imgWriterFlush(ImgWriter *w);
+/** 将源文件的一段数据拷贝到镜像指定位置 */
+int imgWriterCopyFrom(ImgWriter *w, long long pos, int srcFd, long long srcPos, long long len);
+/** 将镜像的一段数据拷贝到目标文件当前位置 */
+int imgWriterCopyTo(ImgWriter *w, long long pos, int destFd, long long len);
+/** 将镜像文件已有的全部内容映射到内存 */
+int imgWriterMap(ImgWriter *w);
+/** 获取映射内存中指定位置的指针 */
+unsigned char* imgWriterMapPtr(ImgWriter *w, long long pos, size_t len);
+/** 写出全部数据、调整文件大小并释放写入器 */
+int imgWriterClose(ImgWriter *w);
+/** 获取本进程中已关闭的写入器发生的写入类系统调用总数 */
+unsigned long long getImgWriterSyscalls(void);
+/** 克隆镜像文件(reflink 或只拷贝数据区段) */
+int imgCloneFile(const char *src, const char *dest);
+
+
+/****************************************************************
+ * FAT表缓存及已打开的镜像
+ ****************************************************************/
+/** 簇分配策略 */
+#define ALLOC_FIRST_FIT 0
+#define ALLOC_NEXT_FIT 1
+#define ALLOC_BEST_FIT 2
+
+/** FSINFO 中未知的空闲簇数/下一空闲簇号 */
+#define FSINFO_UNKNOWN 0xFFFFFFFF
+/** 延迟载入FAT表时每次至少读取的字节数 */
+#define FAT_READ_AHEAD (64 * 1024)
+
+/** 连续簇区段 */
+typedef struct {
+    // 起始簇号
+    unsigned int start;
+    // 簇数
+    unsigned int count;
+} ClusterExtent;
+
+/** FAT12表项取值个数(12 位) */
+#define FAT12_MAX_ENTRIES 4096
+
+/** FAT表项编解码，按FAT类型特化，载入FAT表时选定 */
+typedef struct {
+    // 读取表项
+    unsigned int (*get)(const void *base, unsigned int clusterNum);
+    // 写入表项
+    void (*set)(void *base, unsigned int clusterNum, unsigned int value);
+    // 查找 [from, to) 中第一个空闲簇，没有返回 to
+    unsigned int (*findFree)(const void *base, unsigned int from, unsigned int to);
+    // 查找 [from, to) 中第一个已占用簇，没有返回 to
+    unsigned int (*findUsed)(const void *base, unsigned int from, unsigned int to);
+    // 为第 2 簇至 count - 1 簇建立空闲簇位图，返回空闲簇数
+    unsigned int (*mapFree)(const void *base, unsigned int count, unsigned long long *freeMap);
+    // 每个表项的位数
+    unsigned int entryBits;
+    // 修改一个表项涉及的字节数
+    unsigned int entryBytes;
+    // 簇链结束标记
+    unsigned int endFlag;
+} FatCodec;
+
+/** FAT表缓存 */
+typedef struct {
+    // FAT类型
+    FAT_TYPE type;
+    // FAT1 表内容
+    unsigned char *table;
+    // FAT12表项解包后的 16 位数组，写回前再打包到 table (其余类型为 NULL)
+    unsigned short *entries;
+    // 表项编解码
+    const FatCodec *codec;
+    // 编解码使用的表项数组(FAT12 为 entries，其余为 table)
+    void *base;
+    // 每个FAT表字节数
+    unsigned int size;
+    // FAT1 起始位置(字节)
+    long long pos;
+    // FAT表个数
+    unsigned int fatNum;
+    // 表项数(最大簇号 + 1)
+    unsigned int clusterCount;
+    // 脏标记粒度(字节，即扇区大小)
+    unsigned int sectorSize;
+    // 每扇区一个脏标记
+    unsigned char *dirty;
+    // 脏扇区数
+    unsigned int dirtyCount;
+    // FAT1 表内容是否直接位于镜像映射内存中
+    int mapped;
+    // 延迟载入时使用的镜像读写器
+    ImgWriter *io;
+    // 每扇区一个已载入标记(延迟载入时)，为 NULL 表示FAT1已全部载入
+    unsigned char *loaded;
+    // 空闲簇位图，每个簇一位，1 表示空闲(信任FSINFO提示时按需建立)
+    unsigned long long *freeMap;
+    // 空闲簇数
+    unsigned int freeCount;
+    // 下一次适应分配的起始簇号
+    unsigned int nextFree;
+} FatCache;
+
+/** 长文件名最大长度(UTF-16 字符数) */
+#define LFN_MAX_LEN 255
+/** 每个长文件名表项容纳的 UTF-16 字符数 */
+#define LFN_ITEM_CHARS 13
+/** 一个文件名最多占用的长文件名表项数 */
+#define LFN_MAX_ITEMS 20
+/** 目录表项文件名(UTF-8)缓冲区字节数 */
+#define DIR_NAME_SIZE (LFN_MAX_ITEMS * LFN_ITEM_CHARS * 3 + 1)
+
+/** 长文件名目录项结构，按序号倒序存放在对应的短文件名目录项之前 */
+typedef struct {
+    // 序号(从 1 开始)，长文件名最后一段的表项序号或 0x40
+    unsigned char ordinal;
+    // 长文件名1 (5 个 UTF-16 字符)
+    unsigned char name1[10];
+    // 文件属性，固定为 0x0F
+    unsigned char attr;
+    // 保留项
+    unsigned char reserved;
+    // 短文件名校验值
+    unsigned char checksum;
+    // 长文件名2 (6 个 UTF-16 字符)
+    unsigned char name2[12];
+    // 文件起始簇号 (固定为 0)
+    unsigned short firstCluster;
+    // 长文件名3 (2 个 UTF-16 字符)
+    unsigned char name3[4];
+} __attribute__((packed)) LongDirItem;
+
+/** 目录索引 */
+typedef struct {
+    // 目录数据(每项 32 字节)
+    unsigned char *data;
+    // 目录表项数
+    unsigned int itemNum;
+    // 脏标记粒度(字节，即扇区大小)
+    unsigned int sectorSize;
+    // 哈希桶，短文件名哈希到表项序号链表头，-1 表示空
+    int *heads;
+    // 哈希桶数(2 的幂)
+    unsigned int bucketNum;
+    // 同一哈希桶中的下一表项序号
+    int *next;
+    // 长文件名哈希桶(不区分大小写)，长文件名哈希到其短文件名表项序号
+    int *longHeads;
+    // 同一长文件名哈希桶中的下一表项序号，-2 表示表项没有长文件名
+    int *longNext;
+    // 各表项的长文件名哈希值
+    unsigned int *longHash;
+    // 按短文件名基名哈希的下一个 ~N 序号提示
+    unsigned int *aliasHints;
+    // 空闲表项位图，1 表示空闲
+    unsigned long long *freeMap;
+    // 空闲表项数
+    unsigned int freeCount;
+    // 每扇区一个脏标记
+    unsigned char *dirty;
+    // 脏扇区数
+    unsigned int dirtyCount;
+} DirIndex;
+
+/** 已载入内存的子目录，在打开的镜像中按起始簇号缓存，关闭镜像时写回被修改的扇区 */
+typedef struct SubDir {
+    // 子目录起始簇号
+    unsigned int firstCluster;
+    // 子目录索引(目录数据为 index.data)
+    DirIndex index;
+    // 子目录簇链中的各簇号
+    unsigned int *clusters;
+    // 子目录簇数
+    unsigned int clusterNum;
+    // 同一哈希桶(或已释放链表)中的下一个子目录
+    struct SubDir *next;
+} SubDir;
+
+/** 已打开的FAT镜像 */
+typedef struct {
+    // 镜像读写器
+    ImgWriter io;
+    // FAT类型
+    FAT_TYPE type;
+    // 每扇区字节数
+    unsigned int bytesPerSector;
+    // 每簇扇区数
+    unsigned int sectorsPerCluster;
+    // 每簇字节数
+    unsigned int bytesPerCluster;
+    // 根目录区起始位置(FAT12/FAT16，字节)
+    long long rootPos;
+    // 根目录项数(FAT32 为根目录簇链可容纳的项数)
+    unsigned int rootEntCount;
+    // 根目录区缓存(FAT32 为根目录簇链数据)
+    unsigned char *rootDir;
+    // 根目录区缓存是否直接位于镜像映射内存中
+    int rootMapped;
+    // 根目录索引，根目录的查找、替换及插入均通过索引完成
+    DirIndex rootIndex;
+    // 根目录起始簇号(FAT32)
+    unsigned int rootCluster;
+    // FSINFO 扇区位置(FAT32，字节)，无 FSINFO 为 0
+    long long fsInfoPos;
+    // 打开镜像时FSINFO中的空闲簇数及下一空闲簇号
+    unsigned int fsInfoFree;
+    unsigned int fsInfoNext;
+    // 数据区起始位置(字节)
+    long long dataPos;
+    // FAT表缓存
+    FatCache fat;
+    // 簇分配策略
+    int allocPolicy;
+    // 已载入的子目录，按起始簇号哈希
+    SubDir **subDirs;
+    // 子目录哈希桶数(2 的幂)
+    unsigned int subDirBucketNum;
+    // 已载入的子目录数
+    unsigned int subDirNum;
+    // 簇已释放的子目录，关闭镜像时直接释放，不写回
+    SubDir *droppedSubDirs;
+} FatImg;
+
+/** 打开FAT镜像，读取BPB信息并载入FAT表 */
+int openFatImg(FatImg *img, const char *path, int mode);
+/** 写回FAT表并关闭FAT镜像 */
+int closeFatImg(FatImg *img);
+/** 簇号对应的数据区位置(字节) */
+long long getClusterPos(FatImg *img, unsigned int clusterNum);
+/** 为FAT32根目录追加一簇 */
+int growRootDir(FatImg *img);
+/** 查找已载入的子目录 */
+SubDir* findSubDir(FatImg *img, unsigned int firstCluster);
+/** 将载入的子目录加入镜像的子目录缓存 */
+int addSubDir(FatImg *img, SubDir *dir);
+/** 子目录的簇被释放时从缓存中移除，其修改不再写回 */
+void dropSubDir(FatImg *img, unsigned int firstCluster);
+
+
+/** 为已载入内存的目录数据建立索引 */
+int buildDirIndex(DirIndex *dir, unsigned char *data, unsigned int itemNum, unsigned int sectorSize);
+/** 目录数据扩大后同步扩展索引 */
+int growDirIndex(DirIndex *dir, unsigned char *data, unsigned int itemNum);
+/** 释放目录索引 */
+void freeDirIndex(DirIndex *dir);
+/** 按短文件名查找目录表项 */
+int findDirItem(DirIndex *dir, const char *shortName);
+/** 查找序号最小的空闲目录表项 */
+int findFreeDirItem(DirIndex *dir);
+/** 写入目录表项并更新索引 */
+void setDirItem(DirIndex *dir, unsigned int slot, const void *item);
+/** 删除目录表项(连同其长文件名表项)并更新索引 */
+void removeDirItem(DirIndex *dir, unsigned int slot);
+/** 查找连续的空闲目录表项 */
+int findFreeDirRun(DirIndex *dir, unsigned int count);
+/** 短文件名表项及其长文件名表项所占的表项数 */
+unsigned int getDirItemSpan(DirIndex *dir, unsigned int slot);
+/** 按文件名查找目录表项(长文件名不区分大小写) */
+int findDirItemByName(DirIndex *dir, const char *name);
+/** 获取目录表项的文件名(长文件名或还原大小写的短文件名) */
+void getDirItemName(DirIndex *dir, unsigned int slot, char *name);
+/** 为文件名生成目录中唯一的短文件名 */
+int makeShortName(DirIndex *dir, const char *name, char *shortName, unsigned char *caseFlags);
+/** 写入文件名的长文件名表项及短文件名表项 */
+int insertDirItem(DirIndex *dir, const char *name, unsigned int lfnNum, const void *item);
+
+
 /****************************************************************
  * FAT12
  ****************************************************************/
+/** 镜像中的文件或目录信息 */
+typedef struct {
+    // 文件类型
+    FILE_TYPE type;
+    // 文件属性
+    unsigned char attr;
+    // 文件大小(字节)，目录为 0
+    unsigned long long size;
+    // 起始簇号，空文件及FAT12/FAT16根目录为 0
+    unsigned int firstCluster;
+    // 簇链长度
+    unsigned int clusterNum;
+} ImgItemInfo;
+
 /** 创建标准的空的fat12软盘镜像(1.44M) */
 int createEmptyFat12img(char*, char*);
 /** 创建一个标准的自定义引导扇区的fat12软盘镜像(1.44M) */
 int createCustomBootFat12img(char*, char*, char);
-/** 拷贝文件到FAT12软盘镜像 */
-int copyFileToFat12img(char*, char*, char);
+/** 拷贝多个文件到FAT12软盘镜像 */
+int copyFilesToFat12img(char*, char**, unsigned int, char, int, int);
+/** 拷贝文件到已打开的镜像根目录中 */
+int addFileToImg(FatImg*, char*, char);
+/** 拷贝目录及其全部子项到已打开的镜像根目录中 */
+int addDirToImg(FatImg*, char*);
+/** 拷贝本地文件或目录(递归)到已打开镜像中的目录 */
+int addPathToImgDir(FatImg *img, const char *hostPath, const char *imgDirPath);
+/** 在已打开的镜像中创建目录(含不存在的上级目录) */
+int makeImgDir(FatImg *img, const char *imgPath);
+/** 从已打开的镜像中删除文件或目录 */
+int removeImgPath(FatImg *img, const char *imgPath);
+/** 查找已打开镜像中的文件或目录 */
+int lookupImgPath(FatImg *img, const char *imgPath, ImgItemInfo *info);
+/** 设置已打开镜像的卷标 */
+int setImgVolumeLabel(FatImg *img, const char *volumeLabel);
+/** 将引导文件中的引导代码写入已打开的镜像(保留BPB) */
+int setImgBootCode(FatImg *img, const char *bootPath);
+/** 将本地目录同步到FAT12/FAT32镜像的根目录 */
+int syncDirToFatImg(char*, char*, int, int);
+/** 从FAT12/FAT32镜像中提取文件或目录，或将文件内容输出到标准输出 */
+int extractFromFatImg(char*, char*, char*);
 
 
 /****************************************************************
@@ -55,6 +421,139 @@ int copyFileToFat12img(char*, char*, char);
 int createEmptyFat32img(char *imgPath, float size,  int cluster);
 /** 创建自定义引导扇区的fat32软盘镜像 */
 int createCustomBootFat32img(char *imgPath, char *bootPath, float size, int cluster);
+/** 拷贝多个文件到FAT32镜像 */
+int copyFilesToFat32img(char*, char**, unsigned int, char, int, int);
+/** 构造FAT32文件系统信息扇区(FSINFO) */
+void buildFSInfoSector(unsigned char *sector, unsigned int freeCount, unsigned int nextFree);
+
+
+/****************************************************************
+ * EXFAT
+ ****************************************************************/
+/** 创建空的exFAT镜像 */
+int createEmptyExfatImg(char *imgPath, float size, int cluster, char *volumeLabel);
+/** 拷贝多个文件或目录到exFAT镜像 */
+int copyFilesToExfatImg(char *imgPath, char **filePaths, unsigned int fileNum);
+
+
+/****************************************************************
+ * 镜像检查
+ ****************************************************************/
+/** 检查FAT镜像的一致性，可选修复备份FAT表及FSINFO */
+int checkFatImg(char *imgPath, int repair);
+
+/** 整理镜像碎片，使每个文件及目录连续存放并紧缩目录 */
+int defragFatImg(char *imgPath);
+
+
+/****************************************************************
+ * 文件清单
+ ****************************************************************/
+/** 文件清单，全部条目共用一块内存 */
+typedef struct {
+    // 清单文件内容，各条目原地以 '\0' 结尾
+    char *data;
+    // 条目指针数组
+    char **entries;
+    // 条目数
+    unsigned int count;
+} FileList;
+
+/** 读取文件清单 */
+int loadFileList(const char *path, FileList *list);
+/** 从已打开的文件(如标准输入)读取文件清单 */
+int readFileList(FILE *fp, FileList *list);
+/** 释放文件清单 */
+void freeFileList(FileList *list);
+/** 将清单条目按空白切分为参数 */
+int splitListEntry(char *entry, char **args, int maxArgs);
+
+
+/****************************************************************
+ * 构建缓存
+ ****************************************************************/
+/** 输入哈希状态(128 位) */
+typedef struct {
+    // 4 路累加器
+    unsigned long long lanes[4];
+    // 未满 32 字节的剩余数据
+    unsigned char buf[32];
+    // 剩余数据长度
+    unsigned int bufLen;
+    // 已输入的总字节数
+    unsigned long long total;
+} InputHash;
+
+/** 初始化输入哈希 */
+void inputHashInit(InputHash *h);
+/** 向输入哈希追加数据 */
+void inputHashUpdate(InputHash *h, const void *data, size_t len);
+/** 向输入哈希追加文件或目录(递归)的名称、时间及内容 */
+int inputHashPath(InputHash *h, const char *path);
+/** 结束输入哈希，得到 32 个十六进制字符的键 */
+void inputHashFinal(InputHash *h, char key[33]);
+/** 释放本次运行中已计算的文件内容摘要 */
+void clearContentDigests();
+/** 从构建缓存中取出镜像 */
+int fetchCachedImage(const char *cacheDir, const char *key, const char *imgPath);
+/** 将镜像存入构建缓存 */
+int storeCachedImage(const char *cacheDir, const char *key, const char *imgPath);
+
+
+/****************************************************************
+ * 并行任务
+ ****************************************************************/
+/** 并行任务入口，index 为任务序号，返回任务结果 */
+typedef int (*JobFunc)(void *arg, unsigned int index);
+
+/** 在线程池中并行执行若干任务 */
+int runParallelJobs(unsigned int jobNum, unsigned int threadNum, JobFunc func, void *arg, int *results);
+/** 获取可用的处理器核数 */
+unsigned int getProcessorNum();
+
+
+/****************************************************************
+ * 文件树
+ ****************************************************************/
+/** 本地文件树节点 */
+typedef struct FileNode {
+    // 文件路径
+    char *path;
+    // 文件名(指向 path 中的文件名部分)
+    char *name;
+    // 文件类型
+    FILE_TYPE type;
+    // 文件大小(字节)
+    unsigned long long size;
+    // 文件创建时间
+    int createTimes[6];
+    // 子项(目录)
+    struct FileNode *children;
+    // 子项数
+    unsigned int childNum;
+    // 子项数组容量
+    unsigned int childCap;
+
+    // 镜像中的短文件名(8 + 3 + '\0')
+    char shortName[12];
+    // 短文件名大小写标记(目录表项第 12 字节)
+    unsigned char caseFlags;
+    // 在上级目录数据中的短文件名表项序号
+    unsigned int dirSlot;
+    // 目录数据(目录，含长文件名表项)
+    unsigned char *dirData;
+    // 目录数据表项数
+    unsigned int dirItemNum;
+    // 在镜像中占用的连续簇区段
+    ClusterExtent *extents;
+    // 区段数
+    unsigned int extentNum;
+} FileNode;
+
+/** 扫描本地文件树 */
+int scanFileTree(const char *path, FileNode *root);
+/** 释放文件树 */
+void freeFileTree(FileNode *root);
 
 
 /****************************************************************
@@ -68,8 +567,18 @@ char* strUpper(char* str);
 FAT_TYPE getImageFatType(const char* path);
 /** 获取文件类型 */
 FILE_TYPE getFileType(const char *path);
+/** 获取已打开文件的大小 */
+long long getFileSize(FILE *fp);
 /** 获取文件创建时间 */
 void getFileCreateTimeArray(const char *path, int *dest);
+/** 获取本地时间(线程安全) */
+struct tm* getLocalTime(time_t t, struct tm *result);
+/** 设置可重现构建的固定时间及卷序列号种子 */
+void setReproducibleBuild(long long epoch, unsigned int volumeSeed);
+/** 获取可重现构建设置 */
+int getReproducibleBuild(long long *epoch, unsigned int *volumeSeed);
+/** 获取写入镜像的时间 */
+time_t getBuildTime(time_t t);
 /** 格式化时间为FAT时间格式 */
 unsigned short formatTime();
 /** 格式化日期为日期格式 */
@@ -82,20 +591,47 @@ unsigned short formatCreateTimeArray(int *time);
 void formatFileName(char*, char*);
 /** 根据短文件名获取长文件名目录项的校验值 @return 校验值 */
 unsigned char getChecksumByShortName(const char*);
+/** 生成文件名对应的短文件名基名 */
+int getShortNameBasis(const char *name, char *basis, unsigned char *caseFlags);
+/** 文件名所需的长文件名表项数 */
+int getLongNameItemNum(const char *name);
+/** UTF-8 文件名转 UTF-16 */
+int utf8ToUtf16(const char *src, unsigned short *dest, int max);
+/** UTF-16 文件名转 UTF-8 */
+void utf16ToUtf8(const unsigned short *src, int len, char *dest);
 /** 格式化 FAT12 卷标 */
 void formatFat12VolumeLabel(char[12], const char*);
 /** 检查 FAT12 卷标是否合法 */
 char isValidFat12VolumeLabel(const char*);
 
 
+/** 载入FAT表缓存 */
+int loadFatCache(FatCache *fat, ImgWriter *io, long long fatPos, unsigned int fatSize,
+                 unsigned int fatNum, unsigned int clusterCount, unsigned int sectorSize, FAT_TYPE type,
+                 unsigned int freeHint, unsigned int nextHint);
+/** 将FAT表缓存的脏区域写入全部FAT表 */
+int flushFatCache(FatCache *fat, ImgWriter *io);
+/** 释放FAT表缓存 */
+void freeFatCache(FatCache *fat);
 /** 向本簇号指向的FAT文件分配表表项中写入簇链的下一簇号 */
-void setNextClusterLinkNum(FILE *fp, long fat1Pos, long fat2Pos, unsigned int clusterNum, unsigned int nextClusterNum, FAT_TYPE);
+void setNextClusterLinkNum(FatCache *fat, unsigned int clusterNum, unsigned int nextClusterNum);
 /** 通过本簇号在FAT中查找文件/目录簇链的下一簇号 */
-unsigned int getNextClusterLinkNum(FILE* fp, long fatPos, unsigned int clusterNum, FAT_TYPE type);
+unsigned int getNextClusterLinkNum(FatCache *fat, unsigned int clusterNum);
 /** 在FAT中寻找空簇 */
-unsigned int findEmptyCluster(FILE *fp, long fatPos, long fatSize, unsigned int startNum, FAT_TYPE);
+unsigned int findEmptyCluster(FatCache *fat, unsigned int startNum);
 /** 查找FAT空闲簇数 */
-unsigned int getFreeClusterNum(FILE *fp, long fatPos, long fatSize, FAT_TYPE type);
+unsigned int getFreeClusterNum(FatCache *fat);
+/** 获取FAT类型对应的表项编解码 */
+const FatCodec *getFatCodec(FAT_TYPE type);
+/** 获取FAT类型对应的簇链结束标记 */
+unsigned int getEndClusterFlag(FAT_TYPE type);
+/** 按分配策略为文件分配若干段连续簇并建立簇链 */
+int allocClusterExtents(FatCache *fat, unsigned int needClusters, int policy,
+                        ClusterExtent **extents, unsigned int *extentNum);
+/** 将FAT12表解包为 16 位表项数组 */
+void unpackFat12(const unsigned char *src, unsigned short *dest, unsigned int count);
+/** 将 16 位表项数组打包为FAT12表 */
+void packFat12(const unsigned short *src, unsigned char *dest, unsigned int count);
 
 
 #endif // FATIMG_FATIMG_H
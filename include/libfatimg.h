@@ -0,0 +1,76 @@
+/**
+ * libfatimg FAT镜像库头文件
+ * 通过不透明的镜像句柄操作FAT12/FAT32镜像：句柄中保存解析后的BPB、FAT表缓存、根目录索引及镜像文件描述符，
+ * 同一句柄上的多次操作不再重复打开镜像或扫描FAT表；FAT表、目录及FSINFO在关闭句柄时一次写回，已载入的子目录在句柄关闭前一直保留
+ */
+#ifndef FATIMG_LIBFATIMG_H
+#define FATIMG_LIBFATIMG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** 返回值(与 fatimg 命令行工具相同) */
+#define FATIMG_OK 0
+#define FATIMG_ERROR -1
+#define FATIMG_NO_FIND -2
+#define FATIMG_BAD_FORMAT -3
+#define FATIMG_INSUFFICIENT_SPACE -4
+
+/** 镜像类型 */
+#define FATIMG_FAT12 12
+#define FATIMG_FAT32 32
+
+/** 打开方式 */
+#define FATIMG_OPEN_MMAP 0x10
+#define FATIMG_OPEN_READONLY 0x20
+
+/** 簇分配策略 */
+#define FATIMG_ALLOC_FIRST_FIT 0
+#define FATIMG_ALLOC_NEXT_FIT 1
+#define FATIMG_ALLOC_BEST_FIT 2
+
+/** 已打开的镜像句柄 */
+typedef struct FatImgHandle FatImgHandle;
+
+/** 镜像中的文件或目录信息 */
+typedef struct {
+    // 是否为目录
+    int isDir;
+    // 文件属性
+    unsigned char attr;
+    // 文件大小(字节)，目录为 0
+    unsigned long long size;
+    // 起始簇号，空文件及FAT12根目录为 0
+    unsigned int firstCluster;
+    // 簇链长度
+    unsigned int clusterNum;
+} FatImgEntry;
+
+
+/** 打开已存在的FAT12/FAT32镜像 */
+int fatimgOpen(const char *path, int flags, FatImgHandle **handle);
+/** 创建空的FAT12/FAT32镜像并打开 */
+int fatimgCreate(const char *path, int fatType, float size, int secPerCluster, const char *volumeLabel, FatImgHandle **handle);
+/** 设置簇分配策略 */
+int fatimgSetAllocPolicy(FatImgHandle *handle, int policy);
+/** 拷贝本地文件或目录(递归)到镜像中的目录 */
+int fatimgAdd(FatImgHandle *handle, const char *hostPath, const char *imgDir);
+/** 在镜像中创建目录(含不存在的上级目录) */
+int fatimgMkdir(FatImgHandle *handle, const char *imgPath);
+/** 从镜像中删除文件或目录 */
+int fatimgRemove(FatImgHandle *handle, const char *imgPath);
+/** 查找镜像中的文件或目录 */
+int fatimgLookup(FatImgHandle *handle, const char *imgPath, FatImgEntry *entry);
+/** 设置镜像卷标 */
+int fatimgSetLabel(FatImgHandle *handle, const char *volumeLabel);
+/** 将引导文件中的引导代码写入镜像(保留BPB) */
+int fatimgSetBoot(FatImgHandle *handle, const char *bootPath);
+/** 写回FAT表、目录及FSINFO并关闭镜像句柄 */
+int fatimgClose(FatImgHandle *handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FATIMG_LIBFATIMG_H
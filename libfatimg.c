@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include "include/fatimg.h"
+#include "include/libfatimg.h"
+
+
+/** 已打开的镜像句柄 */
+struct FatImgHandle {
+    // 已打开的镜像(BPB、FAT表缓存、根目录索引及镜像读写器)
+    FatImg img;
+};
+
+
+/**
+ * 打开已存在的FAT12/FAT32镜像
+ * @param path - 镜像文件路径
+ * @param flags - FATIMG_OPEN_MMAP 以内存映射方式修改镜像，FATIMG_OPEN_READONLY 只读打开
+ * @param handle - 返回镜像句柄，由 fatimgClose 关闭
+ * @return 镜像不存在返回 FATIMG_NO_FIND，不是FAT12/FAT32镜像返回 FATIMG_BAD_FORMAT
+ */
+int fatimgOpen(const char *path, int flags, FatImgHandle **handle) {
+    FatImgHandle *h;
+    int status;
+
+    *handle = NULL;
+    h = (FatImgHandle*) malloc(sizeof(FatImgHandle));
+    if (h == NULL) return ERROR;
+
+    status = openFatImg(&h->img, path, flags & (IMG_OPEN_MMAP | IMG_OPEN_RDONLY));
+    if (status == OK && h->img.type != FAT12 && h->img.type != FAT32) {
+        closeFatImg(&h->img);
+        status = BAD_FORMAT;
+    }
+    if (status != OK) {
+        free(h);
+        return status;
+    }
+
+    h->img.allocPolicy = ALLOC_FIRST_FIT;
+    *handle = h;
+    return OK;
+}
+
+
+/**
+ * 创建空的FAT12/FAT32镜像并打开
+ * @param path - 镜像文件路径
+ * @param fatType - FATIMG_FAT12 (1.44M 软盘镜像) 或 FATIMG_FAT32
+ * @param size - 镜像大小(MB，FAT32 有效，不超过 32GB)
+ * @param secPerCluster - 每簇扇区数(FAT32 有效)，0 按镜像大小选择
+ * @param volumeLabel - 卷标(FAT12 有效)，NULL 使用默认卷标
+ * @param handle - 返回镜像句柄，由 fatimgClose 关闭
+ * @return 镜像类型、大小或每簇扇区数无效返回 FATIMG_BAD_FORMAT
+ */
+int fatimgCreate(const char *path, int fatType, float size, int secPerCluster, const char *volumeLabel, FatImgHandle **handle) {
+    int status;
+
+    *handle = NULL;
+    if (fatType == FAT12) {
+        status = createEmptyFat12img((char*) path, (char*) (volumeLabel != NULL ? volumeLabel : "FATIMG     "));
+    } else if (fatType == FAT32 && size > 0 && size <= 32768) {
+        status = createEmptyFat32img((char*) path, size, secPerCluster);
+    } else {
+        status = BAD_FORMAT;
+    }
+    if (status != OK) return status;
+
+    return fatimgOpen(path, 0, handle);
+}
+
+
+/**
+ * 设置簇分配策略
+ * @param handle - 镜像句柄
+ * @param policy - FATIMG_ALLOC_FIRST_FIT / FATIMG_ALLOC_NEXT_FIT / FATIMG_ALLOC_BEST_FIT
+ * @return 策略无效返回 FATIMG_BAD_FORMAT
+ */
+int fatimgSetAllocPolicy(FatImgHandle *handle, int policy) {
+    if (policy != ALLOC_FIRST_FIT && policy != ALLOC_NEXT_FIT && policy != ALLOC_BEST_FIT) return BAD_FORMAT;
+    handle->img.allocPolicy = policy;
+    return OK;
+}
+
+
+/**
+ * 拷贝本地文件或目录(递归)到镜像中的目录
+ * 目录中存在同名(不区分大小写)的文件或目录时先删除旧的再拷贝，空间不足时保留旧的
+ * @param handle - 镜像句柄
+ * @param hostPath - 本地文件或目录
+ * @param imgDir - 镜像内目标目录路径，NULL 或 "/" 表示根目录
+ * @return 目标目录不存在返回 FATIMG_NO_FIND，空间不足返回 FATIMG_INSUFFICIENT_SPACE
+ */
+int fatimgAdd(FatImgHandle *handle, const char *hostPath, const char *imgDir) {
+    if (handle->img.io.readOnly) return ERROR;
+    return addPathToImgDir(&handle->img, hostPath, imgDir);
+}
+
+
+/**
+ * 在镜像中创建目录，路径中不存在的各级目录依次创建
+ * @param handle - 镜像句柄
+ * @param imgPath - 镜像内目录路径
+ * @return 路径中某一级是文件返回 FATIMG_BAD_FORMAT
+ */
+int fatimgMkdir(FatImgHandle *handle, const char *imgPath) {
+    if (handle->img.io.readOnly) return ERROR;
+    return makeImgDir(&handle->img, imgPath);
+}
+
+
+/**
+ * 从镜像中删除文件或目录(连同全部子项)
+ * @param handle - 镜像句柄
+ * @param imgPath - 镜像内路径
+ * @return 路径不存在返回 FATIMG_NO_FIND
+ */
+int fatimgRemove(FatImgHandle *handle, const char *imgPath) {
+    if (handle->img.io.readOnly) return ERROR;
+    return removeImgPath(&handle->img, imgPath);
+}
+
+
+/**
+ * 查找镜像中的文件或目录
+ * @param handle - 镜像句柄
+ * @param imgPath - 镜像内路径，"/" 表示根目录
+ * @param entry - 返回文件或目录信息
+ * @return 路径不存在返回 FATIMG_NO_FIND
+ */
+int fatimgLookup(FatImgHandle *handle, const char *imgPath, FatImgEntry *entry) {
+    ImgItemInfo info;
+    int status = lookupImgPath(&handle->img, imgPath, &info);
+
+    entry->isDir = info.type == TYPE_DIRECTORY;
+    entry->attr = info.attr;
+    entry->size = info.size;
+    entry->firstCluster = info.firstCluster;
+    entry->clusterNum = info.clusterNum;
+    return status;
+}
+
+
+/**
+ * 设置镜像卷标(引导扇区及根目录卷标表项)
+ * @param handle - 镜像句柄
+ * @param volumeLabel - 卷标，最多 11 个字符
+ * @return 卷标含非法字符返回 FATIMG_BAD_FORMAT
+ */
+int fatimgSetLabel(FatImgHandle *handle, const char *volumeLabel) {
+    if (handle->img.io.readOnly) return ERROR;
+    return setImgVolumeLabel(&handle->img, volumeLabel);
+}
+
+
+/**
+ * 将引导文件中的引导代码写入镜像，镜像的BPB保持不变
+ * @param handle - 镜像句柄
+ * @param bootPath - 引导扇区二进制文件路径
+ * @return 引导文件不存在返回 FATIMG_NO_FIND，引导扇区无效返回 FATIMG_BAD_FORMAT
+ */
+int fatimgSetBoot(FatImgHandle *handle, const char *bootPath) {
+    if (handle->img.io.readOnly) return ERROR;
+    return setImgBootCode(&handle->img, bootPath);
+}
+
+
+/**
+ * 写回FAT表、目录及FSINFO并关闭镜像句柄
+ * @param handle - 镜像句柄，可以为 NULL
+ * @return
+ */
+int fatimgClose(FatImgHandle *handle) {
+    int status;
+
+    if (handle == NULL) return OK;
+    status = closeFatImg(&handle->img);
+    free(handle);
+    return status;
+}
@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/fatimg.h"
+
+#include <sys/stat.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <direct.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+
+/** 哈希常数 */
+#define HASH_PRIME1 11400714785074694791ULL
+#define HASH_PRIME2 14029467366897019727ULL
+#define HASH_PRIME3 1609587929392839161ULL
+/** 读取文件内容时的缓冲区大小 */
+#define HASH_READ_SIZE (1024 * 1024)
+
+
+/** 已计算的文件内容摘要 */
+typedef struct ContentDigest {
+    // 文件路径
+    char *path;
+    // 计算摘要时的文件大小及修改时间
+    long long size;
+    long long mtime;
+    // 内容摘要
+    char key[33];
+    struct ContentDigest *next;
+} ContentDigest;
+
+/** 本次运行中已计算的文件内容摘要，多个镜像引用同一文件时只读取一次 */
+static ContentDigest *digests = NULL;
+#if !defined(_WIN32) && !defined(_WIN64)
+static pthread_mutex_t digestLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+/** 累加一个 64 位输入 */
+static unsigned long long hashRound(unsigned long long acc, unsigned long long input);
+/** 混合 64 位哈希值的各位 */
+static unsigned long long hashAvalanche(unsigned long long h);
+/** 累加 32 字节数据块 */
+static void hashBlock(InputHash *h, const unsigned char *block);
+/** 向输入哈希追加文件树节点 */
+static int hashNode(InputHash *h, FileNode *node);
+/** 向输入哈希追加文件内容摘要 */
+static int hashFileContent(InputHash *h, const char *path);
+/** 计算文件内容摘要 */
+static int digestFile(const char *path, long long size, char key[33]);
+
+
+/**
+ * 初始化输入哈希
+ * 4 路 64 位累加器每次处理 32 字节，输入较大时(引导文件、载荷)速度接近内存带宽
+ * @param h - 哈希状态
+ */
+void inputHashInit(InputHash *h) {
+    memset(h, 0, sizeof(InputHash));
+    h->lanes[0] = HASH_PRIME1 + HASH_PRIME2;
+    h->lanes[1] = HASH_PRIME2;
+    h->lanes[2] = 0;
+    h->lanes[3] = 0 - HASH_PRIME1;
+}
+
+
+/**
+ * 向输入哈希追加数据
+ * @param h - 哈希状态
+ * @param data - 数据
+ * @param len - 长度(字节)
+ */
+void inputHashUpdate(InputHash *h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char*) data;
+    size_t n;
+
+    h->total += len;
+    if (h->bufLen > 0) {
+        n = 32 - h->bufLen < len ? 32 - h->bufLen : len;
+        memcpy(h->buf + h->bufLen, p, n);
+        h->bufLen += (unsigned int) n;
+        p += n;
+        len -= n;
+        if (h->bufLen < 32) return;
+        hashBlock(h, h->buf);
+        h->bufLen = 0;
+    }
+    while (len >= 32) {
+        hashBlock(h, p);
+        p += 32;
+        len -= 32;
+    }
+    memcpy(h->buf, p, len);
+    h->bufLen = (unsigned int) len;
+}
+
+
+/**
+ * 向输入哈希追加文件或目录(递归)
+ * 文件追加类型、大小、写入镜像的时间及内容，目录按扫描顺序追加各子项的名称及内容，
+ * 与拷贝到镜像中的内容一一对应
+ * @param h - 哈希状态
+ * @param path - 文件或目录路径
+ * @return 路径不存在返回 NO_FIND
+ */
+int inputHashPath(InputHash *h, const char *path) {
+    FileNode tree;
+    int status = scanFileTree(path, &tree);
+
+    if (status != OK) return status;
+    status = hashNode(h, &tree);
+    freeFileTree(&tree);
+    return status;
+}
+
+
+/**
+ * 结束输入哈希
+ * @param h - 哈希状态
+ * @param key - 32 个十六进制字符及 '\0'
+ */
+void inputHashFinal(InputHash *h, char key[33]) {
+    unsigned long long tail[4] = {0}, high, low;
+    unsigned int i;
+
+    // 剩余数据补 0 后作为最后一块，总长度参与混合以区分补 0 前后的数据
+    if (h->bufLen > 0) {
+        memcpy(tail, h->buf, h->bufLen);
+        hashBlock(h, (const unsigned char*) tail);
+    }
+    high = h->total * HASH_PRIME3;
+    low = ~h->total;
+    for (i = 0; i < 4; i ++) {
+        high = hashRound(high, h->lanes[i]);
+        low = hashRound(low ^ HASH_PRIME2, h->lanes[3 - i]);
+    }
+    sprintf(key, "%016llx%016llx", hashAvalanche(high), hashAvalanche(low ^ high));
+}
+
+
+/**
+ * 释放本次运行中已计算的文件内容摘要
+ */
+void clearContentDigests() {
+    ContentDigest *next;
+
+    while (digests != NULL) {
+        next = digests->next;
+        free(digests->path);
+        free(digests);
+        digests = next;
+    }
+}
+
+
+/**
+ * 从构建缓存中取出镜像
+ * 以 reflink 或拷贝方式取出，不使用硬链接，避免此后修改镜像时改动缓存中的数据
+ * @param cacheDir - 缓存目录
+ * @param key - 输入哈希键
+ * @param imgPath - 镜像文件路径
+ * @return 缓存中不存在返回 NO_FIND
+ */
+int fetchCachedImage(const char *cacheDir, const char *key, const char *imgPath) {
+    char *path = (char*) malloc(strlen(cacheDir) + 40);
+    int status;
+
+    if (path == NULL) return ERROR;
+    sprintf(path, "%s%c%s.img", cacheDir, SEPARATOR, key);
+    status = getFileType(path) == TYPE_FILE ? imgCloneFile(path, imgPath) : NO_FIND;
+    free(path);
+    return status;
+}
+
+
+/**
+ * 将镜像存入构建缓存
+ * 先写入临时文件再改名，并行构建相同镜像或缓存目录被多个进程共享时不会读到不完整的缓存
+ * @param cacheDir - 缓存目录，不存在时创建
+ * @param key - 输入哈希键
+ * @param imgPath - 镜像文件路径
+ * @return
+ */
+int storeCachedImage(const char *cacheDir, const char *key, const char *imgPath) {
+    char *path, *tmpPath;
+    unsigned int pathHash = 2166136261u;
+    const char *p;
+    int status;
+
+    if (getFileType(cacheDir) == TYPE_NOT_FOUND) {
+#if defined(_WIN32) || defined(_WIN64)
+        _mkdir(cacheDir);
+#else
+        mkdir(cacheDir, 0755);
+#endif
+    }
+
+    path = (char*) malloc(strlen(cacheDir) + 40);
+    tmpPath = (char*) malloc(strlen(cacheDir) + 80);
+    if (path == NULL || tmpPath == NULL) {
+        free(path);
+        free(tmpPath);
+        return ERROR;
+    }
+
+    // 临时文件名包含进程号及镜像路径哈希，同一进程中不同镜像构建相同内容时互不覆盖
+    for (p = imgPath; *p; p ++) {
+        pathHash = (pathHash ^ (unsigned char) *p) * 16777619u;
+    }
+    sprintf(path, "%s%c%s.img", cacheDir, SEPARATOR, key);
+    sprintf(tmpPath, "%s%c%s.%lu.%08x.tmp", cacheDir, SEPARATOR, key, (unsigned long) getpid(), pathHash);
+
+    status = imgCloneFile(imgPath, tmpPath);
+    if (status == OK && rename(tmpPath, path) != 0) status = ERROR;
+    if (status != OK) remove(tmpPath);
+
+    free(path);
+    free(tmpPath);
+    return status;
+}
+
+
+/**
+ * 累加一个 64 位输入
+ * @param acc - 累加器
+ * @param input - 输入
+ * @return
+ */
+static unsigned long long hashRound(unsigned long long acc, unsigned long long input) {
+    acc += input * HASH_PRIME2;
+    acc = (acc << 31) | (acc >> 33);
+    return acc * HASH_PRIME1;
+}
+
+
+/**
+ * 混合 64 位哈希值的各位
+ * @param h - 哈希值
+ * @return
+ */
+static unsigned long long hashAvalanche(unsigned long long h) {
+    h ^= h >> 33;
+    h *= HASH_PRIME2;
+    h ^= h >> 29;
+    h *= HASH_PRIME3;
+    return h ^ (h >> 32);
+}
+
+
+/**
+ * 累加 32 字节数据块，每路累加器处理 8 字节
+ * @param h - 哈希状态
+ * @param block - 数据块
+ */
+static void hashBlock(InputHash *h, const unsigned char *block) {
+    unsigned long long words[4];
+    unsigned int i;
+
+    memcpy(words, block, 32);
+    for (i = 0; i < 4; i ++) {
+        h->lanes[i] = hashRound(h->lanes[i], words[i]);
+    }
+}
+
+
+/**
+ * 向输入哈希追加文件树节点
+ * @param h - 哈希状态
+ * @param node - 文件树节点
+ * @return
+ */
+static int hashNode(InputHash *h, FileNode *node) {
+    unsigned int i;
+    int status = OK;
+
+    inputHashUpdate(h, node->name, strlen(node->name) + 1);
+    inputHashUpdate(h, &node->type, sizeof(node->type));
+    inputHashUpdate(h, node->createTimes, sizeof(node->createTimes));
+    if (node->type != TYPE_DIRECTORY) {
+        inputHashUpdate(h, &node->size, sizeof(node->size));
+        return hashFileContent(h, node->path);
+    }
+
+    inputHashUpdate(h, &node->childNum, sizeof(node->childNum));
+    for (i = 0; i < node->childNum && status == OK; i ++) {
+        status = hashNode(h, &node->children[i]);
+    }
+    return status;
+}
+
+
+/**
+ * 向输入哈希追加文件内容摘要
+ * 同一文件(路径、大小及修改时间均相同)的摘要只计算一次，此后各镜像直接使用
+ * @param h - 哈希状态
+ * @param path - 文件路径
+ * @return 文件不存在返回 NO_FIND
+ */
+static int hashFileContent(InputHash *h, const char *path) {
+    struct stat st;
+    ContentDigest *digest;
+    char key[33];
+    int status;
+
+    if (stat(path, &st) != 0) return NO_FIND;
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    pthread_mutex_lock(&digestLock);
+#endif
+    for (digest = digests; digest != NULL; digest = digest->next) {
+        if (digest->size == (long long) st.st_size && digest->mtime == (long long) st.st_mtime
+            && !strcmp(digest->path, path)) break;
+    }
+    if (digest != NULL) memcpy(key, digest->key, sizeof(key));
+#if !defined(_WIN32) && !defined(_WIN64)
+    pthread_mutex_unlock(&digestLock);
+#endif
+
+    if (digest == NULL) {
+        status = digestFile(path, (long long) st.st_size, key);
+        if (status != OK) return status;
+
+        // 记录摘要，多个线程同时计算同一文件时保留先完成的记录即可
+        digest = (ContentDigest*) malloc(sizeof(ContentDigest));
+        if (digest != NULL) {
+            digest->path = (char*) malloc(strlen(path) + 1);
+            if (digest->path == NULL) {
+                free(digest);
+            } else {
+                strcpy(digest->path, path);
+                digest->size = (long long) st.st_size;
+                digest->mtime = (long long) st.st_mtime;
+                memcpy(digest->key, key, sizeof(key));
+#if !defined(_WIN32) && !defined(_WIN64)
+                pthread_mutex_lock(&digestLock);
+#endif
+                digest->next = digests;
+                digests = digest;
+#if !defined(_WIN32) && !defined(_WIN64)
+                pthread_mutex_unlock(&digestLock);
+#endif
+            }
+        }
+    }
+
+    inputHashUpdate(h, key, 32);
+    return OK;
+}
+
+
+/**
+ * 计算文件内容摘要
+ * 小文件按文件大小分配读取缓冲区，大量小文件时不反复分配大块内存
+ * @param path - 文件路径
+ * @param size - 文件大小(字节)
+ * @param key - 32 个十六进制字符的摘要
+ * @return 文件不存在返回 NO_FIND
+ */
+static int digestFile(const char *path, long long size, char key[33]) {
+    InputHash h;
+    unsigned char *buf;
+    size_t n, bufSize = size < HASH_READ_SIZE ? (size_t) size + 1 : HASH_READ_SIZE;
+    FILE *fp = fopen(path, "rb");
+
+    if (fp == NULL) return NO_FIND;
+    buf = (unsigned char*) malloc(bufSize);
+    if (buf == NULL) {
+        fclose(fp);
+        return ERROR;
+    }
+    inputHashInit(&h);
+    while ((n = fread(buf, 1, bufSize, fp)) > 0) {
+        inputHashUpdate(&h, buf, n);
+    }
+    free(buf);
+    fclose(fp);
+    inputHashFinal(&h, key);
+    return OK;
+}
@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/fatimg.h"
+
+
+/** 目录表项大小(字节) */
+#define DIR_ITEM_SIZE 32
+/** 最大目录深度，超过时视为目录结构损坏 */
+#define CHECK_MAX_DEPTH 128
+/** 最多输出的问题条数，其余只计数 */
+#define CHECK_MAX_REPORTS 100
+
+/** 镜像检查状态 */
+typedef struct {
+    // 镜像
+    FatImg *img;
+    // FAT1 表项编解码
+    const FatCodec *codec;
+    // FAT1 表项数组(FAT12 为解包后的数组)
+    const void *table;
+    // 簇占用位图，每个簇一位，1 表示已被某个文件或目录占用
+    unsigned long long *owner;
+    // 最小的簇链结束标记
+    unsigned int endFlag;
+    // 坏簇标记
+    unsigned int badFlag;
+    // 文件数
+    unsigned int files;
+    // 目录数
+    unsigned int dirs;
+    // 发现的问题数
+    unsigned int errors;
+} FatChecker;
+
+
+/** 读取FAT1中的表项 */
+static unsigned int getFatEntry(FatChecker *ck, unsigned int clusterNum);
+/** 输出一条问题 */
+static void reportProblem(FatChecker *ck, const char *path, const char *fmt, unsigned int a, unsigned int b, unsigned int c);
+/** 比较FAT1与备份FAT表 */
+static unsigned int compareFatMirror(const unsigned char *fat1, const unsigned char *mirror, unsigned int size, unsigned int sectorSize);
+/** 沿簇链登记簇的占用 */
+static unsigned int claimChain(FatChecker *ck, unsigned int firstCluster, const char *path, unsigned int **clusters);
+/** 检查目录数据中的各表项(递归) */
+static void checkDirData(FatChecker *ck, const unsigned char *data, unsigned int itemNum, const char *path, unsigned int depth);
+/** 检查子目录 */
+static void checkSubDir(FatChecker *ck, unsigned int firstCluster, const char *path, unsigned int depth);
+
+
+/**
+ * 检查FAT镜像的一致性，可选修复
+ * 各FAT表整体只读取一次，FAT1 与各备份FAT表按块比较；
+ * 随后从根目录出发遍历全部目录，按簇占用位图检查交叉链接、越界簇号、错误的簇链结束标记
+ * 及文件大小与簇链长度不符，最后统计丢失簇(已分配却不属于任何文件)并核对FSINFO。
+ * 修复时在同一遍中以 FAT1 重写不一致的备份FAT表并重新计算FSINFO，不修改目录及簇链
+ * @param imgPath - 镜像文件
+ * @param repair - 是否修复备份FAT表及FSINFO
+ * @return 镜像一致(或发现的问题均已修复)返回 OK，仍有问题返回 BAD_FORMAT，exFAT 镜像返回 UNSUPPORTED
+ */
+int checkFatImg(char *imgPath, int repair) {
+    FatImg img;
+    FatChecker ck;
+    unsigned char *fats, fsInfo[512];
+    unsigned short *entries = NULL;
+    unsigned int i, n, diff, freeCount = 0, nextFree = FSINFO_UNKNOWN, lost = 0, fixed = 0;
+    unsigned int owned, *rootClusters;
+    int status;
+
+    // exFAT 没有FAT12/FAT32的目录结构，不能按本检查处理
+    if (getImageFatType(imgPath) == EXFAT) return UNSUPPORTED;
+    status = openFatImg(&img, imgPath, repair ? 0 : IMG_OPEN_RDONLY);
+    if (status != OK) return status;
+
+    // 全部FAT表一次读入
+    memset(&ck, 0, sizeof(FatChecker));
+    fats = (unsigned char*) malloc((size_t) img.fat.size * img.fat.fatNum);
+    ck.owner = (unsigned long long*) calloc(img.fat.clusterCount / 64 + 1, sizeof(unsigned long long));
+    if (fats == NULL || ck.owner == NULL || imgWriterRead(&img.io, img.fat.pos, fats, (size_t) img.fat.size * img.fat.fatNum) != OK) {
+        free(fats);
+        free(ck.owner);
+        closeFatImg(&img);
+        return ERROR;
+    }
+    ck.img = &img;
+    ck.codec = getFatCodec(img.type);
+    ck.table = fats;
+    if (img.type == FAT12) {
+        // FAT12表先解包为 16 位数组
+        entries = (unsigned short*) calloc(FAT12_MAX_ENTRIES, sizeof(unsigned short));
+        if (entries == NULL) {
+            free(fats);
+            free(ck.owner);
+            closeFatImg(&img);
+            return ERROR;
+        }
+        unpackFat12(fats, entries, img.fat.clusterCount);
+        ck.table = entries;
+    }
+    ck.endFlag = getEndClusterFlag(img.type) & ~7u;
+    ck.badFlag = ck.endFlag - 1;
+
+    // 比较各备份FAT表，修复时以 FAT1 整体重写
+    for (i = 1; i < img.fat.fatNum; i ++) {
+        diff = compareFatMirror(fats, fats + (size_t) i * img.fat.size, img.fat.size, img.bytesPerSector);
+        if (diff == 0) continue;
+        reportProblem(&ck, NULL, "FAT%u differs from FAT1 in %u sectors", i + 1, diff, 0);
+        if (repair && imgWriterWrite(&img.io, img.fat.pos + (long long) i * img.fat.size, fats, img.fat.size) == OK) fixed ++;
+    }
+
+    // 根目录
+    if (img.type == FAT32) {
+        n = claimChain(&ck, img.rootCluster, "/", &rootClusters);
+        free(rootClusters);
+        if (n == 0) reportProblem(&ck, "/", "root directory has no clusters", 0, 0, 0);
+    }
+    ck.dirs ++;
+    if (img.rootDir != NULL) checkDirData(&ck, img.rootDir, img.rootEntCount, "", 0);
+
+    // 统计空闲簇及丢失簇
+    for (i = 2, owned = 0; i < img.fat.clusterCount; i ++) {
+        n = getFatEntry(&ck, i);
+        if (n == 0) {
+            freeCount ++;
+            if (nextFree == FSINFO_UNKNOWN) nextFree = i;
+        } else if (!(ck.owner[i / 64] & (1ULL << (i % 64)))) {
+            if (n != ck.badFlag) lost ++;
+        } else owned ++;
+    }
+    if (lost > 0) reportProblem(&ck, NULL, "%u lost clusters (allocated but not used by any file)", lost, 0, 0);
+
+    // 核对FSINFO，修复时重建整个FSINFO扇区
+    if (img.fsInfoPos > 0) {
+        if (imgWriterRead(&img.io, img.fsInfoPos, fsInfo, sizeof(fsInfo)) != OK
+            || memcmp(fsInfo, "RRaA", 4) != 0 || memcmp(fsInfo + 484, "rrAa", 4) != 0
+            || fsInfo[510] != 0x55 || fsInfo[511] != 0xaa) {
+            reportProblem(&ck, NULL, "FSINFO signature is invalid", 0, 0, 0);
+            diff = 1;
+        } else {
+            // 空闲簇数为 0xFFFFFFFF 表示未知，不算错误
+            diff = img.fsInfoFree != FSINFO_UNKNOWN && img.fsInfoFree != freeCount;
+            if (diff) reportProblem(&ck, NULL, "FSINFO free count %u, actual %u", img.fsInfoFree, freeCount, 0);
+        }
+        if (diff && repair) {
+            buildFSInfoSector(fsInfo, freeCount, nextFree);
+            if (imgWriterWrite(&img.io, img.fsInfoPos, fsInfo, sizeof(fsInfo)) == OK) fixed ++;
+            // 关闭镜像时不再按旧的提示写回
+            img.fsInfoFree = img.fat.freeCount = freeCount;
+            img.fsInfoNext = img.fat.nextFree = nextFree;
+        }
+    }
+
+    printf("Check: %u files, %u directories, %u clusters used, %u free, %u problems",
+           ck.files, ck.dirs, owned, freeCount, ck.errors);
+    if (repair) printf(", %u repaired", fixed);
+    printf(".\n");
+
+    free(fats);
+    free(entries);
+    free(ck.owner);
+    if (closeFatImg(&img) != OK) return ERROR;
+    return ck.errors == fixed ? OK : BAD_FORMAT;
+}
+
+
+/**
+ * 读取FAT1中的表项
+ * @param ck - 检查状态
+ * @param clusterNum - 簇号
+ * @return 表项值
+ */
+static unsigned int getFatEntry(FatChecker *ck, unsigned int clusterNum) {
+    return ck->codec->get(ck->table, clusterNum);
+}
+
+
+/**
+ * 输出一条问题
+ * 超过 CHECK_MAX_REPORTS 条后只计数不输出
+ * @param ck - 检查状态
+ * @param path - 相关的文件路径，没有为 NULL
+ * @param fmt - 问题描述格式，最多 3 个无符号整数参数
+ */
+static void reportProblem(FatChecker *ck, const char *path, const char *fmt, unsigned int a, unsigned int b, unsigned int c) {
+    ck->errors ++;
+    if (ck->errors > CHECK_MAX_REPORTS) return;
+    if (path != NULL) printf("%s: ", path);
+    printf(fmt, a, b, c);
+    printf("\n");
+    if (ck->errors == CHECK_MAX_REPORTS) printf("Too many problems, the rest are only counted.\n");
+}
+
+
+/**
+ * 比较FAT1与备份FAT表
+ * 先整体比较(memcmp 按机器字长及向量指令成块比较)，不同时再按扇区统计
+ * @param fat1 - FAT1 内容
+ * @param mirror - 备份FAT表内容
+ * @param size - FAT表大小(字节)
+ * @param sectorSize - 扇区大小(字节)
+ * @return 内容不同的扇区数
+ */
+static unsigned int compareFatMirror(const unsigned char *fat1, const unsigned char *mirror, unsigned int size, unsigned int sectorSize) {
+    unsigned int offset, len, diff = 0;
+
+    if (memcmp(fat1, mirror, size) == 0) return 0;
+    for (offset = 0; offset < size; offset += sectorSize) {
+        len = size - offset < sectorSize ? size - offset : sectorSize;
+        if (memcmp(fat1 + offset, mirror + offset, len) != 0) diff ++;
+    }
+    return diff;
+}
+
+
+/**
+ * 沿簇链登记簇的占用
+ * 簇号越界、链接到空闲簇或坏簇、与其他文件交叉链接时停止并报告
+ * @param ck - 检查状态
+ * @param firstCluster - 起始簇号
+ * @param path - 文件路径
+ * @param clusters - 不为 NULL 时返回簇链中各簇号，由调用者释放
+ * @return 有效的簇链长度
+ */
+static unsigned int claimChain(FatChecker *ck, unsigned int firstCluster, const char *path, unsigned int **clusters) {
+    unsigned int clusterNum = firstCluster, next, count = 0, capacity = 0, *list = NULL, *temp;
+    unsigned long long bit;
+
+    while (1) {
+        if (clusterNum < 2 || clusterNum >= ck->img->fat.clusterCount) {
+            reportProblem(ck, path, "cluster %u out of range (after %u clusters)", clusterNum, count, 0);
+            break;
+        }
+        bit = 1ULL << (clusterNum % 64);
+        if (ck->owner[clusterNum / 64] & bit) {
+            reportProblem(ck, path, "cross-linked at cluster %u", clusterNum, 0, 0);
+            break;
+        }
+        ck->owner[clusterNum / 64] |= bit;
+
+        if (clusters != NULL) {
+            if (count == capacity) {
+                capacity = capacity == 0 ? 16 : capacity * 2;
+                temp = (unsigned int*) realloc(list, capacity * sizeof(unsigned int));
+                if (temp == NULL) break;
+                list = temp;
+            }
+            list[count] = clusterNum;
+        }
+        count ++;
+
+        next = getFatEntry(ck, clusterNum);
+        if (next >= ck->endFlag) break;
+        if (next == 0 || next == ck->badFlag) {
+            reportProblem(ck, path, "chain ends at cluster %u without end mark (entry %u)", clusterNum, next, 0);
+            break;
+        }
+        clusterNum = next;
+    }
+
+    if (clusters != NULL) *clusters = list;
+    return count;
+}
+
+
+/**
+ * 检查目录数据中的各表项(递归)
+ * @param ck - 检查状态
+ * @param data - 目录数据
+ * @param itemNum - 表项数
+ * @param path - 目录路径，根目录为 ""
+ * @param depth - 目录深度
+ */
+static void checkDirData(FatChecker *ck, const unsigned char *data, unsigned int itemNum, const char *path, unsigned int depth) {
+    const unsigned char *item;
+    unsigned int i, j, n, firstCluster, size, need, errors, bytesPerCluster = ck->img->bytesPerCluster;
+    char name[13], *childPath;
+
+    for (i = 0; i < itemNum; i ++) {
+        item = data + (size_t) i * DIR_ITEM_SIZE;
+        if (item[0] == 0x00) break;
+        // 跳过已删除项、'.'、'..'、长文件名项及卷标
+        if (item[0] == 0xE5 || item[0] == '.' || (item[11] & 0x08)) continue;
+
+        // 短文件名用于报告，足以定位问题
+        for (j = 0, n = 0; j < 8 && item[j] != ' '; j ++) name[n ++] = (char) item[j];
+        if (item[8] != ' ') name[n ++] = '.';
+        for (j = 8; j < 11 && item[j] != ' '; j ++) name[n ++] = (char) item[j];
+        name[n] = '\0';
+        childPath = (char*) malloc(strlen(path) + n + 2);
+        if (childPath == NULL) return;
+        sprintf(childPath, "%s/%s", path, name);
+
+        firstCluster = item[26] | (item[27] << 8);
+        if (ck->img->type == FAT32) firstCluster |= (unsigned int) (item[20] | (item[21] << 8)) << 16;
+        size = item[28] | (item[29] << 8) | (item[30] << 16) | ((unsigned int) item[31] << 24);
+
+        if (item[11] & 0x10) {
+            ck->dirs ++;
+            if (firstCluster == 0) reportProblem(ck, childPath, "directory has no clusters", 0, 0, 0);
+            else if (depth >= CHECK_MAX_DEPTH) reportProblem(ck, childPath, "directory nested deeper than %u", CHECK_MAX_DEPTH, 0, 0);
+            else checkSubDir(ck, firstCluster, childPath, depth + 1);
+        } else {
+            ck->files ++;
+            need = (unsigned int) (((unsigned long long) size + bytesPerCluster - 1) / bytesPerCluster);
+            // 簇链本身已有问题时不再重复报告大小不符
+            errors = ck->errors;
+            n = firstCluster == 0 ? 0 : claimChain(ck, firstCluster, childPath, NULL);
+            if (n != need && ck->errors == errors) reportProblem(ck, childPath, "size %u needs %u clusters, chain has %u", size, need, n);
+        }
+        free(childPath);
+    }
+}
+
+
+/**
+ * 检查子目录
+ * 登记子目录簇链后按连续簇区段读入目录数据，再检查其中各表项
+ * @param ck - 检查状态
+ * @param firstCluster - 子目录起始簇号
+ * @param path - 子目录路径
+ * @param depth - 目录深度
+ */
+static void checkSubDir(FatChecker *ck, unsigned int firstCluster, const char *path, unsigned int depth) {
+    FatImg *img = ck->img;
+    unsigned int *clusters, count, i, run;
+    unsigned char *data;
+
+    count = claimChain(ck, firstCluster, path, &clusters);
+    if (count == 0) {
+        free(clusters);
+        return;
+    }
+
+    data = (unsigned char*) malloc((size_t) count * img->bytesPerCluster);
+    if (data == NULL) {
+        free(clusters);
+        return;
+    }
+    // 连续的簇合并为一次读取
+    for (i = 0; i < count; i += run) {
+        for (run = 1; i + run < count && clusters[i + run] == clusters[i] + run; run ++);
+        if (imgWriterRead(&img->io, getClusterPos(img, clusters[i]), data + (size_t) i * img->bytesPerCluster,
+                          (size_t) run * img->bytesPerCluster) != OK) {
+            memset(data + (size_t) i * img->bytesPerCluster, 0, (size_t) run * img->bytesPerCluster);
+        }
+    }
+    free(clusters);
+
+    checkDirData(ck, data, count * img->bytesPerCluster / DIR_ITEM_SIZE, path, depth);
+    free(data);
+}
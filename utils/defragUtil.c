@@ -0,0 +1,590 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/fatimg.h"
+
+
+/** 目录表项大小(字节) */
+#define DIR_ITEM_SIZE 32
+/** 最大目录深度，超过时视为目录结构损坏 */
+#define DEFRAG_MAX_DEPTH 128
+/** 每批移动的簇数据量(字节) */
+#define DEFRAG_WINDOW_SIZE (8 * 1024 * 1024)
+/** 簇映射中的空值 */
+#define DEFRAG_NONE 0xFFFFFFFF
+
+/** 镜像中的文件或目录 */
+typedef struct DefragNode {
+    // 在上级目录(紧缩后)数据中的短文件名表项序号
+    unsigned int slot;
+    // 是否为目录
+    char isDir;
+    // 原簇链中的各簇号
+    unsigned int *clusters;
+    // 原簇链长度
+    unsigned int clusterNum;
+    // 新起始簇号，没有簇为 0
+    unsigned int newStart;
+    // 新簇数(目录按紧缩后的表项数计算)
+    unsigned int newClusters;
+    // 紧缩后的目录数据(去除已删除表项)
+    unsigned char *data;
+    // 紧缩后的目录表项数
+    unsigned int itemNum;
+    // 子项
+    struct DefragNode *children;
+    // 子项数
+    unsigned int childNum;
+    // 子项数组容量
+    unsigned int childCap;
+} DefragNode;
+
+/** 碎片整理状态 */
+typedef struct {
+    // 镜像
+    FatImg *img;
+    // 簇占用位图，每个簇一位
+    unsigned long long *claimed;
+    // 各目标簇的数据当前所在的簇号
+    unsigned int *src;
+    // 各簇当前存放的数据的目标簇号
+    unsigned int *owner;
+    // 寻找暂存簇的位置(从高簇号向低簇号)
+    unsigned int freePtr;
+    // 文件数
+    unsigned int files;
+    // 目录数
+    unsigned int dirs;
+    // 整理前不连续的文件数
+    unsigned int fragmented;
+    // 移动的簇数
+    unsigned int moved;
+} Defragger;
+
+/** 暂存被挤出的簇 */
+typedef struct {
+    // 暂存簇号
+    unsigned int dest;
+    // 在本批数据中的簇序号
+    unsigned int index;
+} DefragEvict;
+
+
+/** 沿簇链读取并登记全部簇号 */
+static int loadChain(Defragger *df, unsigned int firstCluster, DefragNode *node);
+/** 载入目录数据并紧缩，递归载入子目录及文件簇链 */
+static int loadDirNode(Defragger *df, DefragNode *node, const unsigned char *raw, unsigned int rawItemNum, unsigned int depth);
+/** 按新布局为目录、其下文件及子目录(递归)分配连续簇 */
+static void placeDirNode(Defragger *df, DefragNode *node, unsigned int *next, char isRoot);
+/** 记录文件簇的目标位置 */
+static void mapFileClusters(Defragger *df, DefragNode *node);
+/** 按批移动簇数据到新布局 */
+static int moveClusters(Defragger *df, unsigned int end);
+/** 寻找暂存簇 */
+static unsigned int findSpareCluster(Defragger *df, unsigned int lower);
+/** 释放原簇链 */
+static void releaseFatChains(Defragger *df, DefragNode *node);
+/** 按新布局建立簇链 */
+static void linkFatChains(Defragger *df, DefragNode *node);
+/** 写入目录数据 */
+static int writeDirNode(Defragger *df, DefragNode *node, unsigned int parentStart, char isRoot);
+/** 释放文件树 */
+static void freeDefragNode(DefragNode *node);
+/** 比较暂存簇号 */
+static int compareEvict(const void *a, const void *b);
+
+
+/**
+ * 整理FAT12/FAT32镜像的碎片并紧缩数据区
+ * 先载入全部目录并读出各文件簇链，按 "目录簇、目录下的文件、子目录(递归)" 的顺序
+ * 规划新布局，使每个文件及目录都连续且整体从数据区起始处紧密排列，目录中已删除的表项一并去除。
+ * 簇数据按目标位置分批移动：每批目标区域一次读入，源簇连续的部分合并读取，
+ * 目标区域中尚未移动的数据挤出到高端空闲簇暂存，整批数据一次写出；
+ * 移动完成后统一重写FAT表及各目录，FAT32根目录移动后同步更新BPB。
+ * 存在交叉链接或损坏簇链的镜像不做整理，丢失簇被释放
+ * @param imgPath - 镜像文件
+ * @return 镜像存在坏簇或结构损坏返回 BAD_FORMAT
+ */
+int defragFatImg(char *imgPath) {
+    FatImg img;
+    Defragger df;
+    DefragNode root;
+    unsigned int i, next = 2, lost = 0, entry, badFlag;
+    unsigned char cluster[4], backup[2];
+    int status;
+
+    status = openFatImg(&img, imgPath, 0);
+    if (status != OK) return status;
+
+    memset(&df, 0, sizeof(Defragger));
+    memset(&root, 0, sizeof(DefragNode));
+    df.img = &img;
+    df.claimed = (unsigned long long*) calloc(img.fat.clusterCount / 64 + 1, sizeof(unsigned long long));
+    df.src = (unsigned int*) malloc((size_t) img.fat.clusterCount * sizeof(unsigned int));
+    df.owner = (unsigned int*) malloc((size_t) img.fat.clusterCount * sizeof(unsigned int));
+    if (df.claimed == NULL || df.src == NULL || df.owner == NULL) status = ERROR;
+
+    // 载入根目录及全部子项
+    root.isDir = 1;
+    if (status == OK && img.type == FAT32) status = loadChain(&df, img.rootCluster, &root);
+    if (status == OK) status = loadDirNode(&df, &root, img.rootDir, img.rootEntCount, 0);
+
+    // 有坏簇时无法保证新布局连续，不做整理；全部检查完成后才修改FAT表缓存，放弃整理时镜像保持不变
+    badFlag = (getEndClusterFlag(img.type) & ~7u) - 1;
+    for (i = 2; i < img.fat.clusterCount && status == OK; i ++) {
+        if (getNextClusterLinkNum(&img.fat, i) == badFlag) {
+            printf("The image has bad clusters.\n");
+            status = BAD_FORMAT;
+        }
+    }
+
+    // 已分配但不属于任何文件的丢失簇直接释放
+    for (i = 2; i < img.fat.clusterCount && status == OK; i ++) {
+        entry = getNextClusterLinkNum(&img.fat, i);
+        if (entry != 0 && !(df.claimed[i / 64] & (1ULL << (i % 64)))) {
+            setNextClusterLinkNum(&img.fat, i, 0);
+            lost ++;
+        }
+    }
+
+    if (status == OK) {
+        // 规划新布局并移动簇数据
+        for (i = 0; i < img.fat.clusterCount; i ++) df.src[i] = df.owner[i] = DEFRAG_NONE;
+        df.dirs ++;
+        placeDirNode(&df, &root, &next, 1);
+        mapFileClusters(&df, &root);
+        df.freePtr = img.fat.clusterCount - 1;
+        status = moveClusters(&df, next);
+    }
+
+    if (status == OK) {
+        // 重写FAT表及各目录
+        // 新旧簇链有重叠，全部释放后再建立
+        releaseFatChains(&df, &root);
+        linkFatChains(&df, &root);
+        img.fat.nextFree = next < img.fat.clusterCount ? next : 2;
+        status = writeDirNode(&df, &root, 0, 1);
+
+        // FAT32根目录起始簇号变化时更新BPB及备份引导扇区
+        if (status == OK && img.type == FAT32 && root.newStart != img.rootCluster) {
+            cluster[0] = (unsigned char) root.newStart;
+            cluster[1] = (unsigned char) (root.newStart >> 8);
+            cluster[2] = (unsigned char) (root.newStart >> 16);
+            cluster[3] = (unsigned char) (root.newStart >> 24);
+            status = imgWriterWrite(&img.io, 44, cluster, 4);
+            if (status == OK && imgWriterRead(&img.io, 50, backup, 2) == OK && (backup[0] | (backup[1] << 8)) != 0) {
+                status = imgWriterWrite(&img.io, (long long) (backup[0] | (backup[1] << 8)) * img.bytesPerSector + 44, cluster, 4);
+            }
+        }
+    }
+
+    if (status == OK) {
+        printf("Defrag: %u files, %u directories, %u fragmented, %u clusters moved, %u lost clusters freed.\n",
+               df.files, df.dirs, df.fragmented, df.moved, lost);
+    }
+
+    freeDefragNode(&root);
+    free(df.claimed);
+    free(df.src);
+    free(df.owner);
+    if (closeFatImg(&img) != OK && status == OK) status = ERROR;
+    return status;
+}
+
+
+/**
+ * 沿簇链读取并登记全部簇号
+ * @param df - 碎片整理状态
+ * @param firstCluster - 起始簇号
+ * @param node - 文件或目录节点
+ * @return 簇链越界、未正常结束或与其他文件交叉链接返回 BAD_FORMAT
+ */
+static int loadChain(Defragger *df, unsigned int firstCluster, DefragNode *node) {
+    FatCache *fat = &df->img->fat;
+    unsigned int clusterNum = firstCluster, capacity = 0, *temp;
+    unsigned int endFlag = getEndClusterFlag(df->img->type) & ~7u;
+    unsigned long long bit;
+
+    while (clusterNum < endFlag) {
+        bit = 1ULL << (clusterNum % 64);
+        if (clusterNum < 2 || clusterNum >= fat->clusterCount || (df->claimed[clusterNum / 64] & bit)) {
+            printf("Broken cluster chain at cluster %u, run --check first.\n", clusterNum);
+            return BAD_FORMAT;
+        }
+        df->claimed[clusterNum / 64] |= bit;
+
+        if (node->clusterNum == capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            temp = (unsigned int*) realloc(node->clusters, capacity * sizeof(unsigned int));
+            if (temp == NULL) return ERROR;
+            node->clusters = temp;
+        }
+        node->clusters[node->clusterNum ++] = clusterNum;
+        clusterNum = getNextClusterLinkNum(fat, clusterNum);
+    }
+    return OK;
+}
+
+
+/**
+ * 载入目录数据并紧缩，递归载入子目录及文件簇链
+ * 紧缩时去除已删除的表项，长文件名表项与短文件名表项保持原有顺序
+ * @param df - 碎片整理状态
+ * @param node - 目录节点(簇链已载入)
+ * @param raw - 原目录数据
+ * @param rawItemNum - 原目录表项数
+ * @param depth - 目录深度
+ * @return
+ */
+static int loadDirNode(Defragger *df, DefragNode *node, const unsigned char *raw, unsigned int rawItemNum, unsigned int depth) {
+    FatImg *img = df->img;
+    DefragNode *child;
+    const unsigned char *item;
+    unsigned char *data;
+    unsigned int i, j, firstCluster;
+    int status;
+
+    if (depth > DEFRAG_MAX_DEPTH) return BAD_FORMAT;
+    node->data = (unsigned char*) calloc(rawItemNum + 1, DIR_ITEM_SIZE);
+    if (node->data == NULL) return ERROR;
+
+    for (i = 0; i < rawItemNum; i ++) {
+        item = raw + (size_t) i * DIR_ITEM_SIZE;
+        if (item[0] == 0x00) break;
+        if (item[0] == 0xE5) continue;
+        memcpy(node->data + (size_t) node->itemNum * DIR_ITEM_SIZE, item, DIR_ITEM_SIZE);
+        node->itemNum ++;
+        // 长文件名项、卷标、'.'、'..' 只保留表项
+        if ((item[11] & 0x08) || item[0] == '.') continue;
+
+        if (node->childNum == node->childCap) {
+            node->childCap = node->childCap == 0 ? 8 : node->childCap * 2;
+            child = (DefragNode*) realloc(node->children, node->childCap * sizeof(DefragNode));
+            if (child == NULL) return ERROR;
+            node->children = child;
+        }
+        child = &node->children[node->childNum ++];
+        memset(child, 0, sizeof(DefragNode));
+        child->slot = node->itemNum - 1;
+        child->isDir = (item[11] & 0x10) != 0;
+
+        firstCluster = item[26] | (item[27] << 8);
+        if (img->type == FAT32) firstCluster |= (unsigned int) (item[20] | (item[21] << 8)) << 16;
+        if (firstCluster != 0) {
+            status = loadChain(df, firstCluster, child);
+            if (status != OK) return status;
+        }
+
+        if (!child->isDir) {
+            df->files ++;
+            for (j = 1; j < child->clusterNum && child->clusters[j] == child->clusters[j - 1] + 1; j ++);
+            if (j < child->clusterNum) df->fragmented ++;
+            continue;
+        }
+
+        // 读入子目录数据，连续的簇合并为一次读取
+        df->dirs ++;
+        if (child->clusterNum == 0) return BAD_FORMAT;
+        data = (unsigned char*) malloc((size_t) child->clusterNum * img->bytesPerCluster);
+        if (data == NULL) return ERROR;
+        for (j = 0, status = OK; j < child->clusterNum && status == OK; j ++) {
+            status = imgWriterRead(&img->io, getClusterPos(img, child->clusters[j]),
+                                   data + (size_t) j * img->bytesPerCluster, img->bytesPerCluster);
+        }
+        if (status == OK) status = loadDirNode(df, child, data, child->clusterNum * img->bytesPerCluster / DIR_ITEM_SIZE, depth + 1);
+        free(data);
+        if (status != OK) return status;
+    }
+    return OK;
+}
+
+
+/**
+ * 按新布局为目录、其下文件及子目录(递归)分配连续簇
+ * 与拷贝目录时的规划顺序相同：目录簇之后紧跟其文件簇，再依次排列各子目录
+ * @param df - 碎片整理状态
+ * @param node - 目录节点
+ * @param next - 下一个可用的簇号
+ * @param isRoot - 是否为根目录(FAT12/FAT16根目录不在数据区)
+ */
+static void placeDirNode(Defragger *df, DefragNode *node, unsigned int *next, char isRoot) {
+    unsigned int i, bytesPerCluster = df->img->bytesPerCluster;
+    DefragNode *child;
+
+    if (!isRoot || df->img->type == FAT32) {
+        node->newClusters = (node->itemNum * DIR_ITEM_SIZE + bytesPerCluster - 1) / bytesPerCluster;
+        if (node->newClusters == 0) node->newClusters = 1;
+        node->newStart = *next;
+        *next += node->newClusters;
+    }
+
+    for (i = 0; i < node->childNum; i ++) {
+        child = &node->children[i];
+        if (child->isDir || child->clusterNum == 0) continue;
+        child->newClusters = child->clusterNum;
+        child->newStart = *next;
+        *next += child->newClusters;
+    }
+    for (i = 0; i < node->childNum; i ++) {
+        if (node->children[i].isDir) placeDirNode(df, &node->children[i], next, 0);
+    }
+}
+
+
+/**
+ * 记录文件簇的目标位置
+ * 目录数据已载入内存，其原簇不需要移动，视为空闲
+ * @param df - 碎片整理状态
+ * @param node - 目录节点
+ */
+static void mapFileClusters(Defragger *df, DefragNode *node) {
+    DefragNode *child;
+    unsigned int i, k;
+
+    for (i = 0; i < node->childNum; i ++) {
+        child = &node->children[i];
+        if (child->isDir) {
+            mapFileClusters(df, child);
+            continue;
+        }
+        for (k = 0; k < child->clusterNum; k ++) {
+            df->src[child->newStart + k] = child->clusters[k];
+            df->owner[child->clusters[k]] = child->newStart + k;
+        }
+    }
+}
+
+
+/**
+ * 按批移动簇数据到新布局
+ * 每批处理一段连续的目标簇：目标区域原有数据一次读入，
+ * 源簇在目标区域外的部分按连续簇合并读取；目标区域中属于后续批次的数据挤出到高端空闲簇暂存，
+ * 暂存写入按簇号排序以便合并，最后整批数据一次写入目标区域。已在目标位置的批次直接跳过
+ * @param df - 碎片整理状态
+ * @param end - 新布局的结束簇号
+ * @return
+ */
+static int moveClusters(Defragger *df, unsigned int end) {
+    FatImg *img = df->img;
+    unsigned int window = DEFRAG_WINDOW_SIZE / img->bytesPerCluster, start, count, i, run, s, evictNum;
+    unsigned char *physBuf, *moveBuf;
+    DefragEvict *evicts;
+    size_t bpc = img->bytesPerCluster;
+    int status = OK, inPlace;
+
+    if (window == 0) window = 1;
+    physBuf = (unsigned char*) malloc(window * bpc);
+    moveBuf = (unsigned char*) malloc(window * bpc);
+    evicts = (DefragEvict*) malloc(window * sizeof(DefragEvict));
+    if (physBuf == NULL || moveBuf == NULL || evicts == NULL) status = ERROR;
+
+    for (start = 2; start < end && status == OK; start += count) {
+        count = end - start < window ? end - start : window;
+
+        // 本批数据均已在目标位置
+        for (i = 0, inPlace = 1; i < count && inPlace; i ++) {
+            if ((df->src[start + i] != DEFRAG_NONE && df->src[start + i] != start + i)
+                || (df->owner[start + i] != DEFRAG_NONE && df->owner[start + i] != start + i)) inPlace = 0;
+        }
+        if (inPlace) continue;
+
+        // 目标区域原有数据一次读入
+        status = imgWriterRead(&img->io, getClusterPos(img, start), physBuf, count * bpc);
+        memset(moveBuf, 0, count * bpc);
+
+        // 组装本批数据，区域外连续的源簇合并为一次读取
+        for (i = 0; i < count && status == OK; i += run) {
+            run = 1;
+            s = df->src[start + i];
+            if (s == DEFRAG_NONE) continue;
+            if (s != start + i) df->moved ++;
+            if (s >= start && s < start + count) {
+                memcpy(moveBuf + i * bpc, physBuf + (s - start) * bpc, bpc);
+                continue;
+            }
+            while (i + run < count && df->src[start + i + run] == s + run && s + run >= start + count) {
+                df->moved ++;
+                run ++;
+            }
+            status = imgWriterRead(&img->io, getClusterPos(img, s), moveBuf + i * bpc, run * bpc);
+        }
+        if (status != OK) break;
+
+        // 源簇在区域外的数据已读出，原位置空闲
+        for (i = 0; i < count; i ++) {
+            s = df->src[start + i];
+            if (s != DEFRAG_NONE && (s < start || s >= start + count)) df->owner[s] = DEFRAG_NONE;
+        }
+
+        // 目标区域中属于后续批次的数据挤出到暂存簇
+        for (i = 0, evictNum = 0; i < count && status == OK; i ++) {
+            s = df->owner[start + i];
+            df->owner[start + i] = DEFRAG_NONE;
+            if (s == DEFRAG_NONE || s < start + count) continue;
+            evicts[evictNum].dest = findSpareCluster(df, start + count);
+            evicts[evictNum].index = i;
+            if (evicts[evictNum].dest == DEFRAG_NONE) status = INSUFFICIENT_SPACE;
+            else {
+                df->owner[evicts[evictNum].dest] = s;
+                df->src[s] = evicts[evictNum].dest;
+                evictNum ++;
+            }
+        }
+        qsort(evicts, evictNum, sizeof(DefragEvict), compareEvict);
+        for (i = 0; i < evictNum && status == OK; i ++) {
+            status = imgWriterWrite(&img->io, getClusterPos(img, evicts[i].dest), physBuf + evicts[i].index * bpc, bpc);
+        }
+
+        // 整批写入目标区域
+        if (status == OK) status = imgWriterWrite(&img->io, getClusterPos(img, start), moveBuf, count * bpc);
+    }
+
+    free(physBuf);
+    free(moveBuf);
+    free(evicts);
+    return status;
+}
+
+
+/**
+ * 寻找暂存簇
+ * 从高簇号向低簇号寻找既不属于已处理区域、也没有存放待移动数据的簇，
+ * 优先使用数据区末端的空闲簇，暂存的数据通常不会再次被挤出
+ * @param df - 碎片整理状态
+ * @param lower - 可用的最小簇号
+ * @return 没有可用的簇返回 DEFRAG_NONE
+ */
+static unsigned int findSpareCluster(Defragger *df, unsigned int lower) {
+    unsigned int pass;
+
+    for (pass = 0; pass < 2; pass ++) {
+        while (df->freePtr >= lower && df->owner[df->freePtr] != DEFRAG_NONE) df->freePtr --;
+        if (df->freePtr >= lower) return df->freePtr --;
+        // 此前移走的数据留下的空闲簇可能位于已检查过的位置，从头再找一遍
+        df->freePtr = df->img->fat.clusterCount - 1;
+    }
+    return DEFRAG_NONE;
+}
+
+
+/**
+ * 释放原簇链
+ * @param df - 碎片整理状态
+ * @param node - 目录节点
+ */
+static void releaseFatChains(Defragger *df, DefragNode *node) {
+    FatCache *fat = &df->img->fat;
+    unsigned int i, k;
+    DefragNode *child;
+
+    for (k = 0; k < node->clusterNum; k ++) setNextClusterLinkNum(fat, node->clusters[k], 0);
+    for (i = 0; i < node->childNum; i ++) {
+        child = &node->children[i];
+        if (child->isDir) releaseFatChains(df, child);
+        else for (k = 0; k < child->clusterNum; k ++) setNextClusterLinkNum(fat, child->clusters[k], 0);
+    }
+}
+
+
+/**
+ * 按新布局建立簇链，每个文件及目录均为一段连续簇
+ * @param df - 碎片整理状态
+ * @param node - 目录节点
+ */
+static void linkFatChains(Defragger *df, DefragNode *node) {
+    FatCache *fat = &df->img->fat;
+    unsigned int i, k, endFlag = getEndClusterFlag(df->img->type);
+    DefragNode *child;
+
+    for (k = 0; k < node->newClusters; k ++) {
+        setNextClusterLinkNum(fat, node->newStart + k, k + 1 < node->newClusters ? node->newStart + k + 1 : endFlag);
+    }
+    for (i = 0; i < node->childNum; i ++) {
+        child = &node->children[i];
+        if (child->isDir) {
+            linkFatChains(df, child);
+            continue;
+        }
+        for (k = 0; k < child->newClusters; k ++) {
+            setNextClusterLinkNum(fat, child->newStart + k, k + 1 < child->newClusters ? child->newStart + k + 1 : endFlag);
+        }
+    }
+}
+
+
+/**
+ * 写入目录数据
+ * 更新各子项、'.' 及 '..' 表项的起始簇号后，目录数据一次写入新位置(子目录递归写入)
+ * @param df - 碎片整理状态
+ * @param node - 目录节点
+ * @param parentStart - 上级目录起始簇号，上级为根目录时为 0
+ * @param isRoot - 是否为根目录
+ * @return
+ */
+static int writeDirNode(Defragger *df, DefragNode *node, unsigned int parentStart, char isRoot) {
+    FatImg *img = df->img;
+    DefragNode *child;
+    unsigned char *item, *data;
+    unsigned int i, cluster;
+    size_t size;
+    int status = OK;
+
+    for (i = 0; i < node->itemNum; i ++) {
+        item = node->data + (size_t) i * DIR_ITEM_SIZE;
+        if (item[0] != '.' || (item[11] & 0x08)) continue;
+        cluster = item[1] == '.' ? parentStart : node->newStart;
+        item[26] = (unsigned char) cluster;
+        item[27] = (unsigned char) (cluster >> 8);
+        item[20] = (unsigned char) (cluster >> 16);
+        item[21] = (unsigned char) (cluster >> 24);
+    }
+    for (i = 0; i < node->childNum; i ++) {
+        child = &node->children[i];
+        item = node->data + (size_t) child->slot * DIR_ITEM_SIZE;
+        item[26] = (unsigned char) child->newStart;
+        item[27] = (unsigned char) (child->newStart >> 8);
+        item[20] = (unsigned char) (child->newStart >> 16);
+        item[21] = (unsigned char) (child->newStart >> 24);
+    }
+
+    // FAT12/FAT16根目录位于固定的根目录区
+    size = isRoot && img->type != FAT32 ? (size_t) img->rootEntCount * DIR_ITEM_SIZE : (size_t) node->newClusters * img->bytesPerCluster;
+    data = (unsigned char*) calloc(size, 1);
+    if (data == NULL) return ERROR;
+    memcpy(data, node->data, (size_t) node->itemNum * DIR_ITEM_SIZE);
+    if (isRoot && img->type != FAT32) status = imgWriterWrite(&img->io, img->rootPos, data, size);
+    else status = imgWriterWrite(&img->io, getClusterPos(img, node->newStart), data, size);
+    free(data);
+
+    for (i = 0; i < node->childNum && status == OK; i ++) {
+        if (node->children[i].isDir) status = writeDirNode(df, &node->children[i], isRoot ? 0 : node->newStart, 0);
+    }
+    return status;
+}
+
+
+/**
+ * 释放文件树
+ * @param node - 节点
+ */
+static void freeDefragNode(DefragNode *node) {
+    unsigned int i;
+
+    for (i = 0; i < node->childNum; i ++) freeDefragNode(&node->children[i]);
+    free(node->children);
+    free(node->clusters);
+    free(node->data);
+    memset(node, 0, sizeof(DefragNode));
+}
+
+
+/**
+ * 比较暂存簇号
+ * @param a - 暂存项
+ * @param b - 暂存项
+ * @return
+ */
+static int compareEvict(const void *a, const void *b) {
+    unsigned int x = ((const DefragEvict*) a)->dest, y = ((const DefragEvict*) b)->dest;
+    return x < y ? -1 : x > y;
+}
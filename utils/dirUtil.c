@@ -0,0 +1,646 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/fatimg.h"
+
+
+/** 目录表项大小(字节) */
+#define DIR_ITEM_SIZE 32
+/** 长文件名表项属性 */
+#define LFN_ATTR 0x0F
+/** 长文件名最后一段的序号标记 */
+#define LFN_LAST_FLAG 0x40
+/** 短文件名别名 ~N 的最大序号 */
+#define ALIAS_MAX 999999
+/** 表项没有长文件名(longNext) */
+#define NO_LONG_NAME -2
+
+/** 长文件名表项中各 UTF-16 字符的偏移 */
+static const unsigned char lfnOffsets[LFN_ITEM_CHARS] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+
+
+/** 计算短文件名的哈希值 */
+static unsigned int hashShortName(const unsigned char *name);
+/** 判断目录表项是否为需要索引的文件/目录项 */
+static int isIndexedItem(const unsigned char *item);
+/** 将表项加入哈希索引 */
+static void linkDirItem(DirIndex *dir, unsigned int slot);
+/** 将表项移出哈希索引 */
+static void unlinkDirItem(DirIndex *dir, unsigned int slot);
+/** 标记表项所在扇区为脏 */
+static void markDirItemDirty(DirIndex *dir, unsigned int slot);
+/** 按表项数重建哈希桶 */
+static int rehashDirIndex(DirIndex *dir);
+/** 计算长文件名的哈希值(不区分大小写) */
+static unsigned int hashLongName(const unsigned short *name, int len);
+/** 比较两个长文件名(不区分大小写) */
+static int compareLongName(const unsigned short *a, const unsigned short *b, int len);
+/** 读取短文件名表项之前的长文件名 */
+static int readLongName(DirIndex *dir, unsigned int slot, unsigned short *name);
+/** 构造一个长文件名表项 */
+static void buildLongNameItem(LongDirItem *item, unsigned int ordinal, int last,
+                              const unsigned short *name, int len, unsigned char checksum);
+
+
+/**
+ * 为已载入内存的目录数据建立索引
+ * 短文件名(8 + 3)及长文件名分别哈希到表项序号，空闲表项(已删除或未使用)记录在位图中，
+ * 此后查找、替换、插入均不再遍历目录
+ * @param dir - 目录索引
+ * @param data - 目录数据
+ * @param itemNum - 目录表项数
+ * @param sectorSize - 扇区大小(字节)，作为脏标记粒度
+ * @return
+ */
+int buildDirIndex(DirIndex *dir, unsigned char *data, unsigned int itemNum, unsigned int sectorSize) {
+    unsigned int i;
+    char end = 0;
+
+    memset(dir, 0, sizeof(DirIndex));
+    dir->data = data;
+    dir->sectorSize = sectorSize;
+
+    if (growDirIndex(dir, data, itemNum) != OK) return ERROR;
+    memset(dir->dirty, 0, (itemNum * DIR_ITEM_SIZE + sectorSize - 1) / sectorSize);
+    dir->dirtyCount = 0;
+
+    // 首字节为 0 的表项及其后的全部表项均为空闲，首字节为 0xE5 的表项已删除
+    for (i = 0; i < itemNum; i ++) {
+        if (data[(size_t) i * DIR_ITEM_SIZE] == 0x00) end = 1;
+        if (end || data[(size_t) i * DIR_ITEM_SIZE] == 0xE5) continue;
+        dir->freeMap[i / 64] &= ~(1ULL << (i % 64));
+        dir->freeCount --;
+        if (isIndexedItem(data + (size_t) i * DIR_ITEM_SIZE)) linkDirItem(dir, i);
+    }
+    return OK;
+}
+
+
+/**
+ * 目录数据扩大后(FAT32根目录追加簇)同步扩展索引，新增表项均为空闲，
+ * 新增部分标记为脏，随目录一起写回
+ * @param dir - 目录索引
+ * @param data - 扩大后的目录数据
+ * @param itemNum - 扩大后的目录表项数
+ * @return
+ */
+int growDirIndex(DirIndex *dir, unsigned char *data, unsigned int itemNum) {
+    unsigned int i, oldNum = dir->itemNum;
+    unsigned int sectors = (itemNum * DIR_ITEM_SIZE + dir->sectorSize - 1) / dir->sectorSize;
+    unsigned int oldSectors = (oldNum * DIR_ITEM_SIZE + dir->sectorSize - 1) / dir->sectorSize;
+    unsigned int words = (itemNum + 63) / 64, oldWords = (oldNum + 63) / 64;
+    unsigned long long *freeMap;
+    unsigned char *dirty;
+    unsigned int *longHash;
+    int *next;
+
+    next = (int*) realloc(dir->next, (itemNum + 1) * sizeof(int));
+    if (next == NULL) return ERROR;
+    dir->next = next;
+    next = (int*) realloc(dir->longNext, (itemNum + 1) * sizeof(int));
+    if (next == NULL) return ERROR;
+    dir->longNext = next;
+    longHash = (unsigned int*) realloc(dir->longHash, (itemNum + 1) * sizeof(unsigned int));
+    if (longHash == NULL) return ERROR;
+    dir->longHash = longHash;
+    freeMap = (unsigned long long*) realloc(dir->freeMap, (words + 1) * sizeof(unsigned long long));
+    if (freeMap == NULL) return ERROR;
+    dir->freeMap = freeMap;
+    dirty = (unsigned char*) realloc(dir->dirty, sectors + 1);
+    if (dirty == NULL) return ERROR;
+    dir->dirty = dirty;
+
+    memset(dir->freeMap + oldWords, 0, (words + 1 - oldWords) * sizeof(unsigned long long));
+    memset(dir->dirty + oldSectors, 1, sectors - oldSectors);
+    dir->dirty[sectors] = 0;
+    dir->dirtyCount += sectors - oldSectors;
+    for (i = oldNum; i < itemNum; i ++) {
+        dir->freeMap[i / 64] |= 1ULL << (i % 64);
+        dir->next[i] = -1;
+        dir->longNext[i] = NO_LONG_NAME;
+    }
+
+    dir->data = data;
+    dir->freeCount += itemNum - oldNum;
+    dir->itemNum = itemNum;
+
+    // 平均每个哈希桶超过一项时扩大哈希桶
+    if (dir->bucketNum < itemNum || dir->heads == NULL) return rehashDirIndex(dir);
+    return OK;
+}
+
+
+/**
+ * 释放目录索引(不释放目录数据)
+ * @param dir - 目录索引
+ */
+void freeDirIndex(DirIndex *dir) {
+    free(dir->heads);
+    free(dir->next);
+    free(dir->longHeads);
+    free(dir->longNext);
+    free(dir->longHash);
+    free(dir->aliasHints);
+    free(dir->freeMap);
+    free(dir->dirty);
+    memset(dir, 0, sizeof(DirIndex));
+}
+
+
+/**
+ * 按短文件名查找目录表项
+ * @param dir - 目录索引
+ * @param shortName - 8 + 3 格式的短文件名
+ * @return 表项序号，不存在返回 NO_FIND
+ */
+int findDirItem(DirIndex *dir, const char *shortName) {
+    int slot = dir->heads[hashShortName((const unsigned char*) shortName) & (dir->bucketNum - 1)];
+
+    while (slot >= 0) {
+        if (!memcmp(dir->data + (size_t) slot * DIR_ITEM_SIZE, shortName, 11)) return slot;
+        slot = dir->next[slot];
+    }
+    return NO_FIND;
+}
+
+
+/**
+ * 查找序号最小的空闲目录表项
+ * @param dir - 目录索引
+ * @return 表项序号，目录已满返回 NO_FIND
+ */
+int findFreeDirItem(DirIndex *dir) {
+    unsigned int i, words = (dir->itemNum + 63) / 64;
+
+    for (i = 0; i < words; i ++) {
+        if (dir->freeMap[i] != 0) return (int) (i * 64 + (unsigned int) __builtin_ctzll(dir->freeMap[i]));
+    }
+    return NO_FIND;
+}
+
+
+/**
+ * 写入目录表项并更新索引
+ * @param dir - 目录索引
+ * @param slot - 表项序号
+ * @param item - 32 字节表项内容
+ */
+void setDirItem(DirIndex *dir, unsigned int slot, const void *item) {
+    unsigned char *dest = dir->data + (size_t) slot * DIR_ITEM_SIZE;
+
+    if (!(dir->freeMap[slot / 64] & (1ULL << (slot % 64))) && isIndexedItem(dest)) unlinkDirItem(dir, slot);
+    memcpy(dest, item, DIR_ITEM_SIZE);
+
+    if (dest[0] == 0x00 || dest[0] == 0xE5) {
+        if (!(dir->freeMap[slot / 64] & (1ULL << (slot % 64)))) dir->freeCount ++;
+        dir->freeMap[slot / 64] |= 1ULL << (slot % 64);
+    } else {
+        if (dir->freeMap[slot / 64] & (1ULL << (slot % 64))) dir->freeCount --;
+        dir->freeMap[slot / 64] &= ~(1ULL << (slot % 64));
+        if (isIndexedItem(dest)) linkDirItem(dir, slot);
+    }
+    markDirItemDirty(dir, slot);
+}
+
+
+/**
+ * 删除目录表项(首字节置为 0xE5)并更新索引，其前的长文件名表项一并删除
+ * @param dir - 目录索引
+ * @param slot - 短文件名表项序号
+ */
+void removeDirItem(DirIndex *dir, unsigned int slot) {
+    unsigned char item[DIR_ITEM_SIZE];
+    unsigned int i, span = getDirItemSpan(dir, slot);
+
+    for (i = 0; i < span; i ++) {
+        memcpy(item, dir->data + (size_t) (slot - i) * DIR_ITEM_SIZE, DIR_ITEM_SIZE);
+        item[0] = 0xE5;
+        setDirItem(dir, slot - i, item);
+    }
+}
+
+
+/**
+ * 查找序号最小的连续空闲目录表项，用于写入长文件名表项及其短文件名表项
+ * @param dir - 目录索引
+ * @param count - 表项数
+ * @return 首个表项序号，不存在返回 NO_FIND
+ */
+int findFreeDirRun(DirIndex *dir, unsigned int count) {
+    unsigned int i = 0, run = 0;
+    unsigned long long word;
+
+    while (i < dir->itemNum) {
+        word = dir->freeMap[i / 64] >> (i % 64);
+        if (word == 0) {
+            // 本字中剩余表项均已使用
+            run = 0;
+            i = (i / 64 + 1) * 64;
+        } else if (!(word & 1)) {
+            run = 0;
+            i += (unsigned int) __builtin_ctzll(word);
+        } else {
+            if (++ run == count) return (int) (i + 1 - count);
+            i ++;
+        }
+    }
+    return NO_FIND;
+}
+
+
+/**
+ * 短文件名表项及其长文件名表项所占的表项数
+ * 长文件名表项按序号 1、2、... 倒序位于短文件名表项之前，序号或校验值不符的表项视为孤立项
+ * @param dir - 目录索引
+ * @param slot - 短文件名表项序号
+ * @return 没有长文件名返回 1
+ */
+unsigned int getDirItemSpan(DirIndex *dir, unsigned int slot) {
+    const unsigned char *item;
+    char shortName[12];
+    unsigned char checksum;
+    unsigned int n;
+
+    memcpy(shortName, dir->data + (size_t) slot * DIR_ITEM_SIZE, 11);
+    shortName[11] = '\0';
+    checksum = getChecksumByShortName(shortName);
+
+    for (n = 1; n <= LFN_MAX_ITEMS && n <= slot; n ++) {
+        item = dir->data + (size_t) (slot - n) * DIR_ITEM_SIZE;
+        if (item[11] != LFN_ATTR || item[13] != checksum || (item[0] & 0x3F) != n) return 1;
+        if (item[0] & LFN_LAST_FLAG) return n + 1;
+    }
+    return 1;
+}
+
+
+/**
+ * 按文件名查找目录表项
+ * 先按长文件名(不区分大小写)查找，未找到且文件名除大小写外符合 8.3 格式时再按短文件名查找
+ * @param dir - 目录索引
+ * @param name - 文件名(UTF-8)
+ * @return 短文件名表项序号，不存在返回 NO_FIND
+ */
+int findDirItemByName(DirIndex *dir, const char *name) {
+    unsigned short longName[LFN_MAX_LEN], itemName[LFN_MAX_ITEMS * LFN_ITEM_CHARS];
+    unsigned char caseFlags;
+    char shortName[12];
+    int len = utf8ToUtf16(name, longName, LFN_MAX_LEN), slot;
+
+    if (len > 0) {
+        slot = dir->longHeads[hashLongName(longName, len) & (dir->bucketNum - 1)];
+        for (; slot >= 0; slot = dir->longNext[slot]) {
+            if (readLongName(dir, (unsigned int) slot, itemName) == len && !compareLongName(itemName, longName, len)) {
+                return slot;
+            }
+        }
+    }
+
+    if (getShortNameBasis(name, shortName, &caseFlags) > 1) return NO_FIND;
+    return findDirItem(dir, shortName);
+}
+
+
+/**
+ * 获取目录表项的文件名
+ * 有长文件名时返回长文件名，否则按大小写标记将短文件名还原为 "NAME.EXT" 形式
+ * @param dir - 目录索引
+ * @param slot - 短文件名表项序号
+ * @param name - 文件名(UTF-8)缓冲区，至少 DIR_NAME_SIZE 字节
+ */
+void getDirItemName(DirIndex *dir, unsigned int slot, char *name) {
+    unsigned short longName[LFN_MAX_ITEMS * LFN_ITEM_CHARS];
+    const unsigned char *item = dir->data + (size_t) slot * DIR_ITEM_SIZE;
+    int len = readLongName(dir, slot, longName), i, n = 0;
+
+    if (len > 0) {
+        utf16ToUtf8(longName, len, name);
+        return;
+    }
+
+    // 首字节 0x05 表示实际文件名首字节为 0xE5
+    for (i = 0; i < 8 && item[i] != ' '; i ++) {
+        name[n] = (char) (i == 0 && item[0] == 0x05 ? 0xE5 : item[i]);
+        if ((item[12] & 0x08) && name[n] >= 'A' && name[n] <= 'Z') name[n] += 'a' - 'A';
+        n ++;
+    }
+    if (item[8] != ' ') name[n ++] = '.';
+    for (i = 8; i < 11 && item[i] != ' '; i ++) {
+        name[n] = (char) item[i];
+        if ((item[12] & 0x10) && name[n] >= 'A' && name[n] <= 'Z') name[n] += 'a' - 'A';
+        n ++;
+    }
+    name[n] = '\0';
+}
+
+
+/**
+ * 为文件名生成目录中唯一的短文件名
+ * 符合 8.3 格式的文件名直接使用，否则在基名后追加 ~N。
+ * 已存在的短文件名由目录索引的哈希表判断，每个基名记录下一个待尝试的序号，
+ * 大量相似文件名不必每次从 ~1 开始逐个探测
+ * @param dir - 目录索引
+ * @param name - 文件名(UTF-8)
+ * @param shortName - 8 + 3 + '\0' 格式的短文件名
+ * @param caseFlags - 大小写标记
+ * @return 所需的长文件名表项数，文件名不合法返回 BAD_FORMAT，别名用尽返回 ERROR
+ */
+int makeShortName(DirIndex *dir, const char *name, char *shortName, unsigned char *caseFlags) {
+    char basis[12], tail[8];
+    unsigned int n, k, start, baseLen, tailLen, *hint;
+    int lfnNum = getLongNameItemNum(name);
+
+    if (lfnNum < 0) return lfnNum;
+    getShortNameBasis(name, basis, caseFlags);
+    memcpy(shortName, basis, 12);
+    if (lfnNum == 0) return 0;
+
+    *caseFlags = 0;
+    for (baseLen = 8; baseLen > 0 && basis[baseLen - 1] == ' '; baseLen --);
+    hint = &dir->aliasHints[hashShortName((const unsigned char*) basis) & (dir->bucketNum - 1)];
+    start = *hint > 0 ? *hint : 1;
+
+    for (k = 0; k < ALIAS_MAX; k ++) {
+        n = (start - 1 + k) % ALIAS_MAX + 1;
+        tailLen = (unsigned int) sprintf(tail, "~%u", n);
+        memcpy(shortName, basis, 11);
+        memcpy(shortName + (baseLen + tailLen > 8 ? 8 - tailLen : baseLen), tail, tailLen);
+        if (findDirItem(dir, shortName) == NO_FIND) {
+            *hint = n + 1;
+            return lfnNum;
+        }
+    }
+    return ERROR;
+}
+
+
+/**
+ * 写入文件名的长文件名表项及短文件名表项
+ * 在序号最小的 lfnNum + 1 个连续空闲表项中依次写入长文件名表项(倒序)和短文件名表项
+ * @param dir - 目录索引
+ * @param name - 文件名(UTF-8)
+ * @param lfnNum - 长文件名表项数(makeShortName 的返回值)
+ * @param item - 32 字节短文件名表项内容
+ * @return 短文件名表项序号，无足够的连续空闲表项返回 NO_FIND
+ */
+int insertDirItem(DirIndex *dir, const char *name, unsigned int lfnNum, const void *item) {
+    unsigned short longName[LFN_MAX_LEN];
+    LongDirItem lfn;
+    char shortName[12];
+    unsigned char checksum = 0;
+    unsigned int i;
+    int slot = findFreeDirRun(dir, lfnNum + 1), len = 0;
+
+    if (slot == NO_FIND) return NO_FIND;
+    if (lfnNum > 0) {
+        len = utf8ToUtf16(name, longName, LFN_MAX_LEN);
+        memcpy(shortName, item, 11);
+        shortName[11] = '\0';
+        checksum = getChecksumByShortName(shortName);
+    }
+
+    // 第 i + 1 段长文件名位于短文件名表项之前第 i + 1 项
+    for (i = 0; i < lfnNum; i ++) {
+        buildLongNameItem(&lfn, i + 1, i + 1 == lfnNum, longName, len, checksum);
+        setDirItem(dir, (unsigned int) slot + lfnNum - 1 - i, &lfn);
+    }
+    setDirItem(dir, (unsigned int) slot + lfnNum, item);
+    return slot + (int) lfnNum;
+}
+
+
+/**
+ * 计算短文件名的哈希值(FNV-1a)
+ * @param name - 8 + 3 格式的短文件名
+ * @return
+ */
+static unsigned int hashShortName(const unsigned char *name) {
+    unsigned int i, hash = 2166136261u;
+
+    for (i = 0; i < 11; i ++) {
+        hash ^= name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+/**
+ * 判断目录表项是否为需要索引的文件/目录项
+ * 卷标及长文件名项(属性含 0x08)不参与按名查找
+ * @param item - 表项
+ * @return
+ */
+static int isIndexedItem(const unsigned char *item) {
+    return item[0] != 0x00 && item[0] != 0xE5 && !(item[11] & 0x08);
+}
+
+
+/**
+ * 将表项加入哈希索引
+ * @param dir - 目录索引
+ * @param slot - 表项序号
+ */
+static void linkDirItem(DirIndex *dir, unsigned int slot) {
+    unsigned short longName[LFN_MAX_ITEMS * LFN_ITEM_CHARS];
+    unsigned int bucket = hashShortName(dir->data + (size_t) slot * DIR_ITEM_SIZE) & (dir->bucketNum - 1);
+    int len;
+
+    dir->next[slot] = dir->heads[bucket];
+    dir->heads[bucket] = (int) slot;
+
+    // 有长文件名的表项同时加入长文件名哈希索引
+    len = readLongName(dir, slot, longName);
+    if (len <= 0) {
+        dir->longNext[slot] = NO_LONG_NAME;
+        return;
+    }
+    dir->longHash[slot] = hashLongName(longName, len);
+    bucket = dir->longHash[slot] & (dir->bucketNum - 1);
+    dir->longNext[slot] = dir->longHeads[bucket];
+    dir->longHeads[bucket] = (int) slot;
+}
+
+
+/**
+ * 将表项移出哈希索引
+ * @param dir - 目录索引
+ * @param slot - 表项序号
+ */
+static void unlinkDirItem(DirIndex *dir, unsigned int slot) {
+    int *link = &dir->heads[hashShortName(dir->data + (size_t) slot * DIR_ITEM_SIZE) & (dir->bucketNum - 1)];
+
+    while (*link >= 0) {
+        if (*link == (int) slot) {
+            *link = dir->next[slot];
+            dir->next[slot] = -1;
+            break;
+        }
+        link = &dir->next[*link];
+    }
+
+    if (dir->longNext[slot] == NO_LONG_NAME) return;
+    link = &dir->longHeads[dir->longHash[slot] & (dir->bucketNum - 1)];
+    while (*link >= 0) {
+        if (*link == (int) slot) {
+            *link = dir->longNext[slot];
+            break;
+        }
+        link = &dir->longNext[*link];
+    }
+    dir->longNext[slot] = NO_LONG_NAME;
+}
+
+
+/**
+ * 标记表项所在扇区为脏
+ * @param dir - 目录索引
+ * @param slot - 表项序号
+ */
+static void markDirItemDirty(DirIndex *dir, unsigned int slot) {
+    unsigned int sector = slot * DIR_ITEM_SIZE / dir->sectorSize;
+
+    if (!dir->dirty[sector]) {
+        dir->dirty[sector] = 1;
+        dir->dirtyCount ++;
+    }
+}
+
+
+/**
+ * 按表项数重建哈希桶，哈希桶数为不小于表项数的 2 的幂
+ * 别名序号提示随之清空，此后各基名重新从 ~1 开始尝试
+ * @param dir - 目录索引
+ * @return
+ */
+static int rehashDirIndex(DirIndex *dir) {
+    unsigned int i, bucketNum = 16, *aliasHints;
+    int *heads, *longHeads;
+
+    while (bucketNum < dir->itemNum) bucketNum *= 2;
+    heads = (int*) malloc(bucketNum * sizeof(int));
+    longHeads = (int*) malloc(bucketNum * sizeof(int));
+    aliasHints = (unsigned int*) calloc(bucketNum, sizeof(unsigned int));
+    if (heads == NULL || longHeads == NULL || aliasHints == NULL) {
+        free(heads);
+        free(longHeads);
+        free(aliasHints);
+        return ERROR;
+    }
+    free(dir->heads);
+    free(dir->longHeads);
+    free(dir->aliasHints);
+    dir->heads = heads;
+    dir->longHeads = longHeads;
+    dir->aliasHints = aliasHints;
+    dir->bucketNum = bucketNum;
+
+    for (i = 0; i < bucketNum; i ++) {
+        dir->heads[i] = -1;
+        dir->longHeads[i] = -1;
+    }
+    for (i = 0; i < dir->itemNum; i ++) {
+        dir->next[i] = -1;
+        dir->longNext[i] = NO_LONG_NAME;
+        if (!(dir->freeMap[i / 64] & (1ULL << (i % 64))) && isIndexedItem(dir->data + (size_t) i * DIR_ITEM_SIZE)) {
+            linkDirItem(dir, i);
+        }
+    }
+    return OK;
+}
+
+
+/**
+ * 计算长文件名的哈希值(FNV-1a)，ASCII 字母统一按大写计算
+ * @param name - UTF-16 长文件名
+ * @param len - 字符数
+ * @return
+ */
+static unsigned int hashLongName(const unsigned short *name, int len) {
+    unsigned int hash = 2166136261u, c;
+    int i;
+
+    for (i = 0; i < len; i ++) {
+        c = name[i] >= 'a' && name[i] <= 'z' ? name[i] - 32u : name[i];
+        hash ^= c & 0xFF;
+        hash *= 16777619u;
+        hash ^= c >> 8;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+/**
+ * 比较两个长文件名，ASCII 字母不区分大小写
+ * @param a - UTF-16 长文件名
+ * @param b - UTF-16 长文件名
+ * @param len - 字符数
+ * @return 相同返回 0
+ */
+static int compareLongName(const unsigned short *a, const unsigned short *b, int len) {
+    unsigned int ca, cb;
+    int i;
+
+    for (i = 0; i < len; i ++) {
+        ca = a[i] >= 'a' && a[i] <= 'z' ? a[i] - 32u : a[i];
+        cb = b[i] >= 'a' && b[i] <= 'z' ? b[i] - 32u : b[i];
+        if (ca != cb) return 1;
+    }
+    return 0;
+}
+
+
+/**
+ * 读取短文件名表项之前的长文件名
+ * @param dir - 目录索引
+ * @param slot - 短文件名表项序号
+ * @param name - UTF-16 缓冲区，至少 LFN_MAX_ITEMS * LFN_ITEM_CHARS 个字符
+ * @return 字符数，没有长文件名返回 0
+ */
+static int readLongName(DirIndex *dir, unsigned int slot, unsigned short *name) {
+    const unsigned char *item;
+    unsigned int i, j, span = getDirItemSpan(dir, slot);
+    unsigned short c;
+    int len = 0;
+
+    for (i = 1; i < span; i ++) {
+        item = dir->data + (size_t) (slot - i) * DIR_ITEM_SIZE;
+        for (j = 0; j < LFN_ITEM_CHARS; j ++) {
+            c = (unsigned short) (item[lfnOffsets[j]] | (item[lfnOffsets[j] + 1] << 8));
+            if (c == 0) return len;
+            name[len ++] = c;
+        }
+    }
+    return len;
+}
+
+
+/**
+ * 构造一个长文件名表项
+ * 每项容纳 13 个 UTF-16 字符，文件名结束后补一个 0x0000，其余位置填充 0xFFFF
+ * @param item - 长文件名表项
+ * @param ordinal - 序号(从 1 开始)
+ * @param last - 是否为最后一段
+ * @param name - UTF-16 长文件名
+ * @param len - 字符数
+ * @param checksum - 短文件名校验值
+ */
+static void buildLongNameItem(LongDirItem *item, unsigned int ordinal, int last,
+                              const unsigned short *name, int len, unsigned char checksum) {
+    unsigned char *data = (unsigned char*) item;
+    unsigned int i;
+    int k;
+    unsigned short c;
+
+    memset(item, 0, sizeof(LongDirItem));
+    item->ordinal = (unsigned char) (ordinal | (last ? LFN_LAST_FLAG : 0));
+    item->attr = LFN_ATTR;
+    item->checksum = checksum;
+    for (i = 0; i < LFN_ITEM_CHARS; i ++) {
+        k = (int) ((ordinal - 1) * LFN_ITEM_CHARS + i);
+        c = k < len ? name[k] : k == len ? 0x0000 : 0xFFFF;
+        data[lfnOffsets[i]] = (unsigned char) (c & 0xFF);
+        data[lfnOffsets[i] + 1] = (unsigned char) (c >> 8);
+    }
+}
@@ -0,0 +1,172 @@
+#include <string.h>
+#include "../include/fatimg.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+/** x86 平台按处理器支持的指令集选择 AVX2 / SSSE3 内核 */
+#define FAT12_SIMD 1
+#endif
+
+
+/**
+ * FAT12表项打包/解包
+ * 每 3 字节存放 2 个 12 位表项：偶数项占第 0 字节及第 1 字节低 4 位，奇数项占第 1 字节高 4 位及第 2 字节。
+ * 载入FAT12表时一次解包为 16 位数组，此后表项读写不再跨字节拼接；写回前再一次打包。
+ * x86 平台使用 AVX2 (每次 16 项) 或 SSSE3 (每次 8 项) 内核，其余平台及尾部使用每次 4 项的 64 位标量内核
+ */
+
+
+/** 解包 4 个表项(读取 6 字节) */
+static void unpackFat12Quad(const unsigned char *src, unsigned short *dest) {
+    unsigned long long v = 0;
+    unsigned int i;
+
+    for (i = 0; i < 6; i ++) v |= (unsigned long long) src[i] << (i * 8);
+    dest[0] = (unsigned short) (v & 0xFFF);
+    dest[1] = (unsigned short) ((v >> 12) & 0xFFF);
+    dest[2] = (unsigned short) ((v >> 24) & 0xFFF);
+    dest[3] = (unsigned short) ((v >> 36) & 0xFFF);
+}
+
+
+/** 打包 4 个表项(写入 6 字节) */
+static void packFat12Quad(const unsigned short *src, unsigned char *dest) {
+    unsigned long long v = (unsigned long long) (src[0] & 0xFFF) | ((unsigned long long) (src[1] & 0xFFF) << 12)
+                         | ((unsigned long long) (src[2] & 0xFFF) << 24) | ((unsigned long long) (src[3] & 0xFFF) << 36);
+    unsigned int i;
+
+    for (i = 0; i < 6; i ++) dest[i] = (unsigned char) (v >> (i * 8));
+}
+
+
+#ifdef FAT12_SIMD
+/** 解包 8 个表项：每个 16 位通道取表项所在的 2 字节，偶数项保留低 12 位，奇数项右移 4 位 */
+__attribute__((target("ssse3")))
+static unsigned int unpackFat12Ssse3(const unsigned char *src, unsigned short *dest, unsigned int count) {
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+    const __m128i evenMask = _mm_set1_epi32(0x0000FFFF);
+    const __m128i low12 = _mm_set1_epi16(0x0FFF);
+    __m128i v;
+    unsigned int i;
+
+    // 每次读取 16 字节，只使用前 12 字节，保证不越过表尾
+    for (i = 0; i + 8 <= count && (i / 2 * 3) + 16 <= (count / 2 * 3); i += 8) {
+        v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (src + i / 2 * 3)), shuffle);
+        v = _mm_or_si128(_mm_and_si128(evenMask, _mm_and_si128(v, low12)), _mm_andnot_si128(evenMask, _mm_srli_epi16(v, 4)));
+        _mm_storeu_si128((__m128i*) (dest + i), v);
+    }
+    return i;
+}
+
+
+/** 打包 8 个表项：每个 32 位通道拼成 24 位，再去掉每通道的最高字节 */
+__attribute__((target("ssse3")))
+static unsigned int packFat12Ssse3(const unsigned short *src, unsigned char *dest, unsigned int count) {
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m128i evenMask = _mm_set1_epi32(0x00000FFF);
+    const __m128i oddMask = _mm_set1_epi32(0x0FFF0000);
+    __m128i v;
+    unsigned int i;
+
+    // 每次写入 16 字节，后 4 字节由下一批覆盖，保证不越过表尾
+    for (i = 0; i + 8 <= count && (i / 2 * 3) + 16 <= (count / 2 * 3); i += 8) {
+        v = _mm_loadu_si128((const __m128i*) (src + i));
+        v = _mm_or_si128(_mm_and_si128(v, evenMask), _mm_srli_epi32(_mm_and_si128(v, oddMask), 4));
+        _mm_storeu_si128((__m128i*) (dest + i / 2 * 3), _mm_shuffle_epi8(v, shuffle));
+    }
+    return i;
+}
+
+
+/** 解包 16 个表项：以前 4 字节为起点读取 32 字节，使两个 128 位通道各自对齐 12 字节 */
+__attribute__((target("avx2")))
+static unsigned int unpackFat12Avx2(const unsigned char *src, unsigned short *dest, unsigned int count) {
+    const __m256i shuffle = _mm256_setr_epi8(4, 5, 5, 6, 7, 8, 8, 9, 10, 11, 11, 12, 13, 14, 14, 15,
+                                             0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+    const __m256i evenMask = _mm256_set1_epi32(0x0000FFFF);
+    const __m256i low12 = _mm256_set1_epi16(0x0FFF);
+    __m256i v;
+    unsigned int i;
+
+    // 表头前没有可借用的 4 字节，前 8 项使用标量内核
+    if (count < 8) return 0;
+    unpackFat12Quad(src, dest);
+    unpackFat12Quad(src + 6, dest + 4);
+    for (i = 8; i + 16 <= count && (i / 2 * 3) + 24 + 4 <= (count / 2 * 3); i += 16) {
+        v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*) (src + i / 2 * 3 - 4)), shuffle);
+        v = _mm256_or_si256(_mm256_and_si256(evenMask, _mm256_and_si256(v, low12)), _mm256_andnot_si256(evenMask, _mm256_srli_epi16(v, 4)));
+        _mm256_storeu_si256((__m256i*) (dest + i), v);
+    }
+    return i + unpackFat12Ssse3(src + i / 2 * 3, dest + i, count - i);
+}
+
+
+/** 打包 16 个表项：两个 128 位通道各拼成 12 字节，分两次写出 */
+__attribute__((target("avx2")))
+static unsigned int packFat12Avx2(const unsigned short *src, unsigned char *dest, unsigned int count) {
+    const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                             0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i evenMask = _mm256_set1_epi32(0x00000FFF);
+    const __m256i oddMask = _mm256_set1_epi32(0x0FFF0000);
+    __m256i v;
+    unsigned int i;
+
+    for (i = 0; i + 16 <= count && (i / 2 * 3) + 28 <= (count / 2 * 3); i += 16) {
+        v = _mm256_loadu_si256((const __m256i*) (src + i));
+        v = _mm256_or_si256(_mm256_and_si256(v, evenMask), _mm256_srli_epi32(_mm256_and_si256(v, oddMask), 4));
+        v = _mm256_shuffle_epi8(v, shuffle);
+        _mm_storeu_si128((__m128i*) (dest + i / 2 * 3), _mm256_castsi256_si128(v));
+        _mm_storeu_si128((__m128i*) (dest + i / 2 * 3 + 12), _mm256_extracti128_si256(v, 1));
+    }
+    return i + packFat12Ssse3(src + i, dest + i / 2 * 3, count - i);
+}
+#endif
+
+
+/**
+ * 将FAT12表解包为 16 位表项数组
+ * @param src - FAT12表内容，至少 count / 2 * 3 字节(count 为奇数时再多 2 字节)
+ * @param dest - 表项数组，count 项
+ * @param count - 表项数
+ */
+void unpackFat12(const unsigned char *src, unsigned short *dest, unsigned int count) {
+    unsigned int i = 0;
+
+#ifdef FAT12_SIMD
+    if (__builtin_cpu_supports("avx2")) i = unpackFat12Avx2(src, dest, count);
+    else if (__builtin_cpu_supports("ssse3")) i = unpackFat12Ssse3(src, dest, count);
+#endif
+    for (; i + 4 <= count; i += 4) unpackFat12Quad(src + i / 2 * 3, dest + i);
+    for (; i < count; i ++) {
+        dest[i] = (unsigned short) (src[i + i / 2] | (src[i + i / 2 + 1] << 8));
+        dest[i] = i % 2 == 0 ? dest[i] & 0xFFF : dest[i] >> 4;
+    }
+}
+
+
+/**
+ * 将 16 位表项数组打包为FAT12表
+ * @param src - 表项数组，count 项，只使用低 12 位
+ * @param dest - FAT12表内容
+ * @param count - 表项数
+ */
+void packFat12(const unsigned short *src, unsigned char *dest, unsigned int count) {
+    unsigned int i = 0, offset;
+
+#ifdef FAT12_SIMD
+    if (__builtin_cpu_supports("avx2")) i = packFat12Avx2(src, dest, count);
+    else if (__builtin_cpu_supports("ssse3")) i = packFat12Ssse3(src, dest, count);
+#endif
+    for (; i + 4 <= count; i += 4) packFat12Quad(src + i, dest + i / 2 * 3);
+    for (; i < count; i ++) {
+        // 尾部的单个表项与相邻表项共用字节
+        offset = i + i / 2;
+        if (i % 2 == 0) {
+            dest[offset] = (unsigned char) src[i];
+            dest[offset + 1] = (unsigned char) ((dest[offset + 1] & 0xF0) | ((src[i] >> 8) & 0x0F));
+        } else {
+            dest[offset] = (unsigned char) ((dest[offset] & 0x0F) | ((src[i] & 0xF) << 4));
+            dest[offset + 1] = (unsigned char) (src[i] >> 4);
+        }
+    }
+}
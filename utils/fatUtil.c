@@ -1,10 +1,13 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "../include/fatimg.h"
 
 #if defined(_WIN32) || defined(_WIN64)
 #include <windows.h>
 #include <direct.h>
+#include <io.h>
 #else
 #include <sys/stat.h>
 #endif
@@ -43,6 +46,22 @@ FILE_TYPE getFileType(const char *path) {
 #endif
 }
 
+/**
+ * 获取已打开文件的大小
+ * 使用 64 位长度，不受 long 为 32 位的平台限制
+ * @param fp - 文件句柄
+ * @return 文件大小(字节)，失败返回 -1
+ */
+long long getFileSize(FILE *fp) {
+#if defined(_WIN32) || defined(_WIN64)
+    return _filelengthi64(_fileno(fp));
+#else
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0) return -1;
+    return (long long) st.st_size;
+#endif
+}
+
 /**
  * 获取文件创建时间
  * dest[0] - 年,
@@ -59,6 +78,22 @@ void getFileCreateTimeArray(const char *path, int *dest) {
     WIN32_FILE_ATTRIBUTE_DATA data;
     if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data)) return;
     SYSTEMTIME st;
+    ULARGE_INTEGER ft;
+    struct tm tmBuf;
+    long long epoch;
+    if (getReproducibleBuild(&epoch, NULL)) {
+        // 可重现构建时晚于固定时间的创建时间按固定时间写入
+        ft.LowPart = data.ftCreationTime.dwLowDateTime;
+        ft.HighPart = data.ftCreationTime.dwHighDateTime;
+        if (getLocalTime(getBuildTime((time_t) ((ft.QuadPart - 116444736000000000ULL) / 10000000ULL)), &tmBuf) == NULL) return;
+        dest[0] = tmBuf.tm_year + 1900;
+        dest[1] = tmBuf.tm_mon + 1;
+        dest[2] = tmBuf.tm_mday;
+        dest[3] = tmBuf.tm_hour;
+        dest[4] = tmBuf.tm_min;
+        dest[5] = tmBuf.tm_sec;
+        return;
+    }
     // 使用 ftCreationTime (创建时间)
     FileTimeToSystemTime(&data.ftCreationTime, &st);
     dest[0] = st.wYear;
@@ -69,9 +104,15 @@ void getFileCreateTimeArray(const char *path, int *dest) {
     dest[5] = st.wSecond;
 #else
     struct stat st;
+    struct tm tmBuf;
     if (stat(path, &st) != 0) return;
+#if defined(__APPLE__)
     // 使用 st.st_birthtimespec.tv_sec 创建时间 (秒)
-    struct tm *tm_info = localtime(&st.st_birthtimespec.tv_sec);
+    struct tm *tm_info = getLocalTime(getBuildTime(st.st_birthtimespec.tv_sec), &tmBuf);
+#else
+    // Linux 等平台的 stat 不提供创建时间，使用最后修改时间代替
+    struct tm *tm_info = getLocalTime(getBuildTime(st.st_mtime), &tmBuf);
+#endif
     dest[0] = tm_info->tm_year + 1900;
     dest[1] = tm_info->tm_mon + 1;
     dest[2] = tm_info->tm_mday;
@@ -82,131 +123,655 @@ void getFileCreateTimeArray(const char *path, int *dest) {
 }
 
 
+/** 遍历一次FAT表，建立空闲簇位图并统计空闲簇数 */
+static int buildFreeClusterMap(FatCache *fat);
+/** 按需读入FAT表中尚未载入的扇区 */
+static void ensureFatLoaded(FatCache *fat, unsigned long long offset, unsigned int len);
+/** FAT12表中容纳的完整表项数 */
+static unsigned int getFat12EntryNum(FatCache *fat);
+/** 查找 [from, to) 中第一个空闲或已占用的簇(按需载入FAT扇区) */
+static unsigned int scanFatEntries(FatCache *fat, unsigned int from, unsigned int to, int wantFree);
+
+
 /**
- * 查找FAT空闲簇数
- * @param fp - fat镜像文件句柄
- * @param fatPos - fat起始位置(字节)
- * @param fatSize - fat大小(字节)
+ * FAT表项编解码模板
+ * 按FAT类型生成读取、写入、查找空闲/已占用簇及建立空闲簇位图的特化函数，
+ * 载入FAT表时选定一次，循环内部不再按类型分支。表项位置均为整数运算
+ * @param NAME - 类型名(12 / 16 / 32)
+ * @param BASE_T - 表项数组元素类型
+ * @param READ - 读取表项 p[n] 的宏
+ * @param WRITE - 写入表项 p[n] = v 的宏
+ */
+#define DEFINE_FAT_CODEC(NAME, BASE_T, READ, WRITE) \
+    static unsigned int getFat##NAME##Entry(const void *base, unsigned int n) { \
+        const BASE_T *p = (const BASE_T*) base; \
+        return READ(p, n); \
+    } \
+    static void setFat##NAME##Entry(void *base, unsigned int n, unsigned int v) { \
+        BASE_T *p = (BASE_T*) base; \
+        WRITE(p, n, v); \
+    } \
+    static unsigned int findFat##NAME##Free(const void *base, unsigned int from, unsigned int to) { \
+        const BASE_T *p = (const BASE_T*) base; \
+        unsigned int n; \
+        for (n = from; n < to && READ(p, n) != 0; n ++); \
+        return n; \
+    } \
+    static unsigned int findFat##NAME##Used(const void *base, unsigned int from, unsigned int to) { \
+        const BASE_T *p = (const BASE_T*) base; \
+        unsigned int n; \
+        for (n = from; n < to && READ(p, n) == 0; n ++); \
+        return n; \
+    } \
+    static unsigned int mapFat##NAME##Free(const void *base, unsigned int count, unsigned long long *freeMap) { \
+        const BASE_T *p = (const BASE_T*) base; \
+        unsigned int n, freeCount = 0; \
+        for (n = 2; n < count; n ++) { \
+            if (READ(p, n) == 0) { \
+                freeMap[n / 64] |= 1ULL << (n % 64); \
+                freeCount ++; \
+            } \
+        } \
+        return freeCount; \
+    }
+
+// FAT12表项已解包为 16 位数组
+#define FAT12_READ(p, n) ((unsigned int) (p)[n])
+#define FAT12_WRITE(p, n, v) ((p)[n] = (unsigned short) ((v) & 0xFFF))
+// FAT16表项为 2 字节小端
+#define FAT16_READ(p, n) ((unsigned int) ((p)[(n) * 2] | ((p)[(n) * 2 + 1] << 8)))
+#define FAT16_WRITE(p, n, v) ((p)[(n) * 2] = (unsigned char) (v), (p)[(n) * 2 + 1] = (unsigned char) ((v) >> 8))
+// FAT32表项只使用低 28 位，写入时保持高 4 位原值
+#define FAT32_READ(p, n) (((p)[(n) * 4] | ((p)[(n) * 4 + 1] << 8) | ((p)[(n) * 4 + 2] << 16) \
+                          | ((unsigned int) (p)[(n) * 4 + 3] << 24)) & 0x0FFFFFFF)
+#define FAT32_WRITE(p, n, v) ((p)[(n) * 4] = (unsigned char) (v), (p)[(n) * 4 + 1] = (unsigned char) ((v) >> 8), \
+                              (p)[(n) * 4 + 2] = (unsigned char) ((v) >> 16), \
+                              (p)[(n) * 4 + 3] = (unsigned char) (((p)[(n) * 4 + 3] & 0xF0) | (((v) >> 24) & 0x0F)))
+
+DEFINE_FAT_CODEC(12, unsigned short, FAT12_READ, FAT12_WRITE)
+DEFINE_FAT_CODEC(16, unsigned char, FAT16_READ, FAT16_WRITE)
+DEFINE_FAT_CODEC(32, unsigned char, FAT32_READ, FAT32_WRITE)
+
+static const FatCodec fat12Codec = {getFat12Entry, setFat12Entry, findFat12Free, findFat12Used, mapFat12Free, 12, 2, 0xFFF};
+static const FatCodec fat16Codec = {getFat16Entry, setFat16Entry, findFat16Free, findFat16Used, mapFat16Free, 16, 2, 0xFFFF};
+static const FatCodec fat32Codec = {getFat32Entry, setFat32Entry, findFat32Free, findFat32Used, mapFat32Free, 32, 4, 0x0FFFFFFF};
+
+
+/**
+ * 获取FAT类型对应的表项编解码
  * @param type - fat类型
- * @return 返回FAT空闲簇数
+ * @return 表项编解码
  */
-unsigned int getFreeClusterNum(FILE *fp, long fatPos, long fatSize, FAT_TYPE type) {
-    // FAT文件分配表对应的数据簇从第2个表项开始，即从第2个表项开始查找，一直查找到最后
-    unsigned int startNum = 2, count = 0, temp = 0;
+const FatCodec *getFatCodec(FAT_TYPE type) {
     switch (type) {
-        case FAT12: {
-            while((temp = findEmptyCluster(fp, fatPos, fatSize, startNum, type)) > 0) {
-                startNum = temp + 1;
-                count ++;
+        case FAT12: return &fat12Codec;
+        case FAT16: return &fat16Codec;
+        default: return &fat32Codec;
+    }
+}
+
+
+/**
+ * 载入FAT表缓存
+ * 每个打开的镜像只读取一次FAT1，此后所有表项读写均在内存中完成。
+ * 提供有效的空闲簇数及下一空闲簇提示(FSINFO)时，不遍历FAT表，
+ * FAT1 各扇区在首次访问时才读入，空闲簇位图在需要时才建立
+ * @param fat - FAT表缓存
+ * @param io - 镜像读写器
+ * @param fatPos - FAT1 起始位置(字节)
+ * @param fatSize - 每个FAT表大小(字节)
+ * @param fatNum - FAT表个数
+ * @param clusterCount - 表项数(最大簇号 + 1)
+ * @param sectorSize - 扇区大小(字节)，作为脏标记粒度
+ * @param type - fat类型
+ * @param freeHint - 空闲簇数提示，未知为 FSINFO_UNKNOWN
+ * @param nextHint - 下一空闲簇号提示，未知为 FSINFO_UNKNOWN
+ * @return
+ */
+int loadFatCache(FatCache *fat, ImgWriter *io, long long fatPos, unsigned int fatSize,
+                 unsigned int fatNum, unsigned int clusterCount, unsigned int sectorSize, FAT_TYPE type,
+                 unsigned int freeHint, unsigned int nextHint) {
+    char trustHint = freeHint <= clusterCount - 2 && nextHint >= 2 && nextHint < clusterCount;
+
+    memset(fat, 0, sizeof(FatCache));
+    fat->type = type;
+    fat->codec = getFatCodec(type);
+    fat->pos = fatPos;
+    fat->size = fatSize;
+    fat->fatNum = fatNum;
+    fat->clusterCount = clusterCount;
+    fat->sectorSize = sectorSize;
+
+    fat->dirty = (unsigned char*) calloc(fatSize / sectorSize + 1, 1);
+    if (fat->dirty == NULL) return ERROR;
+
+    // 镜像已映射到内存时直接使用映射中的 FAT1，不再复制
+    fat->table = imgWriterMapPtr(io, fatPos, fatSize);
+    if (fat->table != NULL) {
+        fat->mapped = 1;
+    } else {
+        fat->table = (unsigned char*) malloc(fatSize);
+        if (fat->table == NULL) {
+            freeFatCache(fat);
+            return ERROR;
+        }
+        if (trustHint && type != FAT12) {
+            // 按扇区延迟读入(FAT12表不超过 6KB，总是一次读入)
+            fat->io = io;
+            fat->loaded = (unsigned char*) calloc(fatSize / sectorSize + 1, 1);
+            if (fat->loaded == NULL) {
+                freeFatCache(fat);
+                return ERROR;
+            }
+        } else if (imgWriterRead(io, fatPos, fat->table, fatSize) != OK) {
+            freeFatCache(fat);
+            return ERROR;
+        }
+    }
+
+    // FAT12表一次解包，此后表项读写不再跨字节拼接
+    if (type == FAT12) {
+        // 数组按 12 位表项的全部取值分配，损坏的簇链中越界的簇号也不会越过数组
+        fat->entries = (unsigned short*) calloc(FAT12_MAX_ENTRIES, sizeof(unsigned short));
+        if (fat->entries == NULL) {
+            freeFatCache(fat);
+            return ERROR;
+        }
+        unpackFat12(fat->table, fat->entries, getFat12EntryNum(fat));
+    }
+    fat->base = type == FAT12 ? (void*) fat->entries : (void*) fat->table;
+
+    if (!trustHint) return buildFreeClusterMap(fat);
+    fat->freeCount = freeHint;
+    fat->nextFree = nextHint;
+    return OK;
+}
+
+
+/**
+ * 按需读入FAT表中尚未载入的扇区
+ * 连续的未载入扇区合并为一次读取，每次至少预读 FAT_READ_AHEAD 字节。
+ * 读取失败的扇区填充 0xFF，使其中的簇均视为已占用，不会被分配
+ * @param fat - FAT表缓存
+ * @param offset - 访问位置(字节)
+ * @param len - 访问长度(字节)
+ */
+static void ensureFatLoaded(FatCache *fat, unsigned long long offset, unsigned int len) {
+    unsigned int sectors = (fat->size + fat->sectorSize - 1) / fat->sectorSize;
+    unsigned long long lastSector = (offset + len - 1) / fat->sectorSize;
+    unsigned int first, last, start, end, bytes;
+
+    if (fat->loaded == NULL || offset / fat->sectorSize >= sectors) return;
+    first = (unsigned int) (offset / fat->sectorSize);
+    last = lastSector >= sectors ? sectors - 1 : (unsigned int) lastSector;
+    for (start = first; start <= last; start = end) {
+        if (fat->loaded[start]) {
+            end = start + 1;
+            continue;
+        }
+        // 找出连续的未载入扇区，并向后预读
+        for (end = start + 1; end < sectors && !fat->loaded[end]
+             && (end <= last || (end - start) * fat->sectorSize < FAT_READ_AHEAD); end ++);
+        bytes = end * fat->sectorSize > fat->size ? fat->size - start * fat->sectorSize : (end - start) * fat->sectorSize;
+        if (imgWriterRead(fat->io, fat->pos + (long long)start * fat->sectorSize, fat->table + start * fat->sectorSize, bytes) != OK) {
+            memset(fat->table + start * fat->sectorSize, 0xFF, bytes);
+        }
+        memset(fat->loaded + start, 1, end - start);
+    }
+}
+
+
+/**
+ * 簇号对应的FAT表项在表中的位置
+ * FAT32 簇号乘以表项位数可能超出 unsigned int，按 unsigned long long 计算
+ * @param fat - FAT表缓存
+ * @param clusterNum - 簇号
+ * @return 表项位置(字节)
+ */
+static unsigned long long getFatEntryOffset(FatCache *fat, unsigned int clusterNum) {
+    return (unsigned long long) clusterNum * fat->codec->entryBits / 8;
+}
+
+
+/**
+ * FAT12表中容纳的完整表项数
+ * @param fat - FAT表缓存
+ * @return 不超过 FAT12_MAX_ENTRIES
+ */
+static unsigned int getFat12EntryNum(FatCache *fat) {
+    unsigned int count = fat->size / 3 * 2 + (fat->size % 3 == 2);
+    return count < FAT12_MAX_ENTRIES ? count : FAT12_MAX_ENTRIES;
+}
+
+
+/**
+ * 查找 [from, to) 中第一个空闲或已占用的簇
+ * 延迟载入时按 FAT_READ_AHEAD 分段载入FAT扇区，只读取实际扫描到的部分
+ * @param fat - FAT表缓存
+ * @param from - 起始簇号
+ * @param to - 结束簇号(不含)
+ * @param wantFree - 1 查找空闲簇，0 查找已占用簇
+ * @return 找到的簇号，没有返回 to
+ */
+static unsigned int scanFatEntries(FatCache *fat, unsigned int from, unsigned int to, int wantFree) {
+    const FatCodec *codec = fat->codec;
+    unsigned int step = FAT_READ_AHEAD / codec->entryBytes, end, found;
+
+    for (; from < to; from = end) {
+        end = to - from > step ? from + step : to;
+        if (fat->loaded != NULL) ensureFatLoaded(fat, getFatEntryOffset(fat, from), (end - from) * codec->entryBytes);
+        found = wantFree ? codec->findFree(fat->base, from, end) : codec->findUsed(fat->base, from, end);
+        if (found < end) return found;
+    }
+    return to;
+}
+
+
+/**
+ * 遍历一次FAT表，建立空闲簇位图并统计空闲簇数
+ * @param fat - FAT表缓存
+ * @return
+ */
+static int buildFreeClusterMap(FatCache *fat) {
+    unsigned int words = (fat->clusterCount + 63) / 64;
+
+    fat->freeMap = (unsigned long long*) calloc(words + 1, sizeof(unsigned long long));
+    if (fat->freeMap == NULL) return ERROR;
+
+    // 延迟载入时先一次读入整个FAT1
+    ensureFatLoaded(fat, 0, fat->size);
+
+    // 第 0、1 簇为保留簇，从第 2 簇开始
+    fat->freeCount = fat->codec->mapFree(fat->base, fat->clusterCount, fat->freeMap);
+    if (fat->nextFree < 2 || fat->nextFree >= fat->clusterCount) fat->nextFree = 2;
+    return OK;
+}
+
+
+/**
+ * 将FAT表缓存的脏区域写入全部FAT表
+ * 连续的脏扇区合并为一段，每段在每个FAT表中各写一次
+ * 映射模式下 FAT1 已在映射内存中直接修改，只需写入其余FAT表
+ * @param fat - FAT表缓存
+ * @param io - 镜像读写器
+ * @return
+ */
+int flushFatCache(FatCache *fat, ImgWriter *io) {
+    unsigned int i, start, end, sectors;
+    if (fat->table == NULL || fat->dirtyCount == 0) return OK;
+
+    sectors = (fat->size + fat->sectorSize - 1) / fat->sectorSize;
+    if (fat->entries != NULL) packFat12(fat->entries, fat->table, getFat12EntryNum(fat));
+    if (fat->mapped) io->mapDirty = 1;
+    for (i = fat->mapped ? 1 : 0; i < fat->fatNum; i ++) {
+        for (start = 0; start < sectors; start = end) {
+            // 跳过干净的扇区
+            if (!fat->dirty[start]) {
+                end = start + 1;
+                continue;
+            }
+            // 找出连续的脏扇区
+            for (end = start + 1; end < sectors && fat->dirty[end]; end ++);
+            if (end * fat->sectorSize > fat->size) {
+                if (imgWriterWrite(io, fat->pos + (long long)i * fat->size + (long long)start * fat->sectorSize,
+                                   fat->table + start * fat->sectorSize, fat->size - start * fat->sectorSize) != OK) return ERROR;
+            } else {
+                if (imgWriterWrite(io, fat->pos + (long long)i * fat->size + (long long)start * fat->sectorSize,
+                                   fat->table + start * fat->sectorSize, (end - start) * fat->sectorSize) != OK) return ERROR;
             }
-        } break;
-        case FAT32: {
+        }
+    }
+
+    memset(fat->dirty, 0, sectors);
+    fat->dirtyCount = 0;
+    return OK;
+}
+
+
+/**
+ * 释放FAT表缓存
+ * @param fat - FAT表缓存
+ */
+void freeFatCache(FatCache *fat) {
+    if (!fat->mapped) free(fat->table);
+    free(fat->entries);
+    free(fat->dirty);
+    free(fat->loaded);
+    free(fat->freeMap);
+    fat->table = NULL;
+    fat->entries = NULL;
+    fat->dirty = NULL;
+    fat->loaded = NULL;
+    fat->freeMap = NULL;
+}
+
 
-        } break;
-        default: {}
+/**
+ * 标记FAT表缓存中被修改的区域
+ * @param fat - FAT表缓存
+ * @param offset - 修改位置(字节)
+ * @param len - 修改长度(字节)
+ */
+static void markFatDirty(FatCache *fat, unsigned long long offset, unsigned int len) {
+    unsigned long long i;
+    for (i = offset / fat->sectorSize; i <= (offset + len - 1) / fat->sectorSize; i ++) {
+        if (!fat->dirty[i]) {
+            fat->dirty[i] = 1;
+            fat->dirtyCount ++;
+        }
     }
-    return count;
+}
+
+
+/**
+ * 查找FAT空闲簇数
+ * 空闲簇数在载入FAT表时统计或取自FSINFO，之后随表项修改同步更新
+ * @param fat - FAT表缓存
+ * @return 返回FAT空闲簇数
+ */
+unsigned int getFreeClusterNum(FatCache *fat) {
+    return fat->freeCount;
 }
 
 
 /**
  * 在FAT中寻找空簇
- * @param fp - fat镜像文件句柄
- * @param fatPos - fat起始位置(字节)
- * @param fatSize - fat大小(字节)
+ * 在空闲簇位图中按 64 位字查找，跳过整字全满的区域
+ * @param fat - FAT表缓存
  * @param startNum - 从哪个fat表项开始查找
- * @param type - fat类型
- * @return 返回一个可用的空簇号
+ * @return 返回一个可用的空簇号，没有空簇时返回 0
  */
-unsigned int findEmptyCluster(FILE *fp, long fatPos, long fatSize, unsigned int startNum, FAT_TYPE type) {
-    unsigned int i, loopCount;
-    switch (type) {
-        case FAT12: {
-            // 计算一个FAT表有多少项表项并循环查找空值
-            loopCount = (unsigned int)(fatSize / 1.5);
-            for(i = startNum; i <= loopCount; i ++) {
-                if(getNextClusterLinkNum(fp, fatPos, i, FAT12) == 0) {
-                    return i;
+unsigned int findEmptyCluster(FatCache *fat, unsigned int startNum) {
+    unsigned int i, words = (fat->clusterCount + 63) / 64;
+    unsigned long long word;
+
+    if (fat->freeMap == NULL && buildFreeClusterMap(fat) != OK) return 0;
+    if (startNum < 2) startNum = 2;
+    if (startNum >= fat->clusterCount) return 0;
+
+    // 起始字中屏蔽掉起始簇之前的位
+    i = startNum / 64;
+    word = fat->freeMap[i] & (~0ULL << (startNum % 64));
+    while (1) {
+        if (word != 0) return i * 64 + (unsigned int) __builtin_ctzll(word);
+        if (++ i >= words) return 0;
+        word = fat->freeMap[i];
+    }
+}
+
+
+/**
+ * 在FAT中寻找已占用的簇
+ * @param fat - FAT表缓存
+ * @param startNum - 从哪个fat表项开始查找
+ * @return 返回第一个已占用的簇号，之后全部空闲时返回表项数
+ */
+static unsigned int findUsedCluster(FatCache *fat, unsigned int startNum) {
+    unsigned int i, words = (fat->clusterCount + 63) / 64;
+    unsigned long long word;
+
+    if (startNum >= fat->clusterCount) return fat->clusterCount;
+
+    // 位图取反后查找第一个置位的位
+    i = startNum / 64;
+    word = ~fat->freeMap[i] & (~0ULL << (startNum % 64));
+    while (1) {
+        if (word != 0) {
+            i = i * 64 + (unsigned int) __builtin_ctzll(word);
+            return i < fat->clusterCount ? i : fat->clusterCount;
+        }
+        if (++ i >= words) return fat->clusterCount;
+        word = ~fat->freeMap[i];
+    }
+}
+
+
+/**
+ * 按分配策略查找能容纳所需簇数的连续空闲区段
+ * @param fat - FAT表缓存
+ * @param needClusters - 所需簇数
+ * @param policy - 分配策略
+ * @param extent - 找到的区段
+ * @return 找到返回 OK，否则返回 NO_FIND
+ */
+static int findFreeExtent(FatCache *fat, unsigned int needClusters, int policy, ClusterExtent *extent) {
+    unsigned int start, end, from, pass;
+    unsigned int bestStart = 0, bestCount = 0;
+
+    // 下一次适应从上次分配结束的位置开始查找，找不到时从头查找一遍
+    from = policy == ALLOC_NEXT_FIT ? fat->nextFree : 2;
+    for (pass = 0; pass < 2; pass ++) {
+        start = findEmptyCluster(fat, from);
+        while (start != 0) {
+            end = findUsedCluster(fat, start);
+            if (end - start >= needClusters) {
+                if (policy != ALLOC_BEST_FIT) {
+                    extent->start = start;
+                    extent->count = needClusters;
+                    return OK;
+                }
+                // 最佳适应记录能容纳所需簇数的最小区段
+                if (bestCount == 0 || end - start < bestCount) {
+                    bestStart = start;
+                    bestCount = end - start;
+                    if (bestCount == needClusters) break;
                 }
             }
-        } break;
-        case FAT32: {
+            start = findEmptyCluster(fat, end);
+        }
+        if (policy != ALLOC_NEXT_FIT || from <= 2) break;
+        from = 2;
+    }
 
-        } break;
-        default: {}
+    if (bestCount == 0) return NO_FIND;
+    extent->start = bestStart;
+    extent->count = needClusters;
+    return OK;
+}
+
+
+/**
+ * 查找最大的连续空闲区段
+ * @param fat - FAT表缓存
+ * @param extent - 找到的区段
+ */
+static void findLargestFreeExtent(FatCache *fat, ClusterExtent *extent) {
+    unsigned int start, end;
+
+    extent->start = 0;
+    extent->count = 0;
+    start = findEmptyCluster(fat, 2);
+    while (start != 0) {
+        end = findUsedCluster(fat, start);
+        if (end - start > extent->count) {
+            extent->start = start;
+            extent->count = end - start;
+        }
+        start = findEmptyCluster(fat, end);
     }
-    return 0;
 }
 
 
 /**
- * 通过本簇号在FAT中的偏移查找文件/目录簇链的下一簇号
- * @param fp - fat镜像文件句柄
- * @param offset - 本簇号在FAT文件分配表中的偏移
+ * 获取FAT类型对应的簇链结束标记
  * @param type - fat类型
- * @return 文件/目录簇链的下一簇号
+ * @return 簇链结束标记
  */
-unsigned int getNextClusterLinkNum(FILE* fp, long fatPos, unsigned int clusterNum, FAT_TYPE type) {
-    unsigned short nextClusterNum12 = 0;
-    unsigned int nextClusterNum = 0;
-    switch (type) {
-        case FAT12: {
-            // 获取FAT中的相对位移
-            fseek(fp, (long)(fatPos + clusterNum * 1.5), SEEK_SET);
-            // 读出两个字节（16位模式下为一个字）
-            fread(&nextClusterNum12, 2, 1, fp);
-            // 偶数项取低 12 位，奇数项取高 12 位
-            nextClusterNum =  (clusterNum % 2 == 0 ? nextClusterNum12 & 0xFFF : nextClusterNum12 >> 4);
-        } break;
-        case FAT32: {
+unsigned int getEndClusterFlag(FAT_TYPE type) {
+    return getFatCodec(type)->endFlag;
+}
+
 
-        } break;
-        default: {}
+/**
+ * 将区段内的簇依次相连，最后一簇写入结束标记
+ * @param fat - FAT表缓存
+ * @param extent - 区段
+ */
+static void linkExtent(FatCache *fat, ClusterExtent *extent) {
+    unsigned int j, endFlag = fat->codec->endFlag;
+
+    for (j = 0; j < extent->count; j ++) {
+        setNextClusterLinkNum(fat, extent->start + j, j + 1 < extent->count ? extent->start + j + 1 : endFlag);
     }
-    return nextClusterNum;
 }
 
 
 /**
- * 向本簇号指向的FAT文件分配表表项中写入簇链的下一簇号
- * @param fp - fat镜像文件句柄
- * @param fat1Pos -  fat1起始位置(字节)
- * @param fat2Pos -  fat2起始位置(字节)
- * @param clusterNum - 本簇号
- * @param nextClusterNum  - 下一簇号
- * @param type - fat类型
+ * 从下一空闲簇提示开始顺序查找空闲簇区段，不使用空闲簇位图
+ * 用于FSINFO提示有效时的首次/下次适应分配，只读取提示之后实际用到的FAT扇区
+ * @param fat - FAT表缓存
+ * @param needClusters - 所需簇数
+ * @param extents - 找到的区段列表
+ * @param extentNum - 区段数
+ * @return 提示之后的空闲簇不足返回 NO_FIND
  */
-void setNextClusterLinkNum(FILE *fp, long fat1Pos, long fat2Pos, unsigned int clusterNum, unsigned int nextClusterNum, FAT_TYPE type) {
-    unsigned int temp;
+static int findExtentsFromHint(FatCache *fat, unsigned int needClusters, ClusterExtent **extents, unsigned int *extentNum) {
+    ClusterExtent *list = NULL, *temp;
+    unsigned int count = 0, capacity = 0, remaining = needClusters, cluster = fat->nextFree, start;
 
-    switch (type) {
-        case FAT12: {
+    while (remaining > 0 && cluster < fat->clusterCount) {
+        start = scanFatEntries(fat, cluster, fat->clusterCount, 1);
+        if (start >= fat->clusterCount) break;
+        cluster = scanFatEntries(fat, start, fat->clusterCount - start > remaining ? start + remaining : fat->clusterCount, 0);
 
-            // 读取 本簇号 对应的 FAT表项 所在位置的2个字节
-            fseek(fp, (long)(fat1Pos + clusterNum * 1.5), SEEK_SET);
-            fread(&temp, 2, 1, fp);
+        if (count == capacity) {
+            capacity = capacity == 0 ? 4 : capacity * 2;
+            temp = (ClusterExtent*) realloc(list, capacity * sizeof(ClusterExtent));
+            if (temp == NULL) {
+                free(list);
+                return ERROR;
+            }
+            list = temp;
+        }
+        list[count].start = start;
+        list[count ++].count = cluster - start;
+        remaining -= cluster - start;
+    }
 
-            if(clusterNum % 2 == 0) {
-                // 偶数项放在低 12 位
-                nextClusterNum |= (temp & 0b1111000000000000);
-            } else {
-                // 奇数项放在高 12 位
-                nextClusterNum = ((nextClusterNum << 4) | (temp & 0b1111));
+    if (remaining > 0) {
+        free(list);
+        return NO_FIND;
+    }
+    *extents = list;
+    *extentNum = count;
+    return OK;
+}
+
+
+/**
+ * 按分配策略为文件分配若干段连续簇并建立簇链
+ * 优先按策略分配一整段连续簇，没有足够大的空闲区段时依次取最大的空闲区段，使区段数最少
+ * @param fat - FAT表缓存
+ * @param needClusters - 所需簇数
+ * @param policy - 分配策略 ALLOC_FIRST_FIT / ALLOC_NEXT_FIT / ALLOC_BEST_FIT
+ * @param extents - 返回分配的区段数组，由调用者释放
+ * @param extentNum - 返回区段数
+ * @return 空间不足返回 INSUFFICIENT_SPACE
+ */
+int allocClusterExtents(FatCache *fat, unsigned int needClusters, int policy,
+                        ClusterExtent **extents, unsigned int *extentNum) {
+    ClusterExtent extent, *list = NULL, *temp;
+    unsigned int count = 0, capacity = 0, remaining = needClusters, i;
+    int status;
+
+    *extents = NULL;
+    *extentNum = 0;
+    if (needClusters == 0) return OK;
+
+    // 未建立空闲簇位图时(FSINFO提示有效)，首次/下次适应直接从提示位置向后分配；
+    // 提示之后空间不足、空闲簇数提示不足或使用最佳适应时，才遍历FAT表建立位图
+    if (fat->freeMap == NULL) {
+        status = NO_FIND;
+        if (policy != ALLOC_BEST_FIT && needClusters <= fat->freeCount) {
+            status = findExtentsFromHint(fat, needClusters, &list, &count);
+            if (status == ERROR) return ERROR;
+        }
+        if (status == OK) {
+            for (i = 0; i < count; i ++) {
+                linkExtent(fat, &list[i]);
+                if (i > 0) setNextClusterLinkNum(fat, list[i - 1].start + list[i - 1].count - 1, list[i].start);
             }
+            fat->nextFree = list[count - 1].start + list[count - 1].count;
+            *extents = list;
+            *extentNum = count;
+            return OK;
+        }
+        if (buildFreeClusterMap(fat) != OK) return ERROR;
+    }
 
-            // 将FAT表项值写回FAT1
-            fseek(fp, (long)(fat1Pos + clusterNum * 1.5), SEEK_SET);
-            fwrite(&nextClusterNum, 2, 1, fp);
-            // 将FAT表项值写回FAT2
-            fseek(fp, (long)(fat2Pos + clusterNum * 1.5), SEEK_SET);
-            fwrite(&nextClusterNum, 2, 1, fp);
+    if (needClusters > fat->freeCount) return INSUFFICIENT_SPACE;
 
-        } break;
-        case FAT32: {
+    if (findFreeExtent(fat, needClusters, policy, &extent) != OK) findLargestFreeExtent(fat, &extent);
 
-        } break;
-        default: {}
+    while (remaining > 0) {
+        if (extent.count > remaining) extent.count = remaining;
+
+        if (count == capacity) {
+            capacity = capacity == 0 ? 4 : capacity * 2;
+            temp = (ClusterExtent*) realloc(list, capacity * sizeof(ClusterExtent));
+            if (temp == NULL) {
+                free(list);
+                return ERROR;
+            }
+            list = temp;
+        }
+        list[count ++] = extent;
+
+        // 区段内簇依次相连，先写入结束标记占用簇，之后再连接各区段
+        linkExtent(fat, &extent);
+        remaining -= extent.count;
+        fat->nextFree = extent.start + extent.count;
+
+        if (remaining > 0) findLargestFreeExtent(fat, &extent);
+    }
+
+    // 连接各区段
+    for (i = 1; i < count; i ++) {
+        setNextClusterLinkNum(fat, list[i - 1].start + list[i - 1].count - 1, list[i].start);
     }
 
+    *extents = list;
+    *extentNum = count;
+    return OK;
+}
+
+
+/**
+ * 通过本簇号在FAT中查找文件/目录簇链的下一簇号
+ * @param fat - FAT表缓存
+ * @param clusterNum - 本簇号
+ * @return 文件/目录簇链的下一簇号
+ */
+unsigned int getNextClusterLinkNum(FatCache *fat, unsigned int clusterNum) {
+    if (fat->loaded != NULL) ensureFatLoaded(fat, getFatEntryOffset(fat, clusterNum), fat->codec->entryBytes);
+    return fat->codec->get(fat->base, clusterNum);
 }
 
+
+/**
+ * 向本簇号指向的FAT文件分配表表项中写入簇链的下一簇号
+ * 只修改FAT表缓存，关闭镜像时统一写入各FAT表
+ * @param fat - FAT表缓存
+ * @param clusterNum - 本簇号
+ * @param nextClusterNum  - 下一簇号
+ */
+void setNextClusterLinkNum(FatCache *fat, unsigned int clusterNum, unsigned int nextClusterNum) {
+    unsigned long long bit = 1ULL << (clusterNum % 64);
+    unsigned int oldClusterNum;
+
+    // 同步更新空闲簇数及空闲簇位图(同时载入表项所在扇区)
+    if (clusterNum >= 2 && clusterNum < fat->clusterCount) {
+        oldClusterNum = getNextClusterLinkNum(fat, clusterNum);
+        if (nextClusterNum == 0 && oldClusterNum != 0) {
+            fat->freeCount ++;
+            if (fat->freeMap != NULL) fat->freeMap[clusterNum / 64] |= bit;
+        } else if (nextClusterNum != 0 && oldClusterNum == 0) {
+            if (fat->freeCount > 0) fat->freeCount --;
+            if (fat->freeMap != NULL) fat->freeMap[clusterNum / 64] &= ~bit;
+        }
+    }
+
+    // FAT12表项位置 = 簇号 * 12 / 8，只修改解包后的数组，写回时统一打包
+    fat->codec->set(fat->base, clusterNum, nextClusterNum);
+    markFatDirty(fat, getFatEntryOffset(fat, clusterNum), fat->codec->entryBytes);
+}
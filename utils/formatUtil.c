@@ -6,6 +6,12 @@
 #include "../include/fatimg.h"
 
 
+/** 可重现构建的固定时间(秒)，为 -1 表示使用当前时间 */
+static long long buildEpoch = -1;
+/** 可重现构建的卷序列号种子 */
+static unsigned int buildVolumeSeed = 0;
+
+
 /**
  * 格式化短文件/目录名为 8字节文件名 + 3字节扩展名 + 字符串结束符'\0' 格式
  * 使用字符串结束符'\0'是为了方便比较两个字符串
@@ -55,6 +61,63 @@ void formatFileName(char* orgName, char* desName) {
 }
 
 
+/**
+ * 获取本地时间(线程安全)
+ * 多个镜像在不同线程中同时构建，不能使用 localtime 返回的共享缓冲区。
+ * 可重现构建时使用 UTC 时间，结果与构建机器的时区无关
+ * @param t - 时间
+ * @param result - 结果缓冲区
+ * @return 成功返回 result
+ */
+struct tm* getLocalTime(time_t t, struct tm *result) {
+#if defined(_WIN32) || defined(_WIN64)
+    if (buildEpoch >= 0) return gmtime_s(result, &t) == 0 ? result : NULL;
+    return localtime_s(result, &t) == 0 ? result : NULL;
+#else
+    if (buildEpoch >= 0) return gmtime_r(&t, result);
+    return localtime_r(&t, result);
+#endif
+}
+
+
+/**
+ * 设置可重现构建的固定时间及卷序列号种子
+ * 此后写入镜像的当前时间均为 epoch，文件时间晚于 epoch 的按 epoch 写入，
+ * 卷序列号由种子生成，相同输入的两次构建得到完全相同的镜像
+ * @param epoch - 固定时间(秒，如 SOURCE_DATE_EPOCH)，为 -1 时恢复使用当前时间
+ * @param volumeSeed - 卷序列号种子
+ */
+void setReproducibleBuild(long long epoch, unsigned int volumeSeed) {
+    buildEpoch = epoch;
+    buildVolumeSeed = volumeSeed;
+}
+
+
+/**
+ * 获取可重现构建设置
+ * @param epoch - 固定时间，可为 NULL
+ * @param volumeSeed - 卷序列号种子，可为 NULL
+ * @return 可重现构建返回 1，否则返回 0
+ */
+int getReproducibleBuild(long long *epoch, unsigned int *volumeSeed) {
+    if (epoch != NULL) *epoch = buildEpoch;
+    if (volumeSeed != NULL) *volumeSeed = buildVolumeSeed;
+    return buildEpoch >= 0;
+}
+
+
+/**
+ * 获取写入镜像的时间
+ * 可重现构建时晚于固定时间的时间按固定时间计算
+ * @param t - 时间
+ * @return
+ */
+time_t getBuildTime(time_t t) {
+    if (buildEpoch >= 0 && (long long) t > buildEpoch) return (time_t) buildEpoch;
+    return t;
+}
+
+
 /**
  * 格式化日期为FAT12定义的时间格式
  * 第25、26位表示日期：共16位，从高到低，7位表示年到1980年的偏移，4位表示月，5位表示日
@@ -62,13 +125,13 @@ void formatFileName(char* orgName, char* desName) {
  */
 unsigned short formatDate() {
     time_t t;
-    struct tm *st;
+    struct tm *st, tmBuf;
     short year, mon, day;
     unsigned short fDate = 0;
 
     // 获取年月日
-    time(&t);
-    st = localtime(&t);
+    t = getBuildTime(time(NULL));
+    st = getLocalTime(t, &tmBuf);
     year = st->tm_year + 1900 - 1980;
     mon = st->tm_mon + 1;
     day = st->tm_mday;
@@ -93,13 +156,13 @@ unsigned short formatDate() {
  */
 unsigned short formatTime() {
     time_t t;
-    struct tm *st;
+    struct tm *st, tmBuf;
     short hour, min, sec;
     unsigned short ftime = 0;
 
     // 获取小时、分钟
-    time(&t);
-    st = localtime(&t);
+    t = getBuildTime(time(NULL));
+    st = getLocalTime(t, &tmBuf);
     hour = st->tm_hour;
     if (hour > 8) hour = hour - 8;
     else hour = hour + 24 - 8;
@@ -155,6 +218,183 @@ unsigned char getChecksumByShortName(const char* shortName) {
 }
 
 
+/**
+ * 判断字符能否用于短文件名(不含 '.' 及空格)
+ * @param c - 字符
+ * @return
+ */
+static int isShortNameChar(unsigned char c) {
+    if (c >= 'A' && c <= 'Z') return 1;
+    if (c >= 'a' && c <= 'z') return 1;
+    if (c >= '0' && c <= '9') return 1;
+    return c != 0 && c < 0x80 && strchr("!#$%&'()-@^_`{}~", c) != NULL;
+}
+
+
+/**
+ * 生成文件名对应的短文件名基名
+ * 文件名符合 8.3 格式时直接得到短文件名，文件名或扩展名全部为小写时
+ * 通过 caseFlags(目录项第 12 字节，0x08 文件名小写，0x10 扩展名小写)保留大小写；
+ * 否则需要长文件名，基名按 Windows 规则生成：去除空格及多余的 '.'，
+ * 非法字符替换为 '_'，文件名取前 8 字符，扩展名取最后一个 '.' 之后的前 3 字符
+ * @param name - 文件名
+ * @param basis - 8 + 3 + '\0' 格式的短文件名或基名
+ * @param caseFlags - 大小写标记
+ * @return 符合 8.3 格式返回 0，仅因大小写混合需要长文件名返回 1，其他需要长文件名的情况返回 2
+ */
+int getShortNameBasis(const char *name, char *basis, unsigned char *caseFlags) {
+    const char *dot = strrchr(name, '.'), *p;
+    int i, baseLen = 0, extLen = 0, lossy = 0, mixed = 0, lower[2] = {0}, upper[2] = {0}, part;
+    unsigned char c;
+
+    memset(basis, ' ', 11);
+    basis[11] = '\0';
+    *caseFlags = 0;
+    // '.' 开头(隐藏文件)不作为扩展名分隔符，'.' 结尾的文件名无法用短文件名表示
+    if (dot == name) dot = NULL;
+    if (dot != NULL && dot[1] == '\0') lossy = 1;
+
+    for (p = name; *p; p ++) {
+        c = (unsigned char) *p;
+        part = dot != NULL && p > dot;
+        if (p == dot) continue;
+        if (c == ' ' || c == '.') {
+            lossy = 1;
+            continue;
+        }
+        if (!isShortNameChar(c)) {
+            lossy = 1;
+            c = '_';
+            // 跳过 UTF-8 多字节字符的后续字节
+            if ((unsigned char) *p >= 0xC0) while ((p[1] & 0xC0) == 0x80) p ++;
+        }
+        if (c >= 'a' && c <= 'z') lower[part] = 1;
+        if (c >= 'A' && c <= 'Z') upper[part] = 1;
+
+        if (part) {
+            if (extLen < 3) basis[8 + extLen] = (char) toupper(c);
+            else lossy = 1;
+            extLen ++;
+        } else {
+            if (baseLen < 8) basis[baseLen] = (char) toupper(c);
+            else lossy = 1;
+            baseLen ++;
+        }
+    }
+
+    if (baseLen == 0) {
+        basis[0] = '_';
+        lossy = 1;
+    }
+    if (lossy) return 2;
+    // 同一部分大小写混合时只能用长文件名保留
+    for (i = 0; i < 2; i ++) {
+        if (lower[i] && upper[i]) mixed = 1;
+    }
+    if (mixed) return 1;
+    *caseFlags = (lower[0] ? 0x08 : 0) | (lower[1] ? 0x10 : 0);
+    return 0;
+}
+
+
+/**
+ * 文件名所需的长文件名表项数
+ * @param name - 文件名(UTF-8)
+ * @return 符合 8.3 格式返回 0，文件名过长或含有非法字符返回 BAD_FORMAT
+ */
+int getLongNameItemNum(const char *name) {
+    unsigned short longName[LFN_MAX_LEN];
+    unsigned char caseFlags;
+    char basis[12];
+    const char *p;
+    int len;
+
+    for (p = name; *p; p ++) {
+        if ((unsigned char) *p < 0x20 || strchr("\\/:*?\"<>|", *p) != NULL) return BAD_FORMAT;
+    }
+    if (getShortNameBasis(name, basis, &caseFlags) == 0) return 0;
+
+    len = utf8ToUtf16(name, longName, LFN_MAX_LEN);
+    if (len <= 0) return BAD_FORMAT;
+    return (len + LFN_ITEM_CHARS - 1) / LFN_ITEM_CHARS;
+}
+
+
+/**
+ * UTF-8 文件名转 UTF-16
+ * 无效的 UTF-8 字节按单字节字符处理
+ * @param src - UTF-8 文件名
+ * @param dest - UTF-16 缓冲区
+ * @param max - 缓冲区可容纳的字符数
+ * @return UTF-16 字符数，超出 max 返回 -1
+ */
+int utf8ToUtf16(const char *src, unsigned short *dest, int max) {
+    const unsigned char *p = (const unsigned char*) src;
+    unsigned int code, extra, i;
+    int len = 0;
+
+    while (*p) {
+        code = *p;
+        extra = code >= 0xF0 ? 3 : code >= 0xE0 ? 2 : code >= 0xC0 ? 1 : 0;
+        for (i = 1; i <= extra; i ++) {
+            if ((p[i] & 0xC0) != 0x80) break;
+        }
+        if (i <= extra) extra = 0;
+        else if (extra > 0) {
+            code &= 0x3F >> extra;
+            for (i = 1; i <= extra; i ++) code = (code << 6) | (p[i] & 0x3F);
+        }
+        p += extra + 1;
+
+        if (code >= 0x10000) {
+            if (len + 2 > max) return -1;
+            code -= 0x10000;
+            dest[len ++] = (unsigned short) (0xD800 | (code >> 10));
+            dest[len ++] = (unsigned short) (0xDC00 | (code & 0x3FF));
+        } else {
+            if (len + 1 > max) return -1;
+            dest[len ++] = (unsigned short) code;
+        }
+    }
+    return len;
+}
+
+
+/**
+ * UTF-16 文件名转 UTF-8
+ * @param src - UTF-16 文件名
+ * @param len - UTF-16 字符数
+ * @param dest - UTF-8 缓冲区，至少 len * 3 + 1 字节
+ */
+void utf16ToUtf8(const unsigned short *src, int len, char *dest) {
+    unsigned int code;
+    int i;
+
+    for (i = 0; i < len; i ++) {
+        code = src[i];
+        if (code >= 0xD800 && code < 0xDC00 && i + 1 < len && src[i + 1] >= 0xDC00 && src[i + 1] < 0xE000) {
+            code = 0x10000 + ((code - 0xD800) << 10) + (src[++ i] - 0xDC00);
+        }
+        if (code < 0x80) {
+            *dest ++ = (char) code;
+        } else if (code < 0x800) {
+            *dest ++ = (char) (0xC0 | (code >> 6));
+            *dest ++ = (char) (0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            *dest ++ = (char) (0xE0 | (code >> 12));
+            *dest ++ = (char) (0x80 | ((code >> 6) & 0x3F));
+            *dest ++ = (char) (0x80 | (code & 0x3F));
+        } else {
+            *dest ++ = (char) (0xF0 | (code >> 18));
+            *dest ++ = (char) (0x80 | ((code >> 12) & 0x3F));
+            *dest ++ = (char) (0x80 | ((code >> 6) & 0x3F));
+            *dest ++ = (char) (0x80 | (code & 0x3F));
+        }
+    }
+    *dest = '\0';
+}
+
+
 /**
  * 获取FAT镜像文件类型
  * @param path - 镜像文件路径
@@ -166,8 +406,8 @@ FAT_TYPE getImageFatType(const char* path) {
     char typeName[9] = {0};
 
     // 打开镜像文件
-    // rb+ 以读写方式打开已存在的文件，若文件不存在，则打开失败
-    fp = fopen(path, "rb+");
+    // rb 以只读方式打开已存在的文件，若文件不存在，则打开失败
+    fp = fopen(path, "rb");
     if(fp == NULL) return NO_FIND;
 
     // 读取相对于0扇区的0x36偏移处
@@ -188,6 +428,16 @@ FAT_TYPE getImageFatType(const char* path) {
         return FAT32;
     }
 
+    // 读取相对于0扇区的0x03偏移处
+    // 此处存放着exFAT的文件系统名
+    fseek(fp, 0x03, SEEK_SET);
+    fread(&typeName, 8, 1, fp);
+    if (memcmp(typeName, "EXFAT   ", 8) == 0) {
+        fclose(fp);
+        return EXFAT;
+    }
+
+    fclose(fp);
     return UNKOWN;
 }
 
@@ -216,12 +466,22 @@ char* strUpper(char* str) {
  */
 unsigned int getVolumeID() {
     struct timeval tv;
-    struct tm *tm_info;
+    struct tm *tm_info, tmBuf;
+
+    // 可重现构建时由种子生成卷序列号(整数哈希混合)
+    if (buildEpoch >= 0) {
+        unsigned int id = buildVolumeSeed ^ 0x9E3779B9u;
+        id ^= id >> 16;
+        id *= 0x85EBCA6Bu;
+        id ^= id >> 13;
+        id *= 0xC2B2AE35u;
+        return id ^ (id >> 16);
+    }
 
     // 获取当前精确时间
     gettimeofday(&tv, NULL);
     time_t current_time = (time_t) tv.tv_sec;
-    tm_info = localtime(&current_time);
+    tm_info = getLocalTime(current_time, &tmBuf);
 
     // 提取各部分分量
     unsigned int month = (unsigned int)tm_info->tm_mon + 1; // tm_mon 是 0-11
@@ -0,0 +1,478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/fatimg.h"
+
+
+/**
+ * 读取小端序 16 位整数
+ * @param p - 数据位置
+ * @return
+ */
+static unsigned int readLE16(const unsigned char *p) {
+    return p[0] | (p[1] << 8);
+}
+
+
+/**
+ * 读取小端序 32 位整数
+ * @param p - 数据位置
+ * @return
+ */
+static unsigned int readLE32(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+
+/** 读取或写回FAT32根目录簇链 */
+static int accessRootChain(FatImg *img, char write);
+/** 写回根目录缓存中一段范围内的脏扇区 */
+static int writeRootDirtySectors(FatImg *img, long long pos, size_t offset, size_t len);
+/** 写回子目录中被修改的扇区 */
+static int writeSubDir(FatImg *img, SubDir *dir);
+/** 释放子目录 */
+static void freeSubDir(SubDir *dir);
+/** 子目录起始簇号的哈希桶 */
+static unsigned int getSubDirBucket(FatImg *img, unsigned int firstCluster);
+
+
+/**
+ * 打开FAT镜像，读取BPB信息并载入FAT表
+ * @param img - 镜像
+ * @param path - 镜像文件路径
+ * @param mode - IMG_OPEN_MMAP 以内存映射方式访问镜像，映射失败时使用普通读写方式；
+ *               IMG_OPEN_RDONLY 以只读方式打开镜像
+ * @return 镜像不存在返回 NO_FIND，BPB无效返回 BAD_FORMAT
+ */
+int openFatImg(FatImg *img, const char *path, int mode) {
+    unsigned char bpb[512];
+    unsigned int reservedSectors, fatNum, fatSectors, totalSectors, rootDirSectors;
+    unsigned int dataClusters, fatEntries, fsInfoSector;
+    unsigned char fsInfo[512];
+    int status;
+
+    memset(img, 0, sizeof(FatImg));
+    status = imgWriterOpen(&img->io, path, (mode & IMG_OPEN_RDONLY) ? IMG_OPEN_READ : IMG_OPEN_EXISTING);
+    if (status != OK) return status;
+    if (mode & IMG_OPEN_MMAP) imgWriterMap(&img->io);
+
+    if (imgWriterRead(&img->io, 0, bpb, sizeof(bpb)) != OK) {
+        imgWriterClose(&img->io);
+        return ERROR;
+    }
+
+    // 解析BPB
+    img->bytesPerSector = readLE16(bpb + 11);
+    img->sectorsPerCluster = bpb[13];
+    reservedSectors = readLE16(bpb + 14);
+    fatNum = bpb[16];
+    img->rootEntCount = readLE16(bpb + 17);
+    totalSectors = readLE16(bpb + 19);
+    if (totalSectors == 0) totalSectors = readLE32(bpb + 32);
+    fatSectors = readLE16(bpb + 22);
+    if (fatSectors == 0) fatSectors = readLE32(bpb + 36);
+
+    // 每扇区字节数须为 512 ~ 4096 的 2 的幂，每簇扇区数须为 2 的幂
+    if (img->bytesPerSector < 512 || img->bytesPerSector > 4096
+        || (img->bytesPerSector & (img->bytesPerSector - 1)) != 0
+        || img->sectorsPerCluster == 0 || (img->sectorsPerCluster & (img->sectorsPerCluster - 1)) != 0
+        || reservedSectors == 0 || fatNum == 0 || fatSectors == 0) {
+        imgWriterClose(&img->io);
+        return BAD_FORMAT;
+    }
+
+    img->bytesPerCluster = img->bytesPerSector * img->sectorsPerCluster;
+    rootDirSectors = (img->rootEntCount * 32 + img->bytesPerSector - 1) / img->bytesPerSector;
+    if (totalSectors <= reservedSectors + fatNum * fatSectors + rootDirSectors) {
+        imgWriterClose(&img->io);
+        return BAD_FORMAT;
+    }
+    dataClusters = (totalSectors - reservedSectors - fatNum * fatSectors - rootDirSectors) / img->sectorsPerCluster;
+
+    // 根据数据区簇数确定FAT类型
+    if (readLE16(bpb + 22) == 0) img->type = FAT32;
+    else if (dataClusters < 4085) img->type = FAT12;
+    else img->type = FAT16;
+
+    // 表项数不能超过FAT表能容纳的数量
+    switch (img->type) {
+        case FAT12: fatEntries = fatSectors * img->bytesPerSector * 2 / 3; break;
+        case FAT16: fatEntries = fatSectors * img->bytesPerSector / 2; break;
+        default: fatEntries = fatSectors * img->bytesPerSector / 4; break;
+    }
+    if (dataClusters + 2 < fatEntries) fatEntries = dataClusters + 2;
+
+    img->rootPos = (long long)(reservedSectors + fatNum * fatSectors) * img->bytesPerSector;
+    img->dataPos = img->rootPos + (long long)rootDirSectors * img->bytesPerSector;
+    img->rootCluster = img->type == FAT32 ? readLE32(bpb + 44) : 0;
+
+    // 读取FAT32的FSINFO，签名有效时使用其中的空闲簇数及下一空闲簇号，避免遍历FAT表
+    img->fsInfoFree = FSINFO_UNKNOWN;
+    img->fsInfoNext = FSINFO_UNKNOWN;
+    fsInfoSector = img->type == FAT32 ? readLE16(bpb + 48) : 0;
+    if (fsInfoSector > 0 && fsInfoSector < reservedSectors) {
+        img->fsInfoPos = (long long)fsInfoSector * img->bytesPerSector;
+        if (imgWriterRead(&img->io, img->fsInfoPos, fsInfo, sizeof(fsInfo)) == OK
+            && readLE32(fsInfo) == 0x41615252 && readLE32(fsInfo + 484) == 0x61417272
+            && fsInfo[510] == 0x55 && fsInfo[511] == 0xaa) {
+            img->fsInfoFree = readLE32(fsInfo + 488);
+            img->fsInfoNext = readLE32(fsInfo + 492);
+        }
+    }
+
+    status = loadFatCache(&img->fat, &img->io, (long long)reservedSectors * img->bytesPerSector,
+                          fatSectors * img->bytesPerSector, fatNum, fatEntries, img->bytesPerSector, img->type,
+                          img->fsInfoFree, img->fsInfoNext);
+    if (status != OK) {
+        imgWriterClose(&img->io);
+        return status;
+    }
+
+    // 载入FAT32根目录簇链
+    if (img->type == FAT32) {
+        status = accessRootChain(img, 0);
+        if (status != OK) {
+            freeFatCache(&img->fat);
+            imgWriterClose(&img->io);
+            return status;
+        }
+    }
+    // 载入FAT12/FAT16的固定根目录区，映射模式下直接使用映射内存
+    else if (img->rootEntCount > 0) {
+        img->rootDir = imgWriterMapPtr(&img->io, img->rootPos, img->rootEntCount * 32);
+        if (img->rootDir != NULL) {
+            img->rootMapped = 1;
+        } else {
+            img->rootDir = (unsigned char*) malloc(img->rootEntCount * 32);
+            if (img->rootDir == NULL || imgWriterRead(&img->io, img->rootPos, img->rootDir, img->rootEntCount * 32) != OK) {
+                free(img->rootDir);
+                freeFatCache(&img->fat);
+                imgWriterClose(&img->io);
+                return ERROR;
+            }
+        }
+    }
+
+    // 建立根目录索引
+    if (img->rootDir != NULL && buildDirIndex(&img->rootIndex, img->rootDir, img->rootEntCount, img->bytesPerSector) != OK) {
+        if (!img->rootMapped) free(img->rootDir);
+        freeDirIndex(&img->rootIndex);
+        freeFatCache(&img->fat);
+        imgWriterClose(&img->io);
+        return ERROR;
+    }
+    return OK;
+}
+
+
+/**
+ * 写回FAT表、根目录区、已载入的子目录中被修改的扇区、FSINFO并关闭FAT镜像
+ * @param img - 镜像
+ * @return
+ */
+int closeFatImg(FatImg *img) {
+    int status = img->io.readOnly ? OK : flushFatCache(&img->fat, &img->io);
+    unsigned int hint[2], i;
+    SubDir *dir, *next;
+
+    // 更新FSINFO中的空闲簇数及下一空闲簇号(只读打开时不写回任何数据)
+    if (img->fsInfoPos > 0 && !img->io.readOnly) {
+        hint[0] = img->fat.freeCount;
+        hint[1] = img->fat.nextFree >= 2 && img->fat.nextFree < img->fat.clusterCount ? img->fat.nextFree : FSINFO_UNKNOWN;
+        if ((hint[0] != img->fsInfoFree || hint[1] != img->fsInfoNext)
+            && imgWriterWrite(&img->io, img->fsInfoPos + 488, hint, sizeof(hint)) != OK) status = ERROR;
+    }
+
+    // 只写回根目录区中被修改的扇区
+    if (img->rootIndex.dirtyCount > 0 && !img->io.readOnly) {
+        if (img->rootMapped) img->io.mapDirty = 1;
+        else if (img->type == FAT32) {
+            if (accessRootChain(img, 1) != OK) status = ERROR;
+        }
+        else if (writeRootDirtySectors(img, img->rootPos, 0, (size_t) img->rootEntCount * 32) != OK) status = ERROR;
+    }
+    if (!img->rootMapped) free(img->rootDir);
+    img->rootDir = NULL;
+    freeDirIndex(&img->rootIndex);
+
+    // 写回并释放已载入的子目录
+    for (i = 0; i < img->subDirBucketNum; i ++) {
+        for (dir = img->subDirs[i]; dir != NULL; dir = next) {
+            next = dir->next;
+            if (!img->io.readOnly && writeSubDir(img, dir) != OK) status = ERROR;
+            freeSubDir(dir);
+        }
+    }
+    for (dir = img->droppedSubDirs; dir != NULL; dir = next) {
+        next = dir->next;
+        freeSubDir(dir);
+    }
+    free(img->subDirs);
+    img->subDirs = NULL;
+    img->subDirBucketNum = img->subDirNum = 0;
+    img->droppedSubDirs = NULL;
+
+    freeFatCache(&img->fat);
+    if (imgWriterClose(&img->io) != OK) status = ERROR;
+    return status;
+}
+
+
+/**
+ * 读取或写回FAT32根目录簇链
+ * 读取时按簇链长度分配根目录缓存，簇链中连续的簇合并为一次读写，
+ * 写回时只写各段中的脏扇区
+ * @param img - 镜像
+ * @param write - 0 读取簇链到根目录缓存，1 将根目录缓存写回簇链
+ * @return 根目录簇链无效返回 BAD_FORMAT
+ */
+static int accessRootChain(FatImg *img, char write) {
+    unsigned int clusterNum, nextCluster, runStart, count = 0, runLen;
+    unsigned int endFlag = getEndClusterFlag(FAT32) & ~7u;
+    size_t offset = 0;
+    int status;
+
+    // 统计簇链长度
+    if (!write) {
+        clusterNum = img->rootCluster;
+        while (clusterNum >= 2 && clusterNum < endFlag && clusterNum < img->fat.clusterCount && count < img->fat.clusterCount) {
+            clusterNum = getNextClusterLinkNum(&img->fat, clusterNum);
+            count ++;
+        }
+        if (count == 0) return BAD_FORMAT;
+        img->rootDir = (unsigned char*) malloc((size_t) count * img->bytesPerCluster);
+        if (img->rootDir == NULL) return ERROR;
+        img->rootEntCount = count * img->bytesPerCluster / 32;
+    }
+
+    // 按连续簇区段读写
+    clusterNum = img->rootCluster;
+    while (offset < (size_t) img->rootEntCount * 32) {
+        runStart = clusterNum;
+        runLen = 1;
+        nextCluster = getNextClusterLinkNum(&img->fat, clusterNum);
+        while (nextCluster == clusterNum + 1 && offset + (size_t)(runLen + 1) * img->bytesPerCluster <= (size_t) img->rootEntCount * 32) {
+            clusterNum = nextCluster;
+            nextCluster = getNextClusterLinkNum(&img->fat, clusterNum);
+            runLen ++;
+        }
+
+        if (write) status = writeRootDirtySectors(img, getClusterPos(img, runStart), offset, (size_t) runLen * img->bytesPerCluster);
+        else status = imgWriterRead(&img->io, getClusterPos(img, runStart), img->rootDir + offset, (size_t) runLen * img->bytesPerCluster);
+        if (status != OK) {
+            if (!write) {
+                free(img->rootDir);
+                img->rootDir = NULL;
+            }
+            return ERROR;
+        }
+
+        offset += (size_t) runLen * img->bytesPerCluster;
+        clusterNum = nextCluster;
+    }
+    return OK;
+}
+
+
+/**
+ * 写回根目录缓存中一段范围内的脏扇区，连续的脏扇区合并为一次写入
+ * @param img - 镜像
+ * @param pos - 该范围在镜像中的位置(字节)
+ * @param offset - 该范围在根目录缓存中的位置(字节，扇区对齐)
+ * @param len - 范围长度(字节)
+ * @return
+ */
+static int writeRootDirtySectors(FatImg *img, long long pos, size_t offset, size_t len) {
+    unsigned char *dirty = img->rootIndex.dirty;
+    unsigned int sectorSize = img->bytesPerSector;
+    unsigned int first = offset / sectorSize, last = (offset + len) / sectorSize, start, end;
+
+    for (start = first; start < last; start = end) {
+        if (!dirty[start]) {
+            end = start + 1;
+            continue;
+        }
+        for (end = start + 1; end < last && dirty[end]; end ++);
+        if (imgWriterWrite(&img->io, pos + (long long)(start - first) * sectorSize,
+                           img->rootDir + (size_t) start * sectorSize, (size_t)(end - start) * sectorSize) != OK) return ERROR;
+    }
+    return OK;
+}
+
+
+/**
+ * 为FAT32根目录追加一簇
+ * FAT12/FAT16的根目录区大小固定，无法扩展
+ * @param img - 镜像
+ * @return 无可用空间或根目录大小固定时返回 INSUFFICIENT_SPACE
+ */
+int growRootDir(FatImg *img) {
+    ClusterExtent *extents;
+    unsigned int extentNum, clusterNum, nextCluster, i;
+    unsigned char *rootDir;
+    int status;
+
+    if (img->type != FAT32) return INSUFFICIENT_SPACE;
+
+    rootDir = (unsigned char*) realloc(img->rootDir, (size_t) img->rootEntCount * 32 + img->bytesPerCluster);
+    if (rootDir == NULL) return ERROR;
+    img->rootDir = rootDir;
+    img->rootIndex.data = rootDir;
+
+    status = allocClusterExtents(&img->fat, 1, img->allocPolicy, &extents, &extentNum);
+    if (status != OK) return status;
+
+    // 将新簇连接到簇链末尾
+    clusterNum = img->rootCluster;
+    for (i = 1; i < img->rootEntCount * 32 / img->bytesPerCluster; i ++) {
+        nextCluster = getNextClusterLinkNum(&img->fat, clusterNum);
+        clusterNum = nextCluster;
+    }
+    setNextClusterLinkNum(&img->fat, clusterNum, extents[0].start);
+    free(extents);
+
+    // 新簇的目录项全部置 0，关闭镜像时随根目录一起写回
+    memset(img->rootDir + (size_t) img->rootEntCount * 32, 0, img->bytesPerCluster);
+    img->rootEntCount += img->bytesPerCluster / 32;
+    return growDirIndex(&img->rootIndex, img->rootDir, img->rootEntCount);
+}
+
+
+/**
+ * 子目录起始簇号的哈希桶
+ * @param img - 镜像
+ * @param firstCluster - 子目录起始簇号
+ * @return 哈希桶序号
+ */
+static unsigned int getSubDirBucket(FatImg *img, unsigned int firstCluster) {
+    return ((firstCluster * 2654435761u) >> 8) & (img->subDirBucketNum - 1);
+}
+
+
+/**
+ * 查找已载入的子目录
+ * @param img - 镜像
+ * @param firstCluster - 子目录起始簇号
+ * @return 未载入返回 NULL
+ */
+SubDir* findSubDir(FatImg *img, unsigned int firstCluster) {
+    SubDir *dir;
+
+    if (img->subDirBucketNum == 0) return NULL;
+    for (dir = img->subDirs[getSubDirBucket(img, firstCluster)]; dir != NULL; dir = dir->next) {
+        if (dir->firstCluster == firstCluster) return dir;
+    }
+    return NULL;
+}
+
+
+/**
+ * 将载入的子目录加入镜像的子目录缓存
+ * 子目录在镜像关闭前一直保留，同一子目录的多次操作不再重复读取及建立索引；子目录数超过哈希桶数时哈希桶数加倍
+ * @param img - 镜像
+ * @param dir - 子目录(由 malloc 分配，之后归镜像所有)
+ * @return
+ */
+int addSubDir(FatImg *img, SubDir *dir) {
+    SubDir **buckets, **old = img->subDirs, *item, *next;
+    unsigned int bucketNum, oldNum = img->subDirBucketNum, i, bucket;
+
+    if (img->subDirNum >= img->subDirBucketNum) {
+        bucketNum = img->subDirBucketNum == 0 ? 64 : img->subDirBucketNum * 2;
+        buckets = (SubDir**) calloc(bucketNum, sizeof(SubDir*));
+        if (buckets == NULL) return ERROR;
+        img->subDirs = buckets;
+        img->subDirBucketNum = bucketNum;
+        for (i = 0; i < oldNum; i ++) {
+            for (item = old[i]; item != NULL; item = next) {
+                next = item->next;
+                bucket = getSubDirBucket(img, item->firstCluster);
+                item->next = buckets[bucket];
+                buckets[bucket] = item;
+            }
+        }
+        free(old);
+    }
+
+    bucket = getSubDirBucket(img, dir->firstCluster);
+    dir->next = img->subDirs[bucket];
+    img->subDirs[bucket] = dir;
+    img->subDirNum ++;
+    return OK;
+}
+
+
+/**
+ * 子目录的簇被释放时从缓存中移除，其修改不再写回
+ * 子目录可能仍被调用者引用(损坏的镜像中目录形成环)，关闭镜像时才释放内存
+ * @param img - 镜像
+ * @param firstCluster - 子目录起始簇号
+ */
+void dropSubDir(FatImg *img, unsigned int firstCluster) {
+    SubDir **link, *dir;
+
+    if (img->subDirBucketNum == 0) return;
+    for (link = &img->subDirs[getSubDirBucket(img, firstCluster)]; *link != NULL; link = &(*link)->next) {
+        dir = *link;
+        if (dir->firstCluster != firstCluster) continue;
+        *link = dir->next;
+        dir->next = img->droppedSubDirs;
+        img->droppedSubDirs = dir;
+        img->subDirNum --;
+        return;
+    }
+}
+
+
+/**
+ * 写回子目录中被修改的扇区
+ * 同一簇内连续的脏扇区合并为一次写入
+ * @param img - 镜像
+ * @param dir - 子目录
+ * @return
+ */
+static int writeSubDir(FatImg *img, SubDir *dir) {
+    unsigned int sectorsPerCluster = img->bytesPerCluster / img->bytesPerSector;
+    unsigned int i, first, start, end;
+    unsigned char *dirty = dir->index.dirty;
+    int status = OK;
+
+    for (i = 0; i < dir->clusterNum && dir->index.dirtyCount > 0 && status == OK; i ++) {
+        first = i * sectorsPerCluster;
+        for (start = first; start < first + sectorsPerCluster && status == OK; start = end) {
+            if (!dirty[start]) {
+                end = start + 1;
+                continue;
+            }
+            for (end = start + 1; end < first + sectorsPerCluster && dirty[end]; end ++);
+            status = imgWriterWrite(&img->io, getClusterPos(img, dir->clusters[i]) + (long long) (start - first) * img->bytesPerSector,
+                                    dir->index.data + (size_t) start * img->bytesPerSector,
+                                    (size_t) (end - start) * img->bytesPerSector);
+        }
+    }
+    return status;
+}
+
+
+/**
+ * 释放子目录
+ * @param dir - 子目录
+ */
+static void freeSubDir(SubDir *dir) {
+    free(dir->index.data);
+    freeDirIndex(&dir->index);
+    free(dir->clusters);
+    free(dir);
+}
+
+
+/**
+ * 簇号对应的数据区位置
+ * FAT表项中的第0簇项和第1簇项为保留簇项，FAT表项的第2簇项对应数据区的0簇
+ * @param img - 镜像
+ * @param clusterNum - 簇号
+ * @return 数据区位置(字节)
+ */
+long long getClusterPos(FatImg *img, unsigned int clusterNum) {
+    return img->dataPos + (long long)(clusterNum - 2) * img->bytesPerCluster;
+}
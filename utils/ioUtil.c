@@ -0,0 +1,687 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "../include/fatimg.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <io.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#endif
+
+#if defined(__linux__)
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/**
+ * 镜像写入层
+ *
+ * 所有镜像构建路径都通过 ImgWriter 写入镜像：
+ *   - 写入数据先进入一块按页对齐的大缓冲区(IMG_IO_BUFFER_SIZE)，
+ *     只要写入位置与缓冲区内容首尾相接就继续追加，不产生系统调用；
+ *   - 不相邻的写入或缓冲区放不下时才写出，写出使用 pwrite，
+ *     缓冲区内容与超大写入数据首尾相接时合并为一次 pwritev；
+ *   - 位于文件末尾之后的全 0 区域不写入，关闭时通过截断留为文件空洞；
+ *   - 从其他文件拷贝的数据(imgWriterCopyFrom)优先由内核直接拷贝，不经过用户空间；
+ *   - 映射模式(imgWriterMap)下镜像文件已有部分的读写直接在映射内存中完成，
+ *     不产生读写系统调用，关闭时以 msync 写回脏页。
+ *
+ * 系统调用预算：每段连续区域写出次数为 ceil(长度 / IMG_IO_BUFFER_SIZE)，
+ * 超过缓冲区大小的单次写入直接写出(1 次)，另加至多 1 次扩展文件大小(截断)。
+ * syscalls 字段记录实际发生的写入类系统调用次数，写入器关闭时累加到进程内的总数中。
+ */
+
+/** 全 0 数据块，用于向已有数据区域写入 0 */
+static const unsigned char zeroBlock[4096] = {0};
+
+/** 本进程中已关闭的写入器发生的写入类系统调用总数(并行构建时多个线程同时累加) */
+static unsigned long long totalSyscalls = 0;
+#if !defined(_WIN32) && !defined(_WIN64)
+static pthread_mutex_t totalLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+/**
+ * 将一段数据完整写入文件指定位置
+ * @param w - 写入器
+ * @param pos - 写入位置(字节)
+ * @param data - 数据
+ * @param len - 数据长度
+ * @return
+ */
+static int pwriteAll(ImgWriter *w, long long pos, const unsigned char *data, size_t len) {
+    long long n;
+    while (len > 0) {
+#if defined(_WIN32) || defined(_WIN64)
+        if (_lseeki64(w->fd, pos, SEEK_SET) < 0) return ERROR;
+        n = _write(w->fd, data, len > 0x40000000 ? 0x40000000 : (unsigned int)len);
+#else
+        n = pwrite(w->fd, data, len, (off_t)pos);
+#endif
+        w->syscalls ++;
+        if (n <= 0) return ERROR;
+        pos += n;
+        data += n;
+        len -= (size_t)n;
+    }
+    if (pos > w->fileSize) w->fileSize = pos;
+    return OK;
+}
+
+
+/**
+ * 将首尾相接的两段数据写入文件指定位置，尽量合并为一次系统调用
+ * @param w - 写入器
+ * @param pos - 写入位置(字节)
+ * @param head - 第一段数据
+ * @param headLen - 第一段数据长度
+ * @param tail - 第二段数据
+ * @param tailLen - 第二段数据长度
+ * @return
+ */
+static int pwriteTwo(ImgWriter *w, long long pos, const unsigned char *head, size_t headLen,
+                     const unsigned char *tail, size_t tailLen) {
+#if defined(_WIN32) || defined(_WIN64)
+    if (pwriteAll(w, pos, head, headLen) != OK) return ERROR;
+    return pwriteAll(w, pos + headLen, tail, tailLen);
+#else
+    struct iovec iov[2];
+    ssize_t n;
+
+    iov[0].iov_base = (void*) head;
+    iov[0].iov_len = headLen;
+    iov[1].iov_base = (void*) tail;
+    iov[1].iov_len = tailLen;
+    n = pwritev(w->fd, iov, 2, (off_t)pos);
+    w->syscalls ++;
+    if (n < 0) return ERROR;
+
+    // 部分写入时按剩余部分继续写出
+    if ((size_t)n < headLen) {
+        if (pwriteAll(w, pos + n, head + n, headLen - n) != OK) return ERROR;
+        return pwriteAll(w, pos + headLen, tail, tailLen);
+    }
+    if ((size_t)n < headLen + tailLen) {
+        n -= headLen;
+        return pwriteAll(w, pos + headLen + n, tail + n, tailLen - n);
+    }
+    if (pos + (long long)(headLen + tailLen) > w->fileSize) w->fileSize = pos + headLen + tailLen;
+    return OK;
+#endif
+}
+
+
+/**
+ * 将已打开的文件描述符关联到写入器
+ * 写入器不负责关闭此文件描述符
+ * @param w - 写入器
+ * @param fd - 文件描述符
+ * @return
+ */
+int imgWriterAttach(ImgWriter *w, int fd) {
+    struct stat st;
+
+    memset(w, 0, sizeof(ImgWriter));
+    w->fd = fd;
+    w->cap = IMG_IO_BUFFER_SIZE;
+#if defined(_WIN32) || defined(_WIN64)
+    w->buf = (unsigned char*) _aligned_malloc(w->cap, IMG_IO_ALIGN);
+    if (w->buf == NULL) return ERROR;
+#else
+    if (posix_memalign((void**) &w->buf, IMG_IO_ALIGN, w->cap) != 0) {
+        w->buf = NULL;
+        return ERROR;
+    }
+#endif
+    if (fstat(fd, &st) == 0) w->fileSize = st.st_size;
+    w->size = w->fileSize;
+    return OK;
+}
+
+
+/**
+ * 打开镜像文件并创建写入器
+ * @param w - 写入器
+ * @param path - 镜像文件路径
+ * @param mode - IMG_OPEN_EXISTING 打开已存在的文件；
+ *               IMG_OPEN_CREATE 新建文件，文件存在会覆盖数据；
+ *               IMG_OPEN_KEEP 文件存在时保留数据，不存在时新建；
+ *               IMG_OPEN_READ 以只读方式打开已存在的文件
+ * @return 文件不存在返回 NO_FIND
+ */
+int imgWriterOpen(ImgWriter *w, const char *path, int mode) {
+    int fd, flags = O_RDWR | O_BINARY;
+
+    if (mode == IMG_OPEN_CREATE) flags |= O_CREAT | O_TRUNC;
+    else if (mode == IMG_OPEN_KEEP) flags |= O_CREAT;
+    else if (mode == IMG_OPEN_READ) flags = O_RDONLY | O_BINARY;
+
+    fd = open(path, flags, 0644);
+    if (fd < 0) return mode == IMG_OPEN_EXISTING || mode == IMG_OPEN_READ ? NO_FIND : ERROR;
+
+    if (imgWriterAttach(w, fd) != OK) {
+        close(fd);
+        return ERROR;
+    }
+    w->ownFd = 1;
+    w->readOnly = mode == IMG_OPEN_READ;
+    return OK;
+}
+
+
+/**
+ * 从镜像指定位置读取数据
+ * 尚未写出的缓冲区数据会覆盖读出的内容，保证读到的总是最新数据
+ * @param w - 写入器
+ * @param pos - 读取位置(字节)
+ * @param data - 数据缓冲区
+ * @param len - 读取长度
+ * @return 读取失败返回 ERROR，超出文件末尾的部分读出为 0
+ */
+int imgWriterRead(ImgWriter *w, long long pos, void *data, size_t len) {
+    unsigned char *dst = (unsigned char*) data;
+    long long cur = pos, bufEnd = w->bufPos + w->bufLen, start, end;
+    size_t left = len;
+    long long n;
+
+    // 映射范围内的部分直接从映射内存读取
+    if (w->map != NULL && cur < w->mapSize) {
+        n = w->mapSize - cur < (long long)left ? w->mapSize - cur : (long long)left;
+        memcpy(dst, w->map + cur, (size_t)n);
+        cur += n;
+        dst += n;
+        left -= (size_t)n;
+    }
+
+    while (left > 0) {
+#if defined(_WIN32) || defined(_WIN64)
+        if (_lseeki64(w->fd, cur, SEEK_SET) < 0) return ERROR;
+        n = _read(w->fd, dst, left > 0x40000000 ? 0x40000000 : (unsigned int)left);
+#else
+        n = pread(w->fd, dst, left, (off_t)cur);
+#endif
+        if (n < 0) return ERROR;
+        if (n == 0) {
+            // 文件空洞或文件末尾之后读出为 0
+            memset(dst, 0, left);
+            break;
+        }
+        cur += n;
+        dst += n;
+        left -= (size_t)n;
+    }
+
+    // 叠加缓冲区中与读取区域重叠的部分
+    if (w->bufLen > 0 && pos < bufEnd && pos + (long long)len > w->bufPos) {
+        start = pos > w->bufPos ? pos : w->bufPos;
+        end = pos + (long long)len < bufEnd ? pos + (long long)len : bufEnd;
+        memcpy((unsigned char*) data + (start - pos), w->buf + (start - w->bufPos), (size_t)(end - start));
+    }
+    return OK;
+}
+
+
+/**
+ * 写出缓冲区中的数据
+ * @param w - 写入器
+ * @return
+ */
+int imgWriterFlush(ImgWriter *w) {
+    size_t len = w->bufLen;
+    if (len == 0) return OK;
+    w->bufLen = 0;
+    return pwriteAll(w, w->bufPos, w->buf, len);
+}
+
+
+/**
+ * 向镜像指定位置写入数据
+ * @param w - 写入器
+ * @param pos - 写入位置(字节)
+ * @param data - 数据
+ * @param len - 数据长度
+ * @return
+ */
+int imgWriterWrite(ImgWriter *w, long long pos, const void *data, size_t len) {
+    long long bufEnd = w->bufPos + w->bufLen;
+    size_t n;
+    int result;
+
+    if (len == 0) return OK;
+    if (pos + (long long)len > w->size) w->size = pos + len;
+
+    // 映射范围内的部分直接写入映射内存
+    if (w->map != NULL && pos < w->mapSize) {
+        n = w->mapSize - pos < (long long)len ? (size_t)(w->mapSize - pos) : len;
+        memcpy(w->map + pos, data, n);
+        w->mapDirty = 1;
+        if (n == len) return OK;
+        pos += n;
+        data = (const unsigned char*) data + n;
+        len -= n;
+    }
+
+    // 写入区域完全落在缓冲区内，直接覆盖
+    if (w->bufLen > 0 && pos >= w->bufPos && pos + (long long)len <= bufEnd) {
+        memcpy(w->buf + (pos - w->bufPos), data, len);
+        return OK;
+    }
+
+    // 与缓冲区内容首尾相接
+    if (w->bufLen > 0 && pos == bufEnd) {
+        if (w->bufLen + len <= w->cap) {
+            memcpy(w->buf + w->bufLen, data, len);
+            w->bufLen += len;
+            return OK;
+        }
+        // 缓冲区放不下，缓冲区内容与数据合并为一次写出
+        result = pwriteTwo(w, w->bufPos, w->buf, w->bufLen, (const unsigned char*) data, len);
+        w->bufLen = 0;
+        return result;
+    }
+
+    // 不相邻的写入，先写出缓冲区
+    if (imgWriterFlush(w) != OK) return ERROR;
+    // 大块数据直接写出，不经过缓冲区
+    if (len >= w->cap) return pwriteAll(w, pos, (const unsigned char*) data, len);
+
+    memcpy(w->buf, data, len);
+    w->bufPos = pos;
+    w->bufLen = len;
+    return OK;
+}
+
+
+/**
+ * 将镜像指定区域置 0
+ * 位于文件末尾之后的部分不写入，关闭时以文件空洞形式存在
+ * @param w - 写入器
+ * @param pos - 起始位置(字节)
+ * @param len - 长度(字节)
+ * @return
+ */
+int imgWriterZero(ImgWriter *w, long long pos, long long len) {
+    // 已写入(或待写出)数据的末尾，其后的区域读出均为 0
+    long long dataEnd = w->fileSize;
+    long long n;
+
+    if (w->bufLen > 0 && w->bufPos + (long long)w->bufLen > dataEnd) dataEnd = w->bufPos + w->bufLen;
+
+    while (len > 0 && pos < dataEnd) {
+        n = len < (long long)sizeof(zeroBlock) ? len : (long long)sizeof(zeroBlock);
+        if (pos + n > dataEnd) n = dataEnd - pos;
+        if (imgWriterWrite(w, pos, zeroBlock, (size_t)n) != OK) return ERROR;
+        pos += n;
+        len -= n;
+    }
+    if (len > 0 && pos + len > w->size) w->size = pos + len;
+    return OK;
+}
+
+
+/**
+ * 将镜像文件扩展到应有的大小，扩展部分以文件空洞形式存在
+ * @param w - 写入器
+ * @return
+ */
+static int extendFile(ImgWriter *w) {
+    int result = OK;
+
+    if (w->size <= w->fileSize) return OK;
+#if defined(_WIN32) || defined(_WIN64)
+    if (_chsize_s(w->fd, w->size) != 0) result = ERROR;
+#else
+    if ((long long) (off_t) w->size != w->size || ftruncate(w->fd, (off_t) w->size) != 0) result = ERROR;
+#endif
+    w->syscalls ++;
+    if (result == OK) w->fileSize = w->size;
+    return result;
+}
+
+
+/**
+ * 设置镜像文件大小(只扩展不缩小)，立即扩展文件，扩展部分以文件空洞形式存在
+ * @param w - 写入器
+ * @param size - 镜像文件大小(字节)
+ * @return 文件无法扩展到该大小(超出文件大小限制、空间或配额不足)返回 ERROR
+ */
+int imgWriterSetSize(ImgWriter *w, long long size) {
+    if (size < 0) return ERROR;
+    if (size > w->size) w->size = size;
+    return extendFile(w);
+}
+
+
+/**
+ * 将源文件的一段数据拷贝到镜像指定位置
+ * Linux 下优先使用 copy_file_range，支持的文件系统(如 XFS、btrfs)可直接共享数据块，
+ * 不支持时改用 sendfile，均不可用时通过缓冲区读写拷贝
+ * @param w - 写入器
+ * @param pos - 镜像写入位置(字节)
+ * @param srcFd - 源文件描述符
+ * @param srcPos - 源文件读取位置(字节)
+ * @param len - 拷贝长度(字节)
+ * @return 源文件长度不足时返回 ERROR
+ */
+int imgWriterCopyFrom(ImgWriter *w, long long pos, int srcFd, long long srcPos, long long len) {
+    unsigned char *chunk;
+    long long n, size;
+    int result = OK;
+
+    if (len <= 0) return OK;
+    if (pos + len > w->size) w->size = pos + len;
+    // 内核拷贝绕过缓冲区，与缓冲区数据重叠时先写出缓冲区
+    if (w->bufLen > 0 && pos < w->bufPos + (long long)w->bufLen && pos + len > w->bufPos) {
+        if (imgWriterFlush(w) != OK) return ERROR;
+    }
+
+#if defined(__linux__)
+    {
+        off_t in = (off_t) srcPos, out = (off_t) pos;
+        ssize_t copied;
+
+        // copy_file_range 在同一文件系统内可由文件系统直接完成拷贝
+        while (len > 0) {
+            copied = copy_file_range(srcFd, &in, w->fd, &out, (size_t) len, 0);
+            w->syscalls ++;
+            if (copied <= 0) break;
+            len -= copied;
+        }
+        // sendfile 从源文件当前偏移拷贝到目标文件当前位置，目标位置随之前移(中途失败时由缓冲区拷贝接续)
+        if (len > 0 && lseek(w->fd, out, SEEK_SET) == out) {
+            while (len > 0) {
+                copied = sendfile(w->fd, srcFd, &in, (size_t) len);
+                w->syscalls ++;
+                if (copied <= 0) break;
+                out += copied;
+                len -= copied;
+            }
+        }
+        if (out > w->fileSize) w->fileSize = out;
+        srcPos = in;
+        pos = out;
+        if (len == 0) return OK;
+    }
+#endif
+
+    // 通过缓冲区读写拷贝剩余部分
+    size = len < IMG_COPY_CHUNK_SIZE ? len : IMG_COPY_CHUNK_SIZE;
+    chunk = (unsigned char*) malloc((size_t) size);
+    if (chunk == NULL) return ERROR;
+    while (len > 0 && result == OK) {
+        n = len < size ? len : size;
+#if defined(_WIN32) || defined(_WIN64)
+        if (_lseeki64(srcFd, srcPos, SEEK_SET) < 0) n = -1;
+        else n = _read(srcFd, chunk, (unsigned int) n);
+#else
+        n = pread(srcFd, chunk, (size_t) n, (off_t) srcPos);
+#endif
+        if (n <= 0) {
+            result = ERROR;
+            break;
+        }
+        result = imgWriterWrite(w, pos, chunk, (size_t) n);
+        pos += n;
+        srcPos += n;
+        len -= n;
+    }
+    free(chunk);
+    return result;
+}
+
+
+/**
+ * 将镜像指定位置的一段数据拷贝到目标文件当前位置
+ * 目标为普通文件时优先使用 copy_file_range，为管道等其他文件时使用 sendfile，
+ * 均不可用时以大块缓冲区读写；映射模式下直接从映射内存写出
+ * @param w - 写入器
+ * @param pos - 镜像读取位置(字节)
+ * @param destFd - 目标文件描述符
+ * @param len - 拷贝长度(字节)
+ * @return
+ */
+int imgWriterCopyTo(ImgWriter *w, long long pos, int destFd, long long len) {
+    unsigned char *chunk;
+    long long n, size;
+    int result = OK;
+
+    if (len <= 0) return OK;
+    // 内核拷贝绕过缓冲区，与缓冲区数据重叠时先写出缓冲区
+    if (w->bufLen > 0 && pos < w->bufPos + (long long)w->bufLen && pos + len > w->bufPos) {
+        if (imgWriterFlush(w) != OK) return ERROR;
+    }
+
+    // 映射范围内的部分直接从映射内存写出
+    while (w->map != NULL && pos < w->mapSize && len > 0) {
+        n = w->mapSize - pos < len ? w->mapSize - pos : len;
+#if defined(_WIN32) || defined(_WIN64)
+        n = _write(destFd, w->map + pos, n > 0x40000000 ? 0x40000000 : (unsigned int) n);
+#else
+        n = write(destFd, w->map + pos, (size_t) n);
+#endif
+        w->syscalls ++;
+        if (n <= 0) return ERROR;
+        pos += n;
+        len -= n;
+    }
+
+#if defined(__linux__)
+    {
+        off_t in = (off_t) pos;
+        ssize_t copied;
+
+        // copy_file_range 只支持普通文件，目标为管道时返回错误，改用 sendfile
+        while (len > 0) {
+            copied = copy_file_range(w->fd, &in, destFd, NULL, (size_t) len, 0);
+            w->syscalls ++;
+            if (copied <= 0) break;
+            len -= copied;
+        }
+        while (len > 0) {
+            copied = sendfile(destFd, w->fd, &in, (size_t) len);
+            w->syscalls ++;
+            if (copied <= 0) break;
+            len -= copied;
+        }
+        pos = in;
+        if (len == 0) return OK;
+    }
+#endif
+
+    // 通过缓冲区读写拷贝剩余部分
+    size = len < IMG_COPY_CHUNK_SIZE ? len : IMG_COPY_CHUNK_SIZE;
+    chunk = (unsigned char*) malloc((size_t) size);
+    if (chunk == NULL) return ERROR;
+    while (len > 0 && result == OK) {
+        n = len < size ? len : size;
+        result = imgWriterRead(w, pos, chunk, (size_t) n);
+        if (result != OK) break;
+#if defined(_WIN32) || defined(_WIN64)
+        if (_write(destFd, chunk, (unsigned int) n) != n) result = ERROR;
+#else
+        if (write(destFd, chunk, (size_t) n) != n) result = ERROR;
+#endif
+        w->syscalls += 2;
+        pos += n;
+        len -= n;
+    }
+    free(chunk);
+    return result;
+}
+
+
+/**
+ * 克隆镜像文件
+ * Linux 下优先使用 FICLONE 与源文件共享数据块(btrfs、XFS 等支持 reflink 的文件系统)，
+ * 不支持时只拷贝源文件中的数据区段，稀疏镜像的空洞在目标文件中仍为空洞
+ * @param src - 源文件路径
+ * @param dest - 目标文件路径，存在时覆盖
+ * @return 源文件不存在返回 NO_FIND
+ */
+int imgCloneFile(const char *src, const char *dest) {
+    ImgWriter w;
+    long long size, pos = 0, end;
+    int srcFd, result;
+
+    srcFd = open(src, O_RDONLY | O_BINARY);
+    if (srcFd < 0) return NO_FIND;
+#if defined(_WIN32) || defined(_WIN64)
+    size = _lseeki64(srcFd, 0, SEEK_END);
+#else
+    size = (long long) lseek(srcFd, 0, SEEK_END);
+#endif
+    result = size < 0 ? ERROR : imgWriterOpen(&w, dest, IMG_OPEN_CREATE);
+    if (result != OK) {
+        close(srcFd);
+        return result;
+    }
+#if defined(__linux__) && defined(FICLONE)
+    if (ioctl(w.fd, FICLONE, srcFd) == 0) {
+        w.syscalls ++;
+        w.fileSize = size;
+        pos = size;
+    }
+#endif
+
+    while (pos < size && result == OK) {
+        end = size;
+#if defined(__linux__)
+        // 跳过源文件中的空洞，文件系统不支持时整体拷贝
+        {
+            off_t data = lseek(srcFd, (off_t) pos, SEEK_DATA);
+            if (data < 0 && errno == ENXIO) break;
+            if (data >= 0) {
+                pos = data;
+                end = (long long) lseek(srcFd, data, SEEK_HOLE);
+                if (end < pos || end > size) end = size;
+            }
+        }
+#endif
+        result = imgWriterCopyFrom(&w, pos, srcFd, pos, end - pos);
+        pos = end;
+    }
+    // 源文件末尾的空洞
+    if (result == OK) result = imgWriterSetSize(&w, size);
+
+    close(srcFd);
+    if (imgWriterClose(&w) != OK) result = ERROR;
+    return result;
+}
+
+
+/**
+ * 将镜像文件已有的全部内容映射到内存
+ * 映射后该范围内的读写均直接在映射内存中完成
+ * @param w - 写入器
+ * @return 当前平台或文件不支持映射时返回 ERROR，写入器保持普通读写方式
+ */
+int imgWriterMap(ImgWriter *w) {
+#if defined(_WIN32) || defined(_WIN64)
+    return ERROR;
+#else
+    void *map;
+
+    if (w->map != NULL) return OK;
+    // 空文件或超出地址空间的文件无法映射
+    if (w->fileSize <= 0 || (unsigned long long) w->fileSize > (size_t) -1) return ERROR;
+    // 映射前先写出缓冲区，保证映射内容最新
+    if (imgWriterFlush(w) != OK) return ERROR;
+
+    map = mmap(NULL, (size_t) w->fileSize, w->readOnly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0);
+    if (map == MAP_FAILED) return ERROR;
+    w->map = (unsigned char*) map;
+    w->mapSize = w->fileSize;
+    w->mapDirty = 0;
+    return OK;
+#endif
+}
+
+
+/**
+ * 获取映射内存中指定位置的指针
+ * @param w - 写入器
+ * @param pos - 镜像位置(字节)
+ * @param len - 需要访问的长度
+ * @return 该范围不在映射内时返回 NULL
+ */
+unsigned char* imgWriterMapPtr(ImgWriter *w, long long pos, size_t len) {
+    if (w->map == NULL || pos < 0 || pos + (long long)len > w->mapSize) return NULL;
+    return w->map + pos;
+}
+
+
+/**
+ * 写出全部数据、调整文件大小并释放写入器
+ * @param w - 写入器
+ * @return
+ */
+int imgWriterClose(ImgWriter *w) {
+    int result = imgWriterFlush(w);
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    // 写回映射内存中的脏页并解除映射
+    if (w->map != NULL) {
+        if (w->mapDirty && msync(w->map, (size_t) w->mapSize, MS_SYNC) != 0) result = ERROR;
+        if (w->mapDirty) w->syscalls ++;
+        munmap(w->map, (size_t) w->mapSize);
+        w->map = NULL;
+    }
+#endif
+
+    if (result == OK) result = extendFile(w);
+
+#if defined(_WIN32) || defined(_WIN64)
+    _aligned_free(w->buf);
+#else
+    free(w->buf);
+#endif
+    w->buf = NULL;
+    if (w->ownFd) {
+        if (close(w->fd) != 0) result = ERROR;
+        w->ownFd = 0;
+    }
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    pthread_mutex_lock(&totalLock);
+#endif
+    totalSyscalls += w->syscalls;
+#if !defined(_WIN32) && !defined(_WIN64)
+    pthread_mutex_unlock(&totalLock);
+#endif
+    w->syscalls = 0;
+    return result;
+}
+
+
+/**
+ * 获取本进程中已关闭的写入器发生的写入类系统调用总数
+ * @return
+ */
+unsigned long long getImgWriterSyscalls(void) {
+    unsigned long long total;
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    pthread_mutex_lock(&totalLock);
+#endif
+    total = totalSyscalls;
+#if !defined(_WIN32) && !defined(_WIN64)
+    pthread_mutex_unlock(&totalLock);
+#endif
+    return total;
+}
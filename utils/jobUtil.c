@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../include/fatimg.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+
+/** 线程池最大线程数 */
+#define MAX_JOB_THREADS 64
+
+
+/** 线程池共享状态 */
+typedef struct {
+    // 任务入口及其参数
+    JobFunc func;
+    void *arg;
+    // 任务数
+    unsigned int jobNum;
+    // 下一个待领取的任务序号
+    unsigned int nextJob;
+    // 各任务结果
+    int *results;
+#if !defined(_WIN32) && !defined(_WIN64)
+    // 保护 nextJob
+    pthread_mutex_t lock;
+#endif
+} JobPool;
+
+
+/** 工作线程入口 */
+static void* jobWorker(void *pool);
+
+
+/**
+ * 在线程池中并行执行若干任务
+ * 各工作线程依次领取下一个任务，先完成的线程继续领取，耗时不同的任务也能均匀分布。
+ * Windows 下在当前线程中顺序执行
+ * @param jobNum - 任务数
+ * @param threadNum - 线程数，为 0 时使用处理器核数
+ * @param func - 任务入口
+ * @param arg - 任务参数
+ * @param results - 各任务结果，可为 NULL
+ * @return 全部任务成功返回 OK，否则返回 ERROR
+ */
+int runParallelJobs(unsigned int jobNum, unsigned int threadNum, JobFunc func, void *arg, int *results) {
+    JobPool pool;
+    unsigned int i;
+    int status = OK;
+#if !defined(_WIN32) && !defined(_WIN64)
+    pthread_t threads[MAX_JOB_THREADS];
+    unsigned int started = 0;
+#endif
+
+    memset(&pool, 0, sizeof(JobPool));
+    pool.func = func;
+    pool.arg = arg;
+    pool.jobNum = jobNum;
+    pool.results = results != NULL ? results : (int*) calloc(jobNum > 0 ? jobNum : 1, sizeof(int));
+    if (pool.results == NULL) return ERROR;
+
+    if (threadNum == 0) threadNum = getProcessorNum();
+    if (threadNum > jobNum) threadNum = jobNum;
+    if (threadNum > MAX_JOB_THREADS) threadNum = MAX_JOB_THREADS;
+
+#if defined(_WIN32) || defined(_WIN64)
+    jobWorker(&pool);
+#else
+    pthread_mutex_init(&pool.lock, NULL);
+    // 当前线程也作为一个工作线程，线程创建失败时由已有线程完成剩余任务
+    for (i = 1; i < threadNum; i ++) {
+        if (pthread_create(&threads[started], NULL, jobWorker, &pool) == 0) started ++;
+    }
+    jobWorker(&pool);
+    for (i = 0; i < started; i ++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool.lock);
+#endif
+
+    for (i = 0; i < jobNum; i ++) {
+        if (pool.results[i] != OK) status = ERROR;
+    }
+    if (results == NULL) free(pool.results);
+    return status;
+}
+
+
+/**
+ * 获取可用的处理器核数
+ * @return 至少为 1
+ */
+unsigned int getProcessorNum() {
+#if defined(_WIN32) || defined(_WIN64)
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (unsigned int) info.dwNumberOfProcessors : 1;
+#else
+    long num = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return num > 0 ? (unsigned int) num : 1;
+#endif
+}
+
+
+/**
+ * 工作线程入口，循环领取并执行任务直到全部任务领取完毕
+ * @param pool - 线程池共享状态
+ * @return
+ */
+static void* jobWorker(void *pool) {
+    JobPool *p = (JobPool*) pool;
+    unsigned int index;
+
+    for (;;) {
+#if defined(_WIN32) || defined(_WIN64)
+        index = p->nextJob ++;
+#else
+        pthread_mutex_lock(&p->lock);
+        index = p->nextJob ++;
+        pthread_mutex_unlock(&p->lock);
+#endif
+        if (index >= p->jobNum) break;
+        p->results[index] = p->func(p->arg, index);
+    }
+    return NULL;
+}
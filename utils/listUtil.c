@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/fatimg.h"
+
+
+/**
+ * 读取文件清单
+ * 清单每行一个文件路径，忽略空行及以 '#' 开头的注释行
+ * @param path - 清单文件路径
+ * @param list - 文件清单
+ * @return 清单文件不存在返回 NO_FIND
+ */
+int loadFileList(const char *path, FileList *list) {
+    FILE *fp;
+    int status;
+
+    memset(list, 0, sizeof(FileList));
+    fp = fopen(path, "rb");
+    if (fp == NULL) return NO_FIND;
+    status = readFileList(fp, list);
+    fclose(fp);
+    return status;
+}
+
+
+/**
+ * 从已打开的文件(如标准输入)读取文件清单
+ * 内容按块读到文件末尾，不依赖文件大小，可用于管道。
+ * 各条目在内容内存中原地以 '\0' 结尾，整个清单只分配内容与条目指针数组两块内存，不为单个条目分配内存
+ * @param fp - 已打开的文件
+ * @param list - 文件清单
+ * @return
+ */
+int readFileList(FILE *fp, FileList *list) {
+    size_t size = 0, capacity = 0, n;
+    unsigned int lines = 0, i;
+    char *p, *line, *end;
+
+    memset(list, 0, sizeof(FileList));
+    do {
+        // 至少留出 '\0' 结尾的位置
+        if (capacity - size < 4096 + 1) {
+            capacity = capacity == 0 ? 64 * 1024 : capacity * 2;
+            p = (char*) realloc(list->data, capacity);
+            if (p == NULL) {
+                freeFileList(list);
+                return ERROR;
+            }
+            list->data = p;
+        }
+        n = fread(list->data + size, 1, capacity - size - 1, fp);
+        size += n;
+    } while (n > 0);
+    if (ferror(fp)) {
+        freeFileList(list);
+        return ERROR;
+    }
+    list->data[size] = '\0';
+
+    // 统计行数，确定条目指针数组大小
+    for (p = list->data; *p; p ++) {
+        if (*p == '\n') lines ++;
+    }
+    list->entries = (char**) malloc((lines + 1) * sizeof(char*));
+    if (list->entries == NULL) {
+        freeFileList(list);
+        return ERROR;
+    }
+
+    // 按行切分，去除行首行尾的 '\r' 及空白
+    line = list->data;
+    for (i = 0; i <= lines && *line; i ++) {
+        end = strchr(line, '\n');
+        if (end != NULL) *end = '\0';
+        while (*line == ' ' || *line == '\t') line ++;
+        p = line + strlen(line);
+        while (p > line && (p[-1] == '\r' || p[-1] == ' ' || p[-1] == '\t')) *(-- p) = '\0';
+        if (line[0] != '\0' && line[0] != '#') list->entries[list->count ++] = line;
+        if (end == NULL) break;
+        line = end + 1;
+    }
+    return OK;
+}
+
+
+/**
+ * 释放文件清单
+ * @param list - 文件清单
+ */
+void freeFileList(FileList *list) {
+    free(list->data);
+    free(list->entries);
+    list->data = NULL;
+    list->entries = NULL;
+    list->count = 0;
+}
+
+
+/**
+ * 将清单条目按空白原地切分为参数
+ * 双引号括起的部分作为一个参数(可包含空白)，引号本身被去除
+ * @param entry - 清单条目，切分后各参数在原内存中以 '\0' 结尾
+ * @param args - 参数指针数组
+ * @param maxArgs - 参数指针数组容量
+ * @return 参数个数，超出容量或引号不成对返回 BAD_FORMAT
+ */
+int splitListEntry(char *entry, char **args, int maxArgs) {
+    char *src = entry, *dest;
+    int argc = 0, quoted;
+
+    while (*src) {
+        while (*src == ' ' || *src == '\t') src ++;
+        if (*src == '\0') break;
+        if (argc == maxArgs) return BAD_FORMAT;
+
+        // 参数在原位置向前紧缩，去除引号
+        args[argc ++] = dest = src;
+        quoted = 0;
+        while (*src && (quoted || (*src != ' ' && *src != '\t'))) {
+            if (*src == '"') quoted = !quoted;
+            else *dest ++ = *src;
+            src ++;
+        }
+        if (quoted) return BAD_FORMAT;
+        if (*src) src ++;
+        *dest = '\0';
+    }
+    return argc;
+}
@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../include/fatimg.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#endif
+
+
+/** 扫描文件树时同时运行的最大线程数 */
+#define SCAN_THREAD_NUM 8
+
+
+/** 扫描一个目录下的全部子项(递归) */
+static int scanDirNode(FileNode *node);
+/** 扫描线程入口 */
+static void* scanDirThread(void *node);
+/** 读取一个目录下的直接子项 */
+static int listDirNode(FileNode *node);
+/** 向目录节点追加子项 */
+static int appendChildNode(FileNode *node, const char *name);
+/** 按名称比较节点 */
+static int compareNode(const void *a, const void *b);
+
+
+/**
+ * 扫描本地文件树
+ * 根目录的各个子目录分别由独立线程扫描(Windows 下顺序扫描)，
+ * 每个目录的子项按名称排序，保证生成的镜像布局与扫描顺序无关
+ * @param path - 文件或目录路径
+ * @param root - 扫描结果
+ * @return 路径不存在返回 NO_FIND
+ */
+int scanFileTree(const char *path, FileNode *root) {
+    size_t len = strlen(path);
+    unsigned int i;
+    int status = OK;
+    long long size;
+    FILE *fp;
+#if !defined(_WIN32) && !defined(_WIN64)
+    pthread_t threads[SCAN_THREAD_NUM];
+    FileNode *jobs[SCAN_THREAD_NUM];
+    unsigned int jobNum = 0, j;
+    void *result;
+#endif
+
+    memset(root, 0, sizeof(FileNode));
+    root->type = getFileType(path);
+    if (root->type == TYPE_NOT_FOUND) return NO_FIND;
+
+    // 去除路径末尾的文件分割符
+    while (len > 1 && (path[len - 1] == '/' || path[len - 1] == '\\')) len --;
+    root->path = (char*) malloc(len + 1);
+    if (root->path == NULL) return ERROR;
+    memcpy(root->path, path, len);
+    root->path[len] = '\0';
+
+    // 从路径中取出文件名
+    root->name = strrchr(root->path, '/');
+    if (root->name == NULL || strrchr(root->path, '\\') > root->name) root->name = strrchr(root->path, '\\');
+    root->name = root->name == NULL ? root->path : root->name + 1;
+
+    getFileCreateTimeArray(root->path, root->createTimes);
+    if (root->type != TYPE_DIRECTORY) {
+        // 直接指定的文件取打开后的文件大小
+        fp = fopen(root->path, "rb");
+        if (fp == NULL) {
+            freeFileTree(root);
+            return NO_FIND;
+        }
+        size = getFileSize(fp);
+        fclose(fp);
+        if (size < 0) {
+            freeFileTree(root);
+            return ERROR;
+        }
+        root->size = (unsigned long long) size;
+        return OK;
+    }
+
+    status = listDirNode(root);
+    if (status != OK) {
+        freeFileTree(root);
+        return status;
+    }
+
+#if defined(_WIN32) || defined(_WIN64)
+    for (i = 0; i < root->childNum && status == OK; i ++) {
+        if (root->children[i].type == TYPE_DIRECTORY) status = scanDirNode(&root->children[i]);
+    }
+#else
+    // 每批最多 SCAN_THREAD_NUM 个子目录并行扫描，线程创建失败时在当前线程中扫描
+    for (i = 0; i <= root->childNum; i ++) {
+        if (i < root->childNum && root->children[i].type == TYPE_DIRECTORY) {
+            jobs[jobNum] = &root->children[i];
+            if (pthread_create(&threads[jobNum], NULL, scanDirThread, jobs[jobNum]) == 0) {
+                jobNum ++;
+            } else if (scanDirNode(jobs[jobNum]) != OK) {
+                status = ERROR;
+            }
+        }
+        if (jobNum == SCAN_THREAD_NUM || (i == root->childNum && jobNum > 0)) {
+            for (j = 0; j < jobNum; j ++) {
+                pthread_join(threads[j], &result);
+                if ((long) result != OK) status = ERROR;
+            }
+            jobNum = 0;
+        }
+    }
+#endif
+
+    if (status != OK) freeFileTree(root);
+    return status;
+}
+
+
+/**
+ * 释放文件树
+ * @param root - 根节点
+ */
+void freeFileTree(FileNode *root) {
+    unsigned int i;
+
+    for (i = 0; i < root->childNum; i ++) {
+        freeFileTree(&root->children[i]);
+    }
+    free(root->children);
+    free(root->extents);
+    free(root->dirData);
+    free(root->path);
+    memset(root, 0, sizeof(FileNode));
+}
+
+
+/**
+ * 扫描一个目录下的全部子项(递归)
+ * @param node - 目录节点
+ * @return
+ */
+static int scanDirNode(FileNode *node) {
+    unsigned int i;
+    int status = listDirNode(node);
+
+    for (i = 0; i < node->childNum && status == OK; i ++) {
+        if (node->children[i].type == TYPE_DIRECTORY) status = scanDirNode(&node->children[i]);
+    }
+    return status;
+}
+
+
+/**
+ * 扫描线程入口
+ * @param node - 目录节点
+ * @return 扫描结果(OK/ERROR)
+ */
+static void* scanDirThread(void *node) {
+    return (void*)(long) scanDirNode((FileNode*) node);
+}
+
+
+/**
+ * 读取一个目录下的直接子项，并获取各子项的类型、大小及创建时间
+ * 跳过 '.'、'..' 及非普通文件；'.' 开头的文件(如 .config)照常读取，FAT没有按名称隐藏的约定
+ * @param node - 目录节点
+ * @return
+ */
+static int listDirNode(FileNode *node) {
+#if defined(_WIN32) || defined(_WIN64)
+    WIN32_FIND_DATAA data;
+    HANDLE handle;
+    char *pattern = (char*) malloc(strlen(node->path) + 3);
+
+    if (pattern == NULL) return ERROR;
+    sprintf(pattern, "%s\\*", node->path);
+    handle = FindFirstFileA(pattern, &data);
+    free(pattern);
+    if (handle == INVALID_HANDLE_VALUE) return ERROR;
+    do {
+        if (!strcmp(data.cFileName, ".") || !strcmp(data.cFileName, "..")) continue;
+        if (appendChildNode(node, data.cFileName) != OK) {
+            FindClose(handle);
+            return ERROR;
+        }
+    } while (FindNextFileA(handle, &data));
+    FindClose(handle);
+#else
+    DIR *dir = opendir(node->path);
+    struct dirent *entry;
+
+    if (dir == NULL) return ERROR;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+        if (appendChildNode(node, entry->d_name) != OK) {
+            closedir(dir);
+            return ERROR;
+        }
+    }
+    closedir(dir);
+#endif
+
+    if (node->childNum > 1) qsort(node->children, node->childNum, sizeof(FileNode), compareNode);
+    return OK;
+}
+
+
+/**
+ * 向目录节点追加子项
+ * @param node - 目录节点
+ * @param name - 子项名称
+ * @return
+ */
+static int appendChildNode(FileNode *node, const char *name) {
+    FileNode *child, *children;
+    size_t pathLen = strlen(node->path), nameLen = strlen(name);
+#if defined(_WIN32) || defined(_WIN64)
+    WIN32_FILE_ATTRIBUTE_DATA data;
+#else
+    struct stat st;
+#endif
+
+    if (node->childNum == node->childCap) {
+        children = (FileNode*) realloc(node->children, (node->childCap ? node->childCap * 2 : 16) * sizeof(FileNode));
+        if (children == NULL) return ERROR;
+        node->children = children;
+        node->childCap = node->childCap ? node->childCap * 2 : 16;
+    }
+    child = &node->children[node->childNum];
+    memset(child, 0, sizeof(FileNode));
+
+    child->path = (char*) malloc(pathLen + nameLen + 2);
+    if (child->path == NULL) return ERROR;
+    memcpy(child->path, node->path, pathLen);
+    child->path[pathLen] = SEPARATOR;
+    memcpy(child->path + pathLen + 1, name, nameLen + 1);
+    child->name = child->path + pathLen + 1;
+
+#if defined(_WIN32) || defined(_WIN64)
+    if (!GetFileAttributesExA(child->path, GetFileExInfoStandard, &data)) {
+        free(child->path);
+        return ERROR;
+    }
+    child->type = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? TYPE_DIRECTORY : TYPE_FILE;
+    child->size = ((unsigned long long) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+#else
+    if (stat(child->path, &st) != 0) {
+        free(child->path);
+        return ERROR;
+    }
+    if (S_ISDIR(st.st_mode)) child->type = TYPE_DIRECTORY;
+    else if (S_ISREG(st.st_mode)) child->type = TYPE_FILE;
+    else {
+        // 跳过设备文件、管道等非普通文件
+        free(child->path);
+        return OK;
+    }
+    child->size = (unsigned long long) st.st_size;
+#endif
+
+    getFileCreateTimeArray(child->path, child->createTimes);
+    node->childNum ++;
+    return OK;
+}
+
+
+/**
+ * 按名称比较节点
+ * @param a - 节点
+ * @param b - 节点
+ * @return
+ */
+static int compareNode(const void *a, const void *b) {
+    return strcmp(((const FileNode*) a)->name, ((const FileNode*) b)->name);
+}